@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: MIT */
+
+// measures goodput and delivery latency of the ARQ layer over a simulated full duplex serial link with a fixed
+// bitrate, one way delay and frame loss, for several window sizes. a window of 1 is stop and wait. the link runs on a
+// simulated clock, so the figures do not depend on the machine. prints CSV.
+//
+// usage: simplehdlc_bench_arq_loopback [bitrate] [payload size] [packets]
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simplehdlc_arq.h"
+#include "bench_util.h"
+
+#define MAX_QUEUED 4096
+#define MAX_FRAME_SIZE (2 * (SIMPLEHDLC_ARQ_HEADER_SIZE + 1024 + 7))
+
+typedef struct {
+    uint64_t deliver_at_us;
+    size_t len;
+    uint8_t data[MAX_FRAME_SIZE];
+} link_frame_t;
+
+typedef struct end_s end_t;
+
+struct end_s {
+    simplehdlc_context_t context;
+    simplehdlc_arq_t arq;
+    void *memory;
+    uint8_t rx_buffer[SIMPLEHDLC_ARQ_HEADER_SIZE + 1024];
+    end_t *peer;
+
+    // frames on their way to the peer, in the order they arrive
+    link_frame_t *queue;
+    size_t queue_head;
+    size_t queue_len;
+    uint8_t tx_frame[MAX_FRAME_SIZE];
+    size_t tx_len;
+    uint64_t line_free_at_us; // when the transmitter finishes sending what it has been given
+
+    // packets this end received, and when each of the peer's was handed to simplehdlc_arq_send
+    size_t n_received;
+    uint64_t *sent_at_us;
+    uint64_t *latency_us;
+};
+
+static uint64_t clock_us;
+static uint32_t bitrate;
+static uint32_t delay_ms;
+static uint32_t loss_percent;
+
+static uint32_t now_callback(void *user_ptr) {
+    (void) user_ptr;
+    return (uint32_t) (clock_us / 1000);
+}
+
+static void tx_chunk_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    end_t *end = (end_t *) user_ptr;
+    memcpy(&end->tx_frame[end->tx_len], data, len);
+    end->tx_len += len;
+}
+
+// the frame is complete: it occupies the line for its serialisation time, after anything queued before it
+static void tx_flush_callback(void *user_ptr) {
+    end_t *end = (end_t *) user_ptr;
+    size_t len = end->tx_len;
+    end->tx_len = 0;
+    if (len == 0) return;
+
+    uint64_t start = end->line_free_at_us > clock_us ? end->line_free_at_us : clock_us;
+    end->line_free_at_us = start + (uint64_t) len * 10 * 1000000 / bitrate; // 8N1
+    if (bench_rng() % 100 < loss_percent) return;
+
+    if (end->queue_len == MAX_QUEUED) {
+        fprintf(stderr, "link queue overflow\n");
+        exit(1);
+    }
+
+    link_frame_t *frame = &end->queue[(end->queue_head + end->queue_len++) % MAX_QUEUED];
+    frame->deliver_at_us = end->line_free_at_us + (uint64_t) delay_ms * 1000;
+    frame->len = len;
+    memcpy(frame->data, end->tx_frame, len);
+}
+
+static void rx_frame_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    end_t *end = (end_t *) user_ptr;
+    simplehdlc_arq_receive(&end->arq, payload, len);
+}
+
+static void rx_packet_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    end_t *end = (end_t *) user_ptr;
+    (void) len;
+
+    // packets carry their number, and arrive in order
+    uint32_t n;
+    memcpy(&n, payload, sizeof(n));
+    if (n != end->n_received) {
+        fprintf(stderr, "packet %u arrived when %zu was expected\n", n, end->n_received);
+        exit(1);
+    }
+
+    end->latency_us[end->n_received++] = clock_us - end->peer->sent_at_us[n];
+}
+
+static void init_end(end_t *end, end_t *peer, size_t window, uint16_t payload_size, size_t n_packets) {
+    memset(end, 0, sizeof(end_t));
+    end->peer = peer;
+    end->queue = malloc(MAX_QUEUED * sizeof(link_frame_t));
+    end->sent_at_us = calloc(n_packets, sizeof(uint64_t));
+    end->latency_us = calloc(n_packets, sizeof(uint64_t));
+
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = rx_frame_callback;
+    callbacks.tx_chunk_callback = tx_chunk_callback;
+    callbacks.tx_flush_buffer_callback = tx_flush_callback;
+    simplehdlc_init(&end->context, end->rx_buffer, sizeof(end->rx_buffer), &callbacks, end);
+
+    simplehdlc_arq_config_t config = {0};
+    config.window = window;
+    config.max_payload = payload_size;
+    config.ack_delay_ms = 5;
+
+    simplehdlc_arq_callbacks_t arq_callbacks = {0};
+    arq_callbacks.now_callback = now_callback;
+    arq_callbacks.rx_packet_callback = rx_packet_callback;
+
+    size_t memory_len = SIMPLEHDLC_ARQ_MEMORY_SIZE(window, payload_size);
+    end->memory = malloc(memory_len);
+    if (simplehdlc_arq_init(&end->arq, &end->context, &config, end->memory, memory_len, &arq_callbacks, end) !=
+        SIMPLEHDLC_OK) {
+        fprintf(stderr, "simplehdlc_arq_init failed\n");
+        exit(1);
+    }
+}
+
+static void free_end(end_t *end) {
+    free(end->queue);
+    free(end->sent_at_us);
+    free(end->latency_us);
+    free(end->memory);
+}
+
+// hands the peer the frames which have arrived by now
+static void deliver(end_t *end) {
+    while (end->queue_len && end->queue[end->queue_head].deliver_at_us <= clock_us) {
+        link_frame_t *frame = &end->queue[end->queue_head];
+        end->queue_head = (end->queue_head + 1) % MAX_QUEUED;
+        end->queue_len--;
+        simplehdlc_parse(&end->peer->context, frame->data, frame->len);
+    }
+}
+
+// a sends n_packets to b, which only sends acknowledgements back; the sender keeps its window full but does not
+// queue more on the line than it can send, as a driver with a small transmit FIFO would
+static void run(size_t window, uint16_t payload_size, size_t n_packets) {
+    static end_t a, b;
+    init_end(&a, &b, window, payload_size, n_packets);
+    init_end(&b, &a, window, payload_size, n_packets);
+
+    uint8_t *payload = malloc(payload_size);
+    bench_fill_payload(payload, payload_size, 1);
+
+    clock_us = 0;
+    size_t n_sent = 0;
+    while (b.n_received < n_packets) {
+        while (n_sent < n_packets && a.line_free_at_us <= clock_us) {
+            uint32_t n = (uint32_t) n_sent;
+            memcpy(payload, &n, sizeof(n));
+            if (simplehdlc_arq_send(&a.arq, payload, payload_size) != SIMPLEHDLC_OK) break;
+            a.sent_at_us[n_sent++] = clock_us;
+        }
+
+        deliver(&a);
+        deliver(&b);
+        simplehdlc_arq_poll(&a.arq);
+        simplehdlc_arq_poll(&b.arq);
+        clock_us += 100;
+
+        if (clock_us > (uint64_t) 3600 * 1000000) {
+            fprintf(stderr, "window %zu: transfer did not finish\n", window);
+            exit(1);
+        }
+    }
+
+    double seconds = (double) clock_us / 1e6;
+    double goodput = (double) n_packets * payload_size * 10 / seconds;
+    double mean = 0;
+    for (size_t i=0; i<n_packets; i++) mean += (double) b.latency_us[i];
+    mean /= (double) n_packets;
+    uint64_t p99 = bench_percentile(b.latency_us, n_packets, 99);
+
+    printf("%u,%u,%u,%zu,%u,%zu,%.3f,%.0f,%.3f,%llu,%llu,%llu,%.1f,%.1f\n", bitrate, delay_ms, loss_percent, window,
+           payload_size, n_packets, seconds, goodput, goodput / bitrate, (unsigned long long) a.arq.tx_retransmits,
+           (unsigned long long) a.arq.tx_timeouts, (unsigned long long) b.arq.tx_acks, mean / 1000.0,
+           (double) p99 / 1000.0);
+
+    free(payload);
+    free_end(&a);
+    free_end(&b);
+}
+
+int main(int argc, char **argv) {
+    bitrate = argc > 1 ? strtoul(argv[1], NULL, 0) : 115200;
+    size_t payload_size = argc > 2 ? strtoul(argv[2], NULL, 0) : 256;
+    size_t n_packets = argc > 3 ? strtoul(argv[3], NULL, 0) : 500;
+
+    if (bitrate == 0 || payload_size < 4 || payload_size > 1024 || n_packets == 0) {
+        fprintf(stderr, "usage: %s [bitrate] [payload size (4-1024)] [packets]\n", argv[0]);
+        return 1;
+    }
+
+    static const uint32_t delays[] = {1, 20, 100};
+    static const uint32_t losses[] = {0, 1, 5, 10};
+    static const size_t windows[] = {1, 4, 16, 32};
+
+    // goodput counts the payload at 10 bits a byte as the line does, so utilisation is the fraction of the bitrate left
+    // for payload after framing, headers, retransmissions and idle time
+    printf("bitrate,delay_ms,loss_percent,window,payload,packets,seconds,goodput_bps,utilisation,retransmits,"
+           "timeouts,standalone_acks,mean_latency_ms,p99_latency_ms\n");
+    for (size_t d=0; d<sizeof(delays)/sizeof(delays[0]); d++) {
+        for (size_t l=0; l<sizeof(losses)/sizeof(losses[0]); l++) {
+            for (size_t w=0; w<sizeof(windows)/sizeof(windows[0]); w++) {
+                delay_ms = delays[d];
+                loss_percent = losses[l];
+                run(windows[w], (uint16_t) payload_size, n_packets);
+            }
+        }
+    }
+
+    return 0;
+}
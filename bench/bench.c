@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: MIT */
+
+// throughput benchmark for the CRC, the encoders and the parser. sweeps payload size, escape density (the share of
+// payload bytes which are 0x7E/0x7D) and, for the parser, the size of the chunks the encoded stream is fed in. the
+// _cobs rows are the same with SIMPLEHDLC_FRAMING_COBS. results are written to stdout one row per configuration, as
+// CSV (default) or JSON, so they can be compared across commits.
+//
+// usage: simplehdlc_bench [--json] [--quick] [--bytes N]
+//   --json     write a JSON array instead of CSV
+//   --quick    smaller sweep, for smoke testing
+//   --bytes N  payload bytes processed per configuration (default 16 MiB)
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "simplehdlc.h"
+#include "simplehdlc_crc32.h"
+#include "bench_util.h"
+
+// frames are encoded into a stream of roughly this size, which is then fed to the parser repeatedly
+#define STREAM_TARGET_SIZE (1024 * 1024)
+
+static const size_t payload_sizes[] = {1, 16, 64, 256, 1024, 4096, 16384, 65535};
+static const size_t quick_payload_sizes[] = {16, 1024, 65535};
+static const unsigned int escape_percents[] = {0, 1, 10, 50, 100};
+static const unsigned int quick_escape_percents[] = {0, 10, 100};
+
+// 0 means the whole stream in one call
+static const size_t chunk_sizes[] = {1, 16, 256, 4096, 0};
+static const size_t quick_chunk_sizes[] = {1, 256, 0};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct {
+    bool json;
+    size_t target_bytes;
+    size_t n_rows;
+} output_t;
+
+// results are accumulated here so the compiler cannot discard the work
+static volatile uint32_t sink;
+static size_t frames_received;
+static size_t tx_bytes;
+
+static void rx_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    (void) user_ptr;
+    sink += payload[0] + len;
+    frames_received++;
+}
+
+static void tx_byte_callback(uint8_t byte, void *user_ptr) {
+    (void) user_ptr;
+    sink += byte;
+    tx_bytes++;
+}
+
+static void tx_chunk_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    (void) user_ptr;
+    sink += data[len - 1];
+    tx_bytes += len;
+}
+
+static void print_header(output_t *output) {
+    if (output->json) {
+        printf("[\n");
+    } else {
+        printf("benchmark,payload_size,escape_percent,chunk_size,frames,payload_bytes,wire_bytes,ns_per_frame,mb_per_s\n");
+    }
+}
+
+static void print_footer(output_t *output) {
+    if (output->json) printf("\n]\n");
+}
+
+static void print_row(output_t *output, const char *name, size_t payload_size, unsigned int escape_percent,
+                      size_t chunk_size, size_t frames, size_t payload_bytes, size_t wire_bytes, uint64_t elapsed_ns) {
+    double ns_per_frame = (double) elapsed_ns / (double) frames;
+    double mb_per_s = elapsed_ns ? (double) payload_bytes * 1000.0 / (double) elapsed_ns : 0.0;
+
+    if (output->json) {
+        printf("%s  {\"benchmark\": \"%s\", \"payload_size\": %zu, \"escape_percent\": %u, \"chunk_size\": %zu, "
+               "\"frames\": %zu, \"payload_bytes\": %zu, \"wire_bytes\": %zu, \"ns_per_frame\": %.1f, "
+               "\"mb_per_s\": %.1f}",
+               output->n_rows ? ",\n" : "", name, payload_size, escape_percent, chunk_size, frames, payload_bytes,
+               wire_bytes, ns_per_frame, mb_per_s);
+    } else {
+        printf("%s,%zu,%u,%zu,%zu,%zu,%zu,%.1f,%.1f\n", name, payload_size, escape_percent, chunk_size, frames,
+               payload_bytes, wire_bytes, ns_per_frame, mb_per_s);
+    }
+    output->n_rows++;
+    fflush(stdout);
+}
+
+static size_t get_iterations(output_t *output, size_t payload_size) {
+    size_t iterations = output->target_bytes / payload_size;
+    return iterations ? iterations : 1;
+}
+
+static void bench_crc32(output_t *output, const uint8_t *payload, size_t payload_size) {
+    size_t iterations = get_iterations(output, payload_size);
+
+    uint64_t start = bench_now_ns();
+    for (size_t i=0; i<iterations; i++) {
+        sink += simplehdlc_compute_crc32(payload, payload_size);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    print_row(output, "crc32", payload_size, 0, 0, iterations, iterations * payload_size, 0, elapsed);
+}
+
+static void bench_encode_to_buffer(output_t *output, const char *name, simplehdlc_framing_t framing,
+                                   const uint8_t *payload, size_t payload_size, unsigned int escape_percent,
+                                   uint8_t *buffer, size_t buffer_len) {
+    size_t iterations = get_iterations(output, payload_size);
+    size_t wire_bytes = 0;
+
+    uint64_t start = bench_now_ns();
+    for (size_t i=0; i<iterations; i++) {
+        size_t encoded_size;
+        simplehdlc_encode_to_buffer_with_framing(buffer, buffer_len, &encoded_size, payload, payload_size, framing);
+        sink += buffer[encoded_size - 1];
+        wire_bytes += encoded_size;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    print_row(output, name, payload_size, escape_percent, 0, iterations, iterations * payload_size, wire_bytes, elapsed);
+}
+
+static void bench_encode_to_callback(output_t *output, const char *name, simplehdlc_framing_t framing, bool chunked,
+                                     const uint8_t *payload, size_t payload_size, unsigned int escape_percent) {
+    size_t iterations = get_iterations(output, payload_size);
+
+    simplehdlc_callbacks_t callbacks = {0};
+    if (chunked) {
+        callbacks.tx_chunk_callback = tx_chunk_callback;
+    } else {
+        callbacks.tx_byte_callback = tx_byte_callback;
+    }
+
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, NULL, 0, &callbacks, NULL);
+    simplehdlc_set_tx_framing(&context, framing);
+
+    tx_bytes = 0;
+    uint64_t start = bench_now_ns();
+    for (size_t i=0; i<iterations; i++) {
+        simplehdlc_encode_to_callback(&context, payload, payload_size, false);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    print_row(output, name, payload_size, escape_percent, 0, iterations, iterations * payload_size, tx_bytes, elapsed);
+}
+
+// encodes copies of the payload back to back until the stream is about STREAM_TARGET_SIZE long
+static size_t build_stream(uint8_t *stream, size_t stream_len, simplehdlc_framing_t framing, const uint8_t *payload,
+                           size_t payload_size, size_t *n_frames) {
+    size_t offset = 0;
+    *n_frames = 0;
+    while (offset < STREAM_TARGET_SIZE && stream_len - offset >= SIMPLEHDLC_MAX_ENCODED_SIZE(payload_size)) {
+        size_t encoded_size;
+        simplehdlc_encode_to_buffer_with_framing(&stream[offset], stream_len - offset, &encoded_size, payload,
+                                                 payload_size, framing);
+        offset += encoded_size;
+        (*n_frames)++;
+    }
+    return offset;
+}
+
+static void bench_parse(output_t *output, const char *name, const uint8_t *stream, size_t stream_len,
+                        size_t stream_frames, size_t payload_size, unsigned int escape_percent, size_t chunk_size,
+                        uint8_t *rx_buffer, size_t rx_buffer_len) {
+    size_t repeats = get_iterations(output, stream_frames * payload_size);
+    if (chunk_size == 0 || chunk_size > stream_len) chunk_size = stream_len;
+
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = rx_callback;
+
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, rx_buffer, rx_buffer_len, &callbacks, NULL);
+
+    frames_received = 0;
+    uint64_t start = bench_now_ns();
+    for (size_t r=0; r<repeats; r++) {
+        for (size_t offset=0; offset<stream_len; offset+=chunk_size) {
+            size_t n = stream_len - offset < chunk_size ? stream_len - offset : chunk_size;
+            simplehdlc_parse(&context, &stream[offset], n);
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    if (frames_received != repeats * stream_frames) {
+        fprintf(stderr, "%s: expected %zu frames, got %zu\n", name, repeats * stream_frames, frames_received);
+        exit(1);
+    }
+
+    print_row(output, name, payload_size, escape_percent, chunk_size == stream_len ? 0 : chunk_size,
+              frames_received, frames_received * payload_size, repeats * stream_len, elapsed);
+}
+
+int main(int argc, char **argv) {
+    output_t output = {false, 16 * 1024 * 1024, 0};
+    bool quick = false;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            output.json = true;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc) {
+            output.target_bytes = strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--quick] [--bytes N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (quick && output.target_bytes == 16 * 1024 * 1024) output.target_bytes = 1024 * 1024;
+
+    const size_t *sizes = quick ? quick_payload_sizes : payload_sizes;
+    size_t n_sizes = quick ? ARRAY_LEN(quick_payload_sizes) : ARRAY_LEN(payload_sizes);
+    const unsigned int *percents = quick ? quick_escape_percents : escape_percents;
+    size_t n_percents = quick ? ARRAY_LEN(quick_escape_percents) : ARRAY_LEN(escape_percents);
+    const size_t *chunks = quick ? quick_chunk_sizes : chunk_sizes;
+    size_t n_chunks = quick ? ARRAY_LEN(quick_chunk_sizes) : ARRAY_LEN(chunk_sizes);
+
+    size_t max_payload_size = 65535;
+    size_t buffer_len = SIMPLEHDLC_MAX_ENCODED_SIZE(max_payload_size);
+    size_t stream_len = STREAM_TARGET_SIZE + buffer_len;
+    uint8_t *payload = malloc(max_payload_size);
+    uint8_t *buffer = malloc(buffer_len);
+    uint8_t *stream = malloc(stream_len);
+    uint8_t *rx_buffer = malloc(max_payload_size);
+    if (!payload || !buffer || !stream || !rx_buffer) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    print_header(&output);
+
+    for (size_t s=0; s<n_sizes; s++) {
+        bench_fill_payload(payload, sizes[s], 0);
+        bench_crc32(&output, payload, sizes[s]);
+    }
+
+    for (size_t p=0; p<n_percents; p++) {
+        for (size_t s=0; s<n_sizes; s++) {
+            size_t payload_size = sizes[s];
+            unsigned int escape_percent = percents[p];
+            bench_fill_payload(payload, payload_size, escape_percent);
+
+            bench_encode_to_buffer(&output, "encode_to_buffer", SIMPLEHDLC_FRAMING_ESCAPED, payload, payload_size,
+                                   escape_percent, buffer, buffer_len);
+            bench_encode_to_callback(&output, "encode_to_callback", SIMPLEHDLC_FRAMING_ESCAPED, false, payload,
+                                     payload_size, escape_percent);
+            bench_encode_to_callback(&output, "encode_to_callback_chunk", SIMPLEHDLC_FRAMING_ESCAPED, true, payload,
+                                     payload_size, escape_percent);
+            bench_encode_to_buffer(&output, "encode_to_buffer_cobs", SIMPLEHDLC_FRAMING_COBS, payload, payload_size,
+                                   escape_percent, buffer, buffer_len);
+            bench_encode_to_callback(&output, "encode_to_callback_chunk_cobs", SIMPLEHDLC_FRAMING_COBS, true, payload,
+                                     payload_size, escape_percent);
+
+            size_t stream_frames;
+            size_t stream_used = build_stream(stream, stream_len, SIMPLEHDLC_FRAMING_ESCAPED, payload, payload_size,
+                                              &stream_frames);
+            for (size_t c=0; c<n_chunks; c++) {
+                bench_parse(&output, "parse", stream, stream_used, stream_frames, payload_size, escape_percent,
+                            chunks[c], rx_buffer, max_payload_size);
+            }
+
+            stream_used = build_stream(stream, stream_len, SIMPLEHDLC_FRAMING_COBS, payload, payload_size,
+                                       &stream_frames);
+            for (size_t c=0; c<n_chunks; c++) {
+                bench_parse(&output, "parse_cobs", stream, stream_used, stream_frames, payload_size, escape_percent,
+                            chunks[c], rx_buffer, max_payload_size);
+            }
+        }
+    }
+
+    print_footer(&output);
+
+    free(payload);
+    free(buffer);
+    free(stream);
+    free(rx_buffer);
+    return 0;
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: MIT */
+
+// shared helpers for the benchmarks; these run on a hosted POSIX system
+
+#ifndef SIMPLEHDLC_BENCH_UTIL_H
+#define SIMPLEHDLC_BENCH_UTIL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t bench_rng_state = 0x2545F491;
+
+static inline uint32_t bench_rng(void) {
+    // xorshift32
+    bench_rng_state ^= bench_rng_state << 13;
+    bench_rng_state ^= bench_rng_state >> 17;
+    bench_rng_state ^= bench_rng_state << 5;
+    return bench_rng_state;
+}
+
+// fills payload with random bytes, replacing roughly escape_percent% of them with reserved bytes
+static inline void bench_fill_payload(uint8_t *payload, size_t len, unsigned int escape_percent) {
+    for (size_t i=0; i<len; i++) {
+        if (bench_rng() % 100 < escape_percent) {
+            payload[i] = (bench_rng() & 1) ? 0x7E : 0x7D;
+        } else {
+            uint8_t b = bench_rng();
+            // keep the clean bytes clean so that the escape density is exactly what was asked for
+            payload[i] = (b == 0x7E || b == 0x7D) ? 0 : b;
+        }
+    }
+}
+
+static int bench_compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// sorts samples in place and returns the given percentile (0-100)
+static inline uint64_t bench_percentile(uint64_t *samples, size_t n, double percentile) {
+    qsort(samples, n, sizeof(samples[0]), bench_compare_u64);
+    size_t index = (size_t) (percentile / 100.0 * (double) (n - 1) + 0.5);
+    return samples[index];
+}
+
+#endif //SIMPLEHDLC_BENCH_UTIL_H
@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: MIT */
+
+// compares the round trip latency of the coroutine layer with that of the callback API it is built on. both ends of
+// a unix socketpair are in the same loop; one end echoes every packet back and the other sends the next packet as
+// soon as the echo arrives. one CSV row is written per API.
+//
+// usage: simplehdlc_bench_coro_loopback [payload size] [round trips]
+
+#include <cstdio>
+#include <cstdlib>
+#include <span>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "simplehdlc.h"
+#include "simplehdlc_epoll.h"
+#include "simplehdlc_coro.hpp"
+#include "bench_util.h"
+
+#define TX_QUEUE_SIZE (256 * 1024)
+
+static std::vector<uint8_t> payload;
+static std::vector<uint64_t> round_trips;
+static size_t n_round_trips;
+
+static void print_row(const char *api) {
+    size_t n = round_trips.size();
+    uint64_t total = 0;
+    for (uint64_t t : round_trips) total += t;
+
+    uint64_t p50 = bench_percentile(round_trips.data(), n, 50);
+    uint64_t p99 = bench_percentile(round_trips.data(), n, 99);
+    printf("%s,%zu,%zu,%.0f,%llu,%llu,%llu\n", api, payload.size(), n, (double) total / (double) n,
+           (unsigned long long) p50, (unsigned long long) p99, (unsigned long long) round_trips[n - 1]);
+    fflush(stdout);
+}
+
+// callback API
+
+static simplehdlc_epoll_link_t callback_links[2];
+static uint64_t sent_at;
+
+static void rx_batch_callback(simplehdlc_epoll_link_t *link, const simplehdlc_frame_t *frames, size_t n_frames) {
+    if (link == &callback_links[1]) {
+        for (size_t i=0; i<n_frames; i++) simplehdlc_epoll_send(link, frames[i].ptr, frames[i].len);
+        return;
+    }
+
+    for (size_t i=0; i<n_frames && round_trips.size() < n_round_trips; i++) {
+        uint64_t now = bench_now_ns();
+        round_trips.push_back(now - sent_at);
+        sent_at = now;
+        if (round_trips.size() < n_round_trips) simplehdlc_epoll_send(link, payload.data(), payload.size());
+    }
+}
+
+static bool run_callbacks(int fds[2]) {
+    static simplehdlc_epoll_t loop;
+    static uint8_t rx_buffers[2][65535];
+    static uint8_t tx_buffers[2][TX_QUEUE_SIZE];
+
+    simplehdlc_epoll_callbacks_t callbacks = {};
+    callbacks.rx_batch_callback = rx_batch_callback;
+    if (simplehdlc_epoll_init(&loop, &callbacks) != SIMPLEHDLC_OK) return false;
+    for (int i=0; i<2; i++) {
+        if (simplehdlc_epoll_add(&loop, &callback_links[i], fds[i], rx_buffers[i], sizeof(rx_buffers[i]),
+                                 tx_buffers[i], sizeof(tx_buffers[i]), NULL) != SIMPLEHDLC_OK) {
+            return false;
+        }
+    }
+
+    round_trips.clear();
+    sent_at = bench_now_ns();
+    simplehdlc_epoll_send(&callback_links[0], payload.data(), payload.size());
+    while (round_trips.size() < n_round_trips) {
+        if (simplehdlc_epoll_poll(&loop, 1000) < 0) return false;
+    }
+
+    simplehdlc_epoll_remove(&callback_links[0]);
+    simplehdlc_epoll_remove(&callback_links[1]);
+    simplehdlc_epoll_deinit(&loop);
+    print_row("callback");
+    return true;
+}
+
+// coroutines
+
+static simplehdlc::coro::Task echo(simplehdlc::coro::Link &link) {
+    while (auto frame = co_await link.next_frame()) co_await link.send(*frame);
+}
+
+static simplehdlc::coro::Task ping(simplehdlc::coro::Reactor &reactor, simplehdlc::coro::Link &link) {
+    while (round_trips.size() < n_round_trips) {
+        uint64_t start = bench_now_ns();
+        co_await link.send(payload);
+        if (!co_await link.next_frame()) break;
+        round_trips.push_back(bench_now_ns() - start);
+    }
+    reactor.stop();
+}
+
+static bool run_coroutines(int fds[2]) {
+    simplehdlc::coro::Reactor reactor;
+    simplehdlc::coro::Link links[2];
+    if (reactor.open() != SIMPLEHDLC_OK) return false;
+    for (int i=0; i<2; i++) {
+        if (links[i].open(reactor, fds[i], 65535, TX_QUEUE_SIZE) != SIMPLEHDLC_OK) return false;
+    }
+
+    round_trips.clear();
+    echo(links[1]);
+    ping(reactor, links[0]);
+    if (!reactor.run()) return false;
+
+    // wakes the echo coroutine so that it finishes
+    links[1].close();
+    print_row("coroutine");
+    return true;
+}
+
+int main(int argc, char **argv) {
+    size_t payload_size = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+    n_round_trips = argc > 2 ? strtoul(argv[2], NULL, 0) : 100000;
+
+    if (payload_size == 0 || payload_size > 65535 || n_round_trips == 0) {
+        fprintf(stderr, "usage: %s [payload size (1-65535)] [round trips]\n", argv[0]);
+        return 1;
+    }
+
+    payload.resize(payload_size);
+    bench_fill_payload(payload.data(), payload_size, 1);
+    round_trips.reserve(n_round_trips);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+
+    printf("api,payload_size,round_trips,mean_ns,p50_ns,p99_ns,max_ns\n");
+
+    // each run leaves the socketpair empty, so the same one is used for both
+    if (!run_callbacks(fds) || !run_coroutines(fds)) {
+        perror("epoll");
+        return 1;
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: MIT */
+
+// measures the epoll I/O loop over a unix socketpair, with both ends in the same loop: throughput with one end sending
+// packets as fast as the TX queue allows, and round trip latency with the other end echoing each packet back before
+// the next is sent.
+//
+// usage: simplehdlc_bench_epoll_loop [payload size] [megabytes] [round trips]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "simplehdlc.h"
+#include "simplehdlc_epoll.h"
+#include "bench_util.h"
+
+#define TX_QUEUE_SIZE (256 * 1024)
+
+static simplehdlc_epoll_t loop;
+static simplehdlc_epoll_link_t links[2];
+static uint8_t rx_buffers[2][65535];
+static uint8_t tx_buffers[2][TX_QUEUE_SIZE];
+
+static uint8_t payload[65535];
+static size_t payload_size;
+
+static size_t frames_received;
+static size_t batches_received;
+static bool echo;
+static uint64_t sent_at;
+static uint64_t *round_trips;
+static size_t n_round_trips;
+
+static void rx_batch_callback(simplehdlc_epoll_link_t *link, const simplehdlc_frame_t *frames, size_t n_frames) {
+    frames_received += n_frames;
+    batches_received++;
+
+    if (!echo) return;
+
+    if (link == &links[1]) {
+        for (size_t i=0; i<n_frames; i++) simplehdlc_epoll_send(link, frames[i].ptr, frames[i].len);
+    } else {
+        uint64_t now = bench_now_ns();
+        round_trips[n_round_trips++] = now - sent_at;
+        sent_at = now;
+        simplehdlc_epoll_send(&links[0], payload, payload_size);
+    }
+}
+
+static void closed_callback(simplehdlc_epoll_link_t *link, int error) {
+    (void) link;
+    fprintf(stderr, "link closed (%d)\n", error);
+    exit(1);
+}
+
+static void run_throughput(size_t total_bytes) {
+    size_t n_frames = total_bytes / payload_size;
+    if (n_frames == 0) n_frames = 1;
+
+    echo = false;
+    frames_received = 0;
+    batches_received = 0;
+
+    uint64_t start = bench_now_ns();
+    size_t sent = 0;
+    while (frames_received < n_frames) {
+        while (sent < n_frames && simplehdlc_epoll_send(&links[0], payload, payload_size) == SIMPLEHDLC_OK) sent++;
+        simplehdlc_epoll_poll(&loop, 1000);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    printf("throughput payload_size=%zu frames=%zu mb_per_s=%.1f frames_per_s=%.0f frames_per_batch=%.1f\n",
+           payload_size, n_frames, (double) n_frames * payload_size * 1000.0 / (double) elapsed,
+           (double) n_frames * 1e9 / (double) elapsed, (double) frames_received / (double) batches_received);
+}
+
+static void run_latency(size_t n) {
+    round_trips = malloc(n * sizeof(uint64_t));
+    n_round_trips = 0;
+    echo = true;
+
+    sent_at = bench_now_ns();
+    simplehdlc_epoll_send(&links[0], payload, payload_size);
+    while (n_round_trips < n) simplehdlc_epoll_poll(&loop, 1000);
+    echo = false;
+
+    // the packet still in flight is drained so the loop is idle again
+    for (int i=0; i<4; i++) simplehdlc_epoll_poll(&loop, 10);
+
+    uint64_t p50 = bench_percentile(round_trips, n, 50);
+    uint64_t p99 = bench_percentile(round_trips, n, 99);
+    printf("latency    payload_size=%zu round_trips=%zu p50_ns=%llu p99_ns=%llu max_ns=%llu\n", payload_size, n,
+           (unsigned long long) p50, (unsigned long long) p99, (unsigned long long) round_trips[n - 1]);
+
+    free(round_trips);
+}
+
+int main(int argc, char **argv) {
+    payload_size = argc > 1 ? strtoul(argv[1], NULL, 0) : 1024;
+    size_t megabytes = argc > 2 ? strtoul(argv[2], NULL, 0) : 256;
+    size_t n_round_trips = argc > 3 ? strtoul(argv[3], NULL, 0) : 10000;
+
+    if (payload_size == 0 || payload_size > 65535 || n_round_trips == 0) {
+        fprintf(stderr, "usage: %s [payload size (1-65535)] [megabytes] [round trips]\n", argv[0]);
+        return 1;
+    }
+
+    bench_fill_payload(payload, payload_size, 1);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+
+    simplehdlc_epoll_callbacks_t callbacks = {0};
+    callbacks.rx_batch_callback = rx_batch_callback;
+    callbacks.closed_callback = closed_callback;
+    if (simplehdlc_epoll_init(&loop, &callbacks) != SIMPLEHDLC_OK) {
+        perror("epoll");
+        return 1;
+    }
+    for (int i=0; i<2; i++) {
+        if (simplehdlc_epoll_add(&loop, &links[i], fds[i], rx_buffers[i], sizeof(rx_buffers[i]), tx_buffers[i],
+                                 sizeof(tx_buffers[i]), NULL) != SIMPLEHDLC_OK) {
+            perror("epoll_add");
+            return 1;
+        }
+    }
+
+    run_throughput(megabytes * 1024 * 1024);
+    run_latency(n_round_trips);
+
+    simplehdlc_epoll_deinit(&loop);
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: MIT */
+
+// compares simplehdlc_encode_in_place with encoding into a second buffer. each packet is produced into its own packet
+// buffer (copied from a source payload, as an application would build it there) and then encoded; the two buffer path
+// encodes into an output buffer of its own per packet, as if each were allocated, and the in place path encodes in the
+// packet buffer, which has room for an escape in every 16 bytes. a packet with more escapes than that falls back to the
+// two buffer path. the packets cycle through a working set larger than the cache, so the time taken follows the memory
+// traffic. bytes_written counts the bytes of memory which each path writes per packet after the payload is produced.
+//
+// usage: simplehdlc_bench_in_place [working set MB]
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simplehdlc.h"
+#include "bench_util.h"
+
+#define N_ROUNDS 3
+
+static void run(size_t payload_size, unsigned int escape_percent, size_t working_set) {
+    size_t headroom = SIMPLEHDLC_IN_PLACE_HEADROOM;
+    size_t tailroom = SIMPLEHDLC_IN_PLACE_TAILROOM + payload_size / 16;
+    size_t packet_buffer_len = headroom + payload_size + tailroom;
+    size_t output_len = SIMPLEHDLC_MAX_ENCODED_SIZE(payload_size);
+
+    size_t n_packets = working_set / (packet_buffer_len + output_len) + 1;
+    uint8_t *source = malloc(payload_size);
+    uint8_t *packets = malloc(n_packets * packet_buffer_len);
+    uint8_t *outputs = malloc(n_packets * output_len);
+    uint8_t *snapshot = malloc(packet_buffer_len);
+    bench_fill_payload(source, payload_size, escape_percent);
+
+    // touch everything once so that page faults are not timed
+    memset(packets, 0, n_packets * packet_buffer_len);
+    memset(outputs, 0, n_packets * output_len);
+
+    uint64_t two_buffer_ns = 0;
+    uint64_t in_place_ns = 0;
+    size_t n_fallbacks = 0;
+    size_t frame_len = 0;
+    size_t in_place_written = 0;
+
+    for (int round=0; round<N_ROUNDS; round++) {
+        uint64_t start = bench_now_ns();
+        for (size_t i=0; i<n_packets; i++) {
+            uint8_t *packet = &packets[i * packet_buffer_len];
+            memcpy(&packet[headroom], source, payload_size);
+            simplehdlc_encode_to_buffer(&outputs[i * output_len], output_len, &frame_len, &packet[headroom],
+                                        (uint16_t) payload_size);
+        }
+        two_buffer_ns += bench_now_ns() - start;
+
+        n_fallbacks = 0;
+        start = bench_now_ns();
+        for (size_t i=0; i<n_packets; i++) {
+            uint8_t *packet = &packets[i * packet_buffer_len];
+            memcpy(&packet[headroom], source, payload_size);
+
+            size_t frame_offset;
+            if (simplehdlc_encode_in_place(packet, packet_buffer_len, headroom, (uint16_t) payload_size,
+                                           &frame_offset, &frame_len) != SIMPLEHDLC_OK) {
+                simplehdlc_encode_to_buffer(&outputs[i * output_len], output_len, &frame_len, &packet[headroom],
+                                            (uint16_t) payload_size);
+                n_fallbacks++;
+            }
+        }
+        in_place_ns += bench_now_ns() - start;
+    }
+
+    // the bytes of one packet buffer which the in place encode changed, which is close to how many it wrote, as a
+    // byte moved to a new place rarely lands on one with the same value
+    memset(snapshot, 0, packet_buffer_len);
+    memcpy(&snapshot[headroom], source, payload_size);
+    memcpy(packets, snapshot, packet_buffer_len);
+    size_t frame_offset;
+    if (simplehdlc_encode_in_place(packets, packet_buffer_len, headroom, (uint16_t) payload_size, &frame_offset,
+                                   &frame_len) == SIMPLEHDLC_OK) {
+        for (size_t i=0; i<packet_buffer_len; i++) in_place_written += packets[i] != snapshot[i];
+    } else {
+        in_place_written = frame_len;
+    }
+
+    double n_total = (double) n_packets * N_ROUNDS;
+    printf("%zu,%u,%zu,%zu,%.1f,%zu,%zu,%.1f,%zu,%zu\n", payload_size, escape_percent, n_packets, frame_len,
+           (double) two_buffer_ns / n_total, frame_len, packet_buffer_len + output_len, (double) in_place_ns / n_total,
+           n_fallbacks ? frame_len : in_place_written, n_fallbacks ? packet_buffer_len + output_len : packet_buffer_len);
+
+    free(snapshot);
+    free(outputs);
+    free(packets);
+    free(source);
+}
+
+int main(int argc, char **argv) {
+    size_t working_set_mb = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+    if (working_set_mb == 0) {
+        fprintf(stderr, "usage: %s [working set MB]\n", argv[0]);
+        return 1;
+    }
+
+    static const size_t payload_sizes[] = {64, 1024, 16384, 65535};
+    static const unsigned int escape_percents[] = {0, 1, 5, 25};
+
+    printf("payload,escape_percent,packets,frame_len,two_buffer_ns,two_buffer_bytes_written,two_buffer_buffer_bytes,"
+           "in_place_ns,in_place_bytes_written,in_place_buffer_bytes\n");
+    for (size_t s=0; s<sizeof(payload_sizes)/sizeof(payload_sizes[0]); s++) {
+        for (size_t e=0; e<sizeof(escape_percents)/sizeof(escape_percents[0]); e++) {
+            run(payload_sizes[s], escape_percents[e], working_set_mb * 1024 * 1024);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: MIT */
+
+// measures the per-call latency of simplehdlc_parse against simplehdlc_parse_bytewise when large frames arrive in
+// small chunks. the bytewise parser computes the CRC over the whole payload inside whichever call receives the last
+// byte, simplehdlc_parse folds each chunk into a running CRC as it arrives so that call costs the same as any other.
+//
+// usage: simplehdlc_bench_parse_latency [frame size] [chunk size]
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "simplehdlc.h"
+#include "bench_util.h"
+
+#define N_FRAMES 64
+
+static size_t frames_received = 0;
+
+static void rx_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    (void) payload;
+    (void) len;
+    (void) user_ptr;
+    frames_received++;
+}
+
+typedef void (*parse_fn_t)(simplehdlc_context_t *context, const uint8_t *data, size_t len);
+
+static void run(const char *name, parse_fn_t parse, const uint8_t *stream, size_t stream_len, size_t chunk_size,
+                uint8_t *rx_buffer, size_t rx_buffer_len) {
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = rx_callback;
+
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, rx_buffer, rx_buffer_len, &callbacks, NULL);
+
+    size_t n_calls = (stream_len + chunk_size - 1) / chunk_size;
+    uint64_t *samples = malloc(n_calls * sizeof(uint64_t));
+
+    frames_received = 0;
+    uint64_t total = 0;
+    uint64_t completing_total = 0;
+    uint64_t completing_max = 0;
+    for (size_t call=0; call<n_calls; call++) {
+        size_t offset = call * chunk_size;
+        size_t n = stream_len - offset < chunk_size ? stream_len - offset : chunk_size;
+        size_t frames_before = frames_received;
+
+        uint64_t start = bench_now_ns();
+        parse(&context, &stream[offset], n);
+        samples[call] = bench_now_ns() - start;
+        total += samples[call];
+
+        // the calls which complete a frame are the ones which pay for the CRC in the bytewise parser
+        if (frames_received != frames_before) {
+            completing_total += samples[call];
+            if (samples[call] > completing_max) completing_max = samples[call];
+        }
+    }
+
+    if (frames_received != N_FRAMES) {
+        fprintf(stderr, "%s: expected %d frames, received %zu\n", name, N_FRAMES, frames_received);
+        exit(1);
+    }
+
+    uint64_t p50 = bench_percentile(samples, n_calls, 50);
+    uint64_t p99 = bench_percentile(samples, n_calls, 99);
+    uint64_t max = samples[n_calls - 1];
+
+    printf("%-10s calls=%zu mean_ns=%.0f p50_ns=%llu p99_ns=%llu max_ns=%llu completing_mean_ns=%.0f "
+           "completing_max_ns=%llu\n", name, n_calls, (double) total / (double) n_calls, (unsigned long long) p50,
+           (unsigned long long) p99, (unsigned long long) max, (double) completing_total / N_FRAMES,
+           (unsigned long long) completing_max);
+
+    free(samples);
+}
+
+int main(int argc, char **argv) {
+    size_t frame_size = argc > 1 ? strtoul(argv[1], NULL, 0) : 65535;
+    size_t chunk_size = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+
+    if (frame_size == 0 || frame_size > 65535 || chunk_size == 0) {
+        fprintf(stderr, "usage: %s [frame size (1-65535)] [chunk size]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t *payload = malloc(frame_size);
+    uint8_t *rx_buffer = malloc(frame_size);
+    size_t frame_capacity = 7 + 2 * (frame_size + 6);
+    uint8_t *stream = malloc(N_FRAMES * frame_capacity);
+
+    size_t stream_len = 0;
+    for (int i=0; i<N_FRAMES; i++) {
+        bench_fill_payload(payload, frame_size, 1);
+
+        size_t encoded_size;
+        simplehdlc_encode_to_buffer(&stream[stream_len], frame_capacity, &encoded_size, payload, frame_size);
+        stream_len += encoded_size;
+    }
+
+    printf("frame_size=%zu chunk_size=%zu frames=%d\n", frame_size, chunk_size, N_FRAMES);
+
+    // run each twice so both see a warm cache
+    for (int pass=0; pass<2; pass++) {
+        run("bytewise", simplehdlc_parse_bytewise, stream, stream_len, chunk_size, rx_buffer, frame_size);
+        run("parse", simplehdlc_parse, stream, stream_len, chunk_size, rx_buffer, frame_size);
+    }
+
+    free(stream);
+    free(rx_buffer);
+    free(payload);
+
+    return 0;
+}
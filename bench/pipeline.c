@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: MIT */
+
+// measures how the multi-threaded receive pipeline scales with the number of handler threads. one thread parses the
+// input of all links, in 4 KB reads taken from each link in turn, and every packet is handled by computing its CRC
+// a given number of times to stand in for real work. one CSV row is written per thread count.
+//
+// usage: simplehdlc_bench_pipeline [payload size] [links] [packets] [handler work]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "simplehdlc.h"
+#include "simplehdlc_crc32.h"
+#include "simplehdlc_pipeline.h"
+#include "bench_util.h"
+
+// packets encoded per link; the block is parsed over and over
+#define BLOCK_PACKETS 64
+#define READ_SIZE 4096
+
+static unsigned int handler_work;
+static volatile uint32_t sink;
+
+static void handler(uint32_t link_id, const uint8_t *payload, uint16_t len, void *user_ptr) {
+    (void) link_id;
+    (void) user_ptr;
+
+    uint32_t crc32 = 0;
+    for (unsigned int i=0; i<handler_work; i++) crc32 ^= simplehdlc_compute_crc32(payload, len);
+    sink = crc32;
+}
+
+int main(int argc, char **argv) {
+    size_t payload_size = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+    size_t n_links = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+    size_t n_packets = argc > 3 ? strtoul(argv[3], NULL, 0) : 1000000;
+    handler_work = argc > 4 ? strtoul(argv[4], NULL, 0) : 4;
+
+    if (payload_size == 0 || payload_size > 65535 || n_links == 0) {
+        fprintf(stderr, "usage: %s [payload size (1-65535)] [links] [packets] [handler work]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t *payload = malloc(payload_size);
+    size_t block_capacity = BLOCK_PACKETS * SIMPLEHDLC_MAX_ENCODED_SIZE(payload_size);
+    uint8_t *block = malloc(block_capacity);
+    size_t block_len = 0;
+    for (int i=0; i<BLOCK_PACKETS; i++) {
+        size_t encoded_size;
+        bench_fill_payload(payload, payload_size, 1);
+        simplehdlc_encode_to_buffer(&block[block_len], block_capacity - block_len, &encoded_size, payload,
+                                    payload_size);
+        block_len += encoded_size;
+    }
+
+    size_t rounds = n_packets / (BLOCK_PACKETS * n_links);
+    if (rounds == 0) rounds = 1;
+
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_cpus < 1) n_cpus = 1;
+
+    printf("threads,payload_size,links,packets,handler_work,seconds,packets_per_s,mb_per_s,drops\n");
+
+    for (long n_threads=1; ; n_threads*=2) {
+        if (n_threads > n_cpus) n_threads = n_cpus;
+
+        simplehdlc_pipeline_config_t config = {0};
+        config.n_links = n_links;
+        config.n_threads = n_threads;
+        config.n_buffers = n_links + 1024;
+        config.buffer_size = payload_size;
+        config.link_queue_len = 64;
+        config.policy = SIMPLEHDLC_PIPELINE_BLOCK;
+        config.handler = handler;
+
+        simplehdlc_pipeline_t *pipeline;
+        if (simplehdlc_pipeline_create(&pipeline, &config) != SIMPLEHDLC_OK) {
+            fprintf(stderr, "failed to create the pipeline\n");
+            return 1;
+        }
+
+        uint64_t start = bench_now_ns();
+        for (size_t round=0; round<rounds; round++) {
+            for (size_t offset=0; offset<block_len; offset+=READ_SIZE) {
+                size_t n = block_len - offset < READ_SIZE ? block_len - offset : READ_SIZE;
+                for (uint32_t link=0; link<n_links; link++) {
+                    simplehdlc_pipeline_parse(pipeline, link, &block[offset], n);
+                }
+            }
+        }
+        simplehdlc_pipeline_drain(pipeline);
+        uint64_t elapsed = bench_now_ns() - start;
+
+        size_t total = rounds * BLOCK_PACKETS * n_links;
+        printf("%ld,%zu,%zu,%zu,%u,%.3f,%.0f,%.1f,%llu\n", n_threads, payload_size, n_links, total, handler_work,
+               (double) elapsed / 1e9, (double) total * 1e9 / (double) elapsed,
+               (double) total * payload_size * 1000.0 / (double) elapsed,
+               (unsigned long long) simplehdlc_pipeline_get_drops(pipeline));
+        fflush(stdout);
+
+        simplehdlc_pipeline_destroy(pipeline);
+        if (n_threads == n_cpus) break;
+    }
+
+    free(block);
+    free(payload);
+    return 0;
+}
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: MIT */
+
+// compares updating a few fields of a frame template with encoding the whole packet again, across payload sizes. each
+// update changes a 4 byte counter at the start of the payload, an 8 byte timestamp in the middle and a 4 byte reading
+// at the end. the new field values contain escapes in escape_percent of their bytes, so with more escapes more of the
+// updates change the layout of the frame, which moves the rest of it along. prints CSV.
+//
+// usage: simplehdlc_bench_template [updates]
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simplehdlc_template.h"
+#include "bench_util.h"
+
+#define N_FIELDS 3
+#define N_VALUES 1024
+
+static void run(size_t payload_size, unsigned int escape_percent, size_t n_updates) {
+    uint8_t *payload = malloc(payload_size);
+    uint8_t *frame = malloc(SIMPLEHDLC_MAX_ENCODED_SIZE(payload_size));
+    uint8_t *template_payload = malloc(payload_size);
+    uint8_t *template_frame = malloc(SIMPLEHDLC_MAX_ENCODED_SIZE(payload_size));
+    uint8_t *values = malloc(N_VALUES * 16);
+    bench_fill_payload(payload, payload_size, 1);
+    bench_fill_payload(values, N_VALUES * 16, escape_percent);
+    memcpy(template_payload, payload, payload_size);
+
+    simplehdlc_template_field_t fields[N_FIELDS] = {
+            {.offset = 0, .len = 4},
+            {.offset = (uint16_t) (payload_size / 2 - 4), .len = 8},
+            {.offset = (uint16_t) (payload_size - 4), .len = 4},
+    };
+    simplehdlc_template_t tmpl;
+    simplehdlc_template_init(&tmpl, template_frame, SIMPLEHDLC_MAX_ENCODED_SIZE(payload_size), template_payload,
+                             (uint16_t) payload_size, fields, N_FIELDS);
+
+    size_t frame_len = 0;
+    uint64_t start = bench_now_ns();
+    for (size_t i=0; i<n_updates; i++) {
+        const uint8_t *value = &values[(i % N_VALUES) * 16];
+        for (size_t f=0; f<N_FIELDS; f++) memcpy(&payload[fields[f].offset], &value[f * 4], fields[f].len);
+        simplehdlc_encode_to_buffer_with_framing(frame, SIMPLEHDLC_MAX_ENCODED_SIZE(payload_size), &frame_len, payload,
+                                                 (uint16_t) payload_size, SIMPLEHDLC_FRAMING_ESCAPED);
+    }
+    uint64_t encode_ns = bench_now_ns() - start;
+
+    uint64_t layout_changes = 0;
+    start = bench_now_ns();
+    for (size_t i=0; i<n_updates; i++) {
+        const uint8_t *value = &values[(i % N_VALUES) * 16];
+        for (size_t f=0; f<N_FIELDS; f++) {
+            size_t encoded_len = fields[f].encoded_len;
+            simplehdlc_template_set_field(&tmpl, f, &value[f * 4]);
+            layout_changes += fields[f].encoded_len != encoded_len;
+        }
+    }
+    uint64_t template_ns = bench_now_ns() - start;
+
+    // both ways end up with the same frame
+    if (tmpl.frame_len != frame_len || memcmp(tmpl.frame, frame, frame_len) != 0) {
+        fprintf(stderr, "frames differ for payload %zu\n", payload_size);
+        exit(1);
+    }
+
+    printf("%zu,%u,%zu,%zu,%.1f,%.1f,%.3f\n", payload_size, escape_percent, n_updates, frame_len,
+           (double) encode_ns / (double) n_updates, (double) template_ns / (double) n_updates,
+           (double) layout_changes / (double) (n_updates * N_FIELDS));
+
+    free(values);
+    free(template_frame);
+    free(template_payload);
+    free(frame);
+    free(payload);
+}
+
+int main(int argc, char **argv) {
+    size_t n_updates = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+    if (n_updates == 0) {
+        fprintf(stderr, "usage: %s [updates]\n", argv[0]);
+        return 1;
+    }
+
+    static const size_t payload_sizes[] = {32, 256, 1024, 16384, 65535};
+    static const unsigned int escape_percents[] = {0, 5, 25};
+
+    printf("payload,escape_percent,updates,frame_len,encode_ns,template_ns,layout_changes_per_field\n");
+    for (size_t s=0; s<sizeof(payload_sizes)/sizeof(payload_sizes[0]); s++) {
+        for (size_t e=0; e<sizeof(escape_percents)/sizeof(escape_percents[0]); e++) {
+            // fewer updates for the big frames, which take much longer to encode
+            size_t n = payload_sizes[s] > 1024 ? n_updates / 16 + 1 : n_updates;
+            run(payload_sizes[s], escape_percents[e], n);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: MIT */
+
+// measures writes (syscalls) per packet and per-class latency of the transmit scheduler for mixed traffic: bulk
+// transfers, a stream of small telemetry packets and occasional urgent control packets, over a simulated serial link
+// behind a small kernel transmit buffer, as a tty has. writing each packet as it is sent (one queue, no delay) is
+// compared with one batched queue, and with an urgent queue in front of the batched one. latency runs from the send to
+// the receiver parsing the packet. the link runs on a simulated clock, so the figures do not depend on the machine.
+// prints CSV.
+//
+// usage: simplehdlc_bench_txsched [bitrate] [seconds]
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simplehdlc_txsched.h"
+#include "bench_util.h"
+
+#define STEP_US 10
+#define KERNEL_BUFFER_SIZE 512
+#define N_CLASSES 3
+#define MAX_SAMPLES 400000
+
+typedef struct {
+    const char *name;
+    uint16_t payload_size;
+    uint32_t per_second;
+} traffic_class_t;
+
+static const traffic_class_t classes[N_CLASSES] = {
+    {"control", 8, 100},
+    {"telemetry", 24, 2000},
+    {"bulk", 512, 150},
+};
+
+typedef struct {
+    const char *name;
+    size_t n_queues;
+    uint32_t max_delay_us[2];
+    size_t class_queue[N_CLASSES];
+} strategy_t;
+
+static const strategy_t strategies[] = {
+    {"per_packet", 1, {0, 0}, {0, 0, 0}},
+    {"batched", 1, {2000, 0}, {0, 0, 0}},
+    {"priority", 2, {0, 2000}, {0, 1, 1}},
+};
+
+static uint32_t clock_us;
+static uint32_t bitrate;
+
+// the kernel's transmit buffer, drained onto the line at the bitrate
+static uint8_t kernel_buffer[KERNEL_BUFFER_SIZE];
+static size_t kernel_len;
+static uint64_t line_credit; // bits the line could have sent, times the step count
+
+static uint64_t *samples[N_CLASSES];
+static size_t n_samples[N_CLASSES];
+
+static uint32_t now_callback(void *user_ptr) {
+    (void) user_ptr;
+    return clock_us;
+}
+
+static size_t write_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    (void) user_ptr;
+    size_t n = KERNEL_BUFFER_SIZE - kernel_len;
+    if (n > len) n = len;
+    memcpy(&kernel_buffer[kernel_len], data, n);
+    kernel_len += n;
+    return n;
+}
+
+static void rx_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    (void) len;
+    (void) user_ptr;
+
+    uint32_t sent_at;
+    memcpy(&sent_at, &payload[1], sizeof(sent_at));
+    uint8_t class = payload[0];
+    if (n_samples[class] < MAX_SAMPLES) samples[class][n_samples[class]++] = clock_us - sent_at;
+}
+
+static void run(const strategy_t *strategy, uint32_t seconds) {
+    static uint8_t queue_buffers[2][65536];
+    static uint8_t write_buffer[KERNEL_BUFFER_SIZE];
+    static uint8_t rx_buffer[1024];
+
+    simplehdlc_txsched_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.n_queues = strategy->n_queues;
+    for (size_t i=0; i<strategy->n_queues; i++) {
+        config.queues[i].buffer = queue_buffers[i];
+        config.queues[i].buffer_len = sizeof(queue_buffers[i]);
+        config.queues[i].max_delay_us = strategy->max_delay_us[i];
+    }
+    config.write_buffer = write_buffer;
+    config.write_buffer_len = sizeof(write_buffer);
+
+    simplehdlc_txsched_callbacks_t callbacks = {now_callback, write_callback};
+    simplehdlc_txsched_t sched;
+    simplehdlc_txsched_init(&sched, &config, &callbacks, NULL);
+
+    simplehdlc_callbacks_t rx_callbacks = {0};
+    rx_callbacks.rx_packet_callback = rx_callback;
+    simplehdlc_context_t receiver;
+    simplehdlc_init(&receiver, rx_buffer, sizeof(rx_buffer), &rx_callbacks, NULL);
+
+    clock_us = 0;
+    kernel_len = 0;
+    line_credit = 0;
+    for (int c=0; c<N_CLASSES; c++) n_samples[c] = 0;
+    bench_rng_state = 0x2545F491;
+
+    uint8_t payload[512];
+    bench_fill_payload(payload, sizeof(payload), 1);
+    uint64_t n_dropped = 0;
+
+    for (uint64_t step=0; step<(uint64_t) seconds * 1000000 / STEP_US; step++) {
+        // arrivals, each class at random at its average rate
+        for (int c=0; c<N_CLASSES; c++) {
+            if (bench_rng() % (1000000 / STEP_US) >= classes[c].per_second) continue;
+
+            payload[0] = (uint8_t) c;
+            memcpy(&payload[1], &clock_us, sizeof(clock_us));
+            if (simplehdlc_txsched_send(&sched, strategy->class_queue[c], payload, classes[c].payload_size) !=
+                SIMPLEHDLC_OK) {
+                n_dropped++;
+            }
+        }
+
+        // the line sends bytes (8N1) from the kernel buffer to the receiver
+        line_credit += (uint64_t) bitrate * STEP_US;
+        size_t n = (size_t) (line_credit / (10 * 1000000));
+        if (n > kernel_len) n = kernel_len;
+        line_credit -= (uint64_t) n * 10 * 1000000;
+        if (kernel_len == 0) line_credit = 0;
+        if (n) {
+            simplehdlc_parse(&receiver, kernel_buffer, n);
+            memmove(kernel_buffer, &kernel_buffer[n], kernel_len - n);
+            kernel_len -= n;
+        }
+
+        // after a short write the fd is reported writable once the kernel buffer has drained to half full; timers
+        // are handled in the meantime
+        if (sched.write_len == 0 || kernel_len <= KERNEL_BUFFER_SIZE / 2) simplehdlc_txsched_poll(&sched);
+        clock_us += STEP_US;
+    }
+
+    uint64_t n_received = 0;
+    for (int c=0; c<N_CLASSES; c++) n_received += n_samples[c];
+
+    for (int c=0; c<N_CLASSES; c++) {
+        double mean = 0;
+        for (size_t i=0; i<n_samples[c]; i++) mean += (double) samples[c][i];
+        mean /= n_samples[c] ? (double) n_samples[c] : 1;
+        uint64_t p50 = n_samples[c] ? bench_percentile(samples[c], n_samples[c], 50) : 0;
+        uint64_t p99 = n_samples[c] ? bench_percentile(samples[c], n_samples[c], 99) : 0;
+
+        printf("%s,%s,%u,%llu,%llu,%.3f,%llu,%zu,%.0f,%llu,%llu\n", strategy->name, classes[c].name, bitrate,
+               (unsigned long long) sched.tx_packets, (unsigned long long) sched.tx_writes,
+               (double) sched.tx_writes / (double) n_received, (unsigned long long) n_dropped, n_samples[c], mean,
+               (unsigned long long) p50, (unsigned long long) p99);
+    }
+}
+
+int main(int argc, char **argv) {
+    bitrate = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000000;
+    uint32_t seconds = argc > 2 ? strtoul(argv[2], NULL, 0) : 10;
+
+    if (bitrate < 100000 || seconds == 0) {
+        fprintf(stderr, "usage: %s [bitrate (at least 100000)] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    for (int c=0; c<N_CLASSES; c++) samples[c] = malloc(MAX_SAMPLES * sizeof(uint64_t));
+
+    printf("strategy,class,bitrate,packets,writes,writes_per_packet,dropped,received,mean_latency_us,p50_latency_us,"
+           "p99_latency_us\n");
+    for (size_t s=0; s<sizeof(strategies)/sizeof(strategies[0]); s++) run(&strategies[s], seconds);
+
+    for (int c=0; c<N_CLASSES; c++) free(samples[c]);
+    return 0;
+}
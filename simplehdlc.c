@@ -1,7 +1,17 @@
 /* SPDX-License-Identifier: MIT */
 
+#include <string.h>
+
 #include "simplehdlc.h"
 #include "simplehdlc_crc32.h"
+#include "simplehdlc_internal.h"
+#include "simplehdlc_scan.h"
+
+#ifdef SIMPLEHDLC_ENABLE_STATS
+#define SIMPLEHDLC_STAT_ADD(context, counter, n) ((context)->stats.counter += (n))
+#else
+#define SIMPLEHDLC_STAT_ADD(context, counter, n) ((void) 0)
+#endif
 
 void simplehdlc_init(simplehdlc_context_t *context, uint8_t *parse_buffer, size_t parse_buffer_len, const simplehdlc_callbacks_t *callbacks, void *user_ptr) {
     context->rx_buffer = parse_buffer;
@@ -13,170 +23,1355 @@ void simplehdlc_init(simplehdlc_context_t *context, uint8_t *parse_buffer, size_
     context->escape_next = false;
     context->expected_len = 0;
     context->rx_count = 0;
+    context->rx_crc32_count = 0;
+    context->rx_staged_count = 0;
+    context->rx_streaming = callbacks->rx_data_callback != NULL;
+    context->rx_stream_open = false;
+    context->rx_cobs = false;
+    context->rx_cobs_marker = false;
+    context->rx_cobs_remaining = 0;
+    context->rx_varint_shift = 0;
+    context->rx_ring_held = false;
+    context->rx_ring_held_index = 0;
+    context->rx_ring_checked = 0;
+    context->rx_ring_crc32 = 0;
+    context->tx_framing = SIMPLEHDLC_DEFAULT_FRAMING;
     context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+
+#ifdef SIMPLEHDLC_ENABLE_STATS
+    simplehdlc_reset_stats(context);
+    context->rx_frame_start = 0;
+#endif
+}
+
+void simplehdlc_set_tx_framing(simplehdlc_context_t *context, simplehdlc_framing_t framing) {
+    context->tx_framing = framing;
+}
+
+#ifdef SIMPLEHDLC_ENABLE_STATS
+
+void simplehdlc_get_stats(const simplehdlc_context_t *context, simplehdlc_stats_t *stats) {
+    *stats = context->stats;
+}
+
+void simplehdlc_reset_stats(simplehdlc_context_t *context) {
+    memset(&context->stats, 0, sizeof(context->stats));
+}
+
+static inline bool timing_enabled(const simplehdlc_context_t *context) {
+    return context->callbacks.timestamp_callback != NULL && context->callbacks.rx_frame_timing_callback != NULL;
+}
+
+#endif
+
+static inline void record_frame_start(simplehdlc_context_t *context) {
+#ifdef SIMPLEHDLC_ENABLE_STATS
+    if (timing_enabled(context)) context->rx_frame_start = context->callbacks.timestamp_callback(context->user_ptr);
+#else
+    (void) context;
+#endif
+}
+
+// counts a packet which completed, failed or was dropped, and reports its timing
+static inline void record_frame(simplehdlc_context_t *context, size_t len, simplehdlc_frame_status_t status) {
+#ifdef SIMPLEHDLC_ENABLE_STATS
+    switch (status) {
+        case SIMPLEHDLC_FRAME_OK:
+            SIMPLEHDLC_STAT_ADD(context, rx_frames_ok, 1);
+            break;
+        case SIMPLEHDLC_FRAME_CRC_MISMATCH:
+            SIMPLEHDLC_STAT_ADD(context, rx_crc_failures, 1);
+            break;
+        case SIMPLEHDLC_FRAME_TOO_LARGE:
+            SIMPLEHDLC_STAT_ADD(context, rx_oversize_drops, 1);
+            return;
+    }
+
+    if (timing_enabled(context)) {
+        context->callbacks.rx_frame_timing_callback(context->rx_frame_start,
+                                                    context->callbacks.timestamp_callback(context->user_ptr),
+                                                    len, status, context->user_ptr);
+    }
+#else
+    (void) context;
+    (void) len;
+    (void) status;
+#endif
+}
+
+// folds the payload bytes received since the last call into the running CRC
+static inline void update_running_crc32(simplehdlc_context_t *context) {
+    size_t payload_count = context->rx_count < context->expected_len-4 ? context->rx_count : context->expected_len-4;
+
+    if (payload_count > context->rx_crc32_count) {
+        context->rx_running_crc32 = simplehdlc_crc32_update(context->rx_running_crc32,
+                                                            &context->rx_buffer[context->rx_crc32_count],
+                                                            payload_count - context->rx_crc32_count);
+        context->rx_crc32_count = payload_count;
+    }
+}
+
+// in streaming mode the payload is passed on as it arrives, either straight from the input or, for unescaped bytes
+// and short runs, from rx_buffer which is used as a staging area
+
+// clean runs shorter than this are staged rather than passed on as a piece of their own
+#define SIMPLEHDLC_RX_MIN_DIRECT_RUN 16
+
+static inline void stream_deliver(simplehdlc_context_t *context, const uint8_t *data, size_t len) {
+    context->rx_running_crc32 = simplehdlc_crc32_update(context->rx_running_crc32, data, len);
+    context->callbacks.rx_data_callback(data, len, context->user_ptr);
+}
+
+static inline void stream_flush(simplehdlc_context_t *context) {
+    if (context->rx_staged_count) {
+        stream_deliver(context, context->rx_buffer, context->rx_staged_count);
+        context->rx_staged_count = 0;
+    }
+}
+
+static inline void stream_add_byte(simplehdlc_context_t *context, uint8_t c) {
+    if (context->rx_buffer_len == 0) {
+        stream_deliver(context, &c, 1);
+        return;
+    }
+
+    if (context->rx_staged_count == context->rx_buffer_len) stream_flush(context);
+    context->rx_buffer[context->rx_staged_count++] = c;
+}
+
+static inline void stream_add_run(simplehdlc_context_t *context, const uint8_t *data, size_t len) {
+    if (len < SIMPLEHDLC_RX_MIN_DIRECT_RUN && len <= context->rx_buffer_len - context->rx_staged_count) {
+        memcpy(&context->rx_buffer[context->rx_staged_count], data, len);
+        context->rx_staged_count += len;
+    } else {
+        stream_flush(context);
+        stream_deliver(context, data, len);
+    }
+}
+
+static inline void stream_end(simplehdlc_context_t *context, bool crc_ok) {
+    context->rx_stream_open = false;
+    if (context->callbacks.rx_end_callback != NULL) context->callbacks.rx_end_callback(crc_ok, context->user_ptr);
+}
+
+// abandons any packet in progress and starts a new one
+static inline void parse_boundary(simplehdlc_context_t *context) {
+    // a streamed packet which is cut off is reported as failed so that its data can be discarded
+    if (context->rx_stream_open) stream_end(context, false);
+
+    // repeated markers between packets are idle fill rather than aborted packets
+    if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB || context->state == SIMPLEHDLC_STATE_CONSUMING_PAYLOAD ||
+        context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_VARINT ||
+        (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB && (context->escape_next || context->rx_cobs))) {
+        SIMPLEHDLC_STAT_ADD(context, rx_aborted_frames, 1);
+    }
+    record_frame_start(context);
+
+    context->expected_len = 0;
+    context->rx_count = 0;
+    context->rx_crc32 = 0;
+    context->rx_running_crc32 = simplehdlc_crc32_init();
+    context->rx_crc32_count = 0;
+    context->rx_staged_count = 0;
+    context->escape_next = false;
+    context->rx_cobs = false;
+    context->rx_cobs_marker = false;
+    context->rx_cobs_remaining = 0;
+    context->rx_varint_shift = 0;
+    context->state = SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB;
+}
+
+typedef enum {
+    PARSE_RESULT_NONE = 0,
+    PARSE_RESULT_FRAME_OK,
+    PARSE_RESULT_FRAME_CRC_MISMATCH,
+    PARSE_RESULT_FRAME_TOO_LARGE,
+    PARSE_RESULT_BOUNDARY, // a boundary marker, which abandons any packet in progress
+    PARSE_RESULT_LENGTH, // the length of a packet which is to be received, so its payload is next
+} parse_result_t;
+
+// largest packet which simplehdlc_parse can pass to rx_packet_callback
+static inline size_t parse_max_len(const simplehdlc_context_t *context) {
+    return context->rx_buffer_len < 0xFFFF ? context->rx_buffer_len : 0xFFFF;
+}
+
+// called once the length of a packet has been received, to start receiving its payload. in buffered mode, packets of
+// more than max_len bytes are dropped.
+static inline parse_result_t parse_length(simplehdlc_context_t *context, bool streaming, size_t max_len) {
+    // an extended length may be too large to count with its CRC in a size_t
+    bool too_large = context->expected_len > SIMPLEHDLC_MAX_EXTENDED_PAYLOAD ||
+                     (!streaming && context->expected_len > max_len);
+    context->expected_len += 4; // for the CRC32
+
+    if (too_large) {
+        // packet is too large so ignore it
+        context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+        record_frame(context, context->expected_len - 4, SIMPLEHDLC_FRAME_TOO_LARGE);
+        return PARSE_RESULT_FRAME_TOO_LARGE;
+    }
+
+    if (streaming) {
+        // the packet never has to fit in rx_buffer
+        context->rx_stream_open = true;
+        if (context->callbacks.rx_begin_callback != NULL) {
+            context->callbacks.rx_begin_callback(context->expected_len - 4, context->user_ptr);
+        }
+    }
+    context->state = SIMPLEHDLC_STATE_CONSUMING_PAYLOAD;
+    return PARSE_RESULT_LENGTH;
+}
+
+// runs the state machine for one byte and returns whether it completed (or dropped) a packet; passing the completed
+// packet on is up to the caller, except in streaming mode. the bytewise variant buffers the packet and computes its
+// CRC once it is complete, exactly as the original parser did; otherwise the CRC is kept up to date as the payload
+// arrives.
+static inline parse_result_t parse_byte(simplehdlc_context_t *context, uint8_t c, bool bytewise, bool streaming,
+                                        size_t max_len) {
+    // wait for frame boundary marker
+    if (c == SIMPLEHDLC_BOUNDARY_MARKER) {
+        parse_boundary(context);
+        return PARSE_RESULT_BOUNDARY;
+    }
+
+    if (context->state == SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER) {
+        SIMPLEHDLC_STAT_ADD(context, rx_discarded_bytes, 1);
+        return PARSE_RESULT_NONE;
+    }
+
+    if (context->rx_cobs) {
+        if (context->rx_cobs_remaining) {
+            context->rx_cobs_remaining--;
+        } else {
+            // a code byte, which may first stand for the boundary marker that followed the previous group
+            uint8_t code = c ^ SIMPLEHDLC_BOUNDARY_MARKER;
+            bool marker = context->rx_cobs_marker;
+            context->rx_cobs_remaining = code - 1;
+            context->rx_cobs_marker = code - 1 < SIMPLEHDLC_COBS_MAX_GROUP;
+
+            if (!marker) return PARSE_RESULT_NONE;
+            c = SIMPLEHDLC_BOUNDARY_MARKER;
+        }
+    } else if (context->escape_next) {
+        context->escape_next = false;
+
+        // an escape marker straight after the frame boundary marker followed by something other than an escaped byte
+        // gives the frame type
+        if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB && SIMPLEHDLC_IS_FRAME_TYPE(c)) {
+            context->rx_cobs = (c & SIMPLEHDLC_FRAMING_COBS) != 0;
+            if (c & SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH) context->state = SIMPLEHDLC_STATE_CONSUMING_SIZE_VARINT;
+            return PARSE_RESULT_NONE;
+        }
+        c ^= (1 << 5);
+    } else if (c == SIMPLEHDLC_ESCAPE_MARKER) {
+        context->escape_next = true;
+        SIMPLEHDLC_STAT_ADD(context, rx_escapes, 1);
+        return PARSE_RESULT_NONE;
+    }
+
+    if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB) {
+        context->expected_len |= c << 8;
+        context->state = SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB;
+
+    } else if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB) {
+        context->expected_len |= c;
+        return parse_length(context, streaming, max_len);
+
+    } else if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_VARINT) {
+        // a fifth byte may only hold the top four bits of the length
+        if (context->rx_varint_shift == 28 && (c & 0xF0)) {
+            context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+            return PARSE_RESULT_NONE;
+        }
+
+        context->expected_len |= (size_t) (c & 0x7F) << context->rx_varint_shift;
+        context->rx_varint_shift += 7;
+        if (!(c & 0x80)) return parse_length(context, streaming, max_len);
+
+    } else if (context->state == SIMPLEHDLC_STATE_CONSUMING_PAYLOAD) {
+        if (context->rx_count < context->expected_len-4) {
+            if (streaming) {
+                stream_add_byte(context, c);
+                context->rx_count++;
+            } else {
+                context->rx_buffer[context->rx_count++] = c;
+            }
+        } else {
+            if (!bytewise && context->rx_count == context->expected_len-4) {
+                if (streaming) {
+                    stream_flush(context);
+                } else {
+                    update_running_crc32(context);
+                }
+            }
+
+            context->rx_crc32 |= c;
+            context->rx_count++;
+
+            if (context->rx_count == context->expected_len) {
+                uint32_t crc32;
+                if (bytewise) {
+                    crc32 = simplehdlc_compute_crc32(context->rx_buffer, context->rx_count - 4);
+                } else {
+                    crc32 = simplehdlc_crc32_final(context->rx_running_crc32);
+                }
+
+                context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+
+                bool crc_ok = crc32 == context->rx_crc32;
+                record_frame(context, context->expected_len - 4,
+                             crc_ok ? SIMPLEHDLC_FRAME_OK : SIMPLEHDLC_FRAME_CRC_MISMATCH);
+
+                if (streaming) stream_end(context, crc_ok);
+                return crc_ok ? PARSE_RESULT_FRAME_OK : PARSE_RESULT_FRAME_CRC_MISMATCH;
+            } else {
+                context->rx_crc32 <<= 8;
+            }
+        }
+    }
+
+    return PARSE_RESULT_NONE;
+}
+
+// takes the clean run of payload bytes at the start of data, up to the next reserved byte (or to the end of the COBS
+// group), in one go; returns the number of bytes taken
+static inline size_t parse_clean_run(simplehdlc_context_t *context, const uint8_t *data, size_t len, bool streaming) {
+    if (context->state != SIMPLEHDLC_STATE_CONSUMING_PAYLOAD || context->escape_next ||
+        context->rx_count >= context->expected_len-4) {
+        return 0;
+    }
+
+    size_t run = context->expected_len - 4 - context->rx_count;
+    if (run > len) run = len;
+
+    if (context->rx_cobs) {
+        // only the boundary marker is reserved within a group
+        if (run > context->rx_cobs_remaining) run = context->rx_cobs_remaining;
+        const uint8_t *marker = memchr(data, SIMPLEHDLC_BOUNDARY_MARKER, run);
+        if (marker != NULL) run = marker - data;
+        context->rx_cobs_remaining -= run;
+    } else {
+        run = simplehdlc_scan_reserved(data, run);
+    }
+
+    if (run) {
+        if (streaming) {
+            stream_add_run(context, data, run);
+        } else {
+            memcpy(&context->rx_buffer[context->rx_count], data, run);
+        }
+        context->rx_count += run;
+    }
+
+    return run;
+}
+
+// keeps the CRC up to date with the data received so far, so that completing a frame only has to fold in the last
+// chunk rather than the whole payload. streamed data is passed on before returning rather than being held until the
+// next call.
+static inline void parse_end_of_input(simplehdlc_context_t *context, bool streaming) {
+    if (context->state == SIMPLEHDLC_STATE_CONSUMING_PAYLOAD) {
+        if (streaming) {
+            stream_flush(context);
+        } else {
+            update_running_crc32(context);
+        }
+    }
 }
 
 void simplehdlc_parse(simplehdlc_context_t *context, const uint8_t *data, size_t len) {
-    for (size_t i=0; i<len; i++) {
-        uint8_t c = data[i];
-
-        // wait for frame boundary marker
-        if (c == SIMPLEHDLC_BOUNDARY_MARKER) {
-            context->expected_len = 0;
-            context->rx_count = 0;
-            context->rx_crc32 = 0;
-            context->escape_next = false;
-            context->state = SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB;
+    bool streaming = context->rx_streaming;
+    size_t max_len = parse_max_len(context);
+    size_t i = 0;
+
+    SIMPLEHDLC_STAT_ADD(context, rx_bytes, len);
+
+    while (i < len) {
+        size_t run = parse_clean_run(context, &data[i], len - i, streaming);
+        if (run) {
+            i += run;
             continue;
         }
 
-        if (context->state == SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER) {
-            continue;
+        if (parse_byte(context, data[i++], false, streaming, max_len) == PARSE_RESULT_FRAME_OK && !streaming) {
+            context->callbacks.rx_packet_callback(context->rx_buffer, context->rx_count-4, context->user_ptr);
         }
+    }
+
+    parse_end_of_input(context, streaming);
+}
 
-        if (context->escape_next) {
-            c ^= (1 << 5);
-            context->escape_next = false;
-        } else if (c == SIMPLEHDLC_ESCAPE_MARKER) {
-            context->escape_next = true;
+size_t simplehdlc_parse_to_event(simplehdlc_context_t *context, const uint8_t *data, size_t len,
+                                 simplehdlc_parse_event_t *event) {
+    size_t max_len = parse_max_len(context);
+    size_t i = 0;
+
+    while (i < len) {
+        size_t run = parse_clean_run(context, &data[i], len - i, false);
+        if (run) {
+            i += run;
             continue;
         }
 
-        if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB) {
-            context->expected_len |= c << 8;
-            context->state = SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB;
+        switch (parse_byte(context, data[i++], false, false, max_len)) {
+            case PARSE_RESULT_BOUNDARY:
+                *event = SIMPLEHDLC_PARSE_EVENT_BOUNDARY;
+                return i;
+            case PARSE_RESULT_LENGTH:
+                *event = SIMPLEHDLC_PARSE_EVENT_LENGTH;
+                return i;
+            case PARSE_RESULT_FRAME_OK:
+                *event = SIMPLEHDLC_PARSE_EVENT_FRAME_OK;
+                return i;
+            case PARSE_RESULT_FRAME_CRC_MISMATCH:
+            case PARSE_RESULT_FRAME_TOO_LARGE:
+                *event = SIMPLEHDLC_PARSE_EVENT_FRAME_DROPPED;
+                return i;
+            default:
+                break;
+        }
+    }
 
-        } else if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB) {
-            context->expected_len |= c;
-            context->expected_len += 4; // for the CRC32
+    parse_end_of_input(context, false);
+    *event = SIMPLEHDLC_PARSE_EVENT_NONE;
+    return i;
+}
 
-            if (context->expected_len > (context->rx_buffer_len + 4)) {
-                // packet is too large so ignore it
-                context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
-            } else {
-                context->state = SIMPLEHDLC_STATE_CONSUMING_PAYLOAD;
+void simplehdlc_parse_bytewise(simplehdlc_context_t *context, const uint8_t *data, size_t len) {
+    SIMPLEHDLC_STAT_ADD(context, rx_bytes, len);
+
+    for (size_t i=0; i<len; i++) {
+        if (parse_byte(context, data[i], true, false, parse_max_len(context)) == PARSE_RESULT_FRAME_OK) {
+            context->callbacks.rx_packet_callback(context->rx_buffer, context->rx_count-4, context->user_ptr);
+        }
+    }
+}
+
+static inline uint32_t load_u32_be(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+// if a whole packet without any escaped bytes starts at data[0], checks its CRC where it is and returns its length
+// on the wire; otherwise returns 0 and the packet is left to the state machine
+static size_t decode_in_place(simplehdlc_context_t *context, const uint8_t *data, size_t len,
+                              simplehdlc_frame_t *frame) {
+    if (len < 7 || simplehdlc_scan_reserved(&data[1], 2) != 2) return 0;
+
+    size_t payload_len = ((size_t) data[1] << 8) | data[2];
+    if (payload_len > context->rx_buffer_len || 7 + payload_len > len) return 0;
+    if (simplehdlc_scan_reserved(&data[3], payload_len + 4) != payload_len + 4) return 0;
+
+    bool crc_ok = simplehdlc_compute_crc32(&data[3], payload_len) == load_u32_be(&data[3 + payload_len]);
+
+    frame->ptr = crc_ok ? &data[3] : NULL;
+    frame->len = payload_len;
+    frame->status = crc_ok ? SIMPLEHDLC_FRAME_OK : SIMPLEHDLC_FRAME_CRC_MISMATCH;
+
+    // the marker resets the state machine as usual, and the packet leaves it waiting for the next one
+    parse_boundary(context);
+    context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+    record_frame(context, payload_len, frame->status);
+
+    return 7 + payload_len;
+}
+
+size_t simplehdlc_decode_batch(simplehdlc_context_t *context, const uint8_t *data, size_t len,
+                               simplehdlc_frame_t *frames, size_t max_frames, uint8_t *arena, size_t arena_len,
+                               size_t *consumed) {
+    size_t n_frames = 0;
+    size_t arena_count = 0;
+    bool stop = false;
+    size_t i = 0;
+
+    while (i < len && n_frames < max_frames && !stop) {
+        if (data[i] == SIMPLEHDLC_BOUNDARY_MARKER) {
+            size_t frame_size = decode_in_place(context, &data[i], len - i, &frames[n_frames]);
+            if (frame_size) {
+                n_frames++;
+                i += frame_size;
+                continue;
             }
+        }
 
-        } else if (context->state == SIMPLEHDLC_STATE_CONSUMING_PAYLOAD) {
-            if (context->rx_count < context->expected_len-4) {
-                context->rx_buffer[context->rx_count++] = c;
-            } else {
-                context->rx_crc32 |= c;
-                context->rx_count++;
+        size_t run = parse_clean_run(context, &data[i], len - i, false);
+        if (run) {
+            i += run;
+            continue;
+        }
+
+        simplehdlc_frame_t *frame = &frames[n_frames];
+        switch (parse_byte(context, data[i++], false, false, context->rx_buffer_len)) {
+            case PARSE_RESULT_FRAME_OK:
+                frame->len = context->rx_count - 4;
+                frame->status = SIMPLEHDLC_FRAME_OK;
+
+                if (frame->len <= arena_len - arena_count) {
+                    memcpy(&arena[arena_count], context->rx_buffer, frame->len);
+                    frame->ptr = &arena[arena_count];
+                    arena_count += frame->len;
+                } else {
+                    // out of arena, so hand out the parse buffer and stop before anything can overwrite it
+                    frame->ptr = context->rx_buffer;
+                    stop = true;
+                }
+                n_frames++;
+                break;
+
+            case PARSE_RESULT_FRAME_CRC_MISMATCH:
+                frame->ptr = NULL;
+                frame->len = context->rx_count - 4;
+                frame->status = SIMPLEHDLC_FRAME_CRC_MISMATCH;
+                n_frames++;
+                break;
+
+            case PARSE_RESULT_FRAME_TOO_LARGE:
+                frame->ptr = NULL;
+                frame->len = context->expected_len - 4;
+                frame->status = SIMPLEHDLC_FRAME_TOO_LARGE;
+                n_frames++;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    parse_end_of_input(context, false);
+    SIMPLEHDLC_STAT_ADD(context, rx_bytes, i);
+
+    if (consumed != NULL) *consumed = i;
+
+    return n_frames;
+}
+
+// the unread part of a ring, as the two contiguous pieces it occupies
+typedef struct {
+    const uint8_t *data[2];
+    size_t len[2];
+} ring_segments_t;
+
+// returns the bytes from offset into the ring segments up to the end of the segment they are in
+static inline const uint8_t *ring_span(const ring_segments_t *ring, size_t offset, size_t *len) {
+    if (offset < ring->len[0]) {
+        *len = ring->len[0] - offset;
+        return &ring->data[0][offset];
+    }
+
+    *len = ring->len[0] + ring->len[1] - offset;
+    return &ring->data[1][offset - ring->len[0]];
+}
+
+static inline uint8_t ring_byte(const ring_segments_t *ring, size_t offset) {
+    return offset < ring->len[0] ? ring->data[0][offset] : ring->data[1][offset - ring->len[0]];
+}
+
+// checks that the bytes from..to after the boundary marker at start hold no reserved bytes, and folds those of them
+// before payload_end (which are payload) into the CRC
+static bool ring_check_clean(const ring_segments_t *ring, size_t start, size_t from, size_t to, size_t payload_end,
+                             uint32_t *crc32) {
+    while (from < to) {
+        size_t n;
+        const uint8_t *data = ring_span(ring, start + 1 + from, &n);
+        if (n > to - from) n = to - from;
+
+        size_t run = simplehdlc_scan_reserved(data, n);
+        if (run < n) return false;
+
+        // the payload starts after the two bytes of length
+        size_t crc_from = from > 2 ? from : 2;
+        size_t crc_to = from + n < payload_end ? from + n : payload_end;
+        if (crc_to > crc_from) *crc32 = simplehdlc_crc32_update(*crc32, &data[crc_from - from], crc_to - crc_from);
+
+        from += n;
+    }
+
+    return true;
+}
+
+typedef enum {
+    RING_FRAME_NONE = 0, // left to the state machine
+    RING_FRAME_DONE,
+    RING_FRAME_HOLD,
+} ring_frame_result_t;
 
-                if (context->rx_count == context->expected_len) {
-                    uint32_t crc32 = simplehdlc_compute_crc32(context->rx_buffer, context->rx_count - 4);
+// if the packet whose boundary marker is at start has no escaped bytes and fits in the ring, checks it where it is and
+// passes it on, and sets *frame_size to its length on the wire. a packet of that kind which has not fully arrived is
+// held back, and the check carries on from where it got to next time.
+static ring_frame_result_t ring_frame(simplehdlc_context_t *context, const ring_segments_t *ring, size_t start,
+                                      size_t ring_len, size_t *frame_size) {
+    size_t have = ring->len[0] + ring->len[1] - start - 1; // bytes after the marker
+    size_t checked = context->rx_ring_checked;
+    uint32_t crc32 = checked ? context->rx_ring_crc32 : simplehdlc_crc32_init();
+    context->rx_ring_checked = 0;
 
-                    if (crc32 == context->rx_crc32) {
-                        context->callbacks.rx_packet_callback(context->rx_buffer, context->rx_count-4, context->user_ptr);
-                    }
+    // too small to hold even an empty packet
+    if (ring_len <= 7) return RING_FRAME_NONE;
 
-                    context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+    size_t header_end = have < 2 ? have : 2;
+    if (checked < header_end && !ring_check_clean(ring, start, checked, header_end, 2, &crc32)) return RING_FRAME_NONE;
+    if (checked < header_end) checked = header_end;
+
+    if (have >= 2) {
+        size_t payload_len = ((size_t) ring_byte(ring, start + 1) << 8) | ring_byte(ring, start + 2);
+
+        // the same limit as simplehdlc_parse, and a packet which the ring can never hold all of at once
+        if (payload_len > parse_max_len(context) || 7 + payload_len >= ring_len) return RING_FRAME_NONE;
+
+        size_t need = 2 + payload_len + 4;
+        size_t end = have < need ? have : need;
+        if (checked < end && !ring_check_clean(ring, start, checked, end, 2 + payload_len, &crc32)) {
+            return RING_FRAME_NONE;
+        }
+        if (checked < end) checked = end;
+
+        if (have >= need) {
+            size_t first_len;
+            const uint8_t *first = ring_span(ring, start + 3, &first_len);
+            if (first_len > payload_len) first_len = payload_len;
+            const uint8_t *second = ring->data[1];
+            size_t second_len = payload_len - first_len;
+
+            // without the ring callback, a packet in two pieces has to be gathered in the parse buffer
+            if (second_len && context->callbacks.rx_ring_packet_callback == NULL) return RING_FRAME_NONE;
+
+            uint32_t expected_crc32 = 0;
+            for (size_t i=0; i<4; i++) {
+                expected_crc32 = expected_crc32 << 8 | ring_byte(ring, start + 3 + payload_len + i);
+            }
+            bool crc_ok = simplehdlc_crc32_final(crc32) == expected_crc32;
+
+            // the marker resets the state machine as usual, and the packet leaves it waiting for the next one
+            parse_boundary(context);
+            context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+            record_frame(context, payload_len, crc_ok ? SIMPLEHDLC_FRAME_OK : SIMPLEHDLC_FRAME_CRC_MISMATCH);
+
+            if (crc_ok) {
+                if (context->callbacks.rx_ring_packet_callback != NULL) {
+                    context->callbacks.rx_ring_packet_callback(first, first_len, second, second_len,
+                                                               context->user_ptr);
                 } else {
-                    context->rx_crc32 <<= 8;
+                    context->callbacks.rx_packet_callback(first, (uint16_t) payload_len, context->user_ptr);
                 }
             }
+
+            *frame_size = 1 + need;
+            return RING_FRAME_DONE;
+        }
+    }
+
+    context->rx_ring_checked = checked;
+    context->rx_ring_crc32 = crc32;
+    return RING_FRAME_HOLD;
+}
+
+size_t simplehdlc_parse_ring(simplehdlc_context_t *context, const uint8_t *first, size_t first_len,
+                             const uint8_t *second, size_t second_len, size_t read_index, size_t ring_len) {
+    ring_segments_t ring = {{first, second}, {first_len, second_len}};
+    size_t len = first_len + second_len;
+    bool streaming = context->rx_streaming;
+    size_t max_len = parse_max_len(context);
+    size_t i = 0;
+
+    // what was checked of a packet held back last time only counts if it is still where it was
+    if (!context->rx_ring_held || context->rx_ring_held_index != read_index || len == 0 ||
+        ring_byte(&ring, 0) != SIMPLEHDLC_BOUNDARY_MARKER) {
+        context->rx_ring_checked = 0;
+    }
+    context->rx_ring_held = false;
+
+    while (i < len) {
+        size_t n;
+        const uint8_t *data = ring_span(&ring, i, &n);
+
+        if (!streaming && data[0] == SIMPLEHDLC_BOUNDARY_MARKER) {
+            size_t frame_size;
+            ring_frame_result_t result = ring_frame(context, &ring, i, ring_len, &frame_size);
+            if (result == RING_FRAME_DONE) {
+                i += frame_size;
+                continue;
+            }
+            if (result == RING_FRAME_HOLD) {
+                context->rx_ring_held = true;
+                context->rx_ring_held_index = (read_index + i) % ring_len;
+                break;
+            }
+        }
+
+        size_t run = parse_clean_run(context, data, n, streaming);
+        if (run) {
+            i += run;
+            continue;
+        }
+
+        if (parse_byte(context, data[0], false, streaming, max_len) == PARSE_RESULT_FRAME_OK && !streaming) {
+            if (context->callbacks.rx_ring_packet_callback != NULL) {
+                context->callbacks.rx_ring_packet_callback(context->rx_buffer, context->rx_count-4, NULL, 0,
+                                                           context->user_ptr);
+            } else {
+                context->callbacks.rx_packet_callback(context->rx_buffer, context->rx_count-4, context->user_ptr);
+            }
+        }
+        i++;
+    }
+
+    parse_end_of_input(context, streaming);
+    SIMPLEHDLC_STAT_ADD(context, rx_bytes, i);
+
+    return i;
+}
+
+size_t simplehdlc_escaped_size(const uint8_t *bytes, size_t len) {
+    size_t escaped_size = len;
+    size_t i = simplehdlc_scan_reserved(bytes, len);
+
+    while (i < len) {
+        escaped_size++;
+        i++;
+        i += simplehdlc_scan_reserved(&bytes[i], len - i);
+    }
+
+    return escaped_size;
+}
+
+typedef struct {
+    size_t size;
+    size_t group_len;
+    bool open;
+} cobs_size_t;
+
+// adds the COBS encoded size of bytes to size, following the same rules as encoder_cobs_output
+static void add_cobs_size(cobs_size_t *size, const uint8_t *bytes, size_t len) {
+    while (len) {
+        const uint8_t *marker = memchr(bytes, SIMPLEHDLC_BOUNDARY_MARKER, len);
+        size_t run = marker != NULL ? (size_t) (marker - bytes) : len;
+
+        if (run) {
+            if (!size->open) {
+                size->size++;
+                size->group_len = 0;
+            }
+
+            // a code byte for each group which fills up with more of the run to come
+            size_t group_len = size->group_len + run;
+            size->size += run + (group_len - 1) / SIMPLEHDLC_COBS_MAX_GROUP;
+            size->group_len = group_len % SIMPLEHDLC_COBS_MAX_GROUP;
+            size->open = size->group_len != 0;
+        }
+
+        if (marker != NULL) {
+            // the marker ends a group, which is empty if none was open, and starts the next
+            size->size += size->open ? 1 : 2;
+            size->group_len = 0;
+            size->open = true;
+            run++;
+        }
+
+        bytes += run;
+        len -= run;
+    }
+}
+
+// writes the length field of a packet into out and returns its size: two bytes, most significant first, or a varint
+// for an extended length frame
+static size_t put_length(uint8_t *out, uint32_t len, bool extended) {
+    if (!extended) {
+        out[0] = (len & 0xFF00) >> 8;
+        out[1] = len & 0xFF;
+        return 2;
+    }
+
+    size_t n = 0;
+    while (len >= 0x80) {
+        out[n++] = (len & 0x7F) | 0x80;
+        len >>= 7;
+    }
+    out[n++] = len;
+    return n;
+}
+
+static size_t get_encoded_size(const uint8_t *payload, uint32_t len, simplehdlc_framing_t framing, bool extended) {
+    uint32_t crc32 = simplehdlc_compute_crc32(payload, len);
+    uint8_t header[5];
+    size_t header_len = put_length(header, len, extended);
+    uint8_t trailer[4] = {(crc32 & 0xFF000000) >> 24, (crc32 & 0xFF0000) >> 16, (crc32 & 0xFF00) >> 8, crc32 & 0xFF};
+
+    if (framing == SIMPLEHDLC_FRAMING_COBS) {
+        cobs_size_t size = {0};
+        add_cobs_size(&size, header, header_len);
+        add_cobs_size(&size, payload, len);
+        add_cobs_size(&size, trailer, sizeof(trailer));
+        return 3 + size.size;
+    }
+
+    return (extended ? 3 : 1) + simplehdlc_escaped_size(header, header_len) +
+           simplehdlc_escaped_size(payload, len) +
+           simplehdlc_escaped_size(trailer, sizeof(trailer));
+}
+
+size_t simplehdlc_get_encoded_size_with_framing(const uint8_t *payload, uint16_t len, simplehdlc_framing_t framing) {
+    return get_encoded_size(payload, len, framing, false);
+}
+
+size_t simplehdlc_get_extended_encoded_size(const uint8_t *payload, uint32_t len, simplehdlc_framing_t framing) {
+    return get_encoded_size(payload, len, framing, true);
+}
+
+size_t simplehdlc_get_encoded_size(const uint8_t *payload, uint16_t len) {
+    return simplehdlc_get_encoded_size_with_framing(payload, len, SIMPLEHDLC_DEFAULT_FRAMING);
+}
+
+// payload is escaped in blocks of this size and each block is folded into the CRC straight afterwards, while it is
+// still in cache, rather than paying for a CRC call per clean run
+#define SIMPLEHDLC_ENCODE_CRC32_BLOCK 4096
+
+// clean runs shorter than this are copied into the staging area rather than sent as a chunk of their own
+#define SIMPLEHDLC_TX_MIN_DIRECT_RUN 16
+
+#if SIMPLEHDLC_TX_STAGING_SIZE < SIMPLEHDLC_TX_MIN_DIRECT_RUN
+#error "SIMPLEHDLC_TX_STAGING_SIZE is too small"
+#endif
+
+static inline void encoder_flush_staging(simplehdlc_encoder_t *encoder) {
+    if (encoder->staging_len) {
+        encoder->context->callbacks.tx_chunk_callback(encoder->staging, encoder->staging_len, encoder->context->user_ptr);
+        encoder->staging_len = 0;
+    }
+}
+
+// outputs a run of bytes which do not need escaping
+static inline void encoder_output_run(simplehdlc_encoder_t *encoder, const uint8_t *data, size_t len) {
+    if (encoder->error != SIMPLEHDLC_OK || len == 0) return;
+
+    if (encoder->context == NULL) {
+        // the output is checked for room as it is written, so that the encode can give up as soon as it runs out
+        if (!encoder->buffer_checked && len > encoder->buffer_len - encoder->output_count) {
+            encoder->error = SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+            return;
+        }
+        memcpy(&encoder->buffer[encoder->output_count], data, len);
+
+    } else if (encoder->context->callbacks.tx_chunk_callback != NULL) {
+        if (len >= SIMPLEHDLC_TX_MIN_DIRECT_RUN) {
+            // long clean runs go straight from the caller's buffer
+            encoder_flush_staging(encoder);
+            encoder->context->callbacks.tx_chunk_callback(data, len, encoder->context->user_ptr);
+        } else {
+            if (SIMPLEHDLC_TX_STAGING_SIZE - encoder->staging_len < len) encoder_flush_staging(encoder);
+            memcpy(&encoder->staging[encoder->staging_len], data, len);
+            encoder->staging_len += len;
+        }
+
+    } else {
+        for (size_t i=0; i<len; i++) {
+            encoder->context->callbacks.tx_byte_callback(data[i], encoder->context->user_ptr);
         }
     }
+
+    encoder->output_count += len;
 }
 
-static void escape_and_add_to_buffer(uint8_t byte, uint8_t *buffer, size_t *index) {
+// outputs a single byte, escaping it if required
+static inline void encoder_output_byte(simplehdlc_encoder_t *encoder, uint8_t byte) {
+    uint8_t escaped[2] = {SIMPLEHDLC_ESCAPE_MARKER, byte ^ (1 << 5)};
+
     if (byte == SIMPLEHDLC_BOUNDARY_MARKER || byte == SIMPLEHDLC_ESCAPE_MARKER) {
-        buffer[(*index)++] = SIMPLEHDLC_ESCAPE_MARKER;
-        buffer[(*index)++] = byte ^ (1 << 5);
+        encoder_output_run(encoder, escaped, 2);
+        if (encoder->context != NULL) SIMPLEHDLC_STAT_ADD(encoder->context, tx_escapes, 1);
     } else {
-        buffer[(*index)++] = byte;
+        encoder_output_run(encoder, &byte, 1);
     }
 }
 
-static size_t get_escaped_size(const uint8_t *bytes, size_t len) {
-    size_t escaped_size = 0;
-    for (size_t i=0; i<len; i++) {
-        if (bytes[i] == SIMPLEHDLC_BOUNDARY_MARKER || bytes[i] == SIMPLEHDLC_ESCAPE_MARKER) {
-            escaped_size += 2;
+// starts a COBS group. when encoding to a buffer, room is left for its code byte and the data goes straight into the
+// buffer after it; otherwise the group is gathered in the context, as its code byte has to be sent first.
+static inline void encoder_cobs_open(simplehdlc_encoder_t *encoder) {
+    encoder->cobs_open = true;
+    encoder->cobs_group_len = 0;
+
+    if (encoder->context == NULL) {
+        uint8_t code = 0;
+        encoder->cobs_code_pos = encoder->output_count;
+        encoder_output_run(encoder, &code, 1);
+    }
+}
+
+static inline void encoder_cobs_close(simplehdlc_encoder_t *encoder) {
+    uint8_t code = (uint8_t) (encoder->cobs_group_len + 1) ^ SIMPLEHDLC_BOUNDARY_MARKER;
+    encoder->cobs_open = false;
+
+    if (encoder->context == NULL) {
+        if (encoder->error == SIMPLEHDLC_OK) encoder->buffer[encoder->cobs_code_pos] = code;
+    } else {
+        encoder_output_run(encoder, &code, 1);
+        encoder_output_run(encoder, encoder->context->tx_cobs_group, encoder->cobs_group_len);
+    }
+}
+
+// outputs bytes with consistent overhead byte stuffing: each run up to the next boundary marker is copied in one go,
+// and the marker itself ends the group
+static void encoder_cobs_output(simplehdlc_encoder_t *encoder, const uint8_t *data, size_t len) {
+    while (len && encoder->error == SIMPLEHDLC_OK) {
+        if (!encoder->cobs_open) encoder_cobs_open(encoder);
+
+        size_t run = SIMPLEHDLC_COBS_MAX_GROUP - encoder->cobs_group_len;
+        if (run > len) run = len;
+        const uint8_t *marker = memchr(data, SIMPLEHDLC_BOUNDARY_MARKER, run);
+        if (marker != NULL) run = marker - data;
+
+        if (encoder->context == NULL) {
+            encoder_output_run(encoder, data, run);
         } else {
-            escaped_size += 1;
+            memcpy(&encoder->context->tx_cobs_group[encoder->cobs_group_len], data, run);
+        }
+        encoder->cobs_group_len += run;
+        data += run;
+        len -= run;
+
+        if (marker != NULL) {
+            // a group which is followed by the marker is always followed by another, even if it is empty
+            encoder_cobs_close(encoder);
+            encoder_cobs_open(encoder);
+            data++;
+            len--;
+        } else if (encoder->cobs_group_len == SIMPLEHDLC_COBS_MAX_GROUP) {
+            encoder_cobs_close(encoder);
         }
     }
+}
 
-    return escaped_size;
+// outputs the header and CRC bytes in the encoder's framing
+static inline void encoder_output_bytes(simplehdlc_encoder_t *encoder, const uint8_t *bytes, size_t len) {
+    if (encoder->framing == SIMPLEHDLC_FRAMING_COBS) {
+        encoder_cobs_output(encoder, bytes, len);
+    } else {
+        for (size_t i=0; i<len; i++) encoder_output_byte(encoder, bytes[i]);
+    }
 }
 
-size_t simplehdlc_get_encoded_size(const uint8_t *payload, uint16_t len) {
-    uint32_t crc32 = simplehdlc_compute_crc32(payload, len);
+static void encoder_begin(simplehdlc_encoder_t *encoder, uint32_t payload_len, simplehdlc_framing_t framing,
+                          bool extended) {
+    encoder->payload_len = payload_len;
+    encoder->payload_count = 0;
+    encoder->output_count = 0;
+    encoder->staging_len = 0;
+    encoder->crc32 = simplehdlc_crc32_init();
+    encoder->error = SIMPLEHDLC_OK;
+    encoder->framing = framing;
+    encoder->cobs_open = false;
+    encoder->cobs_group_len = 0;
+
+    uint8_t type = framing | (extended ? SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH : 0);
+    uint8_t header[3] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER, type};
+    encoder_output_run(encoder, header, type == 0 ? 1 : 3);
 
-    return 1 + get_escaped_size((uint8_t *)&len, sizeof(len)) +
-           get_escaped_size(payload, len) +
-           get_escaped_size((uint8_t *)&crc32, sizeof(crc32));
+    uint8_t len[5];
+    encoder_output_bytes(encoder, len, put_length(len, payload_len, extended));
 }
 
 simplehdlc_error_code_t
-simplehdlc_encode_to_buffer(uint8_t *buffer, size_t buffer_len, size_t *encoded_size, const uint8_t *payload,
-                            uint16_t payload_len) {
+simplehdlc_encoder_begin_buffer(simplehdlc_encoder_t *encoder, uint8_t *buffer, size_t buffer_len, uint16_t payload_len) {
+    return simplehdlc_encoder_begin_buffer_with_framing(encoder, buffer, buffer_len, payload_len,
+                                                        SIMPLEHDLC_DEFAULT_FRAMING);
+}
+
+static simplehdlc_error_code_t
+encoder_begin_buffer(simplehdlc_encoder_t *encoder, uint8_t *buffer, size_t buffer_len, uint32_t payload_len,
+                     simplehdlc_framing_t framing, bool extended) {
+    encoder->context = NULL;
+    encoder->buffer = buffer;
+    encoder->buffer_len = buffer_len;
+    encoder->buffer_checked = false;
+    encoder->flush = false;
+
+    if (buffer_len < 7) {
+        encoder->error = SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+        return encoder->error;
+    }
+
+    encoder_begin(encoder, payload_len, framing, extended);
+    return encoder->error;
+}
+
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_buffer_with_framing(simplehdlc_encoder_t *encoder, uint8_t *buffer, size_t buffer_len,
+                                             uint16_t payload_len, simplehdlc_framing_t framing) {
+    return encoder_begin_buffer(encoder, buffer, buffer_len, payload_len, framing, false);
+}
+
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_buffer_extended(simplehdlc_encoder_t *encoder, uint8_t *buffer, size_t buffer_len,
+                                         uint32_t payload_len, simplehdlc_framing_t framing) {
+    if (payload_len > SIMPLEHDLC_MAX_EXTENDED_PAYLOAD) {
+        encoder->error = SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+        return encoder->error;
+    }
+
+    return encoder_begin_buffer(encoder, buffer, buffer_len, payload_len, framing, true);
+}
+
+static simplehdlc_error_code_t
+encoder_begin_callback(simplehdlc_encoder_t *encoder, simplehdlc_context_t *context, uint32_t payload_len, bool flush,
+                       bool extended) {
+    encoder->context = context;
+    encoder->buffer = NULL;
+    encoder->buffer_len = 0;
+    encoder->buffer_checked = false;
+    encoder->flush = flush;
+
+    if (context->callbacks.tx_chunk_callback == NULL && context->callbacks.tx_byte_callback == NULL) {
+        encoder->error = SIMPLEHDLC_ERROR_CALLBACK_MISSING;
+        return encoder->error;
+    }
+
+    encoder_begin(encoder, payload_len, context->tx_framing, extended);
+    return encoder->error;
+}
 
-    size_t expected_size = simplehdlc_get_encoded_size(payload, payload_len);
-    if (buffer_len < 7 || expected_size > buffer_len) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_callback(simplehdlc_encoder_t *encoder, simplehdlc_context_t *context, uint16_t payload_len,
+                                  bool flush) {
+    return encoder_begin_callback(encoder, context, payload_len, flush, false);
+}
+
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_callback_extended(simplehdlc_encoder_t *encoder, simplehdlc_context_t *context,
+                                           uint32_t payload_len, bool flush) {
+    if (payload_len > SIMPLEHDLC_MAX_EXTENDED_PAYLOAD) {
+        encoder->error = SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+        return encoder->error;
+    }
+
+    return encoder_begin_callback(encoder, context, payload_len, flush, true);
+}
+
+simplehdlc_error_code_t simplehdlc_encoder_append(simplehdlc_encoder_t *encoder, const uint8_t *data, size_t len) {
+    if (encoder->error != SIMPLEHDLC_OK) return encoder->error;
+
+    if (len > (size_t) encoder->payload_len - encoder->payload_count) {
+        encoder->error = SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH;
+        return encoder->error;
+    }
+
+    while (len && encoder->error == SIMPLEHDLC_OK) {
+        size_t block_len = len < SIMPLEHDLC_ENCODE_CRC32_BLOCK ? len : SIMPLEHDLC_ENCODE_CRC32_BLOCK;
+
+        if (encoder->framing == SIMPLEHDLC_FRAMING_COBS) {
+            encoder_cobs_output(encoder, data, block_len);
+        } else {
+            size_t i = 0;
+            while (i < block_len) {
+                size_t run = simplehdlc_scan_reserved(&data[i], block_len - i);
+                encoder_output_run(encoder, &data[i], run);
+                i += run;
 
-    size_t output_index = 0;
+                if (i < block_len) {
+                    encoder_output_byte(encoder, data[i]);
+                    i++;
+                }
+            }
+        }
 
-    buffer[output_index++] = SIMPLEHDLC_BOUNDARY_MARKER;
+        encoder->crc32 = simplehdlc_crc32_update(encoder->crc32, data, block_len);
+        encoder->payload_count += block_len;
+        data += block_len;
+        len -= block_len;
+    }
 
-    escape_and_add_to_buffer((payload_len & 0xFF00) >> 8, buffer, &output_index);
-    escape_and_add_to_buffer(payload_len & 0xFF, buffer, &output_index);
+    return encoder->error;
+}
+
+simplehdlc_error_code_t simplehdlc_encoder_finish(simplehdlc_encoder_t *encoder, size_t *encoded_size) {
+    if (encoder->error != SIMPLEHDLC_OK) return encoder->error;
 
-    for (uint16_t i=0; i<payload_len; i++) {
-        escape_and_add_to_buffer(payload[i], buffer, &output_index);
+    if (encoder->payload_count != encoder->payload_len) {
+        encoder->error = SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH;
+        return encoder->error;
     }
 
-    uint32_t crc32 = simplehdlc_compute_crc32(payload, payload_len);
+    uint32_t crc32 = simplehdlc_crc32_final(encoder->crc32);
+    uint8_t trailer[4] = {(crc32 & 0xFF000000) >> 24, (crc32 & 0xFF0000) >> 16, (crc32 & 0xFF00) >> 8, crc32 & 0xFF};
+    encoder_output_bytes(encoder, trailer, sizeof(trailer));
+    if (encoder->cobs_open) encoder_cobs_close(encoder);
 
-    escape_and_add_to_buffer((crc32 & 0xFF000000) >> 24, buffer, &output_index);
-    escape_and_add_to_buffer((crc32 & 0xFF0000) >> 16, buffer, &output_index);
-    escape_and_add_to_buffer((crc32 & 0xFF00) >> 8, buffer, &output_index);
-    escape_and_add_to_buffer(crc32 & 0xFF, buffer, &output_index);
+    if (encoder->error != SIMPLEHDLC_OK) return encoder->error;
 
-    if (output_index != expected_size) return SIMPLEHDLC_ERROR_INTERNAL_ENCODE_LENGTH_MISMATCH;
+    if (encoder->context != NULL) {
+        if (encoder->context->callbacks.tx_chunk_callback != NULL) encoder_flush_staging(encoder);
 
-    *encoded_size = output_index;
+        SIMPLEHDLC_STAT_ADD(encoder->context, tx_frames, 1);
+        SIMPLEHDLC_STAT_ADD(encoder->context, tx_bytes, encoder->output_count);
+
+        if (encoder->flush) {
+            if (encoder->context->callbacks.tx_flush_buffer_callback != NULL) {
+                encoder->context->callbacks.tx_flush_buffer_callback(encoder->context->user_ptr);
+            } else {
+                encoder->error = SIMPLEHDLC_ERROR_CALLBACK_MISSING;
+                return encoder->error;
+            }
+        }
+    }
+
+    if (encoded_size != NULL) *encoded_size = encoder->output_count;
 
     return SIMPLEHDLC_OK;
 }
 
-static void escape_and_send_to_callback(simplehdlc_context_t *context, uint8_t byte) {
-    if (byte == SIMPLEHDLC_BOUNDARY_MARKER || byte == SIMPLEHDLC_ESCAPE_MARKER) {
-        context->callbacks.tx_byte_callback(SIMPLEHDLC_ESCAPE_MARKER, context->user_ptr);
-        context->callbacks.tx_byte_callback(byte ^ (1 << 5), context->user_ptr);
-    } else {
-        context->callbacks.tx_byte_callback(byte, context->user_ptr);
+simplehdlc_error_code_t
+simplehdlc_encode_to_buffer(uint8_t *buffer, size_t buffer_len, size_t *encoded_size, const uint8_t *payload,
+                            uint16_t payload_len) {
+    return simplehdlc_encode_to_buffer_with_framing(buffer, buffer_len, encoded_size, payload, payload_len,
+                                                    SIMPLEHDLC_DEFAULT_FRAMING);
+}
+
+// true if the rest of the frame, the payload still to come and the CRC, fits in the room left in the buffer however it
+// turns out to be escaped: every byte doubled, or in COBS one code byte more for each group it can start
+static inline bool encoder_rest_fits(const simplehdlc_encoder_t *encoder) {
+    size_t left = (size_t) (encoder->payload_len - encoder->payload_count) + 4;
+    size_t room = encoder->buffer_len - encoder->output_count;
+
+    if (encoder->framing == SIMPLEHDLC_FRAMING_COBS) {
+        size_t groups = left / SIMPLEHDLC_COBS_MAX_GROUP;
+        return groups < room && left < room - groups;
     }
+    return left <= room / 2;
+}
+
+// encodes a whole payload into a buffer in a single pass. the output is not checked for room for as long as the worst
+// case of the rest of the frame fits in what is left of the buffer, so a buffer of the worst case size is never checked
+// at all; a smaller one is checked only for the tail which might not fit.
+static simplehdlc_error_code_t
+encode_to_buffer(uint8_t *buffer, size_t buffer_len, size_t *encoded_size, const uint8_t *payload, uint32_t payload_len,
+                 simplehdlc_framing_t framing, bool extended) {
+    simplehdlc_encoder_t encoder;
+    if (encoder_begin_buffer(&encoder, buffer, buffer_len, payload_len, framing, extended) != SIMPLEHDLC_OK) {
+        return encoder.error;
+    }
+
+    // the worst case bounds everything still to be written, so once it fits nothing after it needs checking
+    do {
+        size_t block_len = payload_len - encoder.payload_count;
+        if (block_len > SIMPLEHDLC_ENCODE_CRC32_BLOCK) block_len = SIMPLEHDLC_ENCODE_CRC32_BLOCK;
+
+        if (!encoder.buffer_checked) encoder.buffer_checked = encoder_rest_fits(&encoder);
+        if (simplehdlc_encoder_append(&encoder, &payload[encoder.payload_count], block_len) != SIMPLEHDLC_OK) {
+            return encoder.error;
+        }
+    } while (encoder.payload_count < payload_len);
+
+    if (!encoder.buffer_checked) encoder.buffer_checked = encoder_rest_fits(&encoder);
+    return simplehdlc_encoder_finish(&encoder, encoded_size);
+}
+
+simplehdlc_error_code_t
+simplehdlc_encode_to_buffer_with_framing(uint8_t *buffer, size_t buffer_len, size_t *encoded_size,
+                                         const uint8_t *payload, uint16_t payload_len, simplehdlc_framing_t framing) {
+    return encode_to_buffer(buffer, buffer_len, encoded_size, payload, payload_len, framing, false);
 }
 
 simplehdlc_error_code_t
 simplehdlc_encode_to_callback(simplehdlc_context_t *context, const uint8_t *payload, uint16_t payload_len, bool flush) {
-    if (context->callbacks.tx_byte_callback == NULL) return SIMPLEHDLC_ERROR_CALLBACK_MISSING;
+    simplehdlc_encoder_t encoder;
+
+    if (simplehdlc_encoder_begin_callback(&encoder, context, payload_len, flush) != SIMPLEHDLC_OK ||
+        simplehdlc_encoder_append(&encoder, payload, payload_len) != SIMPLEHDLC_OK) {
+        return encoder.error;
+    }
+
+    return simplehdlc_encoder_finish(&encoder, NULL);
+}
+
+simplehdlc_error_code_t
+simplehdlc_encode_to_buffer_extended(uint8_t *buffer, size_t buffer_len, size_t *encoded_size, const uint8_t *payload,
+                                     uint32_t payload_len, simplehdlc_framing_t framing) {
+    if (payload_len > SIMPLEHDLC_MAX_EXTENDED_PAYLOAD) return SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+
+    return encode_to_buffer(buffer, buffer_len, encoded_size, payload, payload_len, framing, true);
+}
 
-    context->callbacks.tx_byte_callback(SIMPLEHDLC_BOUNDARY_MARKER, context->user_ptr);
+simplehdlc_error_code_t
+simplehdlc_encode_to_callback_extended(simplehdlc_context_t *context, const uint8_t *payload, uint32_t payload_len,
+                                       bool flush) {
+    simplehdlc_encoder_t encoder;
+
+    if (simplehdlc_encoder_begin_callback_extended(&encoder, context, payload_len, flush) != SIMPLEHDLC_OK ||
+        simplehdlc_encoder_append(&encoder, payload, payload_len) != SIMPLEHDLC_OK) {
+        return encoder.error;
+    }
+
+    return simplehdlc_encoder_finish(&encoder, NULL);
+}
+
+static bool get_iov_payload_len(const simplehdlc_iovec_t *iov, size_t iovcnt, uint16_t *payload_len) {
+    size_t total = 0;
+    for (size_t i=0; i<iovcnt; i++) {
+        if (iov[i].len > 0xFFFF - total) return false;
+        total += iov[i].len;
+    }
+
+    *payload_len = (uint16_t) total;
+    return true;
+}
+
+static simplehdlc_error_code_t encoder_append_iov(simplehdlc_encoder_t *encoder, const simplehdlc_iovec_t *iov,
+                                                  size_t iovcnt) {
+    for (size_t i=0; i<iovcnt; i++) {
+        if (simplehdlc_encoder_append(encoder, (const uint8_t *) iov[i].data, iov[i].len) != SIMPLEHDLC_OK) break;
+    }
+
+    return encoder->error;
+}
 
-    escape_and_send_to_callback(context, (payload_len & 0xFF00) >> 8);
-    escape_and_send_to_callback(context, payload_len & 0xFF);
+simplehdlc_error_code_t
+simplehdlc_encode_iov_to_buffer(uint8_t *buffer, size_t buffer_len, size_t *encoded_size, const simplehdlc_iovec_t *iov,
+                                size_t iovcnt) {
+    uint16_t payload_len;
+    if (!get_iov_payload_len(iov, iovcnt, &payload_len)) return SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+
+    simplehdlc_encoder_t encoder;
 
-    for (uint16_t i=0; i<payload_len; i++) {
-        escape_and_send_to_callback(context, payload[i]);
+    if (simplehdlc_encoder_begin_buffer(&encoder, buffer, buffer_len, payload_len) != SIMPLEHDLC_OK ||
+        encoder_append_iov(&encoder, iov, iovcnt) != SIMPLEHDLC_OK) {
+        return encoder.error;
     }
 
-    uint32_t crc32 = simplehdlc_compute_crc32(payload, payload_len);
-    escape_and_send_to_callback(context, (crc32 & 0xFF000000) >> 24);
-    escape_and_send_to_callback(context, (crc32 & 0xFF0000) >> 16);
-    escape_and_send_to_callback(context, (crc32 & 0xFF00) >> 8);
-    escape_and_send_to_callback(context, crc32 & 0xFF);
+    return simplehdlc_encoder_finish(&encoder, encoded_size);
+}
+
+simplehdlc_error_code_t
+simplehdlc_encode_iov_to_callback(simplehdlc_context_t *context, const simplehdlc_iovec_t *iov, size_t iovcnt,
+                                  bool flush) {
+    uint16_t payload_len;
+    if (!get_iov_payload_len(iov, iovcnt, &payload_len)) return SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+
+    simplehdlc_encoder_t encoder;
+
+    if (simplehdlc_encoder_begin_callback(&encoder, context, payload_len, flush) != SIMPLEHDLC_OK ||
+        encoder_append_iov(&encoder, iov, iovcnt) != SIMPLEHDLC_OK) {
+        return encoder.error;
+    }
+
+    return simplehdlc_encoder_finish(&encoder, NULL);
+}
+
+// the in place encode works back from the end of the payload in blocks of this size
+#define SIMPLEHDLC_IN_PLACE_BLOCK 256
+
+static inline bool is_reserved(uint8_t c) {
+    return c == SIMPLEHDLC_BOUNDARY_MARKER || c == SIMPLEHDLC_ESCAPE_MARKER;
+}
 
-    if (flush) {
-        if (context->callbacks.tx_flush_buffer_callback != NULL) {
-            context->callbacks.tx_flush_buffer_callback(context->user_ptr);
+size_t simplehdlc_put_escaped(uint8_t *out, const uint8_t *bytes, size_t len) {
+    size_t n = 0;
+    for (size_t i=0; i<len; i++) {
+        if (is_reserved(bytes[i])) {
+            out[n++] = SIMPLEHDLC_ESCAPE_MARKER;
+            out[n++] = bytes[i] ^ (1 << 5);
         } else {
-            return SIMPLEHDLC_ERROR_CALLBACK_MISSING;
+            out[n++] = bytes[i];
         }
     }
 
+    return n;
+}
+
+simplehdlc_error_code_t
+simplehdlc_encode_in_place(uint8_t *buffer, size_t buffer_len, size_t headroom, uint16_t payload_len,
+                           size_t *frame_offset, size_t *frame_len) {
+    if (headroom > buffer_len || payload_len > buffer_len - headroom) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+
+    uint8_t *payload = &buffer[headroom];
+    size_t tailroom = buffer_len - headroom - payload_len;
+
+    // count the escapes, noting the first and last, and work out everything else before any of the buffer is touched.
+    // the CRC is folded in a block at a time, while each block is still in cache from being scanned.
+    size_t n_escapes = 0;
+    size_t first = payload_len;
+    size_t last = payload_len;
+    uint32_t crc32 = simplehdlc_crc32_init();
+    for (size_t block=0; block<payload_len; block+=SIMPLEHDLC_ENCODE_CRC32_BLOCK) {
+        size_t block_end = payload_len - block < SIMPLEHDLC_ENCODE_CRC32_BLOCK ? payload_len
+                                                                               : block + SIMPLEHDLC_ENCODE_CRC32_BLOCK;
+        size_t i = block + simplehdlc_scan_reserved(&payload[block], block_end - block);
+        while (i < block_end) {
+            if (n_escapes++ == 0) first = i;
+            last = i++;
+            i += simplehdlc_scan_reserved(&payload[i], block_end - i);
+        }
+        crc32 = simplehdlc_crc32_update(crc32, &payload[block], block_end - block);
+    }
+    crc32 = simplehdlc_crc32_final(crc32);
+
+    uint8_t header[2] = {(payload_len & 0xFF00) >> 8, payload_len & 0xFF};
+    uint8_t trailer[4] = {(crc32 & 0xFF000000) >> 24, (crc32 & 0xFF0000) >> 16, (crc32 & 0xFF00) >> 8, crc32 & 0xFF};
+    size_t header_size = 1 + simplehdlc_escaped_size(header, sizeof(header));
+    size_t trailer_size = simplehdlc_escaped_size(trailer, sizeof(trailer));
+    if (headroom < header_size || tailroom < trailer_size) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+
+    // the payload moves back into the headroom by the first shift escapes, and forward into the tailroom by the rest.
+    // the bytes between those two groups of escapes stay where they are, so where there is a choice the longer of the
+    // runs before the first escape and after the last is left alone.
+    size_t max_shift = headroom - header_size < n_escapes ? headroom - header_size : n_escapes;
+    size_t min_shift = n_escapes + trailer_size > tailroom ? n_escapes + trailer_size - tailroom : 0;
+    if (min_shift > max_shift) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+
+    size_t shift = max_shift;
+    if (min_shift == 0 && (max_shift < n_escapes || first >= payload_len - last - 1)) shift = 0;
+
+    // front to back up to the shift'th escape: the output never gets ahead of the input
+    uint8_t *out = payload - shift;
+    size_t in = 0;
+    for (size_t i=0; i<shift; i++) {
+        size_t run = simplehdlc_scan_reserved(&payload[in], payload_len - in);
+        memmove(out, &payload[in], run);
+        out += run;
+        in += run;
+
+        uint8_t c = payload[in++];
+        *out++ = SIMPLEHDLC_ESCAPE_MARKER;
+        *out++ = c ^ (1 << 5);
+    }
+
+    // then back to front from the end, where the input never gets ahead of the output. the escapes are found a block
+    // at a time with the same forward scan, and their positions replayed backwards.
+    uint8_t *back = &payload[payload_len + n_escapes - shift];
+    size_t end = payload_len;
+    size_t remaining = n_escapes - shift;
+    while (remaining) {
+        size_t start = end - in > SIMPLEHDLC_IN_PLACE_BLOCK ? end - SIMPLEHDLC_IN_PLACE_BLOCK : in;
+        uint16_t positions[SIMPLEHDLC_IN_PLACE_BLOCK];
+        size_t n_positions = 0;
+        for (size_t i=start + simplehdlc_scan_reserved(&payload[start], end - start); i<end; ) {
+            positions[n_positions++] = (uint16_t) (i - start);
+            i++;
+            i += simplehdlc_scan_reserved(&payload[i], end - i);
+        }
+
+        while (n_positions) {
+            size_t escape = start + positions[--n_positions];
+            back -= end - escape - 1;
+            memmove(back, &payload[escape + 1], end - escape - 1);
+
+            uint8_t c = payload[escape];
+            back -= 2;
+            back[0] = SIMPLEHDLC_ESCAPE_MARKER;
+            back[1] = c ^ (1 << 5);
+            end = escape;
+            remaining--;
+        }
+
+        // the rest of a block without escapes moves as it is, unless nothing is left to move
+        if (remaining) {
+            back -= end - start;
+            memmove(back, &payload[start], end - start);
+            end = start;
+        }
+    }
+
+    uint8_t *frame = payload - shift - header_size;
+    frame[0] = SIMPLEHDLC_BOUNDARY_MARKER;
+    simplehdlc_put_escaped(&frame[1], header, sizeof(header));
+    simplehdlc_put_escaped(&payload[payload_len + n_escapes - shift], trailer, sizeof(trailer));
+
+    *frame_offset = (size_t) (frame - buffer);
+    *frame_len = header_size + payload_len + n_escapes + trailer_size;
     return SIMPLEHDLC_OK;
-}
\ No newline at end of file
+}
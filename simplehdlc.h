@@ -19,24 +19,151 @@ extern "C" {
 #define SIMPLEHDLC_ESCAPE_MARKER 0x7D
 #endif
 
+// upper bound on the encoded size of a payload of len bytes, reached when every byte of the length, payload and CRC
+// needs escaping. this is also an upper bound for SIMPLEHDLC_FRAMING_COBS.
+#define SIMPLEHDLC_MAX_ENCODED_SIZE(len) (1 + 2 * ((size_t) (len) + 6))
+
+// upper bound on the encoded size of a payload of len bytes with SIMPLEHDLC_FRAMING_COBS: the three byte frame header,
+// plus the length, payload and CRC with one code byte per COBS group and one to spare
+#define SIMPLEHDLC_COBS_MAX_ENCODED_SIZE(len) \
+    (4 + ((size_t) (len) + 6) + ((size_t) (len) + 6) / SIMPLEHDLC_COBS_MAX_GROUP)
+
+// most data bytes in a COBS group
+#define SIMPLEHDLC_COBS_MAX_GROUP 254
+
+// frame type bit marking an extended length frame; see simplehdlc_encoder_begin_buffer_extended
+#define SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH 0x01
+
+// whether c, escaped straight after the boundary marker, is a frame type rather than an escaped length byte. a length
+// byte which is one of the markers escapes to the marker ^ 0x20, so with overridden markers that value is never a type.
+#define SIMPLEHDLC_IS_FRAME_TYPE(c) \
+    ((c) != 0 && ((c) & ~(SIMPLEHDLC_FRAMING_COBS | SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH)) == 0 && \
+     (c) != (SIMPLEHDLC_BOUNDARY_MARKER ^ (1 << 5)) && (c) != (SIMPLEHDLC_ESCAPE_MARKER ^ (1 << 5)))
+
+// largest payload of an extended length frame, so that the payload and its CRC can be counted in 32 bits
+#define SIMPLEHDLC_MAX_EXTENDED_PAYLOAD 0xFFFFFFFBu
+
+// upper bounds on the encoded size of an extended length frame with a payload of len bytes, as
+// SIMPLEHDLC_MAX_ENCODED_SIZE and SIMPLEHDLC_COBS_MAX_ENCODED_SIZE: the three byte frame header, then up to five bytes
+// of length, the payload and the CRC
+#define SIMPLEHDLC_EXTENDED_MAX_ENCODED_SIZE(len) (3 + 2 * ((size_t) (len) + 9))
+#define SIMPLEHDLC_EXTENDED_COBS_MAX_ENCODED_SIZE(len) \
+    (4 + ((size_t) (len) + 9) + ((size_t) (len) + 9) / SIMPLEHDLC_COBS_MAX_GROUP)
+
+// room simplehdlc_encode_in_place needs around a payload of len bytes in the worst case: headroom for the marker and
+// an escaped length, tailroom for an escaped CRC, and a byte more for every payload byte escaped, which can go in
+// either. SIMPLEHDLC_IN_PLACE_ROOM(len) is all of that together, i.e. the room needed beyond the payload.
+#define SIMPLEHDLC_IN_PLACE_HEADROOM 5
+#define SIMPLEHDLC_IN_PLACE_TAILROOM 8
+#define SIMPLEHDLC_IN_PLACE_ROOM(len) (SIMPLEHDLC_IN_PLACE_HEADROOM + SIMPLEHDLC_IN_PLACE_TAILROOM + (size_t) (len))
+
+// framing used for transmitted packets when the context does not say otherwise
+#ifndef SIMPLEHDLC_DEFAULT_FRAMING
+#define SIMPLEHDLC_DEFAULT_FRAMING SIMPLEHDLC_FRAMING_ESCAPED
+#endif
+
+// size of the stack buffer used by simplehdlc_encode_to_callback to gather the parts of a packet which are not sent
+// straight from the payload when tx_chunk_callback is in use
+#ifndef SIMPLEHDLC_TX_STAGING_SIZE
+#define SIMPLEHDLC_TX_STAGING_SIZE 64
+#endif
+
+// how the bytes of a packet after its frame boundary marker are kept free of the marker. received packets are
+// recognised in either framing whatever the context sends with.
+//
+// SIMPLEHDLC_FRAMING_ESCAPED is the original format: every boundary or escape marker is sent as the escape marker
+// followed by the byte XOR 0x20, which can double the size of the packet.
+//
+// SIMPLEHDLC_FRAMING_COBS frames begin with the boundary marker, the escape marker and the frame type 0x02, which an
+// escaped frame never does. the length, payload and CRC follow with consistent overhead byte stuffing: they are split
+// into groups of up to 254 bytes which contain no boundary marker, and each group is preceded by a code byte holding
+// its length plus one, XORed with the boundary marker so that it can never be one. a group of less than 254 bytes is
+// followed by a boundary marker in the data, except at the end of the packet. this costs one byte per 254 at worst.
+//
+// extended length frames set SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH in the frame type, giving 0x01 for escaped framing
+// (which is therefore also sent with the header) and 0x03 for COBS. their length is a varint of up to five bytes,
+// seven bits per byte starting with the least significant, with the top bit set on all but the last byte.
+typedef enum {
+    SIMPLEHDLC_FRAMING_ESCAPED = 0,
+    SIMPLEHDLC_FRAMING_COBS = 2
+} simplehdlc_framing_t;
+
+typedef enum {
+    SIMPLEHDLC_FRAME_OK = 0,
+    SIMPLEHDLC_FRAME_CRC_MISMATCH = 1,
+    SIMPLEHDLC_FRAME_TOO_LARGE = 2
+} simplehdlc_frame_status_t;
+
 typedef struct {
     void (*rx_packet_callback)(const uint8_t *payload, uint16_t len, void *user_ptr);
     void (*tx_byte_callback)(uint8_t byte, void *user_ptr);
     void (*tx_flush_buffer_callback)(void *user_ptr);
+
+    // optional; if set, it is used by simplehdlc_encode_to_callback instead of tx_byte_callback. data is only valid
+    // for the duration of the call, and long clean runs of payload are passed straight from the caller's buffer.
+    void (*tx_chunk_callback)(const uint8_t *data, size_t len, void *user_ptr);
+
+    // optional streaming receive mode, used instead of rx_packet_callback if rx_data_callback is set. rx_begin_callback
+    // is called with the payload length once the header of a packet has been received, rx_data_callback is called with
+    // the payload in pieces as it arrives, and rx_end_callback reports whether the CRC matched. a packet which is cut
+    // off by a new frame boundary marker is ended with crc_ok = false. the packet does not need to fit in the parse
+    // buffer, which is only used to gather unescaped bytes and can be small (or even empty). rx_begin_callback and
+    // rx_end_callback may be NULL.
+    void (*rx_begin_callback)(size_t len, void *user_ptr);
+    void (*rx_data_callback)(const uint8_t *data, size_t len, void *user_ptr);
+    void (*rx_end_callback)(bool crc_ok, void *user_ptr);
+
+    // optional; if set, simplehdlc_parse_ring passes each packet to it instead of rx_packet_callback, as the first_len
+    // bytes at first followed by the second_len bytes at second. a packet which wraps round the end of the ring comes
+    // in two pieces, and any other in one (second_len is 0). the data is only valid for the duration of the call.
+    void (*rx_ring_packet_callback)(const uint8_t *first, size_t first_len, const uint8_t *second, size_t second_len,
+                                    void *user_ptr);
+
+#ifdef SIMPLEHDLC_ENABLE_STATS
+    // optional timing hook: if both are set, rx_frame_timing_callback is called for every packet which completes or
+    // fails its CRC check, with the timestamps of its frame boundary marker and of its last byte. timestamp_callback
+    // provides them, in whatever unit suits (cycles, ns, ...).
+    uint64_t (*timestamp_callback)(void *user_ptr);
+    void (*rx_frame_timing_callback)(uint64_t start, uint64_t end, size_t len, simplehdlc_frame_status_t status,
+                                     void *user_ptr);
+#endif
 } simplehdlc_callbacks_t;
 
+#ifdef SIMPLEHDLC_ENABLE_STATS
+// counters kept per context when SIMPLEHDLC_ENABLE_STATS is defined; without it they are compiled out entirely
+typedef struct {
+    uint64_t rx_frames_ok;
+    uint64_t rx_crc_failures;
+    uint64_t rx_oversize_drops; // packets larger than the parse buffer
+    uint64_t rx_aborted_frames; // packets cut off by a frame boundary marker
+    uint64_t rx_discarded_bytes; // bytes received while waiting for a frame boundary marker
+    uint64_t rx_bytes;
+    uint64_t rx_escapes; // the escape ratio is rx_escapes / rx_bytes
+
+    uint64_t tx_frames; // only packets encoded to the callbacks are counted
+    uint64_t tx_bytes;
+    uint64_t tx_escapes;
+} simplehdlc_stats_t;
+#endif
+
 typedef enum {
     SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER = 0,
     SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB = 1,
     SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB = 2,
     SIMPLEHDLC_STATE_CONSUMING_PAYLOAD = 3,
+    SIMPLEHDLC_STATE_CONSUMING_SIZE_VARINT = 4,
 } hdlc_parser_state_t;
 
 typedef enum {
     SIMPLEHDLC_OK = 0,
     SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL = 1,
     SIMPLEHDLC_ERROR_CALLBACK_MISSING = 2,
-    SIMPLEHDLC_ERROR_INTERNAL_ENCODE_LENGTH_MISMATCH = 3
+    SIMPLEHDLC_ERROR_INTERNAL_ENCODE_LENGTH_MISMATCH = 3,
+    SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH = 4,
+    SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE = 5,
+    SIMPLEHDLC_ERROR_WOULD_BLOCK = 6,
+    SIMPLEHDLC_ERROR_IO = 7,
+    SIMPLEHDLC_ERROR_OUT_OF_MEMORY = 8
 } simplehdlc_error_code_t;
 
 typedef struct {
@@ -44,6 +171,8 @@ typedef struct {
     size_t rx_buffer_len;
     size_t rx_count;
     uint32_t rx_crc32;
+    uint32_t rx_running_crc32;
+    size_t rx_crc32_count;
 
     simplehdlc_callbacks_t callbacks;
     void *user_ptr;
@@ -51,17 +180,196 @@ typedef struct {
     hdlc_parser_state_t state;
     size_t expected_len;
     bool escape_next;
+
+    bool rx_streaming;
+    bool rx_stream_open;
+    size_t rx_staged_count;
+
+    bool rx_cobs; // the packet being received uses SIMPLEHDLC_FRAMING_COBS
+    bool rx_cobs_marker; // the COBS group being received is followed by a boundary marker in the data
+    uint8_t rx_cobs_remaining; // bytes left in the COBS group being received
+    uint8_t rx_varint_shift; // bits of an extended length received so far
+
+    // a packet which simplehdlc_parse_ring left in the ring until the rest of it arrives: where it starts, how many of
+    // the bytes after its boundary marker have been checked for escapes, and the CRC of the payload among them
+    bool rx_ring_held;
+    size_t rx_ring_held_index;
+    size_t rx_ring_checked;
+    uint32_t rx_ring_crc32;
+
+    simplehdlc_framing_t tx_framing;
+    // a COBS group on its way to the callbacks, held until its code byte is known. it lives here rather than in
+    // simplehdlc_encoder_t so that an encode to a buffer does not carry it on the stack.
+    uint8_t tx_cobs_group[SIMPLEHDLC_COBS_MAX_GROUP];
+
+#ifdef SIMPLEHDLC_ENABLE_STATS
+    simplehdlc_stats_t stats;
+    uint64_t rx_frame_start;
+#endif
 } simplehdlc_context_t;
 
+// a packet returned by simplehdlc_decode_batch. ptr is NULL unless status is SIMPLEHDLC_FRAME_OK; len is the payload
+// length given in the header.
+typedef struct {
+    const uint8_t *ptr;
+    size_t len;
+    simplehdlc_frame_status_t status;
+} simplehdlc_frame_t;
+
+// state of a packet being encoded piece by piece; see simplehdlc_encoder_begin_buffer and
+// simplehdlc_encoder_begin_callback
+typedef struct {
+    simplehdlc_context_t *context; // NULL when encoding to a buffer
+    uint8_t *buffer;
+    size_t buffer_len;
+    bool buffer_checked; // the whole frame is known to fit in the buffer, so it is not checked for room as it goes
+    bool flush;
+
+    uint32_t payload_len;
+    size_t payload_count;
+    size_t output_count;
+    uint32_t crc32;
+    simplehdlc_error_code_t error;
+
+    size_t staging_len;
+    uint8_t staging[SIMPLEHDLC_TX_STAGING_SIZE];
+
+    simplehdlc_framing_t framing;
+    bool cobs_open; // a COBS group has been started
+    size_t cobs_code_pos; // where the code byte of the group goes, when encoding to a buffer
+    size_t cobs_group_len; // the group itself is gathered in the context's tx_cobs_group, when encoding to callbacks
+} simplehdlc_encoder_t;
+
+typedef struct {
+    const void *data;
+    size_t len;
+} simplehdlc_iovec_t;
+
 void simplehdlc_init(simplehdlc_context_t *context, uint8_t *parse_buffer, size_t parse_buffer_len, const simplehdlc_callbacks_t *callbacks, void *user_ptr);
 void simplehdlc_parse(simplehdlc_context_t *context, const uint8_t *data, size_t len);
+
+// runs the parser state machine once per input byte and computes the CRC over the whole payload once it is complete;
+// produces exactly the same results as simplehdlc_parse, which copies clean runs of payload in bulk and keeps the CRC
+// up to date as each chunk arrives. it shares the state machine with simplehdlc_parse, so it checks those fast paths
+// rather than the state machine itself. only supports the buffered receive mode (rx_packet_callback).
+void simplehdlc_parse_bytewise(simplehdlc_context_t *context, const uint8_t *data, size_t len);
+
+// pull interface to the parser: parses data with the same rules as simplehdlc_parse, but rather than calling
+// rx_packet_callback it fills in a descriptor per packet which completes (or fails its CRC check, or is dropped for
+// being larger than the parse buffer), and returns the number of descriptors filled in.
+//
+// a packet which contains no escaped bytes and lies entirely within data is checked where it is and its descriptor
+// points into data. any other packet is parsed into the parse buffer as usual and then copied into arena; if arena
+// has no room left for it, its descriptor points at the parse buffer instead and the batch stops after it, so that it
+// is valid until the parser is next used. parsing also stops once max_frames descriptors have been filled in.
+// *consumed (which may be NULL) is set to the number of bytes of data which were parsed; call again with the rest.
+// the receive callbacks are not used.
+size_t simplehdlc_decode_batch(simplehdlc_context_t *context, const uint8_t *data, size_t len,
+                               simplehdlc_frame_t *frames, size_t max_frames, uint8_t *arena, size_t arena_len,
+                               size_t *consumed);
+
+// receive interface for a circular buffer filled by a producer such as a DMA engine or another thread. the unread part
+// of the ring is passed as the two contiguous segments it occupies: first_len bytes at first, which is
+// ring[read_index], and then, if it wraps round the end of the ring, second_len bytes at second, which is ring[0].
+// ring_len is the size of the ring. returns how far the read index can be advanced: that many bytes have been parsed,
+// and the producer may have them back.
+//
+// nothing is copied out of the ring for a packet without escaped bytes; it is checked where it is and passed on as a
+// view into the ring, in two pieces if it wraps (see rx_ring_packet_callback; without it, a packet which wraps is
+// parsed into the parse buffer). a packet of this kind which has not fully arrived yet is left unread, and is
+// picked up again from where the check got to by the next call, as long as it starts at read_index. a packet which
+// could never fit in the ring as a whole, or has escaped bytes, is parsed into the parse buffer as by
+// simplehdlc_parse. in streaming mode (rx_data_callback) everything is parsed as by simplehdlc_parse, which already
+// passes long clean runs on straight from the input.
+//
+// the context must not be given other data while a packet is held back in the ring.
+size_t simplehdlc_parse_ring(simplehdlc_context_t *context, const uint8_t *first, size_t first_len,
+                             const uint8_t *second, size_t second_len, size_t read_index, size_t ring_len);
+
 simplehdlc_error_code_t
 simplehdlc_encode_to_callback(simplehdlc_context_t *context, const uint8_t *payload, uint16_t payload_len, bool flush);
 
+#ifdef SIMPLEHDLC_ENABLE_STATS
+void simplehdlc_get_stats(const simplehdlc_context_t *context, simplehdlc_stats_t *stats);
+void simplehdlc_reset_stats(simplehdlc_context_t *context);
+#endif
+
+// sets the framing used by simplehdlc_encode_to_callback and the other callback encoders; the default is
+// SIMPLEHDLC_DEFAULT_FRAMING. only switch to SIMPLEHDLC_FRAMING_COBS once the other end is known to understand it.
+void simplehdlc_set_tx_framing(simplehdlc_context_t *context, simplehdlc_framing_t framing);
+
 size_t simplehdlc_get_encoded_size(const uint8_t *payload, uint16_t len);
+size_t simplehdlc_get_encoded_size_with_framing(const uint8_t *payload, uint16_t len, simplehdlc_framing_t framing);
+
+// returns SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL if buffer_len is less than simplehdlc_get_encoded_size(), in which case
+// the start of the frame may have been written to buffer. a buffer of SIMPLEHDLC_MAX_ENCODED_SIZE(payload_len) bytes is
+// always large enough (or SIMPLEHDLC_COBS_MAX_ENCODED_SIZE with SIMPLEHDLC_FRAMING_COBS). the payload is encoded in a
+// single pass, which only checks for room once the worst case of the rest of the frame no longer fits in what is left of
+// the buffer. simplehdlc_encode_to_buffer uses SIMPLEHDLC_DEFAULT_FRAMING.
 simplehdlc_error_code_t
 simplehdlc_encode_to_buffer(uint8_t *buffer, size_t buffer_len, size_t *encoded_size, const uint8_t *payload,
                             uint16_t payload_len);
+simplehdlc_error_code_t
+simplehdlc_encode_to_buffer_with_framing(uint8_t *buffer, size_t buffer_len, size_t *encoded_size,
+                                         const uint8_t *payload, uint16_t payload_len, simplehdlc_framing_t framing);
+
+// streaming encoder, for payloads which are not contiguous in memory: begin with the total payload length, append the
+// payload in any number of pieces, then finish. the CRC is computed as the pieces are appended and nothing is copied
+// into an intermediate buffer, other than COBS groups on their way to the callbacks. errors are sticky: once a call
+// fails, the remaining calls return the same error. appending more or less than payload_len bytes in total gives
+// SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH.
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_buffer(simplehdlc_encoder_t *encoder, uint8_t *buffer, size_t buffer_len, uint16_t payload_len);
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_buffer_with_framing(simplehdlc_encoder_t *encoder, uint8_t *buffer, size_t buffer_len,
+                                             uint16_t payload_len, simplehdlc_framing_t framing);
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_callback(simplehdlc_encoder_t *encoder, simplehdlc_context_t *context, uint16_t payload_len,
+                                  bool flush);
+simplehdlc_error_code_t simplehdlc_encoder_append(simplehdlc_encoder_t *encoder, const uint8_t *data, size_t len);
+// encoded_size may be NULL
+simplehdlc_error_code_t simplehdlc_encoder_finish(simplehdlc_encoder_t *encoder, size_t *encoded_size);
+
+// gather variants, encoding the concatenation of iovcnt pieces as a single payload
+simplehdlc_error_code_t
+simplehdlc_encode_iov_to_buffer(uint8_t *buffer, size_t buffer_len, size_t *encoded_size, const simplehdlc_iovec_t *iov,
+                                size_t iovcnt);
+simplehdlc_error_code_t
+simplehdlc_encode_iov_to_callback(simplehdlc_context_t *context, const simplehdlc_iovec_t *iov, size_t iovcnt,
+                                  bool flush);
+
+// extended length frames, for payloads of up to SIMPLEHDLC_MAX_EXTENDED_PAYLOAD bytes, in either framing. only send
+// them once the other end is known to understand them. they are received like any other packet, but one of more than
+// 65535 bytes can only be received in streaming mode (rx_data_callback) or by simplehdlc_decode_batch, as
+// rx_packet_callback cannot give its length; in buffered mode it is dropped as too large. a multi-megabyte transfer
+// can therefore be sent as a single frame with the streaming encoder and received with a small parse buffer, with one
+// CRC kept up to date on both sides as the data goes by. the callback variants use the context's framing, and a
+// longer payload gives SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE.
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_buffer_extended(simplehdlc_encoder_t *encoder, uint8_t *buffer, size_t buffer_len,
+                                         uint32_t payload_len, simplehdlc_framing_t framing);
+simplehdlc_error_code_t
+simplehdlc_encoder_begin_callback_extended(simplehdlc_encoder_t *encoder, simplehdlc_context_t *context,
+                                           uint32_t payload_len, bool flush);
+simplehdlc_error_code_t
+simplehdlc_encode_to_buffer_extended(uint8_t *buffer, size_t buffer_len, size_t *encoded_size, const uint8_t *payload,
+                                     uint32_t payload_len, simplehdlc_framing_t framing);
+simplehdlc_error_code_t
+simplehdlc_encode_to_callback_extended(simplehdlc_context_t *context, const uint8_t *payload, uint32_t payload_len,
+                                       bool flush);
+size_t simplehdlc_get_extended_encoded_size(const uint8_t *payload, uint32_t len, simplehdlc_framing_t framing);
+
+// encodes the payload_len bytes at buffer[headroom] into an escaped frame in the same buffer, without a second buffer
+// or a copy of the clean runs which can stay where they are. the boundary marker and length go in the headroom before
+// the payload and the CRC in the tailroom after it, and each escape takes a byte of one or the other. the frame is left
+// at buffer[*frame_offset], *frame_len bytes long. any payload fits with at least SIMPLEHDLC_IN_PLACE_HEADROOM bytes
+// of headroom and SIMPLEHDLC_IN_PLACE_TAILROOM of tailroom, and SIMPLEHDLC_IN_PLACE_ROOM(payload_len) bytes of room in
+// total besides the payload (headroom + tailroom), split between the two in any way. with less, a payload with too
+// many reserved bytes gives SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL and the buffer is left as it was, so that it can still be
+// encoded into another buffer.
+simplehdlc_error_code_t
+simplehdlc_encode_in_place(uint8_t *buffer, size_t buffer_len, size_t headroom, uint16_t payload_len,
+                           size_t *frame_offset, size_t *frame_len);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,355 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_HPP
+#define SIMPLEHDLC_SIMPLEHDLC_HPP
+
+// header-only C++20 version of the parser and encoder, producing the same wire format as simplehdlc.c. the packet
+// handler and the output sink are template parameters rather than function pointers, so the compiler can inline them,
+// and the frame boundary and escape markers are template parameters too, so links with different markers can live in
+// one program. nothing here depends on the C library.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace simplehdlc {
+
+inline constexpr std::uint8_t default_boundary_marker = 0x7E;
+inline constexpr std::uint8_t default_escape_marker = 0x7D;
+
+// upper bound on the encoded size of a payload of len bytes, as SIMPLEHDLC_MAX_ENCODED_SIZE
+constexpr std::size_t max_encoded_size(std::size_t len) noexcept {
+    return 1 + 2 * (len + 6);
+}
+
+namespace detail {
+
+// slicing-by-8 tables for the reflected CRC-32 polynomial, generated at compile time
+constexpr std::array<std::array<std::uint32_t, 256>, 8> make_crc32_tables() noexcept {
+    std::array<std::array<std::uint32_t, 256>, 8> tables{};
+
+    for (std::uint32_t i=0; i<256; i++) {
+        std::uint32_t c = i;
+        for (int k=0; k<8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        tables[0][i] = c;
+    }
+    for (std::size_t row=1; row<8; row++) {
+        for (std::size_t i=0; i<256; i++) {
+            tables[row][i] = (tables[row - 1][i] >> 8) ^ tables[0][tables[row - 1][i] & 0xFF];
+        }
+    }
+
+    return tables;
+}
+
+inline constexpr auto crc32_tables = make_crc32_tables();
+
+// the index of the first boundary or escape marker in data, or len if there is none. outside constant evaluation this
+// checks eight bytes at a time.
+template <std::uint8_t Boundary, std::uint8_t Escape>
+constexpr std::size_t scan_reserved(const std::uint8_t *data, std::size_t len) noexcept {
+    std::size_t i = 0;
+
+    if (!std::is_constant_evaluated()) {
+        constexpr std::uint64_t ones = 0x0101010101010101ull;
+        constexpr std::uint64_t highs = 0x8080808080808080ull;
+        constexpr std::uint64_t boundary = ones * Boundary;
+        constexpr std::uint64_t escape = ones * Escape;
+
+        for (; i + 8 <= len; i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, &data[i], 8);
+
+            std::uint64_t b = word ^ boundary;
+            std::uint64_t e = word ^ escape;
+            if (((b - ones) & ~b & highs) | ((e - ones) & ~e & highs)) break;
+        }
+    }
+
+    for (; i < len; i++) {
+        if (data[i] == Boundary || data[i] == Escape) return i;
+    }
+    return len;
+}
+
+} // namespace detail
+
+// streaming CRC matching simplehdlc_crc32_update: start from 0 and feed the data in any number of pieces
+constexpr std::uint32_t crc32_update(std::uint32_t crc, std::span<const std::uint8_t> data) noexcept {
+    const auto &t = detail::crc32_tables;
+    std::uint32_t c = ~crc;
+    std::size_t i = 0;
+
+    for (; i + 8 <= data.size(); i += 8) {
+        std::uint32_t lo = c ^ (std::uint32_t(data[i]) | std::uint32_t(data[i + 1]) << 8 |
+                                std::uint32_t(data[i + 2]) << 16 | std::uint32_t(data[i + 3]) << 24);
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+            t[3][data[i + 4]] ^ t[2][data[i + 5]] ^ t[1][data[i + 6]] ^ t[0][data[i + 7]];
+    }
+    for (; i < data.size(); i++) c = t[0][(c ^ data[i]) & 0xFF] ^ (c >> 8);
+
+    return ~c;
+}
+
+constexpr std::uint32_t crc32(std::span<const std::uint8_t> data) noexcept {
+    return crc32_update(0, data);
+}
+
+// encodes a packet into out and returns its size, or 0 if out is too small or the payload is longer than 65535 bytes.
+// usable in constant expressions, so fixed packets can be encoded at compile time.
+template <std::uint8_t Boundary = default_boundary_marker, std::uint8_t Escape = default_escape_marker>
+constexpr std::size_t encode_to_buffer(std::span<std::uint8_t> out, std::span<const std::uint8_t> payload) noexcept {
+    if (payload.size() > 0xFFFF || out.size() < 7) return 0;
+
+    std::size_t count = 0;
+    auto put = [&](std::uint8_t byte) {
+        if (byte == Boundary || byte == Escape) {
+            if (out.size() - count < 2) return false;
+            out[count++] = Escape;
+            out[count++] = byte ^ (1 << 5);
+        } else {
+            if (out.size() - count < 1) return false;
+            out[count++] = byte;
+        }
+        return true;
+    };
+
+    out[count++] = Boundary;
+    if (!put(payload.size() >> 8) || !put(payload.size() & 0xFF)) return 0;
+
+    std::size_t i = 0;
+    while (i < payload.size()) {
+        std::size_t run = detail::scan_reserved<Boundary, Escape>(&payload[i], payload.size() - i);
+        if (run > out.size() - count) return 0;
+        for (std::size_t j=0; j<run; j++) out[count + j] = payload[i + j];
+        count += run;
+        i += run;
+
+        if (i < payload.size() && !put(payload[i++])) return 0;
+    }
+
+    std::uint32_t crc = crc32(payload);
+    for (int shift=24; shift>=0; shift-=8) {
+        if (!put(crc >> shift)) return 0;
+    }
+
+    return count;
+}
+
+// receives packets of up to BufSize bytes. handler is called as handler(std::span<const std::uint8_t>) for every good
+// packet, with the payload only valid for the duration of the call. only escaped frames with a two byte length are
+// received: COBS and extended length frames, which the C library sends with SIMPLEHDLC_FRAMING_COBS or the _extended
+// encoders and which start with the boundary marker, the escape marker and a frame type, are dropped.
+template <std::size_t BufSize, typename Handler, std::uint8_t Boundary = default_boundary_marker,
+          std::uint8_t Escape = default_escape_marker>
+class Parser {
+    static_assert(Boundary != Escape, "the boundary and escape markers must differ");
+    static_assert(BufSize <= 0xFFFF, "packets are at most 65535 bytes");
+
+public:
+    constexpr explicit Parser(Handler handler = Handler{}) noexcept(std::is_nothrow_move_constructible_v<Handler>)
+        : handler_(std::move(handler)) {}
+
+    void parse(std::span<const std::uint8_t> data) {
+        std::size_t i = 0;
+
+        while (i < data.size()) {
+            // clean runs of payload are copied in one go
+            if (state_ == State::payload && !escape_next_ && count_ < expected_len_) {
+                std::size_t run = expected_len_ - count_;
+                if (run > data.size() - i) run = data.size() - i;
+
+                run = detail::scan_reserved<Boundary, Escape>(&data[i], run);
+                if (run) {
+                    std::memcpy(&buffer_[count_], &data[i], run);
+                    count_ += run;
+                    i += run;
+                    continue;
+                }
+            }
+
+            parse_byte(data[i++]);
+        }
+
+        // fold in the payload received so far, so the call which completes a packet only has to do the rest
+        if (state_ == State::payload) update_crc();
+    }
+
+    Handler &handler() noexcept { return handler_; }
+    const Handler &handler() const noexcept { return handler_; }
+
+private:
+    enum class State : std::uint8_t {
+        waiting_for_frame_marker,
+        size_msb,
+        size_lsb,
+        payload,
+    };
+
+    void update_crc() noexcept {
+        std::size_t payload_count = count_ < expected_len_ ? count_ : expected_len_;
+        if (payload_count > crc_count_) {
+            crc_ = crc32_update(crc_, std::span<const std::uint8_t>(&buffer_[crc_count_], payload_count - crc_count_));
+            crc_count_ = payload_count;
+        }
+    }
+
+    // whether an escaped byte straight after the boundary marker is a frame type rather than an escaped length byte
+    static constexpr bool is_frame_type(std::uint8_t c) noexcept {
+        return c >= 0x01 && c <= 0x03 && c != (Boundary ^ (1 << 5)) && c != (Escape ^ (1 << 5));
+    }
+
+    void parse_byte(std::uint8_t c) {
+        if (c == Boundary) {
+            state_ = State::size_msb;
+            escape_next_ = false;
+            expected_len_ = 0;
+            count_ = 0;
+            crc_ = 0;
+            crc_count_ = 0;
+            rx_crc_ = 0;
+            return;
+        }
+
+        if (state_ == State::waiting_for_frame_marker) return;
+
+        if (escape_next_) {
+            escape_next_ = false;
+            if (state_ == State::size_msb && is_frame_type(c)) {
+                state_ = State::waiting_for_frame_marker;
+                return;
+            }
+            c ^= (1 << 5);
+        } else if (c == Escape) {
+            escape_next_ = true;
+            return;
+        }
+
+        switch (state_) {
+            case State::size_msb:
+                expected_len_ = std::size_t(c) << 8;
+                state_ = State::size_lsb;
+                break;
+
+            case State::size_lsb:
+                expected_len_ |= c;
+                // packet is too large so ignore it
+                state_ = expected_len_ > BufSize ? State::waiting_for_frame_marker : State::payload;
+                break;
+
+            case State::payload:
+                if (count_ < expected_len_) {
+                    buffer_[count_++] = c;
+                    break;
+                }
+
+                if (count_ == expected_len_) update_crc();
+                rx_crc_ = (rx_crc_ << 8) | c;
+                count_++;
+
+                if (count_ == expected_len_ + 4) {
+                    state_ = State::waiting_for_frame_marker;
+                    if (rx_crc_ == crc_) handler_(std::span<const std::uint8_t>(buffer_.data(), expected_len_));
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    std::array<std::uint8_t, BufSize> buffer_{};
+    std::size_t expected_len_ = 0;
+    std::size_t count_ = 0;
+    std::size_t crc_count_ = 0;
+    std::uint32_t crc_ = 0;
+    std::uint32_t rx_crc_ = 0;
+    State state_ = State::waiting_for_frame_marker;
+    bool escape_next_ = false;
+    [[no_unique_address]] Handler handler_;
+};
+
+// encodes packets into sink, which is called as sink(std::span<const std::uint8_t>) with the encoded packet in pieces.
+// long clean runs of payload are passed straight from the caller's buffer, and everything else goes through a small
+// staging buffer, as with tx_chunk_callback in the C library.
+template <typename Sink, std::uint8_t Boundary = default_boundary_marker,
+          std::uint8_t Escape = default_escape_marker, std::size_t StagingSize = 64>
+class Encoder {
+    static_assert(Boundary != Escape, "the boundary and escape markers must differ");
+    static_assert(StagingSize >= 2, "the staging buffer must hold an escaped byte");
+
+public:
+    constexpr explicit Encoder(Sink sink = Sink{}) noexcept(std::is_nothrow_move_constructible_v<Sink>)
+        : sink_(std::move(sink)) {}
+
+    // returns false, without sending anything, if the payload is longer than 65535 bytes
+    bool encode(std::span<const std::uint8_t> payload) {
+        if (payload.size() > 0xFFFF) return false;
+
+        staging_len_ = 0;
+        staging_[staging_len_++] = Boundary;
+        put(payload.size() >> 8);
+        put(payload.size() & 0xFF);
+
+        std::size_t i = 0;
+        while (i < payload.size()) {
+            std::size_t run = detail::scan_reserved<Boundary, Escape>(&payload[i], payload.size() - i);
+            if (run >= min_direct_run) {
+                flush();
+                sink_(payload.subspan(i, run));
+            } else {
+                for (std::size_t j=0; j<run; j++) put_raw(payload[i + j]);
+            }
+            i += run;
+
+            if (i < payload.size()) put(payload[i++]);
+        }
+
+        std::uint32_t crc = crc32(payload);
+        for (int shift=24; shift>=0; shift-=8) put(crc >> shift);
+        flush();
+
+        return true;
+    }
+
+    Sink &sink() noexcept { return sink_; }
+    const Sink &sink() const noexcept { return sink_; }
+
+private:
+    // clean runs shorter than this are staged rather than passed on as a piece of their own
+    static constexpr std::size_t min_direct_run = 16;
+
+    void flush() {
+        if (staging_len_) {
+            sink_(std::span<const std::uint8_t>(staging_.data(), staging_len_));
+            staging_len_ = 0;
+        }
+    }
+
+    void put_raw(std::uint8_t byte) {
+        if (staging_len_ == StagingSize) flush();
+        staging_[staging_len_++] = byte;
+    }
+
+    void put(std::uint8_t byte) {
+        if (byte == Boundary || byte == Escape) {
+            if (StagingSize - staging_len_ < 2) flush();
+            staging_[staging_len_++] = Escape;
+            staging_[staging_len_++] = byte ^ (1 << 5);
+        } else {
+            put_raw(byte);
+        }
+    }
+
+    std::array<std::uint8_t, StagingSize> staging_{};
+    std::size_t staging_len_ = 0;
+    [[no_unique_address]] Sink sink_;
+};
+
+} // namespace simplehdlc
+
+#endif //SIMPLEHDLC_SIMPLEHDLC_HPP
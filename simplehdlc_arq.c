@@ -0,0 +1,323 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <assert.h>
+#include <string.h>
+
+#include "simplehdlc_arq.h"
+
+#define ARQ_DEFAULT_INITIAL_RTO_MS 1000
+#define ARQ_DEFAULT_MIN_RTO_MS 10
+#define ARQ_DEFAULT_MAX_RTO_MS 60000
+
+// the packets in flight occupy consecutive slots from the one holding the oldest, wrapping around, so that any window
+// size works with sequence numbers which wrap at 256
+static inline size_t tx_index(const simplehdlc_arq_t *arq, uint8_t seq) {
+    return (arq->tx_base_slot + (uint8_t) (seq - arq->tx_base)) % arq->config.window;
+}
+
+static inline size_t rx_index(const simplehdlc_arq_t *arq, uint8_t offset) {
+    return (arq->rx_base_slot + offset) % arq->config.window;
+}
+
+static inline bool time_reached(uint32_t now, uint32_t t) {
+    return (int32_t) (now - t) >= 0;
+}
+
+static inline uint32_t now_ms(const simplehdlc_arq_t *arq) {
+    return arq->callbacks.now_callback(arq->user_ptr);
+}
+
+size_t simplehdlc_arq_in_flight(const simplehdlc_arq_t *arq) {
+    return (uint8_t) (arq->tx_next - arq->tx_base);
+}
+
+simplehdlc_error_code_t
+simplehdlc_arq_init(simplehdlc_arq_t *arq, simplehdlc_context_t *context, const simplehdlc_arq_config_t *config,
+                    void *memory, size_t memory_len, const simplehdlc_arq_callbacks_t *callbacks, void *user_ptr) {
+    if (config->window == 0 || config->window > SIMPLEHDLC_ARQ_MAX_WINDOW ||
+        memory_len < SIMPLEHDLC_ARQ_MEMORY_SIZE(config->window, config->max_payload)) {
+        return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+    }
+    if (config->max_payload > SIMPLEHDLC_ARQ_MAX_PAYLOAD) return SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+    if (callbacks->now_callback == NULL || callbacks->rx_packet_callback == NULL ||
+        (context->callbacks.tx_chunk_callback == NULL && context->callbacks.tx_byte_callback == NULL)) {
+        return SIMPLEHDLC_ERROR_CALLBACK_MISSING;
+    }
+
+    memset(arq, 0, sizeof(simplehdlc_arq_t));
+    arq->context = context;
+    arq->config = *config;
+    arq->callbacks = *callbacks;
+    arq->user_ptr = user_ptr;
+
+    if (arq->config.initial_rto_ms == 0) arq->config.initial_rto_ms = ARQ_DEFAULT_INITIAL_RTO_MS;
+    if (arq->config.min_rto_ms == 0) arq->config.min_rto_ms = ARQ_DEFAULT_MIN_RTO_MS;
+    if (arq->config.max_rto_ms == 0) arq->config.max_rto_ms = ARQ_DEFAULT_MAX_RTO_MS;
+    arq->rto_ms = arq->config.initial_rto_ms;
+
+    // the slots first so that they stay aligned
+    size_t window = config->window;
+    arq->tx_slots = (simplehdlc_arq_slot_t *) memory;
+    arq->rx_slots = &arq->tx_slots[window];
+    arq->tx_payloads = (uint8_t *) &arq->rx_slots[window];
+    arq->rx_payloads = &arq->tx_payloads[window * config->max_payload];
+    memset(arq->tx_slots, 0, 2 * window * sizeof(simplehdlc_arq_slot_t));
+
+    return SIMPLEHDLC_OK;
+}
+
+// the selective ACK bitmap for the packets received after the next one expected
+static uint32_t get_sack(const simplehdlc_arq_t *arq) {
+    uint32_t sack = 0;
+    for (size_t i=1; i<arq->config.window; i++) {
+        if (arq->rx_slots[rx_index(arq, i)].in_use) sack |= (uint32_t) 1 << (i - 1);
+    }
+
+    return sack;
+}
+
+// sends a frame, which carries the acknowledgement for the other direction whatever else it holds
+static void send_frame(simplehdlc_arq_t *arq, uint8_t type, uint8_t seq, const uint8_t *payload, uint16_t len) {
+    uint32_t sack = get_sack(arq);
+    uint8_t header[SIMPLEHDLC_ARQ_HEADER_SIZE] = {
+            type | (arq->nack_pending ? SIMPLEHDLC_ARQ_TYPE_NACK : 0), seq, arq->rx_next,
+            (sack & 0xFF000000) >> 24, (sack & 0xFF0000) >> 16, (sack & 0xFF00) >> 8, sack & 0xFF
+    };
+    simplehdlc_iovec_t iov[2] = {{header, sizeof(header)}, {payload, len}};
+
+    arq->ack_pending = false;
+    arq->nack_pending = false;
+
+    // the encode cannot fail: init checked that the context has a transmit callback and that max_payload keeps the
+    // header and payload within 0xFFFF bytes, and a flush is only asked for when there is a flush callback
+    bool flush = arq->context->callbacks.tx_flush_buffer_callback != NULL;
+    simplehdlc_error_code_t error = simplehdlc_encode_iov_to_callback(arq->context, iov, len ? 2 : 1, flush);
+    assert(error == SIMPLEHDLC_OK);
+    (void) error;
+}
+
+static void transmit(simplehdlc_arq_t *arq, uint8_t seq, uint32_t now) {
+    size_t index = tx_index(arq, seq);
+    simplehdlc_arq_slot_t *slot = &arq->tx_slots[index];
+
+    if (slot->n_sent) arq->tx_retransmits++;
+    if (slot->n_sent < UINT8_MAX) slot->n_sent++;
+    slot->sent_at = now;
+
+    send_frame(arq, SIMPLEHDLC_ARQ_TYPE_DATA, seq, &arq->tx_payloads[index * arq->config.max_payload], slot->len);
+}
+
+simplehdlc_error_code_t simplehdlc_arq_send(simplehdlc_arq_t *arq, const uint8_t *payload, uint16_t len) {
+    if (len > arq->config.max_payload) return SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+
+    if (simplehdlc_arq_in_flight(arq) == arq->config.window) {
+        arq->tx_blocked = true;
+        return SIMPLEHDLC_ERROR_WOULD_BLOCK;
+    }
+
+    uint8_t seq = arq->tx_next++;
+    size_t index = tx_index(arq, seq);
+    simplehdlc_arq_slot_t *slot = &arq->tx_slots[index];
+    memcpy(&arq->tx_payloads[index * arq->config.max_payload], payload, len);
+    slot->in_use = true;
+    slot->acked = false;
+    slot->n_sent = 0;
+    slot->len = len;
+
+    arq->tx_packets++;
+    transmit(arq, seq, now_ms(arq));
+    return SIMPLEHDLC_OK;
+}
+
+// folds a round trip sample into the estimate and recomputes the timeout, as RFC 6298
+static void add_rtt_sample(simplehdlc_arq_t *arq, uint32_t rtt) {
+    if (!arq->rtt_measured) {
+        arq->srtt8 = rtt * 8;
+        arq->rttvar4 = rtt * 2;
+        arq->rtt_measured = true;
+    } else {
+        int32_t error = (int32_t) rtt - (int32_t) (arq->srtt8 / 8);
+        uint32_t magnitude = error < 0 ? (uint32_t) -error : (uint32_t) error;
+        arq->srtt8 = (uint32_t) ((int32_t) arq->srtt8 + error);
+        arq->rttvar4 = arq->rttvar4 + magnitude - arq->rttvar4 / 4;
+    }
+
+    uint32_t rto = arq->srtt8 / 8 + arq->rttvar4;
+    if (rto < arq->config.min_rto_ms) rto = arq->config.min_rto_ms;
+    if (rto > arq->config.max_rto_ms) rto = arq->config.max_rto_ms;
+    arq->rto_ms = rto;
+}
+
+static void handle_ack(simplehdlc_arq_t *arq, uint8_t ack, uint32_t sack, bool nack, uint32_t now) {
+    size_t in_flight = simplehdlc_arq_in_flight(arq);
+    uint8_t n_acked = ack - arq->tx_base;
+
+    // an old acknowledgement, overtaken by a later one
+    if (n_acked > in_flight) return;
+
+    // only packets which were sent once give a round trip sample (Karn's rule), and the latest is the best
+    bool sampled = false;
+    uint32_t rtt = 0;
+
+    while (arq->tx_base != ack) {
+        simplehdlc_arq_slot_t *slot = &arq->tx_slots[arq->tx_base_slot];
+        if (slot->n_sent == 1 && !slot->acked) {
+            rtt = now - slot->sent_at;
+            sampled = true;
+        }
+        slot->in_use = false;
+        arq->tx_base++;
+        arq->tx_base_slot = (arq->tx_base_slot + 1) % arq->config.window;
+    }
+    in_flight -= n_acked;
+
+    uint8_t highest = 0;
+    for (size_t i=0; i<32 && i+1<in_flight; i++) {
+        if (!(sack & ((uint32_t) 1 << i))) continue;
+
+        simplehdlc_arq_slot_t *slot = &arq->tx_slots[tx_index(arq, ack + 1 + i)];
+        if (slot->n_sent == 1 && !slot->acked) {
+            rtt = now - slot->sent_at;
+            sampled = true;
+        }
+        slot->acked = true;
+        highest = i + 1;
+    }
+
+    if (sampled) add_rtt_sample(arq, rtt);
+
+    // repeat the packets missing below the highest one to arrive, unless they were sent again too recently for the
+    // receiver to have seen them yet
+    if (nack) {
+        uint32_t min_age = arq->rtt_measured ? arq->srtt8 / 8 : arq->rto_ms;
+        for (uint8_t offset=0; offset<highest; offset++) {
+            uint8_t seq = ack + offset;
+            simplehdlc_arq_slot_t *slot = &arq->tx_slots[tx_index(arq, seq)];
+            if (!slot->acked && time_reached(now, slot->sent_at + min_age)) transmit(arq, seq, now);
+        }
+    }
+
+    if (n_acked && arq->tx_blocked) {
+        arq->tx_blocked = false;
+        if (arq->callbacks.tx_ready_callback != NULL) arq->callbacks.tx_ready_callback(arq->user_ptr);
+    }
+}
+
+static inline void schedule_ack(simplehdlc_arq_t *arq, uint32_t due) {
+    if (!arq->ack_pending || time_reached(arq->ack_due, due)) arq->ack_due = due;
+    arq->ack_pending = true;
+}
+
+// delivers the packet at rx_next and then any which were waiting for it
+static void deliver(simplehdlc_arq_t *arq, const uint8_t *payload, uint16_t len) {
+    arq->rx_next++;
+    arq->rx_base_slot = (arq->rx_base_slot + 1) % arq->config.window;
+    arq->rx_packets++;
+    arq->callbacks.rx_packet_callback(payload, len, arq->user_ptr);
+
+    while (arq->rx_slots[arq->rx_base_slot].in_use) {
+        size_t index = arq->rx_base_slot;
+        arq->rx_slots[index].in_use = false;
+        arq->rx_next++;
+        arq->rx_base_slot = (arq->rx_base_slot + 1) % arq->config.window;
+        arq->rx_packets++;
+        arq->callbacks.rx_packet_callback(&arq->rx_payloads[index * arq->config.max_payload],
+                                          arq->rx_slots[index].len, arq->user_ptr);
+    }
+}
+
+static void handle_data(simplehdlc_arq_t *arq, uint8_t seq, const uint8_t *payload, uint16_t len, uint32_t now) {
+    uint8_t offset = seq - arq->rx_next;
+
+    if (offset >= arq->config.window) {
+        // delivered already, so our acknowledgement was lost: send it again straight away
+        arq->rx_duplicates++;
+        schedule_ack(arq, now);
+        return;
+    }
+    if (len > arq->config.max_payload) return;
+
+    if (offset == 0) {
+        // scheduled first so that a packet sent from rx_packet_callback carries the acknowledgement
+        bool filled_gap = arq->rx_slots[rx_index(arq, 1)].in_use;
+        schedule_ack(arq, filled_gap ? now : now + arq->config.ack_delay_ms);
+        deliver(arq, payload, len);
+        return;
+    }
+
+    simplehdlc_arq_slot_t *slot = &arq->rx_slots[rx_index(arq, offset)];
+    if (slot->in_use) {
+        arq->rx_duplicates++;
+    } else {
+        memcpy(&arq->rx_payloads[rx_index(arq, offset) * arq->config.max_payload], payload, len);
+        slot->in_use = true;
+        slot->len = len;
+        arq->rx_out_of_order++;
+    }
+
+    // something before it is missing
+    arq->nack_pending = true;
+    schedule_ack(arq, now);
+}
+
+void simplehdlc_arq_receive(simplehdlc_arq_t *arq, const uint8_t *frame, uint16_t len) {
+    if (len < SIMPLEHDLC_ARQ_HEADER_SIZE) return;
+
+    uint32_t now = now_ms(arq);
+    uint32_t sack = ((uint32_t) frame[3] << 24) | ((uint32_t) frame[4] << 16) | ((uint32_t) frame[5] << 8) | frame[6];
+    handle_ack(arq, frame[2], sack, frame[0] & SIMPLEHDLC_ARQ_TYPE_NACK, now);
+
+    if (frame[0] & SIMPLEHDLC_ARQ_TYPE_DATA) {
+        handle_data(arq, frame[1], &frame[SIMPLEHDLC_ARQ_HEADER_SIZE], len - SIMPLEHDLC_ARQ_HEADER_SIZE, now);
+    }
+
+    if (arq->ack_pending && time_reached(now, arq->ack_due)) {
+        arq->tx_acks++;
+        send_frame(arq, 0, arq->tx_next, NULL, 0);
+    }
+}
+
+uint32_t simplehdlc_arq_poll(simplehdlc_arq_t *arq) {
+    uint32_t now = now_ms(arq);
+    uint32_t wait = UINT32_MAX;
+    uint32_t rto = arq->rto_ms;
+    bool timed_out = false;
+
+    size_t in_flight = simplehdlc_arq_in_flight(arq);
+    for (size_t offset=0; offset<in_flight; offset++) {
+        uint8_t seq = arq->tx_base + offset;
+        simplehdlc_arq_slot_t *slot = &arq->tx_slots[tx_index(arq, seq)];
+        if (slot->acked) continue;
+
+        if (time_reached(now, slot->sent_at + rto)) {
+            timed_out = true;
+            transmit(arq, seq, now);
+        }
+    }
+
+    // back off once per poll however many packets timed out, as they were most likely lost together
+    if (timed_out) {
+        arq->tx_timeouts++;
+        arq->rto_ms = rto * 2 < arq->config.max_rto_ms ? rto * 2 : arq->config.max_rto_ms;
+    }
+
+    // the next poll times packets out against the timeout as it is now, backed off or not
+    for (size_t offset=0; offset<in_flight; offset++) {
+        simplehdlc_arq_slot_t *slot = &arq->tx_slots[tx_index(arq, arq->tx_base + offset)];
+        if (slot->acked) continue;
+
+        uint32_t remaining = slot->sent_at + arq->rto_ms - now;
+        if (remaining < wait) wait = remaining;
+    }
+
+    if (arq->ack_pending) {
+        if (time_reached(now, arq->ack_due)) {
+            arq->tx_acks++;
+            send_frame(arq, 0, arq->tx_next, NULL, 0);
+        } else if (arq->ack_due - now < wait) {
+            wait = arq->ack_due - now;
+        }
+    }
+
+    return wait;
+}
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_ARQ_H
+#define SIMPLEHDLC_SIMPLEHDLC_ARQ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "simplehdlc.h"
+
+// optional reliable transport over a simplehdlc context: packets are delivered to the other end once each and in
+// order, however the link loses, corrupts or delays frames. up to window packets are in flight at a time, each with
+// an 8-bit sequence number. the receiver reports the next sequence number it expects along with which of the packets
+// after it have arrived, so that only the missing ones are sent again (selective repeat). every data frame carries
+// this acknowledgement for the other direction, and an acknowledgement on its own is only sent when no data frame
+// goes out within ack_delay_ms. a packet arriving out of order is acknowledged at once with the NACK flag set, which
+// has the sender repeat the packets missing before it without waiting for their timers. retransmission timers follow
+// the measured round trip time (Jacobson/Karels, with Karn's rule and exponential backoff).
+//
+// each frame is the header below followed by the payload, sent with simplehdlc_encode_iov_to_callback:
+//
+//     type (SIMPLEHDLC_ARQ_TYPE_*), sequence number, next sequence number expected, selective ACK bitmap (32 bits,
+//     most significant byte first, bit i set if sequence number expected + 1 + i has arrived)
+//
+// all memory is provided by the caller. times are in milliseconds from now_callback, and may wrap.
+
+#define SIMPLEHDLC_ARQ_HEADER_SIZE 7
+
+// most packets in flight: the selective ACK bitmap covers the whole window
+#define SIMPLEHDLC_ARQ_MAX_WINDOW 32
+
+// largest payload, so that the payload and header fit in a legacy frame
+#define SIMPLEHDLC_ARQ_MAX_PAYLOAD (0xFFFF - SIMPLEHDLC_ARQ_HEADER_SIZE)
+
+#define SIMPLEHDLC_ARQ_TYPE_DATA 0x01 // the frame carries a payload; otherwise it is only an acknowledgement
+#define SIMPLEHDLC_ARQ_TYPE_NACK 0x02 // the packets missing before the highest one acknowledged are lost
+
+typedef struct {
+    uint32_t sent_at;
+    uint16_t len;
+    uint8_t n_sent;
+    bool in_use;
+    bool acked; // selectively acknowledged, but not yet cumulatively
+} simplehdlc_arq_slot_t;
+
+// bytes of memory needed for a window of packets of up to max_payload bytes in each direction
+#define SIMPLEHDLC_ARQ_MEMORY_SIZE(window, max_payload) \
+    (2 * (size_t) (window) * (sizeof(simplehdlc_arq_slot_t) + (size_t) (max_payload)))
+
+typedef struct {
+    // packets in flight in each direction, from 1 (stop and wait) to SIMPLEHDLC_ARQ_MAX_WINDOW
+    size_t window;
+    uint16_t max_payload;
+
+    // retransmission timeout before the round trip time has been measured, and its limits; 0 gives 1000, 10 and 60000
+    uint32_t initial_rto_ms;
+    uint32_t min_rto_ms;
+    uint32_t max_rto_ms;
+
+    // how long an acknowledgement may wait for a data frame to ride on
+    uint32_t ack_delay_ms;
+} simplehdlc_arq_config_t;
+
+typedef struct {
+    uint32_t (*now_callback)(void *user_ptr);
+
+    // called once for every packet, in the order they were sent; the payload is only valid for the duration of the
+    // call
+    void (*rx_packet_callback)(const uint8_t *payload, uint16_t len, void *user_ptr);
+
+    // optional; called when room opens up in the transmit window after simplehdlc_arq_send gave
+    // SIMPLEHDLC_ERROR_WOULD_BLOCK
+    void (*tx_ready_callback)(void *user_ptr);
+} simplehdlc_arq_callbacks_t;
+
+typedef struct {
+    simplehdlc_context_t *context;
+    simplehdlc_arq_config_t config;
+    simplehdlc_arq_callbacks_t callbacks;
+    void *user_ptr;
+
+    // the packets in flight (or waiting to be delivered) in each direction, in a ring starting at tx_base_slot (or
+    // rx_base_slot)
+    simplehdlc_arq_slot_t *tx_slots;
+    simplehdlc_arq_slot_t *rx_slots;
+    uint8_t *tx_payloads;
+    uint8_t *rx_payloads;
+
+    uint8_t tx_base; // oldest packet not yet acknowledged
+    uint8_t tx_next; // sequence number of the next packet sent
+    uint8_t rx_next; // next packet to be delivered
+    size_t tx_base_slot;
+    size_t rx_base_slot;
+    bool tx_blocked;
+
+    bool ack_pending;
+    bool nack_pending;
+    uint32_t ack_due;
+
+    // round trip estimate, in 1/8 ms for the mean and 1/4 ms for the deviation as in RFC 6298
+    bool rtt_measured;
+    uint32_t srtt8;
+    uint32_t rttvar4;
+    uint32_t rto_ms;
+
+    uint64_t tx_packets;
+    uint64_t tx_retransmits;
+    uint64_t tx_timeouts;
+    uint64_t tx_acks; // acknowledgements sent on their own
+    uint64_t rx_packets;
+    uint64_t rx_duplicates;
+    uint64_t rx_out_of_order;
+} simplehdlc_arq_t;
+
+// frames are sent with context's callback encoders, and flushed if it has a tx_flush_buffer_callback. memory must be
+// aligned for uint32_t and at least SIMPLEHDLC_ARQ_MEMORY_SIZE(window, max_payload) bytes long. returns
+// SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL if it is not or the window is out of range, SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE if
+// max_payload is more than SIMPLEHDLC_ARQ_MAX_PAYLOAD and SIMPLEHDLC_ERROR_CALLBACK_MISSING without now_callback,
+// rx_packet_callback or a transmit callback on context.
+simplehdlc_error_code_t
+simplehdlc_arq_init(simplehdlc_arq_t *arq, simplehdlc_context_t *context, const simplehdlc_arq_config_t *config,
+                    void *memory, size_t memory_len, const simplehdlc_arq_callbacks_t *callbacks, void *user_ptr);
+
+// copies the payload into the transmit window and sends it. returns SIMPLEHDLC_ERROR_WOULD_BLOCK while the window is
+// full, and SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE for a payload of more than max_payload bytes.
+simplehdlc_error_code_t simplehdlc_arq_send(simplehdlc_arq_t *arq, const uint8_t *payload, uint16_t len);
+
+// handles a frame received by the context; call it from the context's rx_packet_callback
+void simplehdlc_arq_receive(simplehdlc_arq_t *arq, const uint8_t *frame, uint16_t len);
+
+// sends acknowledgements and retransmissions which have come due. call it regularly, at the latest after the number
+// of milliseconds it returns (UINT32_MAX if nothing is waiting).
+uint32_t simplehdlc_arq_poll(simplehdlc_arq_t *arq);
+
+// packets sent but not yet acknowledged
+size_t simplehdlc_arq_in_flight(const simplehdlc_arq_t *arq);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //SIMPLEHDLC_SIMPLEHDLC_ARQ_H
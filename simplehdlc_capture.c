@@ -0,0 +1,358 @@
+/* SPDX-License-Identifier: MIT */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "simplehdlc_capture.h"
+
+// smallest chunk picked when the caller does not give a size
+#define SIMPLEHDLC_CAPTURE_MIN_CHUNK (1024 * 1024)
+
+// chunks per thread when the caller does not give a size, so that a chunk full of large packets does not leave the
+// other threads idle at the end
+#define SIMPLEHDLC_CAPTURE_CHUNKS_PER_THREAD 8
+
+typedef struct {
+    simplehdlc_capture_frame_t *frames;
+    size_t n_frames;
+    size_t capacity;
+    bool failed;
+} chunk_result_t;
+
+typedef struct {
+    simplehdlc_capture_t *capture;
+    chunk_result_t *results;
+    size_t next_chunk;
+    bool out_of_memory; // a thread could not allocate its parse buffer
+} decode_job_t;
+
+void simplehdlc_capture_init(simplehdlc_capture_t *capture, const uint8_t *data, size_t len) {
+    memset(capture, 0, sizeof(simplehdlc_capture_t));
+    capture->data = data;
+    capture->len = len;
+}
+
+simplehdlc_error_code_t simplehdlc_capture_open(simplehdlc_capture_t *capture, const char *path) {
+    simplehdlc_capture_init(capture, NULL, 0);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return SIMPLEHDLC_ERROR_IO;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return SIMPLEHDLC_ERROR_IO;
+    }
+
+    // an empty file cannot be mapped, and has nothing to decode anyway
+    if (st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return SIMPLEHDLC_ERROR_IO;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+        capture->data = (const uint8_t *) data;
+        capture->len = st.st_size;
+        capture->mapped = true;
+    }
+
+    close(fd);
+    return SIMPLEHDLC_OK;
+}
+
+void simplehdlc_capture_close(simplehdlc_capture_t *capture) {
+    if (capture->mapped) munmap((void *) capture->data, capture->len);
+    free(capture->frames);
+    free(capture->chunks);
+    simplehdlc_capture_init(capture, NULL, 0);
+}
+
+static bool add_frame(chunk_result_t *result, uint64_t offset, const simplehdlc_frame_t *frame) {
+    if (result->n_frames == result->capacity) {
+        size_t capacity = result->capacity ? 2 * result->capacity : 256;
+        simplehdlc_capture_frame_t *frames = realloc(result->frames, capacity * sizeof(simplehdlc_capture_frame_t));
+        if (frames == NULL) return false;
+
+        result->frames = frames;
+        result->capacity = capacity;
+    }
+
+    simplehdlc_capture_frame_t *out = &result->frames[result->n_frames++];
+    out->offset = offset;
+    out->len = frame->len;
+    out->status = frame->status;
+    return true;
+}
+
+// decodes one chunk a marker at a time: a marker starts at most one packet, so every packet found between two
+// markers belongs to the first of them
+static void decode_chunk(const simplehdlc_capture_t *capture, simplehdlc_context_t *context,
+                         simplehdlc_capture_chunk_stats_t *stats, chunk_result_t *result) {
+    const uint8_t *data = capture->data;
+    size_t end = stats->offset + stats->len;
+    size_t start = stats->offset;
+
+    while (start < end) {
+        const uint8_t *marker = memchr(&data[start + 1], SIMPLEHDLC_BOUNDARY_MARKER, end - start - 1);
+        size_t next = marker != NULL ? (size_t) (marker - data) : end;
+
+        // the payloads themselves are not needed, so no arena is given; a packet decoded into the parse buffer ends
+        // the batch early and the rest of the segment is decoded by the next call
+        size_t offset = start;
+        while (offset < next) {
+            simplehdlc_frame_t frames[2];
+            uint8_t arena[1];
+            size_t consumed;
+            size_t n_frames = simplehdlc_decode_batch(context, &data[offset], next - offset, frames, 2, arena, 0,
+                                                      &consumed);
+            offset += consumed;
+
+            for (size_t i=0; i<n_frames; i++) {
+                if (frames[i].status == SIMPLEHDLC_FRAME_OK) {
+                    stats->frames_ok++;
+                } else if (frames[i].status == SIMPLEHDLC_FRAME_CRC_MISMATCH) {
+                    stats->crc_failures++;
+                } else {
+                    stats->oversize_drops++;
+                }
+
+                if (!add_frame(result, start, &frames[i])) {
+                    result->failed = true;
+                    return;
+                }
+            }
+        }
+
+        // anything part way through a packet here is cut off by the next marker or the end of the capture
+        if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB ||
+            context->state == SIMPLEHDLC_STATE_CONSUMING_PAYLOAD ||
+            context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_VARINT ||
+            (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB && (context->escape_next || context->rx_cobs))) {
+            stats->aborted_frames++;
+        }
+
+        start = next;
+    }
+}
+
+static void *decode_thread(void *arg) {
+    decode_job_t *job = (decode_job_t *) arg;
+    simplehdlc_capture_t *capture = job->capture;
+
+    uint8_t *rx_buffer = malloc(capture->max_payload ? capture->max_payload : 1);
+    if (rx_buffer == NULL) {
+        __atomic_store_n(&job->out_of_memory, true, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    simplehdlc_callbacks_t callbacks = {0};
+    simplehdlc_context_t context;
+
+    while (1) {
+        size_t chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= capture->n_chunks) break;
+
+        // every chunk but the first starts at a marker, which resets the parser anyway
+        simplehdlc_init(&context, rx_buffer, capture->max_payload, &callbacks, NULL);
+        decode_chunk(capture, &context, &capture->chunks[chunk], &job->results[chunk]);
+    }
+
+    free(rx_buffer);
+    return NULL;
+}
+
+// splits the capture into chunks which start at markers
+static bool split_chunks(simplehdlc_capture_t *capture, size_t n_threads, size_t chunk_size) {
+    if (chunk_size == 0) {
+        chunk_size = capture->len / (n_threads * SIMPLEHDLC_CAPTURE_CHUNKS_PER_THREAD) + 1;
+        if (chunk_size < SIMPLEHDLC_CAPTURE_MIN_CHUNK) chunk_size = SIMPLEHDLC_CAPTURE_MIN_CHUNK;
+    }
+
+    size_t max_chunks = capture->len / chunk_size + 1;
+    capture->chunks = calloc(max_chunks, sizeof(simplehdlc_capture_chunk_stats_t));
+    if (capture->chunks == NULL) return false;
+
+    size_t start = 0;
+    capture->n_chunks = 0;
+    while (start < capture->len || capture->n_chunks == 0) {
+        size_t end = start + chunk_size;
+        if (end >= capture->len) {
+            end = capture->len;
+        } else {
+            const uint8_t *marker = memchr(&capture->data[end], SIMPLEHDLC_BOUNDARY_MARKER, capture->len - end);
+            end = marker != NULL ? (size_t) (marker - capture->data) : capture->len;
+        }
+
+        capture->chunks[capture->n_chunks].offset = start;
+        capture->chunks[capture->n_chunks].len = end - start;
+        capture->n_chunks++;
+        start = end;
+    }
+
+    return true;
+}
+
+simplehdlc_error_code_t
+simplehdlc_capture_decode(simplehdlc_capture_t *capture, size_t n_threads, size_t chunk_size, size_t max_payload) {
+    free(capture->frames);
+    free(capture->chunks);
+    capture->frames = NULL;
+    capture->n_frames = 0;
+    capture->chunks = NULL;
+    capture->n_chunks = 0;
+    capture->max_payload = max_payload;
+
+    if (n_threads == 0) n_threads = 1;
+
+    // a single thread decodes the whole capture as one chunk, which is the sequential decode
+    if (!split_chunks(capture, n_threads, n_threads == 1 && chunk_size == 0 ? capture->len + 1 : chunk_size)) {
+        return SIMPLEHDLC_ERROR_OUT_OF_MEMORY;
+    }
+    if (n_threads > capture->n_chunks) n_threads = capture->n_chunks;
+
+    decode_job_t job;
+    job.capture = capture;
+    job.next_chunk = 0;
+    job.out_of_memory = false;
+    job.results = calloc(capture->n_chunks, sizeof(chunk_result_t));
+    pthread_t *threads = calloc(n_threads, sizeof(pthread_t));
+    if (job.results == NULL || threads == NULL) {
+        free(job.results);
+        free(threads);
+        return SIMPLEHDLC_ERROR_OUT_OF_MEMORY;
+    }
+
+    simplehdlc_error_code_t error = SIMPLEHDLC_OK;
+
+    // the calling thread decodes too
+    size_t n_started = 0;
+    for (size_t i=1; i<n_threads; i++) {
+        if (pthread_create(&threads[i], NULL, decode_thread, &job) != 0) {
+            error = SIMPLEHDLC_ERROR_IO;
+            break;
+        }
+        n_started++;
+    }
+    decode_thread(&job);
+    for (size_t i=1; i<=n_started; i++) pthread_join(threads[i], NULL);
+
+    if (job.out_of_memory) error = SIMPLEHDLC_ERROR_OUT_OF_MEMORY;
+
+    // stitch the chunks' packets together in order
+    size_t n_frames = 0;
+    for (size_t i=0; i<capture->n_chunks; i++) {
+        if (job.results[i].failed) error = SIMPLEHDLC_ERROR_OUT_OF_MEMORY;
+        n_frames += job.results[i].n_frames;
+    }
+
+    if (error == SIMPLEHDLC_OK && n_frames) {
+        capture->frames = malloc(n_frames * sizeof(simplehdlc_capture_frame_t));
+        if (capture->frames == NULL) error = SIMPLEHDLC_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (error == SIMPLEHDLC_OK) {
+        for (size_t i=0; i<capture->n_chunks; i++) {
+            if (job.results[i].n_frames == 0) continue;
+            memcpy(&capture->frames[capture->n_frames], job.results[i].frames,
+                   job.results[i].n_frames * sizeof(simplehdlc_capture_frame_t));
+            capture->n_frames += job.results[i].n_frames;
+        }
+    }
+
+    for (size_t i=0; i<capture->n_chunks; i++) free(job.results[i].frames);
+    free(job.results);
+    free(threads);
+
+    return error;
+}
+
+// the decoded bytes of a packet after its frame type, of which the length field is skipped and the payload kept
+typedef struct {
+    uint8_t *payload;
+    size_t count;
+    size_t skip; // length bytes still to skip
+    bool varint; // an extended length is being skipped
+} payload_reader_t;
+
+static inline void payload_reader_add(payload_reader_t *reader, uint8_t c) {
+    if (reader->varint) {
+        reader->varint = (c & 0x80) != 0;
+    } else if (reader->skip) {
+        reader->skip--;
+    } else {
+        reader->payload[reader->count++] = c;
+    }
+}
+
+simplehdlc_error_code_t simplehdlc_capture_read_payload(const simplehdlc_capture_t *capture,
+                                                        const simplehdlc_capture_frame_t *frame, uint8_t *payload) {
+    if (frame->status == SIMPLEHDLC_FRAME_TOO_LARGE) return SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+
+    // skip the marker, the frame type if there is one and the length, unescaping as we go; the decode has already
+    // checked the packet is all there
+    payload_reader_t reader = {payload, 0, 2, false};
+    bool escape_next = false;
+    uint8_t type = 0;
+
+    size_t start = frame->offset + 1;
+    if (start + 1 < capture->len && capture->data[start] == SIMPLEHDLC_ESCAPE_MARKER &&
+        SIMPLEHDLC_IS_FRAME_TYPE(capture->data[start + 1])) {
+        type = capture->data[start + 1];
+        start += 2;
+    }
+
+    if (type & SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH) {
+        reader.skip = 0;
+        reader.varint = true;
+    }
+
+    if (type & SIMPLEHDLC_FRAMING_COBS) {
+        // each code byte gives the length of the group which follows, and stands for a boundary marker in the data
+        // unless it is the first or the group before it was full
+        size_t remaining = 0;
+        bool marker = false;
+
+        for (size_t i=start; i<capture->len && reader.count<frame->len; i++) {
+            uint8_t c = capture->data[i];
+            if (remaining) {
+                remaining--;
+            } else {
+                uint8_t code = c ^ SIMPLEHDLC_BOUNDARY_MARKER;
+                bool was_marker = marker;
+                remaining = code - 1;
+                marker = code - 1 < SIMPLEHDLC_COBS_MAX_GROUP;
+                if (!was_marker) continue;
+                c = SIMPLEHDLC_BOUNDARY_MARKER;
+            }
+
+            payload_reader_add(&reader, c);
+        }
+
+        return SIMPLEHDLC_OK;
+    }
+
+    for (size_t i=start; i<capture->len && reader.count<frame->len; i++) {
+        uint8_t c = capture->data[i];
+        if (escape_next) {
+            c ^= (1 << 5);
+            escape_next = false;
+        } else if (c == SIMPLEHDLC_ESCAPE_MARKER) {
+            escape_next = true;
+            continue;
+        }
+
+        payload_reader_add(&reader, c);
+    }
+
+    return SIMPLEHDLC_OK;
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_CAPTURE_H
+#define SIMPLEHDLC_SIMPLEHDLC_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "simplehdlc.h"
+
+// optional decoder for raw captures of a link (POSIX: mmap and threads). the capture is split into chunks which
+// start at a frame boundary marker and the chunks are decoded in parallel. every marker resets the parser, so no
+// packet can span two chunks and the results are exactly those of decoding the whole capture with one parser,
+// just in pieces. simplehdlc_capture_decode with one thread is that sequential decode.
+
+// a packet found in the capture: offset is that of its frame boundary marker
+typedef struct {
+    uint64_t offset;
+    uint32_t len;
+    simplehdlc_frame_status_t status;
+} simplehdlc_capture_frame_t;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t len;
+    uint64_t frames_ok;
+    uint64_t crc_failures;
+    uint64_t oversize_drops;
+    uint64_t aborted_frames; // cut off by the next marker, or by the end of the capture
+} simplehdlc_capture_chunk_stats_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+
+    // filled in by simplehdlc_capture_decode, in capture order
+    simplehdlc_capture_frame_t *frames;
+    size_t n_frames;
+    simplehdlc_capture_chunk_stats_t *chunks;
+    size_t n_chunks;
+
+    size_t max_payload;
+    bool mapped;
+} simplehdlc_capture_t;
+
+// maps the file at path; returns SIMPLEHDLC_ERROR_IO (with errno set) if it cannot be opened or mapped
+simplehdlc_error_code_t simplehdlc_capture_open(simplehdlc_capture_t *capture, const char *path);
+
+// uses a capture which is already in memory
+void simplehdlc_capture_init(simplehdlc_capture_t *capture, const uint8_t *data, size_t len);
+
+// decodes the capture on n_threads threads, in chunks of about chunk_size bytes (0 picks a size), with packets of
+// more than max_payload bytes dropped as too large, just as a parse buffer of that size would. returns
+// SIMPLEHDLC_ERROR_OUT_OF_MEMORY or SIMPLEHDLC_ERROR_IO (a thread could not be started) on failure.
+simplehdlc_error_code_t
+simplehdlc_capture_decode(simplehdlc_capture_t *capture, size_t n_threads, size_t chunk_size, size_t max_payload);
+
+// unescapes the payload of a packet which was not too large into payload, which must have room for frame->len bytes.
+// returns SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE for a packet which was too large.
+simplehdlc_error_code_t simplehdlc_capture_read_payload(const simplehdlc_capture_t *capture,
+                                                        const simplehdlc_capture_frame_t *frame, uint8_t *payload);
+
+// frees the results and unmaps the file
+void simplehdlc_capture_close(simplehdlc_capture_t *capture);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //SIMPLEHDLC_SIMPLEHDLC_CAPTURE_H
@@ -0,0 +1,330 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_CORO_HPP
+#define SIMPLEHDLC_SIMPLEHDLC_CORO_HPP
+
+// optional C++20 coroutine layer over the linux I/O loop in simplehdlc_epoll.c, so that a link can be used as
+//
+//     auto frame = co_await link.next_frame();
+//     co_await link.send(*frame);
+//
+// everything runs on the thread which calls Reactor::run or Reactor::poll. a coroutine waiting for a packet is resumed
+// straight from the parse loop with a span over the decoded payload, which is not copied; packets which arrive while
+// nothing is waiting are copied into a backlog until they are asked for. sends are queued on the link and written
+// together at the end of each poll, as with simplehdlc_epoll_send, and only suspend while the TX queue is full.
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "simplehdlc_epoll.h"
+
+namespace simplehdlc::coro {
+
+// return type for detached coroutines: the coroutine starts running as soon as it is called and frees itself when it
+// finishes. an exception escaping it terminates the program.
+struct Task {
+    struct promise_type {
+        Task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+class Link;
+
+class Reactor {
+public:
+    Reactor() = default;
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    ~Reactor() {
+        if (loop_) simplehdlc_epoll_deinit(loop_.get());
+    }
+
+    // returns SIMPLEHDLC_ERROR_IO (with errno set) if the epoll instance cannot be created
+    simplehdlc_error_code_t open() {
+        loop_ = std::make_unique<simplehdlc_epoll_t>();
+
+        simplehdlc_epoll_callbacks_t callbacks = {};
+        callbacks.rx_batch_callback = rx_batch_callback;
+        callbacks.tx_ready_callback = tx_ready_callback;
+        callbacks.closed_callback = closed_callback;
+
+        simplehdlc_error_code_t error = simplehdlc_epoll_init(loop_.get(), &callbacks);
+        if (error != SIMPLEHDLC_OK) loop_.reset();
+        return error;
+    }
+
+    // one iteration of the loop, resuming any coroutines whose packets arrived or whose sends can now go ahead;
+    // returns as simplehdlc_epoll_poll
+    int poll(int timeout_ms) { return simplehdlc_epoll_poll(loop_.get(), timeout_ms); }
+
+    // polls until stop is called (usually from a coroutine), or epoll_wait fails, in which case it returns false
+    bool run() {
+        stopped_ = false;
+        while (!stopped_) {
+            if (poll(-1) < 0) return false;
+        }
+        return true;
+    }
+
+    void stop() noexcept { stopped_ = true; }
+
+    simplehdlc_epoll_t *get() noexcept { return loop_.get(); }
+
+private:
+    static void rx_batch_callback(simplehdlc_epoll_link_t *link, const simplehdlc_frame_t *frames, size_t n_frames);
+    static void tx_ready_callback(simplehdlc_epoll_link_t *link);
+    static void closed_callback(simplehdlc_epoll_link_t *link, int error);
+
+    std::unique_ptr<simplehdlc_epoll_t> loop_;
+    bool stopped_ = false;
+};
+
+// a non-blocking fd with a parser, driven by a Reactor. a link must not be moved once opened, nor destroyed while a
+// coroutine is waiting on it or from within a coroutine which the reactor resumed; close it first, which wakes its
+// waiters.
+class Link {
+public:
+    class FrameAwaiter;
+    class SendAwaiter;
+
+    Link() = default;
+    Link(const Link &) = delete;
+    Link &operator=(const Link &) = delete;
+
+    ~Link() {
+        if (open_) simplehdlc_epoll_remove(&link_);
+    }
+
+    // starts receiving on fd, which is made non-blocking and is not closed by the link. packets of more than
+    // max_payload bytes are dropped, tx_queue_size bytes are set aside for encoded packets waiting to be written, and
+    // at most max_backlog packets are kept while no coroutine is waiting for them; any more are dropped.
+    simplehdlc_error_code_t open(Reactor &reactor, int fd, size_t max_payload = 65535,
+                                 size_t tx_queue_size = 64 * 1024, size_t max_backlog = 1024) {
+        rx_buffer_ = std::make_unique<std::uint8_t[]>(max_payload ? max_payload : 1);
+        tx_buffer_ = std::make_unique<std::uint8_t[]>(tx_queue_size);
+        max_backlog_ = max_backlog;
+        backlog_.clear();
+        dropped_ = 0;
+        error_ = 0;
+
+        simplehdlc_error_code_t error = simplehdlc_epoll_add(reactor.get(), &link_, fd, rx_buffer_.get(), max_payload,
+                                                             tx_buffer_.get(), tx_queue_size, this);
+        open_ = error == SIMPLEHDLC_OK;
+        return error;
+    }
+
+    // stops using the link and wakes its waiters: next_frame gives std::nullopt once the backlog is empty, and sends
+    // give SIMPLEHDLC_ERROR_IO. queued packets which have not been written are discarded.
+    void close() {
+        if (!open_) return;
+        simplehdlc_epoll_remove(&link_);
+        closed(0);
+    }
+
+    // co_await gives the next good packet, or std::nullopt once the link has closed. the span is only valid until
+    // the awaiting coroutine next suspends. one coroutine at a time may wait for packets on a link.
+    FrameAwaiter next_frame() noexcept;
+
+    // co_await queues a packet and gives SIMPLEHDLC_OK, waiting first if the TX queue is full. otherwise nothing is
+    // queued and it gives SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE for a payload of more than 0xFFFF bytes,
+    // SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL if the packet could never fit in the TX queue, SIMPLEHDLC_ERROR_IO if the link
+    // has closed, or whatever error encoding the packet gave, which simplehdlc_epoll_send passes on. packets are sent
+    // in the order send was called, and the payload is copied if the send has to wait, so it may be a received frame.
+    SendAwaiter send(std::span<const std::uint8_t> payload) noexcept;
+
+    bool is_open() const noexcept { return open_; }
+
+    // the errno which closed the link, or 0 if the other end closed it or close was called
+    int error() const noexcept { return error_; }
+
+    // packets dropped because the backlog was full
+    std::uint64_t dropped() const noexcept { return dropped_; }
+
+    int fd() const noexcept { return link_.fd; }
+
+private:
+    friend class Reactor;
+
+    // gives SIMPLEHDLC_ERROR_WOULD_BLOCK if the send has to wait, or any of the results listed for send
+    simplehdlc_error_code_t try_send(std::span<const std::uint8_t> payload) {
+        if (payload.size() > 0xFFFF) return SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE;
+        return simplehdlc_epoll_send(&link_, payload.data(), payload.size());
+    }
+
+    void received(const simplehdlc_frame_t *frames, size_t n_frames);
+    void tx_ready();
+    void closed(int error);
+
+    simplehdlc_epoll_link_t link_ = {};
+    std::unique_ptr<std::uint8_t[]> rx_buffer_;
+    std::unique_ptr<std::uint8_t[]> tx_buffer_;
+    bool open_ = false;
+    int error_ = 0;
+
+    // the coroutine waiting for a packet, and the packet handed to it
+    std::coroutine_handle<> rx_waiter_;
+    std::span<const std::uint8_t> frame_;
+    bool frame_ready_ = false;
+
+    std::deque<std::vector<std::uint8_t>> backlog_;
+    std::vector<std::uint8_t> current_; // the backlog packet last handed out
+    size_t max_backlog_ = 0;
+    std::uint64_t dropped_ = 0;
+
+    // sends waiting for room in the TX queue, oldest first
+    SendAwaiter *tx_head_ = nullptr;
+    SendAwaiter *tx_tail_ = nullptr;
+};
+
+class Link::FrameAwaiter {
+public:
+    explicit FrameAwaiter(Link &link) noexcept : link_(link) {}
+
+    bool await_ready() const noexcept { return !link_.backlog_.empty() || !link_.open_; }
+
+    void await_suspend(std::coroutine_handle<> handle) noexcept { link_.rx_waiter_ = handle; }
+
+    std::optional<std::span<const std::uint8_t>> await_resume() {
+        if (link_.frame_ready_) {
+            link_.frame_ready_ = false;
+            return link_.frame_;
+        }
+
+        if (!link_.backlog_.empty()) {
+            link_.current_.swap(link_.backlog_.front());
+            link_.backlog_.pop_front();
+            return std::span<const std::uint8_t>(link_.current_);
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    Link &link_;
+};
+
+class Link::SendAwaiter {
+public:
+    SendAwaiter(Link &link, std::span<const std::uint8_t> payload) noexcept : link_(link), payload_(payload) {}
+
+    bool await_ready() {
+        // packets already waiting go first
+        if (link_.tx_head_ != nullptr) return false;
+
+        result_ = link_.try_send(payload_);
+        return result_ != SIMPLEHDLC_ERROR_WOULD_BLOCK;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        copy_.assign(payload_.begin(), payload_.end());
+        payload_ = copy_;
+        handle_ = handle;
+
+        if (link_.tx_tail_ != nullptr) {
+            link_.tx_tail_->next_ = this;
+        } else {
+            link_.tx_head_ = this;
+        }
+        link_.tx_tail_ = this;
+    }
+
+    simplehdlc_error_code_t await_resume() const noexcept { return result_; }
+
+private:
+    friend class Link;
+
+    Link &link_;
+    std::span<const std::uint8_t> payload_;
+    std::vector<std::uint8_t> copy_;
+    simplehdlc_error_code_t result_ = SIMPLEHDLC_OK;
+    std::coroutine_handle<> handle_;
+    SendAwaiter *next_ = nullptr;
+};
+
+inline Link::FrameAwaiter Link::next_frame() noexcept {
+    return FrameAwaiter(*this);
+}
+
+inline Link::SendAwaiter Link::send(std::span<const std::uint8_t> payload) noexcept {
+    return SendAwaiter(*this, payload);
+}
+
+inline void Link::received(const simplehdlc_frame_t *frames, size_t n_frames) {
+    for (size_t i=0; i<n_frames && open_; i++) {
+        std::span<const std::uint8_t> payload(frames[i].ptr, frames[i].len);
+
+        // the waiting coroutine runs until it next suspends, which is usually when it waits for the next packet
+        if (rx_waiter_) {
+            std::coroutine_handle<> waiter = rx_waiter_;
+            rx_waiter_ = nullptr;
+            frame_ = payload;
+            frame_ready_ = true;
+            waiter.resume();
+        } else if (backlog_.size() < max_backlog_) {
+            backlog_.emplace_back(payload.begin(), payload.end());
+        } else {
+            dropped_++;
+        }
+    }
+}
+
+inline void Link::tx_ready() {
+    while (tx_head_ != nullptr) {
+        SendAwaiter *awaiter = tx_head_;
+        simplehdlc_error_code_t result = try_send(awaiter->payload_);
+        if (result == SIMPLEHDLC_ERROR_WOULD_BLOCK) return;
+
+        tx_head_ = awaiter->next_;
+        if (tx_head_ == nullptr) tx_tail_ = nullptr;
+        awaiter->result_ = result;
+        awaiter->handle_.resume();
+    }
+}
+
+inline void Link::closed(int error) {
+    open_ = false;
+    error_ = error;
+
+    if (rx_waiter_) {
+        std::coroutine_handle<> waiter = rx_waiter_;
+        rx_waiter_ = nullptr;
+        waiter.resume();
+    }
+
+    while (tx_head_ != nullptr) {
+        SendAwaiter *awaiter = tx_head_;
+        tx_head_ = awaiter->next_;
+        if (tx_head_ == nullptr) tx_tail_ = nullptr;
+        awaiter->result_ = SIMPLEHDLC_ERROR_IO;
+        awaiter->handle_.resume();
+    }
+}
+
+inline void Reactor::rx_batch_callback(simplehdlc_epoll_link_t *link, const simplehdlc_frame_t *frames,
+                                       size_t n_frames) {
+    static_cast<Link *>(link->user_ptr)->received(frames, n_frames);
+}
+
+inline void Reactor::tx_ready_callback(simplehdlc_epoll_link_t *link) {
+    static_cast<Link *>(link->user_ptr)->tx_ready();
+}
+
+inline void Reactor::closed_callback(simplehdlc_epoll_link_t *link, int error) {
+    static_cast<Link *>(link->user_ptr)->closed(error);
+}
+
+} // namespace simplehdlc::coro
+
+#endif //SIMPLEHDLC_SIMPLEHDLC_CORO_HPP
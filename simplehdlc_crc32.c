@@ -4,6 +4,39 @@
 
 #include "simplehdlc_crc32.h"
 
+#if defined(SIMPLEHDLC_CRC32_FORCE_ENGINE)
+#define SIMPLEHDLC_CRC32_HAVE_SLICE8 (SIMPLEHDLC_CRC32_FORCE_ENGINE == SIMPLEHDLC_CRC32_SLICE8)
+#define SIMPLEHDLC_CRC32_HAVE_SLICE16 (SIMPLEHDLC_CRC32_FORCE_ENGINE == SIMPLEHDLC_CRC32_SLICE16 || \
+                                       SIMPLEHDLC_CRC32_FORCE_ENGINE == SIMPLEHDLC_CRC32_PCLMUL)
+#define SIMPLEHDLC_CRC32_HAVE_PCLMUL (SIMPLEHDLC_CRC32_FORCE_ENGINE == SIMPLEHDLC_CRC32_PCLMUL)
+#define SIMPLEHDLC_CRC32_DISPATCH 0
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMPLEHDLC_CRC32_HAVE_SLICE8 1
+#define SIMPLEHDLC_CRC32_HAVE_SLICE16 1
+#define SIMPLEHDLC_CRC32_HAVE_PCLMUL 1
+#define SIMPLEHDLC_CRC32_DISPATCH 1
+#else
+#define SIMPLEHDLC_CRC32_HAVE_SLICE8 0
+#define SIMPLEHDLC_CRC32_HAVE_SLICE16 0
+#define SIMPLEHDLC_CRC32_HAVE_PCLMUL 0
+#define SIMPLEHDLC_CRC32_DISPATCH 0
+#endif
+
+#if SIMPLEHDLC_CRC32_HAVE_PCLMUL
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if SIMPLEHDLC_CRC32_HAVE_SLICE16
+#define SIMPLEHDLC_CRC32_SLICE_ROWS 16
+#elif SIMPLEHDLC_CRC32_HAVE_SLICE8
+#define SIMPLEHDLC_CRC32_SLICE_ROWS 8
+#endif
+
+#ifdef SIMPLEHDLC_CRC32_SLICE_ROWS
+#include "simplehdlc_crc32_tables.h"
+#endif
+
 //static uint32_t crc32_for_byte(uint32_t r) {
 //    for(int j = 0; j < 8; ++j)
 //        r = (r & 1? 0: (uint32_t)0xEDB88320L) ^ r >> 1;
@@ -45,10 +78,306 @@ static const uint32_t crc32_table[0x100] = {
         0x616495a3, 0x1663a535, 0x8f6af48f, 0xf86dc419, 0x660951ba, 0x110e612c, 0x88073096, 0xff000000
 };
 
-uint32_t simplehdlc_compute_crc32(const void *data, size_t n_bytes) {
-    uint32_t crc = 0;
+static uint32_t crc32_update_table(uint32_t crc, const uint8_t *data, size_t n_bytes) {
     for(size_t i = 0; i < n_bytes; ++i)
-        crc = crc32_table[(uint8_t)crc ^ ((uint8_t*)data)[i]] ^ crc >> 8;
+        crc = crc32_table[(uint8_t)crc ^ data[i]] ^ crc >> 8;
+
+    return crc;
+}
+
+#ifdef SIMPLEHDLC_CRC32_SLICE_ROWS
+
+static inline uint32_t load_u32_le(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// crc32_table is the standard table with its index and top byte inverted, so the slicing engines work on the
+// inverted running CRC to be able to use the standard slicing tables
+
+#endif
+
+#if SIMPLEHDLC_CRC32_HAVE_SLICE8
+
+static uint32_t crc32_update_slice8(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+    uint32_t c = ~crc;
+
+    while (n_bytes >= 8) {
+        uint32_t one = load_u32_le(data) ^ c;
+        uint32_t two = load_u32_le(data + 4);
+
+        c = crc32_slice_table[7][one & 0xFF] ^ crc32_slice_table[6][(one >> 8) & 0xFF] ^
+            crc32_slice_table[5][(one >> 16) & 0xFF] ^ crc32_slice_table[4][one >> 24] ^
+            crc32_slice_table[3][two & 0xFF] ^ crc32_slice_table[2][(two >> 8) & 0xFF] ^
+            crc32_slice_table[1][(two >> 16) & 0xFF] ^ crc32_slice_table[0][two >> 24];
+
+        data += 8;
+        n_bytes -= 8;
+    }
+
+    return crc32_update_table(~c, data, n_bytes);
+}
+
+#endif
+
+#if SIMPLEHDLC_CRC32_HAVE_SLICE16
+
+static uint32_t crc32_update_slice16(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+    uint32_t c = ~crc;
+
+    while (n_bytes >= 16) {
+        uint32_t one = load_u32_le(data) ^ c;
+        uint32_t two = load_u32_le(data + 4);
+        uint32_t three = load_u32_le(data + 8);
+        uint32_t four = load_u32_le(data + 12);
+
+        c = crc32_slice_table[15][one & 0xFF] ^ crc32_slice_table[14][(one >> 8) & 0xFF] ^
+            crc32_slice_table[13][(one >> 16) & 0xFF] ^ crc32_slice_table[12][one >> 24] ^
+            crc32_slice_table[11][two & 0xFF] ^ crc32_slice_table[10][(two >> 8) & 0xFF] ^
+            crc32_slice_table[9][(two >> 16) & 0xFF] ^ crc32_slice_table[8][two >> 24] ^
+            crc32_slice_table[7][three & 0xFF] ^ crc32_slice_table[6][(three >> 8) & 0xFF] ^
+            crc32_slice_table[5][(three >> 16) & 0xFF] ^ crc32_slice_table[4][three >> 24] ^
+            crc32_slice_table[3][four & 0xFF] ^ crc32_slice_table[2][(four >> 8) & 0xFF] ^
+            crc32_slice_table[1][(four >> 16) & 0xFF] ^ crc32_slice_table[0][four >> 24];
+
+        data += 16;
+        n_bytes -= 16;
+    }
+
+    return crc32_update_table(~c, data, n_bytes);
+}
+
+#endif
+
+#if SIMPLEHDLC_CRC32_HAVE_PCLMUL
+
+// folds 64 bytes at a time with carry-less multiplication, then reduces with a barrett reduction. the constants are
+// the usual ones for the reflected ethernet polynomial (x^n mod P for the fold distances, P' and u' for barrett), as
+// in intel's "fast CRC computation for generic polynomials using PCLMULQDQ" paper. needs at least 64 bytes; the
+// remainder which is not a multiple of 16 bytes is left to the slicing engine.
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+    if (n_bytes < 64) return crc32_update_slice16(crc, data, n_bytes);
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) ~crc));
+
+    data += 64;
+    n_bytes -= 64;
+
+    // fold 4 x 128 bits at a time
+    while (n_bytes >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (data + 0x30)));
+
+        data += 64;
+        n_bytes -= 64;
+    }
 
+    // fold down to 128 bits
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (n_bytes >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *) data)), x5);
+
+        data += 16;
+        n_bytes -= 16;
+    }
+
+    // fold 128 bits down to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // barrett reduction down to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    uint32_t c = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+    return crc32_update_slice16(~c, data, n_bytes);
+}
+
+static bool cpu_has_pclmul(void) {
+#if SIMPLEHDLC_CRC32_DISPATCH
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    return (ecx & bit_PCLMUL) != 0;
+#else
+    return true;
+#endif
+}
+
+#endif
+
+typedef uint32_t (*crc32_update_fn_t)(uint32_t crc, const uint8_t *data, size_t n_bytes);
+
+static crc32_update_fn_t get_engine_fn(simplehdlc_crc32_engine_t engine) {
+    switch (engine) {
+#if SIMPLEHDLC_CRC32_HAVE_SLICE8
+        case SIMPLEHDLC_CRC32_ENGINE_SLICE8:
+            return crc32_update_slice8;
+#endif
+#if SIMPLEHDLC_CRC32_HAVE_SLICE16
+        case SIMPLEHDLC_CRC32_ENGINE_SLICE16:
+            return crc32_update_slice16;
+#endif
+#if SIMPLEHDLC_CRC32_HAVE_PCLMUL
+        case SIMPLEHDLC_CRC32_ENGINE_PCLMUL:
+            return cpu_has_pclmul() ? crc32_update_pclmul : NULL;
+#endif
+        case SIMPLEHDLC_CRC32_ENGINE_TABLE:
+            return crc32_update_table;
+        default:
+            return NULL;
+    }
+}
+
+#if SIMPLEHDLC_CRC32_DISPATCH
+
+static uint32_t crc32_update_resolve(uint32_t crc, const uint8_t *data, size_t n_bytes);
+
+// resolved on first use. every thread resolves to the same engine, so relaxed atomics are enough to make racing on
+// this well defined
+static crc32_update_fn_t crc32_update_fn = crc32_update_resolve;
+
+static uint32_t crc32_update_resolve(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+    crc32_update_fn_t fn = cpu_has_pclmul() ? crc32_update_pclmul : crc32_update_slice16;
+    __atomic_store_n(&crc32_update_fn, fn, __ATOMIC_RELAXED);
+    return fn(crc, data, n_bytes);
+}
+
+static inline uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+    return __atomic_load_n(&crc32_update_fn, __ATOMIC_RELAXED)(crc, data, n_bytes);
+}
+
+simplehdlc_crc32_engine_t simplehdlc_crc32_get_engine(void) {
+    return cpu_has_pclmul() ? SIMPLEHDLC_CRC32_ENGINE_PCLMUL : SIMPLEHDLC_CRC32_ENGINE_SLICE16;
+}
+
+#elif defined(SIMPLEHDLC_CRC32_FORCE_ENGINE) && SIMPLEHDLC_CRC32_FORCE_ENGINE == SIMPLEHDLC_CRC32_SLICE8
+#define crc32_update crc32_update_slice8
+simplehdlc_crc32_engine_t simplehdlc_crc32_get_engine(void) { return SIMPLEHDLC_CRC32_ENGINE_SLICE8; }
+#elif defined(SIMPLEHDLC_CRC32_FORCE_ENGINE) && SIMPLEHDLC_CRC32_FORCE_ENGINE == SIMPLEHDLC_CRC32_SLICE16
+#define crc32_update crc32_update_slice16
+simplehdlc_crc32_engine_t simplehdlc_crc32_get_engine(void) { return SIMPLEHDLC_CRC32_ENGINE_SLICE16; }
+#elif defined(SIMPLEHDLC_CRC32_FORCE_ENGINE) && SIMPLEHDLC_CRC32_FORCE_ENGINE == SIMPLEHDLC_CRC32_PCLMUL
+#define crc32_update crc32_update_pclmul
+simplehdlc_crc32_engine_t simplehdlc_crc32_get_engine(void) { return SIMPLEHDLC_CRC32_ENGINE_PCLMUL; }
+#else
+#define crc32_update crc32_update_table
+simplehdlc_crc32_engine_t simplehdlc_crc32_get_engine(void) { return SIMPLEHDLC_CRC32_ENGINE_TABLE; }
+#endif
+
+uint32_t simplehdlc_compute_crc32(const void *data, size_t n_bytes) {
+    return crc32_update(0, (const uint8_t *) data, n_bytes);
+}
+
+// the table already folds the initial and final inversions into the running value, so there is nothing to do at
+// either end
+uint32_t simplehdlc_crc32_init(void) {
+    return 0;
+}
+
+uint32_t simplehdlc_crc32_update(uint32_t crc, const void *data, size_t n_bytes) {
+    return crc32_update(crc, (const uint8_t *) data, n_bytes);
+}
+
+uint32_t simplehdlc_crc32_final(uint32_t crc) {
     return crc;
-}
\ No newline at end of file
+}
+
+bool simplehdlc_crc32_engine_available(simplehdlc_crc32_engine_t engine) {
+    return get_engine_fn(engine) != NULL;
+}
+
+uint32_t simplehdlc_compute_crc32_with_engine(simplehdlc_crc32_engine_t engine, const void *data, size_t n_bytes) {
+    crc32_update_fn_t fn = get_engine_fn(engine);
+    if (fn == NULL) fn = crc32_update_table;
+
+    return fn(0, (const uint8_t *) data, n_bytes);
+}
+
+// the remaining functions do arithmetic on polynomials modulo the CRC polynomial, in the same bit reflected form as the
+// CRC, so bit 31 holds the coefficient of x^0 (after zlib's crc32_combine)
+
+// a * b mod the CRC polynomial, a byte of a at a time, highest powers first. each step multiplies what there is so far
+// by x^8 and adds on the byte times b, which leaves up to 8 bits past x^31 for the table to fold back in, as it does
+// for each byte of a CRC (the table has the inversions folded in, so it is looked up as such). the byte times b is
+// made of two nibbles times b, from a table of b times each nibble.
+static uint32_t crc32_multiply(uint32_t a, uint32_t b) {
+    // bit 3 of a nibble holds the coefficient of x^0
+    uint64_t b_times[16];
+    b_times[0] = 0;
+    for (int i=0; i<4; i++) b_times[8 >> i] = ((uint64_t) b << 8) >> i;
+    for (int n=3; n<16; n++) {
+        if (n & (n - 1)) b_times[n] = b_times[n & (n - 1)] ^ b_times[n & -n];
+    }
+
+    uint32_t p = 0;
+    for (int k=0; k<4; k++) {
+        uint8_t c = (a >> (8 * k)) & 0xFF;
+        uint64_t w = p ^ b_times[c >> 4] ^ (b_times[c & 0xF] >> 4);
+        p = (uint32_t) (w >> 8) ^ crc32_table[(w & 0xFF) ^ 0xFF] ^ 0xFF000000;
+    }
+
+    return p;
+}
+
+// x^(8 * n_after) mod the CRC polynomial, by repeated squaring
+uint32_t simplehdlc_crc32_shift_factor(size_t n_after) {
+    uint32_t factor = (uint32_t) 1 << 31; // x^0
+    uint32_t square = (uint32_t) 1 << 23; // x^8
+    while (n_after) {
+        if (n_after & 1) factor = crc32_multiply(square, factor);
+        n_after >>= 1;
+        if (n_after) square = crc32_multiply(square, square);
+    }
+
+    return factor;
+}
+
+uint32_t simplehdlc_crc32_shift(uint32_t crc_change, uint32_t factor) {
+    return crc32_multiply(factor, crc_change);
+}
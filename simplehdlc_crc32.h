@@ -5,9 +5,54 @@
 #ifndef SIMPLEHDLC_SIMPLEHDLC_CRC32_H
 #define SIMPLEHDLC_SIMPLEHDLC_CRC32_H
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
+// CRC32 engines. All of them produce identical results; by default the fastest one supported by the CPU is picked at
+// runtime on x86 hosts, and the single 256 entry table is used everywhere else. Define SIMPLEHDLC_CRC32_FORCE_ENGINE
+// to one of the values below to build only that engine (SIMPLEHDLC_CRC32_TABLE gives the smallest build).
+#define SIMPLEHDLC_CRC32_TABLE 1
+#define SIMPLEHDLC_CRC32_SLICE8 2
+#define SIMPLEHDLC_CRC32_SLICE16 3
+#define SIMPLEHDLC_CRC32_PCLMUL 4
+
+typedef enum {
+    SIMPLEHDLC_CRC32_ENGINE_TABLE = SIMPLEHDLC_CRC32_TABLE,
+    SIMPLEHDLC_CRC32_ENGINE_SLICE8 = SIMPLEHDLC_CRC32_SLICE8,
+    SIMPLEHDLC_CRC32_ENGINE_SLICE16 = SIMPLEHDLC_CRC32_SLICE16,
+    SIMPLEHDLC_CRC32_ENGINE_PCLMUL = SIMPLEHDLC_CRC32_PCLMUL,
+} simplehdlc_crc32_engine_t;
+
 uint32_t simplehdlc_compute_crc32(const void *data, size_t n_bytes);
 
+// streaming interface; feeding the data through any number of update calls gives the same result as
+// simplehdlc_compute_crc32 over all of it:
+//   simplehdlc_crc32_final(simplehdlc_crc32_update(simplehdlc_crc32_init(), data, n_bytes))
+uint32_t simplehdlc_crc32_init(void);
+uint32_t simplehdlc_crc32_update(uint32_t crc, const void *data, size_t n_bytes);
+uint32_t simplehdlc_crc32_final(uint32_t crc);
+
+// CRC32 is linear: when some bytes in the middle of a message change, its CRC changes by the CRC of the change carried
+// through the bytes after it, whatever the rest of the message is. for old and new bytes of the same length, followed
+// by n_after bytes:
+//   crc(new message) = crc(old message) ^
+//                      simplehdlc_crc32_shift(crc(old bytes) ^ crc(new bytes), simplehdlc_crc32_shift_factor(n_after))
+// the factor only depends on n_after, so it can be worked out once for a field which is updated many times.
+uint32_t simplehdlc_crc32_shift_factor(size_t n_after);
+uint32_t simplehdlc_crc32_shift(uint32_t crc_change, uint32_t factor);
+
+simplehdlc_crc32_engine_t simplehdlc_crc32_get_engine(void);
+bool simplehdlc_crc32_engine_available(simplehdlc_crc32_engine_t engine);
+
+// computes the CRC32 with a specific engine; engines which are not available fall back to the table
+uint32_t simplehdlc_compute_crc32_with_engine(simplehdlc_crc32_engine_t engine, const void *data, size_t n_bytes);
+
+#ifdef __cplusplus
+}
+#endif
 #endif //SIMPLEHDLC_SIMPLEHDLC_CRC32_H
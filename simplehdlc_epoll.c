@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: MIT */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "simplehdlc_epoll.h"
+
+simplehdlc_error_code_t simplehdlc_epoll_init(simplehdlc_epoll_t *loop, const simplehdlc_epoll_callbacks_t *callbacks) {
+    if (callbacks->rx_batch_callback == NULL) return SIMPLEHDLC_ERROR_CALLBACK_MISSING;
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) return SIMPLEHDLC_ERROR_IO;
+
+    loop->callbacks = *callbacks;
+    loop->pending = NULL;
+
+    return SIMPLEHDLC_OK;
+}
+
+void simplehdlc_epoll_deinit(simplehdlc_epoll_t *loop) {
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+}
+
+// encoded packets are appended to the TX queue through the chunk callback of the link's context
+static void link_tx_chunk_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    simplehdlc_epoll_link_t *link = (simplehdlc_epoll_link_t *) user_ptr;
+
+    size_t tail = link->tx_head + link->tx_count;
+    if (tail >= link->tx_buffer_len) tail -= link->tx_buffer_len;
+
+    size_t first = link->tx_buffer_len - tail < len ? link->tx_buffer_len - tail : len;
+    memcpy(&link->tx_buffer[tail], data, first);
+    memcpy(link->tx_buffer, &data[first], len - first);
+    link->tx_count += len;
+}
+
+simplehdlc_error_code_t
+simplehdlc_epoll_add(simplehdlc_epoll_t *loop, simplehdlc_epoll_link_t *link, int fd, uint8_t *rx_buffer,
+                     size_t rx_buffer_len, uint8_t *tx_buffer, size_t tx_buffer_len, void *user_ptr) {
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.tx_chunk_callback = link_tx_chunk_callback;
+    simplehdlc_init(&link->context, rx_buffer, rx_buffer_len, &callbacks, link);
+
+    link->fd = fd;
+    link->tx_buffer = tx_buffer;
+    link->tx_buffer_len = tx_buffer_len;
+    link->tx_head = 0;
+    link->tx_count = 0;
+    link->tx_blocked = false;
+    link->tx_polling = false;
+    link->tx_pending = false;
+    link->next_pending = NULL;
+    link->user_ptr = user_ptr;
+    link->loop = NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) return SIMPLEHDLC_ERROR_IO;
+    link->is_socket = S_ISSOCK(st.st_mode);
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return SIMPLEHDLC_ERROR_IO;
+
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = link;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) return SIMPLEHDLC_ERROR_IO;
+
+    link->loop = loop;
+    return SIMPLEHDLC_OK;
+}
+
+void simplehdlc_epoll_remove(simplehdlc_epoll_link_t *link) {
+    simplehdlc_epoll_t *loop = link->loop;
+    if (loop == NULL) return;
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, link->fd, NULL);
+
+    if (link->tx_pending) {
+        simplehdlc_epoll_link_t **p = &loop->pending;
+        while (*p != NULL && *p != link) p = &(*p)->next_pending;
+        if (*p == link) *p = link->next_pending;
+        link->tx_pending = false;
+    }
+
+    link->tx_count = 0;
+    link->loop = NULL;
+}
+
+static void link_close(simplehdlc_epoll_link_t *link, int error) {
+    simplehdlc_epoll_t *loop = link->loop;
+    simplehdlc_epoll_remove(link);
+    if (loop->callbacks.closed_callback != NULL) loop->callbacks.closed_callback(link, error);
+}
+
+simplehdlc_error_code_t simplehdlc_epoll_send(simplehdlc_epoll_link_t *link, const uint8_t *payload, uint16_t len) {
+    if (link->loop == NULL) return SIMPLEHDLC_ERROR_IO;
+
+    // only count the escapes if the worst case does not fit
+    size_t space = link->tx_buffer_len - link->tx_count;
+    if (SIMPLEHDLC_MAX_ENCODED_SIZE(len) > space) {
+        size_t encoded_size = simplehdlc_get_encoded_size_with_framing(payload, len, link->context.tx_framing);
+        if (encoded_size > link->tx_buffer_len) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+        if (encoded_size > space) {
+            link->tx_blocked = true;
+            return SIMPLEHDLC_ERROR_WOULD_BLOCK;
+        }
+    }
+
+    // a packet which fails to encode is taken back out of the TX queue
+    size_t tx_count = link->tx_count;
+    simplehdlc_error_code_t error = simplehdlc_encode_to_callback(&link->context, payload, len, false);
+    if (error != SIMPLEHDLC_OK) {
+        link->tx_count = tx_count;
+        return error;
+    }
+
+    if (!link->tx_pending) {
+        link->tx_pending = true;
+        link->next_pending = link->loop->pending;
+        link->loop->pending = link;
+    }
+
+    return SIMPLEHDLC_OK;
+}
+
+static void link_set_tx_polling(simplehdlc_epoll_link_t *link, bool polling) {
+    if (link->tx_polling == polling) return;
+
+    struct epoll_event event = {0};
+    event.events = polling ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.ptr = link;
+    epoll_ctl(link->loop->epoll_fd, EPOLL_CTL_MOD, link->fd, &event);
+    link->tx_polling = polling;
+}
+
+// writes as much of the TX queue as the fd will take, in one call unless the fd takes less than all of it
+static void link_write(simplehdlc_epoll_link_t *link) {
+    while (link->tx_count) {
+        struct iovec iov[2];
+        int iovcnt = 1;
+
+        iov[0].iov_base = &link->tx_buffer[link->tx_head];
+        iov[0].iov_len = link->tx_buffer_len - link->tx_head;
+        if (iov[0].iov_len >= link->tx_count) {
+            iov[0].iov_len = link->tx_count;
+        } else {
+            iov[1].iov_base = link->tx_buffer;
+            iov[1].iov_len = link->tx_count - iov[0].iov_len;
+            iovcnt = 2;
+        }
+
+        ssize_t n;
+        if (link->is_socket) {
+            // writev would raise SIGPIPE if the peer has gone
+            struct msghdr msg = {0};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            n = sendmsg(link->fd, &msg, MSG_NOSIGNAL);
+        } else {
+            n = writev(link->fd, iov, iovcnt);
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            link_close(link, errno);
+            return;
+        }
+
+        link->tx_head += n;
+        if (link->tx_head >= link->tx_buffer_len) link->tx_head -= link->tx_buffer_len;
+        link->tx_count -= n;
+    }
+
+    // start from the beginning again when empty so that the next batch is contiguous
+    if (link->tx_count == 0) link->tx_head = 0;
+
+    link_set_tx_polling(link, link->tx_count != 0);
+
+    if (link->tx_blocked && link->tx_count <= link->tx_buffer_len / 2) {
+        link->tx_blocked = false;
+        if (link->loop->callbacks.tx_ready_callback != NULL) link->loop->callbacks.tx_ready_callback(link);
+    }
+}
+
+void simplehdlc_epoll_flush(simplehdlc_epoll_t *loop) {
+    // only the links pending now; packets sent from callbacks during the flush wait for the next one
+    simplehdlc_epoll_link_t *link = loop->pending;
+    loop->pending = NULL;
+
+    while (link != NULL) {
+        simplehdlc_epoll_link_t *next = link->next_pending;
+        link->tx_pending = false;
+        link->next_pending = NULL;
+
+        if (link->loop == loop) link_write(link);
+        link = next;
+    }
+}
+
+static void link_read(simplehdlc_epoll_t *loop, simplehdlc_epoll_link_t *link) {
+    ssize_t n = read(link->fd, loop->read_buffer, sizeof(loop->read_buffer));
+    if (n == 0) {
+        link_close(link, 0);
+        return;
+    } else if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) link_close(link, errno);
+        return;
+    }
+
+    size_t offset = 0;
+    while (offset < (size_t) n && link->loop == loop) {
+        simplehdlc_frame_t frames[SIMPLEHDLC_EPOLL_BATCH_SIZE];
+        size_t consumed;
+        size_t n_frames = simplehdlc_decode_batch(&link->context, &loop->read_buffer[offset], n - offset, frames,
+                                                  SIMPLEHDLC_EPOLL_BATCH_SIZE, loop->arena, sizeof(loop->arena),
+                                                  &consumed);
+        offset += consumed;
+
+        // only the good packets are passed on
+        size_t n_ok = 0;
+        for (size_t i=0; i<n_frames; i++) {
+            if (frames[i].status == SIMPLEHDLC_FRAME_OK) frames[n_ok++] = frames[i];
+        }
+        if (n_ok) loop->callbacks.rx_batch_callback(link, frames, n_ok);
+    }
+}
+
+int simplehdlc_epoll_poll(simplehdlc_epoll_t *loop, int timeout_ms) {
+    struct epoll_event events[SIMPLEHDLC_EPOLL_MAX_EVENTS];
+
+    // packets sent since the last poll go out before waiting, as whatever is waited for may be the reply to them
+    simplehdlc_epoll_flush(loop);
+
+    int n = epoll_wait(loop->epoll_fd, events, SIMPLEHDLC_EPOLL_MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno != EINTR) return -1;
+        n = 0;
+    }
+
+    for (int i=0; i<n; i++) {
+        simplehdlc_epoll_link_t *link = (simplehdlc_epoll_link_t *) events[i].data.ptr;
+
+        // hangups and errors are picked up by the read
+        if (link->loop == loop && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) link_read(loop, link);
+        if (link->loop == loop && (events[i].events & EPOLLOUT)) link_write(link);
+    }
+
+    simplehdlc_epoll_flush(loop);
+    return n;
+}
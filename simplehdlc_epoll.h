@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_EPOLL_H
+#define SIMPLEHDLC_SIMPLEHDLC_EPOLL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "simplehdlc.h"
+
+// optional linux only I/O loop: drives a parser per non-blocking fd (tty, pty, socket, pipe, ...) from epoll. each
+// readable fd is read into one large buffer and decoded with simplehdlc_decode_batch, and the packets from each read
+// are passed on together. packets sent on a link are encoded into its TX queue and written out with one writev per
+// link at the end of the poll call (or once the fd becomes writable), so packets sent together go out together. when
+// the queue of a link is full, sending is refused with SIMPLEHDLC_ERROR_WOULD_BLOCK rather than letting a slow peer
+// make it grow, and tx_ready_callback is called once it has drained to half full.
+
+// size of the buffer each fd is read into
+#ifndef SIMPLEHDLC_EPOLL_READ_SIZE
+#define SIMPLEHDLC_EPOLL_READ_SIZE 65536
+#endif
+
+// most packets passed to rx_batch_callback at once
+#ifndef SIMPLEHDLC_EPOLL_BATCH_SIZE
+#define SIMPLEHDLC_EPOLL_BATCH_SIZE 64
+#endif
+
+// space for escaped packets decoded from one read
+#ifndef SIMPLEHDLC_EPOLL_ARENA_SIZE
+#define SIMPLEHDLC_EPOLL_ARENA_SIZE 16384
+#endif
+
+// most fds reported by one epoll_wait
+#ifndef SIMPLEHDLC_EPOLL_MAX_EVENTS
+#define SIMPLEHDLC_EPOLL_MAX_EVENTS 64
+#endif
+
+typedef struct simplehdlc_epoll_link simplehdlc_epoll_link_t;
+
+typedef struct {
+    // called with the good packets decoded from one read, in order. the payloads are only valid for the duration of
+    // the call.
+    void (*rx_batch_callback)(simplehdlc_epoll_link_t *link, const simplehdlc_frame_t *frames, size_t n_frames);
+
+    // optional; called once a send refused with SIMPLEHDLC_ERROR_WOULD_BLOCK can be retried
+    void (*tx_ready_callback)(simplehdlc_epoll_link_t *link);
+
+    // optional; called after the link has been removed from the loop because the other end closed it (error = 0) or
+    // reading or writing failed (error is the errno). the fd is not closed.
+    void (*closed_callback)(simplehdlc_epoll_link_t *link, int error);
+} simplehdlc_epoll_callbacks_t;
+
+typedef struct {
+    int epoll_fd;
+    simplehdlc_epoll_callbacks_t callbacks;
+
+    // links with queued packets which have not been written yet
+    simplehdlc_epoll_link_t *pending;
+
+    uint8_t read_buffer[SIMPLEHDLC_EPOLL_READ_SIZE];
+    uint8_t arena[SIMPLEHDLC_EPOLL_ARENA_SIZE];
+} simplehdlc_epoll_t;
+
+struct simplehdlc_epoll_link {
+    int fd;
+    bool is_socket;
+    simplehdlc_epoll_t *loop; // NULL once removed
+    simplehdlc_context_t context;
+
+    // TX queue, a ring of encoded bytes
+    uint8_t *tx_buffer;
+    size_t tx_buffer_len;
+    size_t tx_head;
+    size_t tx_count;
+
+    bool tx_blocked; // a send has been refused since the queue last drained
+    bool tx_polling; // waiting for the fd to become writable
+    bool tx_pending; // on the loop's pending list
+    simplehdlc_epoll_link_t *next_pending;
+
+    void *user_ptr;
+};
+
+// returns SIMPLEHDLC_ERROR_IO (with errno set) if the epoll instance cannot be created
+simplehdlc_error_code_t simplehdlc_epoll_init(simplehdlc_epoll_t *loop, const simplehdlc_epoll_callbacks_t *callbacks);
+
+// closes the epoll instance; the links' fds are left open
+void simplehdlc_epoll_deinit(simplehdlc_epoll_t *loop);
+
+// makes fd non-blocking and starts receiving on it. rx_buffer is the parse buffer, and limits the size of packets
+// which can be received; tx_buffer holds the TX queue. both must outlive the link.
+simplehdlc_error_code_t
+simplehdlc_epoll_add(simplehdlc_epoll_t *loop, simplehdlc_epoll_link_t *link, int fd, uint8_t *rx_buffer,
+                     size_t rx_buffer_len, uint8_t *tx_buffer, size_t tx_buffer_len, void *user_ptr);
+
+// stops using the link; queued packets which have not been written are discarded. may be called from within any
+// callback, but the link must not be freed until simplehdlc_epoll_poll (or simplehdlc_epoll_flush) returns.
+void simplehdlc_epoll_remove(simplehdlc_epoll_link_t *link);
+
+// queues a packet, which is written by the next simplehdlc_epoll_poll or simplehdlc_epoll_flush. returns
+// SIMPLEHDLC_ERROR_WOULD_BLOCK, without queueing anything, if the TX queue does not have room for it right now, or
+// SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL if it never will. returns SIMPLEHDLC_ERROR_IO once the link has been removed, and
+// passes on any error from encoding the packet, again without queueing anything.
+simplehdlc_error_code_t simplehdlc_epoll_send(simplehdlc_epoll_link_t *link, const uint8_t *payload, uint16_t len);
+
+// writes as much of every link's queued packets as the fds will take now
+void simplehdlc_epoll_flush(simplehdlc_epoll_t *loop);
+
+// flushes, waits up to timeout_ms (-1 for no limit) for fds to become ready, handles them, then flushes again. returns
+// the number of ready fds, or -1 with errno set if epoll_wait fails.
+int simplehdlc_epoll_poll(simplehdlc_epoll_t *loop, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //SIMPLEHDLC_SIMPLEHDLC_EPOLL_H
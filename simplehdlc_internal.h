@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_INTERNAL_H
+#define SIMPLEHDLC_SIMPLEHDLC_INTERNAL_H
+
+// shared between the library's own sources; not part of its interface
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "simplehdlc.h"
+
+// escaping shared by the encoders (defined in simplehdlc.c): the size of len bytes once escaped, and writing them
+// escaped to out, which returns how many bytes that took
+size_t simplehdlc_escaped_size(const uint8_t *bytes, size_t len);
+size_t simplehdlc_put_escaped(uint8_t *out, const uint8_t *bytes, size_t len);
+
+// for receivers which keep their own packet buffers, such as simplehdlc_mux: simplehdlc_parse_to_event (defined in
+// simplehdlc.c) runs the same state machine as simplehdlc_parse, in buffered mode, but stops after anything the caller
+// has to act on and returns the number of bytes taken. packets of more than rx_buffer_len bytes are dropped; rx_buffer
+// itself is only written once the length of a packet has been received, so it may be pointed at a buffer for that
+// packet then, or the packet dropped by setting state to SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER.
+typedef enum {
+    SIMPLEHDLC_PARSE_EVENT_NONE = 0, // all of data has been taken
+    SIMPLEHDLC_PARSE_EVENT_BOUNDARY, // a boundary marker, which abandons any packet in progress
+    SIMPLEHDLC_PARSE_EVENT_LENGTH, // a packet of expected_len - 4 bytes has started
+    SIMPLEHDLC_PARSE_EVENT_FRAME_OK, // a good packet of rx_count - 4 bytes is in rx_buffer
+    SIMPLEHDLC_PARSE_EVENT_FRAME_DROPPED, // a packet failed its CRC or was too large
+} simplehdlc_parse_event_t;
+
+size_t simplehdlc_parse_to_event(simplehdlc_context_t *context, const uint8_t *data, size_t len,
+                                 simplehdlc_parse_event_t *event);
+
+#endif //SIMPLEHDLC_SIMPLEHDLC_INTERNAL_H
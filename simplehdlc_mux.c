@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "simplehdlc_mux.h"
+#include "simplehdlc_internal.h"
+
+// each link's state byte holds a hdlc_parser_state_t in the low bits and the parser's flags above it
+#define MUX_STATE_MASK 0x07
+#define MUX_ESCAPE_NEXT 0x08
+#define MUX_COBS 0x10
+#define MUX_COBS_MARKER 0x20
+
+simplehdlc_error_code_t
+simplehdlc_mux_init(simplehdlc_mux_t *mux, size_t n_streams, void *memory, size_t memory_len, uint8_t *slab,
+                    size_t slot_size, size_t n_slots, const simplehdlc_mux_callbacks_t *callbacks, void *user_ptr) {
+    if (memory_len < SIMPLEHDLC_MUX_MEMORY_SIZE(n_streams, n_slots)) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+
+    // largest types first so that every array stays aligned
+    uint32_t *words = (uint32_t *) memory;
+    mux->crc32 = words;
+    mux->rx_crc32 = &words[n_streams];
+    mux->rx_count = &words[2 * n_streams];
+    mux->expected_len = &words[3 * n_streams];
+    mux->slot = &words[4 * n_streams];
+    mux->free_slots = &words[5 * n_streams];
+    mux->state = (uint8_t *) &words[5 * n_streams + n_slots];
+    mux->cobs_remaining = &mux->state[n_streams];
+    mux->varint_shift = &mux->state[2 * n_streams];
+
+    mux->n_streams = n_streams;
+    for (size_t i=0; i<n_streams; i++) {
+        mux->crc32[i] = 0;
+        mux->rx_crc32[i] = 0;
+        mux->rx_count[i] = 0;
+        mux->expected_len[i] = 0;
+        mux->slot[i] = SIMPLEHDLC_MUX_NO_SLOT;
+        mux->state[i] = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+        mux->cobs_remaining[i] = 0;
+        mux->varint_shift[i] = 0;
+    }
+
+    // packets are received into the slots, so the parser has no buffer of its own
+    simplehdlc_callbacks_t parser_callbacks = {0};
+    simplehdlc_init(&mux->parser, NULL, slot_size, &parser_callbacks, NULL);
+
+    mux->slab = slab;
+    mux->slot_size = slot_size;
+    mux->n_slots = n_slots;
+    for (size_t i=0; i<n_slots; i++) {
+        mux->free_slots[i] = n_slots - 1 - i;
+    }
+    mux->n_free_slots = n_slots;
+    mux->rx_no_slot_drops = 0;
+
+    mux->callbacks = *callbacks;
+    mux->user_ptr = user_ptr;
+
+    return SIMPLEHDLC_OK;
+}
+
+static inline uint32_t acquire_slot(simplehdlc_mux_t *mux) {
+    if (mux->n_free_slots == 0) return SIMPLEHDLC_MUX_NO_SLOT;
+    return mux->free_slots[--mux->n_free_slots];
+}
+
+static inline void release_slot(simplehdlc_mux_t *mux, uint32_t slot) {
+    if (slot != SIMPLEHDLC_MUX_NO_SLOT) mux->free_slots[mux->n_free_slots++] = slot;
+}
+
+void simplehdlc_mux_reset_stream(simplehdlc_mux_t *mux, uint32_t stream_id) {
+    release_slot(mux, mux->slot[stream_id]);
+    mux->slot[stream_id] = SIMPLEHDLC_MUX_NO_SLOT;
+    mux->state[stream_id] = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+}
+
+static inline void load_stream(simplehdlc_mux_t *mux, uint32_t stream_id) {
+    simplehdlc_context_t *parser = &mux->parser;
+    uint8_t state = mux->state[stream_id];
+
+    parser->state = (hdlc_parser_state_t) (state & MUX_STATE_MASK);
+    parser->escape_next = (state & MUX_ESCAPE_NEXT) != 0;
+    parser->rx_cobs = (state & MUX_COBS) != 0;
+    parser->rx_cobs_marker = (state & MUX_COBS_MARKER) != 0;
+    parser->rx_cobs_remaining = mux->cobs_remaining[stream_id];
+    parser->rx_varint_shift = mux->varint_shift[stream_id];
+    parser->expected_len = mux->expected_len[stream_id];
+    parser->rx_count = mux->rx_count[stream_id];
+    parser->rx_running_crc32 = mux->crc32[stream_id];
+    parser->rx_crc32 = mux->rx_crc32[stream_id];
+
+    // the CRC was brought up to date with the payload received when the link was last fed
+    parser->rx_crc32_count = 0;
+    if (parser->state == SIMPLEHDLC_STATE_CONSUMING_PAYLOAD) {
+        parser->rx_crc32_count = parser->rx_count < parser->expected_len - 4 ? parser->rx_count :
+                                 parser->expected_len - 4;
+    }
+
+    uint32_t slot = mux->slot[stream_id];
+    parser->rx_buffer = slot == SIMPLEHDLC_MUX_NO_SLOT ? NULL : &mux->slab[slot * mux->slot_size];
+}
+
+static inline void store_stream(simplehdlc_mux_t *mux, uint32_t stream_id) {
+    const simplehdlc_context_t *parser = &mux->parser;
+
+    mux->state[stream_id] = (uint8_t) (parser->state | (parser->escape_next ? MUX_ESCAPE_NEXT : 0) |
+                                       (parser->rx_cobs ? MUX_COBS : 0) |
+                                       (parser->rx_cobs_marker ? MUX_COBS_MARKER : 0));
+    mux->cobs_remaining[stream_id] = parser->rx_cobs_remaining;
+    mux->varint_shift[stream_id] = parser->rx_varint_shift;
+    mux->expected_len[stream_id] = (uint32_t) parser->expected_len;
+    mux->rx_count[stream_id] = (uint32_t) parser->rx_count;
+    mux->crc32[stream_id] = parser->rx_running_crc32;
+    mux->rx_crc32[stream_id] = parser->rx_crc32;
+}
+
+static inline void release_stream_slot(simplehdlc_mux_t *mux, uint32_t stream_id) {
+    release_slot(mux, mux->slot[stream_id]);
+    mux->slot[stream_id] = SIMPLEHDLC_MUX_NO_SLOT;
+    mux->parser.rx_buffer = NULL;
+}
+
+// the link's state is loaded into the shared parser for the duration of the call and written back at the end, so only
+// the link being parsed is touched. the parser stops whenever a packet starts or ends, for the link to take or give
+// back a slot.
+void simplehdlc_mux_feed(simplehdlc_mux_t *mux, uint32_t stream_id, const uint8_t *data, size_t len) {
+    simplehdlc_context_t *parser = &mux->parser;
+    load_stream(mux, stream_id);
+
+    size_t i = 0;
+    while (i < len) {
+        simplehdlc_parse_event_t event;
+        i += simplehdlc_parse_to_event(parser, &data[i], len - i, &event);
+
+        switch (event) {
+            case SIMPLEHDLC_PARSE_EVENT_LENGTH:
+                if (parser->expected_len > 4) {
+                    uint32_t slot = acquire_slot(mux);
+                    if (slot == SIMPLEHDLC_MUX_NO_SLOT) {
+                        mux->rx_no_slot_drops++;
+                        parser->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+                        break;
+                    }
+                    mux->slot[stream_id] = slot;
+                    parser->rx_buffer = &mux->slab[slot * mux->slot_size];
+                }
+                break;
+
+            case SIMPLEHDLC_PARSE_EVENT_FRAME_OK:
+                mux->callbacks.rx_packet_callback(stream_id, parser->rx_buffer, (uint16_t) (parser->rx_count - 4),
+                                                  mux->user_ptr);
+                release_stream_slot(mux, stream_id);
+                break;
+
+            case SIMPLEHDLC_PARSE_EVENT_BOUNDARY:
+            case SIMPLEHDLC_PARSE_EVENT_FRAME_DROPPED:
+                release_stream_slot(mux, stream_id);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    store_stream(mux, stream_id);
+}
+
+void simplehdlc_mux_feed_batch(simplehdlc_mux_t *mux, const simplehdlc_mux_input_t *inputs, size_t n_inputs) {
+    for (size_t i=0; i<n_inputs; i++) {
+#if defined(__GNUC__)
+        // the links in a batch are usually scattered across the state arrays, so fetch the next one's state while
+        // this one is parsed
+        if (i + 1 < n_inputs) {
+            uint32_t next = inputs[i + 1].stream_id;
+            __builtin_prefetch(&mux->state[next]);
+            __builtin_prefetch(&mux->cobs_remaining[next]);
+            __builtin_prefetch(&mux->varint_shift[next]);
+            __builtin_prefetch(&mux->expected_len[next]);
+            __builtin_prefetch(&mux->rx_count[next]);
+            __builtin_prefetch(&mux->crc32[next]);
+            __builtin_prefetch(&mux->rx_crc32[next]);
+            __builtin_prefetch(&mux->slot[next]);
+        }
+#endif
+        simplehdlc_mux_feed(mux, inputs[i].stream_id, inputs[i].data, inputs[i].len);
+    }
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_MUX_H
+#define SIMPLEHDLC_SIMPLEHDLC_MUX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "simplehdlc.h"
+
+// receives on many links at once with one shared set of callbacks. rather than a simplehdlc_context_t and a parse
+// buffer per link, the parser state of each link is kept in a handful of arrays (23 bytes per link) and loaded into one
+// shared context while that link is parsed, and a packet only holds a buffer from a shared pool of fixed size slots
+// while it is being received. a packet which arrives while no slot is free, or which is larger than a slot, is dropped.
+// the state machine is simplehdlc_parse's, so every framing it accepts is received.
+
+// bytes of memory needed for the per-link state and the slot free list
+#define SIMPLEHDLC_MUX_MEMORY_SIZE(n_streams, n_slots) \
+    ((size_t) (n_streams) * (5 * sizeof(uint32_t) + 3 * sizeof(uint8_t)) + (size_t) (n_slots) * sizeof(uint32_t))
+
+#define SIMPLEHDLC_MUX_NO_SLOT UINT32_MAX
+
+typedef struct {
+    void (*rx_packet_callback)(uint32_t stream_id, const uint8_t *payload, uint16_t len, void *user_ptr);
+} simplehdlc_mux_callbacks_t;
+
+typedef struct {
+    size_t n_streams;
+
+    // per link state, indexed by stream id
+    uint32_t *crc32; // the CRC of the payload received so far
+    uint32_t *rx_crc32; // the CRC bytes received so far
+    uint32_t *rx_count;
+    uint32_t *expected_len;
+    uint32_t *slot;
+    uint8_t *state;
+    uint8_t *cobs_remaining;
+    uint8_t *varint_shift;
+
+    // the state machine, into which each link's state is loaded while it is parsed
+    simplehdlc_context_t parser;
+
+    uint8_t *slab;
+    size_t slot_size;
+    size_t n_slots;
+    uint32_t *free_slots;
+    size_t n_free_slots;
+
+    // number of packets dropped because every slot was in use
+    size_t rx_no_slot_drops;
+
+    simplehdlc_mux_callbacks_t callbacks;
+    void *user_ptr;
+} simplehdlc_mux_t;
+
+// one link's pending input, for simplehdlc_mux_feed_batch
+typedef struct {
+    uint32_t stream_id;
+    const uint8_t *data;
+    size_t len;
+} simplehdlc_mux_input_t;
+
+// memory must be aligned for uint32_t and at least SIMPLEHDLC_MUX_MEMORY_SIZE(n_streams, n_slots) bytes long, or
+// SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL is returned. slab holds n_slots slots of slot_size bytes each, and slot_size is
+// the largest payload which can be received.
+simplehdlc_error_code_t
+simplehdlc_mux_init(simplehdlc_mux_t *mux, size_t n_streams, void *memory, size_t memory_len, uint8_t *slab,
+                    size_t slot_size, size_t n_slots, const simplehdlc_mux_callbacks_t *callbacks, void *user_ptr);
+
+// parses data received on one link; rx_packet_callback is called with the stream id for every good packet, and the
+// payload is only valid for the duration of the call
+void simplehdlc_mux_feed(simplehdlc_mux_t *mux, uint32_t stream_id, const uint8_t *data, size_t len);
+
+// parses the pending input of several links in one call, in order
+void simplehdlc_mux_feed_batch(simplehdlc_mux_t *mux, const simplehdlc_mux_input_t *inputs, size_t n_inputs);
+
+// abandons any packet in progress on a link (e.g. when it disconnects) and returns its slot to the pool
+void simplehdlc_mux_reset_stream(simplehdlc_mux_t *mux, uint32_t stream_id);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //SIMPLEHDLC_SIMPLEHDLC_MUX_H
@@ -0,0 +1,375 @@
+/* SPDX-License-Identifier: MIT */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simplehdlc_pipeline.h"
+
+// keeps data written by different threads on different cache lines
+#define CACHE_ALIGNED __attribute__((aligned(64)))
+
+// packets handled per visit to a link before it goes to the back of the run queue, so a busy link cannot hold on to
+// a handler thread
+#define SIMPLEHDLC_PIPELINE_LINK_BATCH 32
+
+// attempts to take a link from the run queue before a handler thread goes to sleep
+#define SIMPLEHDLC_PIPELINE_SPINS 64
+
+// bounded multi-producer multi-consumer queue of 32 bit values (Vyukov); each cell's sequence number says whether it
+// is ready to be written or read at a given position
+typedef struct {
+    uint32_t sequence;
+    uint32_t value;
+} queue_cell_t;
+
+typedef struct {
+    queue_cell_t *cells;
+    uint32_t mask;
+    uint32_t enqueue_pos CACHE_ALIGNED;
+    uint32_t dequeue_pos CACHE_ALIGNED;
+} mpmc_queue_t;
+
+typedef struct {
+    uint32_t buffer;
+    uint32_t len;
+} packet_ref_t;
+
+typedef struct {
+    // only used by the I/O thread
+    simplehdlc_context_t context;
+    simplehdlc_pipeline_t *pipeline;
+    uint32_t id;
+    uint32_t buffer; // the pool buffer being parsed into
+
+    // single producer (the I/O thread) single consumer (the handler thread holding the link) queue of packets
+    packet_ref_t *queue;
+    uint32_t queue_mask;
+    uint32_t tail CACHE_ALIGNED;
+    uint32_t head CACHE_ALIGNED;
+
+    // set while the link is on the run queue or being handled, so only one handler thread has it at a time
+    uint8_t scheduled;
+} link_t;
+
+struct simplehdlc_pipeline {
+    simplehdlc_pipeline_config_t config;
+
+    uint8_t *buffers;
+    mpmc_queue_t free_buffers;
+    mpmc_queue_t run_queue;
+    link_t *links;
+
+    pthread_t *threads;
+    size_t n_threads;
+
+    // idle handler threads sleep here
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t sleepers;
+    bool stop;
+
+    uint64_t queued CACHE_ALIGNED;
+    uint64_t drops;
+    uint64_t handled CACHE_ALIGNED;
+};
+
+// calloc for the structs with CACHE_ALIGNED members, which need more alignment than malloc gives
+static void *calloc_cache_aligned(size_t n, size_t size) {
+    size_t len = (n * size + 63) & ~(size_t) 63;
+    void *p;
+    if (posix_memalign(&p, 64, len) != 0) return NULL;
+
+    memset(p, 0, len);
+    return p;
+}
+
+static uint32_t round_up_pow2(size_t n) {
+    uint32_t x = 1;
+    while (x < n) x <<= 1;
+    return x;
+}
+
+static bool queue_init(mpmc_queue_t *queue, size_t capacity) {
+    uint32_t n = round_up_pow2(capacity);
+    queue->cells = calloc(n, sizeof(queue_cell_t));
+    if (queue->cells == NULL) return false;
+
+    for (uint32_t i=0; i<n; i++) queue->cells[i].sequence = i;
+    queue->mask = n - 1;
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+    return true;
+}
+
+static bool queue_push(mpmc_queue_t *queue, uint32_t value) {
+    uint32_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    queue_cell_t *cell;
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        int32_t diff = (int32_t) (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->value = value;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool queue_pop(mpmc_queue_t *queue, uint32_t *value) {
+    uint32_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    queue_cell_t *cell;
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        int32_t diff = (int32_t) (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // empty
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    *value = cell->value;
+    __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static inline uint8_t *get_buffer(simplehdlc_pipeline_t *pipeline, uint32_t buffer) {
+    return &pipeline->buffers[(size_t) buffer * pipeline->config.buffer_size];
+}
+
+static void wake_handler(simplehdlc_pipeline_t *pipeline) {
+    // pairs with the fence in take_link: either a sleeping thread is seen here, or it sees the link just queued
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pipeline->sleepers, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&pipeline->mutex);
+        pthread_cond_signal(&pipeline->cond);
+        pthread_mutex_unlock(&pipeline->mutex);
+    }
+}
+
+static void schedule_link(simplehdlc_pipeline_t *pipeline, link_t *link) {
+    if (!__atomic_exchange_n(&link->scheduled, 1, __ATOMIC_SEQ_CST)) {
+        // the run queue has room for every link, and each link is on it at most once
+        queue_push(&pipeline->run_queue, link->id);
+        wake_handler(pipeline);
+    }
+}
+
+// runs on the I/O thread from within simplehdlc_parse
+static void link_rx_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    link_t *link = (link_t *) user_ptr;
+    simplehdlc_pipeline_t *pipeline = link->pipeline;
+    bool block = pipeline->config.policy == SIMPLEHDLC_PIPELINE_BLOCK;
+    (void) payload;
+
+    uint32_t tail = link->tail;
+    while (tail - __atomic_load_n(&link->head, __ATOMIC_ACQUIRE) > link->queue_mask) {
+        if (!block) {
+            __atomic_add_fetch(&pipeline->drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        sched_yield();
+    }
+
+    uint32_t next_buffer;
+    while (!queue_pop(&pipeline->free_buffers, &next_buffer)) {
+        if (!block) {
+            __atomic_add_fetch(&pipeline->drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        sched_yield();
+    }
+
+    // the packet is handed over in the buffer it was parsed into, and parsing carries on into a fresh one.
+    // simplehdlc_parse reads rx_buffer from the context again after calling rx_packet_callback.
+    link->queue[tail & link->queue_mask].buffer = link->buffer;
+    link->queue[tail & link->queue_mask].len = len;
+    __atomic_store_n(&link->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    link->buffer = next_buffer;
+    link->context.rx_buffer = get_buffer(pipeline, next_buffer);
+
+    __atomic_store_n(&pipeline->queued, pipeline->queued + 1, __ATOMIC_RELAXED);
+    schedule_link(pipeline, link);
+}
+
+static void handle_link(simplehdlc_pipeline_t *pipeline, link_t *link) {
+    uint32_t head = __atomic_load_n(&link->head, __ATOMIC_ACQUIRE);
+
+    while (1) {
+        uint32_t tail = __atomic_load_n(&link->tail, __ATOMIC_ACQUIRE);
+        size_t n = 0;
+
+        while (head != tail && n < SIMPLEHDLC_PIPELINE_LINK_BATCH) {
+            packet_ref_t packet = link->queue[head & link->queue_mask];
+            pipeline->config.handler(link->id, get_buffer(pipeline, packet.buffer), packet.len,
+                                     pipeline->config.user_ptr);
+
+            // the free list has room for every buffer
+            queue_push(&pipeline->free_buffers, packet.buffer);
+            __atomic_store_n(&link->head, ++head, __ATOMIC_RELEASE);
+            n++;
+        }
+        __atomic_add_fetch(&pipeline->handled, n, __ATOMIC_RELEASE);
+
+        if (n == SIMPLEHDLC_PIPELINE_LINK_BATCH) {
+            // still holding the link, so it goes straight back on the run queue
+            queue_push(&pipeline->run_queue, link->id);
+            wake_handler(pipeline);
+            return;
+        }
+
+        // let go of the link, then check for a packet which arrived before the I/O thread could see that
+        __atomic_store_n(&link->scheduled, 0, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&link->tail, __ATOMIC_SEQ_CST) == head) return;
+        if (__atomic_exchange_n(&link->scheduled, 1, __ATOMIC_SEQ_CST)) return;
+    }
+}
+
+// returns false once the pipeline is stopping and there is nothing left to handle
+static bool take_link(simplehdlc_pipeline_t *pipeline, uint32_t *id) {
+    for (int i=0; i<SIMPLEHDLC_PIPELINE_SPINS; i++) {
+        if (queue_pop(&pipeline->run_queue, id)) return true;
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    __atomic_add_fetch(&pipeline->sleepers, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    bool taken;
+    while (!(taken = queue_pop(&pipeline->run_queue, id)) && !pipeline->stop) {
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+
+    __atomic_sub_fetch(&pipeline->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return taken;
+}
+
+static void *handler_thread(void *arg) {
+    simplehdlc_pipeline_t *pipeline = (simplehdlc_pipeline_t *) arg;
+    uint32_t id;
+
+    while (take_link(pipeline, &id)) handle_link(pipeline, &pipeline->links[id]);
+    return NULL;
+}
+
+static void stop_threads(simplehdlc_pipeline_t *pipeline) {
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->stop = true;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    for (size_t i=0; i<pipeline->n_threads; i++) pthread_join(pipeline->threads[i], NULL);
+    pipeline->n_threads = 0;
+}
+
+static void free_pipeline(simplehdlc_pipeline_t *pipeline) {
+    if (pipeline->links != NULL) {
+        for (size_t i=0; i<pipeline->config.n_links; i++) free(pipeline->links[i].queue);
+    }
+
+    pthread_cond_destroy(&pipeline->cond);
+    pthread_mutex_destroy(&pipeline->mutex);
+    free(pipeline->threads);
+    free(pipeline->links);
+    free(pipeline->run_queue.cells);
+    free(pipeline->free_buffers.cells);
+    free(pipeline->buffers);
+    free(pipeline);
+}
+
+simplehdlc_error_code_t
+simplehdlc_pipeline_create(simplehdlc_pipeline_t **pipeline_out, const simplehdlc_pipeline_config_t *config) {
+    if (config->handler == NULL) return SIMPLEHDLC_ERROR_CALLBACK_MISSING;
+    if (config->n_buffers <= config->n_links || config->buffer_size == 0) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+
+    simplehdlc_pipeline_t *pipeline = calloc_cache_aligned(1, sizeof(simplehdlc_pipeline_t));
+    if (pipeline == NULL) return SIMPLEHDLC_ERROR_OUT_OF_MEMORY;
+
+    pipeline->config = *config;
+    if (pipeline->config.n_threads == 0) pipeline->config.n_threads = 1;
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->cond, NULL);
+
+    pipeline->buffers = malloc(config->n_buffers * config->buffer_size);
+    pipeline->links = calloc_cache_aligned(config->n_links, sizeof(link_t));
+    pipeline->threads = calloc(pipeline->config.n_threads, sizeof(pthread_t));
+    if (pipeline->buffers == NULL || pipeline->links == NULL || pipeline->threads == NULL ||
+        !queue_init(&pipeline->free_buffers, config->n_buffers) || !queue_init(&pipeline->run_queue, config->n_links)) {
+        free_pipeline(pipeline);
+        return SIMPLEHDLC_ERROR_OUT_OF_MEMORY;
+    }
+
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = link_rx_callback;
+
+    uint32_t queue_len = round_up_pow2(config->link_queue_len ? config->link_queue_len : 1);
+    for (size_t i=0; i<config->n_links; i++) {
+        link_t *link = &pipeline->links[i];
+        link->queue = calloc(queue_len, sizeof(packet_ref_t));
+        if (link->queue == NULL) {
+            free_pipeline(pipeline);
+            return SIMPLEHDLC_ERROR_OUT_OF_MEMORY;
+        }
+        link->queue_mask = queue_len - 1;
+        link->pipeline = pipeline;
+        link->id = i;
+        link->buffer = i;
+        simplehdlc_init(&link->context, get_buffer(pipeline, i), config->buffer_size, &callbacks, link);
+    }
+
+    for (size_t i=config->n_links; i<config->n_buffers; i++) queue_push(&pipeline->free_buffers, i);
+
+    for (size_t i=0; i<pipeline->config.n_threads; i++) {
+        if (pthread_create(&pipeline->threads[i], NULL, handler_thread, pipeline) != 0) {
+            stop_threads(pipeline);
+            free_pipeline(pipeline);
+            return SIMPLEHDLC_ERROR_IO;
+        }
+        pipeline->n_threads++;
+    }
+
+    *pipeline_out = pipeline;
+    return SIMPLEHDLC_OK;
+}
+
+void simplehdlc_pipeline_destroy(simplehdlc_pipeline_t *pipeline) {
+    simplehdlc_pipeline_drain(pipeline);
+    stop_threads(pipeline);
+    free_pipeline(pipeline);
+}
+
+void simplehdlc_pipeline_parse(simplehdlc_pipeline_t *pipeline, uint32_t link_id, const uint8_t *data, size_t len) {
+    simplehdlc_parse(&pipeline->links[link_id].context, data, len);
+}
+
+void simplehdlc_pipeline_drain(simplehdlc_pipeline_t *pipeline) {
+    uint64_t queued = __atomic_load_n(&pipeline->queued, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&pipeline->handled, __ATOMIC_ACQUIRE) != queued) sched_yield();
+}
+
+uint64_t simplehdlc_pipeline_get_drops(const simplehdlc_pipeline_t *pipeline) {
+    return __atomic_load_n(&pipeline->drops, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_PIPELINE_H
+#define SIMPLEHDLC_SIMPLEHDLC_PIPELINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "simplehdlc.h"
+
+// optional multi-threaded receive pipeline (POSIX threads, GCC/clang atomics). one I/O thread parses the input of
+// many links with simplehdlc_pipeline_parse, and the packets are handled on a pool of handler threads, so a slow
+// handler does not hold up the parser. packets are received straight into buffers from a shared pool and handed over
+// by reference, through a lock-free queue per link. the packets of each link are handled one at a time and in order,
+// while different links are handled in parallel.
+//
+// when a packet completes while the pool has no free buffer or its link's queue is full, it is either dropped
+// (SIMPLEHDLC_PIPELINE_DROP) or the I/O thread waits for room (SIMPLEHDLC_PIPELINE_BLOCK), which pushes back on
+// whatever it is reading from.
+
+typedef enum {
+    SIMPLEHDLC_PIPELINE_DROP = 0,
+    SIMPLEHDLC_PIPELINE_BLOCK = 1
+} simplehdlc_pipeline_policy_t;
+
+typedef struct {
+    size_t n_links;
+    size_t n_threads;
+
+    // every link holds one buffer for the packet it is receiving, so n_buffers must be larger than n_links; the rest
+    // are shared by the packets waiting to be handled. buffer_size is the largest payload which can be received.
+    size_t n_buffers;
+    size_t buffer_size;
+
+    // most packets waiting to be handled per link, rounded up to a power of two
+    size_t link_queue_len;
+
+    simplehdlc_pipeline_policy_t policy;
+
+    // called on a handler thread for every good packet. calls for one link never overlap and are in the order the
+    // packets were received; the payload is only valid for the duration of the call.
+    void (*handler)(uint32_t link_id, const uint8_t *payload, uint16_t len, void *user_ptr);
+    void *user_ptr;
+} simplehdlc_pipeline_config_t;
+
+typedef struct simplehdlc_pipeline simplehdlc_pipeline_t;
+
+// allocates the pipeline and starts its handler threads. returns SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL if n_buffers is
+// not larger than n_links, SIMPLEHDLC_ERROR_CALLBACK_MISSING if there is no handler, SIMPLEHDLC_ERROR_OUT_OF_MEMORY if
+// allocation fails and SIMPLEHDLC_ERROR_IO if a thread cannot be started.
+simplehdlc_error_code_t
+simplehdlc_pipeline_create(simplehdlc_pipeline_t **pipeline, const simplehdlc_pipeline_config_t *config);
+
+// waits for the packets already handed over to be handled, stops the handler threads and frees the pipeline
+void simplehdlc_pipeline_destroy(simplehdlc_pipeline_t *pipeline);
+
+// parses data received on a link. must only be called from one thread at a time.
+void simplehdlc_pipeline_parse(simplehdlc_pipeline_t *pipeline, uint32_t link_id, const uint8_t *data, size_t len);
+
+// waits until every packet handed over so far has been handled; call from the thread which parses
+void simplehdlc_pipeline_drain(simplehdlc_pipeline_t *pipeline);
+
+// number of packets dropped under SIMPLEHDLC_PIPELINE_DROP
+uint64_t simplehdlc_pipeline_get_drops(const simplehdlc_pipeline_t *pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //SIMPLEHDLC_SIMPLEHDLC_PIPELINE_H
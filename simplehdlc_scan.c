@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+
+// bulk scanning for the reserved bytes, used to skip over clean runs of payload data
+//
+// SSE2/AVX2 are used when the compiler targets them, otherwise the data is checked one machine word at a time.
+// define SIMPLEHDLC_SCAN_PORTABLE to force the word-at-a-time version.
+
+#include <string.h>
+
+#include "simplehdlc.h"
+#include "simplehdlc_scan.h"
+
+#if !defined(SIMPLEHDLC_SCAN_PORTABLE) && (defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64))
+#include <immintrin.h>
+#define SIMPLEHDLC_SCAN_SIMD
+#endif
+
+static size_t scan_reserved_bytewise(const uint8_t *data, size_t len) {
+    for (size_t i=0; i<len; i++) {
+        if (data[i] == SIMPLEHDLC_BOUNDARY_MARKER || data[i] == SIMPLEHDLC_ESCAPE_MARKER) return i;
+    }
+    return len;
+}
+
+#ifdef SIMPLEHDLC_SCAN_SIMD
+
+static inline unsigned int first_set_bit(uint32_t mask) {
+#if defined(__GNUC__)
+    return (unsigned int) __builtin_ctz(mask);
+#else
+    unsigned int n = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+size_t simplehdlc_scan_reserved(const uint8_t *data, size_t len) {
+    size_t i = 0;
+
+#ifdef __AVX2__
+    const __m256i boundary32 = _mm256_set1_epi8((char) SIMPLEHDLC_BOUNDARY_MARKER);
+    const __m256i escape32 = _mm256_set1_epi8((char) SIMPLEHDLC_ESCAPE_MARKER);
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) &data[i]);
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, boundary32), _mm256_cmpeq_epi8(v, escape32)));
+        if (mask) return i + first_set_bit(mask);
+    }
+#endif
+
+    const __m128i boundary16 = _mm_set1_epi8((char) SIMPLEHDLC_BOUNDARY_MARKER);
+    const __m128i escape16 = _mm_set1_epi8((char) SIMPLEHDLC_ESCAPE_MARKER);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &data[i]);
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(v, boundary16), _mm_cmpeq_epi8(v, escape16)));
+        if (mask) return i + first_set_bit(mask);
+    }
+
+    return i + scan_reserved_bytewise(&data[i], len - i);
+}
+
+#else
+
+#define SIMPLEHDLC_SCAN_ONES ((uint64_t) 0x0101010101010101ULL)
+#define SIMPLEHDLC_SCAN_HIGHS ((uint64_t) 0x8080808080808080ULL)
+
+// non-zero if any byte of word is zero; may also flag bytes above a zero byte, which is fine here as a hit only
+// sends us to the bytewise scan of that word
+static inline uint64_t has_zero_byte(uint64_t word) {
+    return (word - SIMPLEHDLC_SCAN_ONES) & ~word & SIMPLEHDLC_SCAN_HIGHS;
+}
+
+size_t simplehdlc_scan_reserved(const uint8_t *data, size_t len) {
+    const uint64_t boundary = SIMPLEHDLC_SCAN_ONES * SIMPLEHDLC_BOUNDARY_MARKER;
+    const uint64_t escape = SIMPLEHDLC_SCAN_ONES * SIMPLEHDLC_ESCAPE_MARKER;
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(word));
+
+        if (has_zero_byte(word ^ boundary) | has_zero_byte(word ^ escape)) {
+            return i + scan_reserved_bytewise(&data[i], 8);
+        }
+    }
+
+    return i + scan_reserved_bytewise(&data[i], len - i);
+}
+
+#endif
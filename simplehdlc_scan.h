@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_SCAN_H
+#define SIMPLEHDLC_SIMPLEHDLC_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// returns the index of the first boundary or escape marker in data, or len if there is none
+size_t simplehdlc_scan_reserved(const uint8_t *data, size_t len);
+
+#endif //SIMPLEHDLC_SIMPLEHDLC_SCAN_H
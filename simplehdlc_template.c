@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+
+#include "simplehdlc_template.h"
+#include "simplehdlc_crc32.h"
+#include "simplehdlc_internal.h"
+
+static inline void put_u32_be(uint8_t *out, uint32_t x) {
+    out[0] = (x & 0xFF000000) >> 24;
+    out[1] = (x & 0xFF0000) >> 16;
+    out[2] = (x & 0xFF00) >> 8;
+    out[3] = x & 0xFF;
+}
+
+simplehdlc_error_code_t
+simplehdlc_template_init(simplehdlc_template_t *tmpl, uint8_t *frame_buffer, size_t frame_buffer_len, uint8_t *payload,
+                         uint16_t payload_len, simplehdlc_template_field_t *fields, size_t n_fields) {
+    size_t end = 0;
+    for (size_t i=0; i<n_fields; i++) {
+        if (fields[i].offset < end || fields[i].len > payload_len - fields[i].offset) {
+            return SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH;
+        }
+        end = fields[i].offset + fields[i].len;
+    }
+
+    size_t frame_len;
+    simplehdlc_error_code_t error;
+    error = simplehdlc_encode_to_buffer_with_framing(frame_buffer, frame_buffer_len, &frame_len, payload, payload_len,
+                                                     SIMPLEHDLC_FRAMING_ESCAPED);
+    if (error != SIMPLEHDLC_OK) return error;
+
+    memset(tmpl, 0, sizeof(simplehdlc_template_t));
+    tmpl->frame = frame_buffer;
+    tmpl->frame_len = frame_len;
+    tmpl->frame_buffer_len = frame_buffer_len;
+    tmpl->payload = payload;
+    tmpl->payload_len = payload_len;
+    tmpl->crc32 = simplehdlc_compute_crc32(payload, payload_len);
+    tmpl->fields = fields;
+    tmpl->n_fields = n_fields;
+
+    uint8_t trailer[4];
+    put_u32_be(trailer, tmpl->crc32);
+    tmpl->crc_offset = frame_len - simplehdlc_escaped_size(trailer, sizeof(trailer));
+
+    // every payload byte before a field takes one byte in the frame, or two if it is escaped
+    uint8_t header[2] = {(payload_len & 0xFF00) >> 8, payload_len & 0xFF};
+    size_t encoded_offset = 1 + simplehdlc_escaped_size(header, sizeof(header));
+    size_t offset = 0;
+    for (size_t i=0; i<n_fields; i++) {
+        simplehdlc_template_field_t *f = &fields[i];
+        encoded_offset += simplehdlc_escaped_size(&payload[offset], f->offset - offset);
+        f->encoded_offset = encoded_offset;
+        f->encoded_len = simplehdlc_escaped_size(&payload[f->offset], f->len);
+        f->crc_factor = simplehdlc_crc32_shift_factor(payload_len - f->offset - f->len);
+
+        encoded_offset += f->encoded_len;
+        offset = f->offset + f->len;
+    }
+
+    return SIMPLEHDLC_OK;
+}
+
+simplehdlc_error_code_t simplehdlc_template_set_field(simplehdlc_template_t *tmpl, size_t field, const uint8_t *data) {
+    simplehdlc_template_field_t *f = &tmpl->fields[field];
+    uint8_t *old = &tmpl->payload[f->offset];
+
+    // the CRC changes by the CRC of the change to the field, carried through the rest of the payload
+    uint32_t crc_change = simplehdlc_compute_crc32(old, f->len) ^ simplehdlc_compute_crc32(data, f->len);
+    uint32_t crc32 = tmpl->crc32 ^ simplehdlc_crc32_shift(crc_change, f->crc_factor);
+
+    uint8_t trailer[4];
+    put_u32_be(trailer, crc32);
+    size_t encoded_len = simplehdlc_escaped_size(data, f->len);
+    size_t rest = f->encoded_offset + f->encoded_len;
+    size_t rest_len = tmpl->crc_offset - rest;
+    size_t frame_len = f->encoded_offset + encoded_len + rest_len + simplehdlc_escaped_size(trailer, sizeof(trailer));
+    if (frame_len > tmpl->frame_buffer_len) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+
+    // the field has gained or lost escapes, so the rest of the payload moves to make room
+    if (encoded_len != f->encoded_len) {
+        memmove(&tmpl->frame[f->encoded_offset + encoded_len], &tmpl->frame[rest], rest_len);
+        for (size_t i=field+1; i<tmpl->n_fields; i++) {
+            tmpl->fields[i].encoded_offset = tmpl->fields[i].encoded_offset + encoded_len - f->encoded_len;
+        }
+        tmpl->crc_offset = f->encoded_offset + encoded_len + rest_len;
+        f->encoded_len = encoded_len;
+    }
+
+    simplehdlc_put_escaped(&tmpl->frame[f->encoded_offset], data, f->len);
+    simplehdlc_put_escaped(&tmpl->frame[tmpl->crc_offset], trailer, sizeof(trailer));
+    memmove(old, data, f->len);
+    tmpl->crc32 = crc32;
+    tmpl->frame_len = frame_len;
+
+    return SIMPLEHDLC_OK;
+}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_TEMPLATE_H
+#define SIMPLEHDLC_SIMPLEHDLC_TEMPLATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "simplehdlc.h"
+
+// optional frame templates, for packets which are sent again and again with only a few fields changed (e.g. a
+// telemetry packet with a counter and some readings). the payload is encoded once, and each later change to a field
+// rewrites just that field's encoded bytes and the CRC in the frame, so the frame is always ready to send. the CRC is
+// patched from the old and new field bytes alone (see simplehdlc_crc32_shift), so the cost of an update follows the
+// size of the field, not of the frame, unless the field gains or loses escapes: then the rest of the frame after it
+// moves along to match.
+//
+// escaped framing (SIMPLEHDLC_FRAMING_ESCAPED) only. all memory is provided by the caller.
+
+typedef struct {
+    // set by the caller: where the field sits in the payload
+    uint16_t offset;
+    uint16_t len;
+
+    // set by simplehdlc_template_init
+    uint32_t crc_factor; // carries a change to the field through the payload after it into the CRC
+    size_t encoded_offset; // where the field's escaped bytes start in the frame
+    size_t encoded_len;
+} simplehdlc_template_field_t;
+
+typedef struct {
+    // the encoded frame, ready to send, is frame_len bytes at frame
+    uint8_t *frame;
+    size_t frame_len;
+    size_t frame_buffer_len;
+
+    // the payload the frame holds, kept up to date by simplehdlc_template_set_field
+    uint8_t *payload;
+    uint16_t payload_len;
+
+    uint32_t crc32;
+    size_t crc_offset; // where the escaped CRC starts in the frame
+
+    simplehdlc_template_field_t *fields;
+    size_t n_fields;
+} simplehdlc_template_t;
+
+// encodes payload into frame_buffer, and works out where each of the fields ends up. the fields must be in order of
+// offset, must not overlap and must lie inside the payload, or SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH is returned.
+// the frame buffer needs room for the frame to grow as the fields change, so SIMPLEHDLC_MAX_ENCODED_SIZE(payload_len)
+// is enough for any update; SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL is returned if the frame does not fit at all. the payload
+// and fields are used in place and must outlive the template.
+simplehdlc_error_code_t
+simplehdlc_template_init(simplehdlc_template_t *tmpl, uint8_t *frame_buffer, size_t frame_buffer_len, uint8_t *payload,
+                         uint16_t payload_len, simplehdlc_template_field_t *fields, size_t n_fields);
+
+// sets a field to fields[field].len bytes of data, updating the payload and the frame. returns
+// SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL, and changes nothing, if the new frame would not fit in the frame buffer.
+simplehdlc_error_code_t simplehdlc_template_set_field(simplehdlc_template_t *tmpl, size_t field, const uint8_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //SIMPLEHDLC_SIMPLEHDLC_TEMPLATE_H
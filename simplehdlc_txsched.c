@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+
+#include "simplehdlc_txsched.h"
+
+static inline bool time_reached(uint32_t now, uint32_t t) {
+    return (int32_t) (now - t) >= 0;
+}
+
+static inline uint32_t record_len(const simplehdlc_txsched_queue_t *queue) {
+    uint32_t len;
+    memcpy(&len, &queue->buffer[queue->head], sizeof(len));
+    return len;
+}
+
+// when the oldest packet in the queue has to be written by
+static inline uint32_t record_deadline(const simplehdlc_txsched_queue_t *queue) {
+    uint32_t queued_at;
+    memcpy(&queued_at, &queue->buffer[queue->head + sizeof(uint32_t)], sizeof(queued_at));
+    return queued_at + queue->max_delay_us;
+}
+
+simplehdlc_error_code_t
+simplehdlc_txsched_init(simplehdlc_txsched_t *sched, const simplehdlc_txsched_config_t *config,
+                        const simplehdlc_txsched_callbacks_t *callbacks, void *user_ptr) {
+    if (config->n_queues == 0 || config->n_queues > SIMPLEHDLC_TXSCHED_MAX_QUEUES || config->write_buffer_len == 0) {
+        return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+    }
+    for (size_t i=0; i<config->n_queues; i++) {
+        if (config->queues[i].buffer_len <= SIMPLEHDLC_TXSCHED_RECORD_SIZE) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+    }
+    if (callbacks->now_callback == NULL || callbacks->write_callback == NULL) return SIMPLEHDLC_ERROR_CALLBACK_MISSING;
+
+    memset(sched, 0, sizeof(simplehdlc_txsched_t));
+    sched->callbacks = *callbacks;
+    sched->user_ptr = user_ptr;
+    sched->framing = config->framing;
+    sched->write_buffer = config->write_buffer;
+    sched->write_buffer_len = config->write_buffer_len;
+    sched->flush_bytes = config->flush_bytes ? config->flush_bytes : config->write_buffer_len;
+
+    sched->n_queues = config->n_queues;
+    for (size_t i=0; i<config->n_queues; i++) {
+        sched->queues[i].buffer = config->queues[i].buffer;
+        sched->queues[i].buffer_len = config->queues[i].buffer_len;
+        sched->queues[i].max_delay_us = config->queues[i].max_delay_us;
+    }
+
+    return SIMPLEHDLC_OK;
+}
+
+size_t simplehdlc_txsched_pending(const simplehdlc_txsched_t *sched) {
+    return sched->queued_bytes + sched->write_len;
+}
+
+// moves as much of the queue's oldest packet into the write buffer as fits, and returns whether that was all of it
+static bool move_head(simplehdlc_txsched_t *sched, simplehdlc_txsched_queue_t *queue) {
+    uint32_t len = record_len(queue);
+    const uint8_t *frame = &queue->buffer[queue->head + SIMPLEHDLC_TXSCHED_RECORD_SIZE];
+
+    // one marker is enough to separate two frames
+    if (queue->head_written == 0 && sched->last_was_marker && frame[0] == SIMPLEHDLC_BOUNDARY_MARKER) {
+        queue->head_written = 1;
+        sched->queued_bytes--;
+        sched->tx_markers_dropped++;
+    }
+
+    size_t n = len - queue->head_written;
+    if (n > sched->write_buffer_len - sched->write_len) n = sched->write_buffer_len - sched->write_len;
+
+    if (n) {
+        memcpy(&sched->write_buffer[sched->write_len], &frame[queue->head_written], n);
+        sched->write_len += n;
+        sched->queued_bytes -= n;
+        queue->head_written += n;
+        sched->last_was_marker = frame[queue->head_written - 1] == SIMPLEHDLC_BOUNDARY_MARKER;
+    }
+
+    if (queue->head_written < len) return false;
+
+    queue->head += SIMPLEHDLC_TXSCHED_RECORD_SIZE + len;
+    queue->head_written = 0;
+    return true;
+}
+
+// fills the write buffer from the queues, most urgent first, after finishing a packet which was cut off last time
+static void fill_write_buffer(simplehdlc_txsched_t *sched) {
+    if (sched->partial != NULL) {
+        if (!move_head(sched, sched->partial)) return;
+        sched->partial = NULL;
+    }
+
+    for (size_t i=0; i<sched->n_queues; i++) {
+        simplehdlc_txsched_queue_t *queue = &sched->queues[i];
+        while (queue->head != queue->tail) {
+            if (!move_head(sched, queue)) {
+                sched->partial = queue;
+                return;
+            }
+        }
+    }
+}
+
+// writes until everything queued has gone or the output is full, and returns whether everything went
+static bool write_out(simplehdlc_txsched_t *sched) {
+    while (1) {
+        if (sched->write_len == 0) fill_write_buffer(sched);
+        if (sched->write_len == 0) return true;
+
+        size_t n = sched->callbacks.write_callback(sched->write_buffer, sched->write_len, sched->user_ptr);
+        sched->tx_writes++;
+        sched->tx_bytes += n;
+
+        if (n < sched->write_len) {
+            sched->tx_short_writes++;
+            memmove(sched->write_buffer, &sched->write_buffer[n], sched->write_len - n);
+            sched->write_len -= n;
+            return false;
+        }
+        sched->write_len = 0;
+    }
+}
+
+// whether enough is queued to be worth a write, or a packet has waited as long as it may
+static bool write_due(const simplehdlc_txsched_t *sched, uint32_t now) {
+    if (sched->queued_bytes + sched->write_len >= sched->flush_bytes) return true;
+
+    for (size_t i=0; i<sched->n_queues; i++) {
+        const simplehdlc_txsched_queue_t *queue = &sched->queues[i];
+        if (queue->head != queue->tail && time_reached(now, record_deadline(queue))) return true;
+    }
+
+    return false;
+}
+
+// makes room at the tail of the queue for a record of max_size encoded bytes if it can, by moving the waiting records
+// to the start of the buffer, and returns the room there is
+static size_t queue_room(simplehdlc_txsched_queue_t *queue, size_t max_size) {
+    if (queue->head == queue->tail) {
+        queue->head = 0;
+        queue->tail = 0;
+    }
+
+    if (queue->buffer_len - queue->tail < SIMPLEHDLC_TXSCHED_RECORD_SIZE + max_size && queue->head > 0) {
+        memmove(queue->buffer, &queue->buffer[queue->head], queue->tail - queue->head);
+        queue->tail -= queue->head;
+        queue->head = 0;
+    }
+
+    size_t room = queue->buffer_len - queue->tail;
+    return room > SIMPLEHDLC_TXSCHED_RECORD_SIZE ? room - SIMPLEHDLC_TXSCHED_RECORD_SIZE : 0;
+}
+
+static simplehdlc_error_code_t put_packet(simplehdlc_txsched_t *sched, simplehdlc_txsched_queue_t *queue,
+                                          const uint8_t *data, size_t len, bool encoded, size_t *size) {
+    size_t max_size = len;
+    if (!encoded) {
+        max_size = sched->framing == SIMPLEHDLC_FRAMING_COBS ? SIMPLEHDLC_COBS_MAX_ENCODED_SIZE(len)
+                                                             : SIMPLEHDLC_MAX_ENCODED_SIZE(len);
+    }
+
+    size_t room = queue_room(queue, max_size);
+    if (room == 0) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+    uint8_t *out = &queue->buffer[queue->tail + SIMPLEHDLC_TXSCHED_RECORD_SIZE];
+
+    if (!encoded) {
+        return simplehdlc_encode_to_buffer_with_framing(out, room, size, data, (uint16_t) len, sched->framing);
+    }
+
+    if (len > room) return SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL;
+    memcpy(out, data, len);
+    *size = len;
+    return SIMPLEHDLC_OK;
+}
+
+static simplehdlc_error_code_t
+queue_packet(simplehdlc_txsched_t *sched, size_t index, const uint8_t *data, size_t len, bool encoded) {
+    simplehdlc_txsched_queue_t *queue = &sched->queues[index];
+    size_t size;
+
+    simplehdlc_error_code_t error = put_packet(sched, queue, data, len, encoded, &size);
+    if (error == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL && queue->head != queue->tail) {
+        // write out what is waiting to make room, unless the output is full, then try again
+        if (sched->write_len == 0) {
+            write_out(sched);
+            error = put_packet(sched, queue, data, len, encoded, &size);
+        }
+        if (error == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL && queue->head != queue->tail) {
+            error = SIMPLEHDLC_ERROR_WOULD_BLOCK;
+        }
+    }
+    if (error != SIMPLEHDLC_OK) return error;
+
+    uint32_t now = sched->callbacks.now_callback(sched->user_ptr);
+    uint32_t record[2] = {(uint32_t) size, now};
+    memcpy(&queue->buffer[queue->tail], record, sizeof(record));
+    queue->tail += SIMPLEHDLC_TXSCHED_RECORD_SIZE + size;
+    sched->queued_bytes += size;
+    sched->tx_packets++;
+
+    // after a short write the output is full, so nothing more is written until we are polled
+    if (sched->write_len == 0 && write_due(sched, now)) write_out(sched);
+    return SIMPLEHDLC_OK;
+}
+
+simplehdlc_error_code_t
+simplehdlc_txsched_send(simplehdlc_txsched_t *sched, size_t queue, const uint8_t *payload, uint16_t len) {
+    return queue_packet(sched, queue, payload, len, false);
+}
+
+simplehdlc_error_code_t
+simplehdlc_txsched_send_encoded(simplehdlc_txsched_t *sched, size_t queue, const uint8_t *data, size_t len) {
+    if (len == 0) return SIMPLEHDLC_OK;
+
+    return queue_packet(sched, queue, data, len, true);
+}
+
+uint32_t simplehdlc_txsched_poll(simplehdlc_txsched_t *sched) {
+    uint32_t now = sched->callbacks.now_callback(sched->user_ptr);
+
+    // a write cut short is retried whenever we are polled. if it is cut short again, nothing more goes out until the
+    // output can take more, so there is no deadline to wait for
+    if (sched->write_len || write_due(sched, now)) write_out(sched);
+    if (sched->write_len) return UINT32_MAX;
+
+    uint32_t wait = UINT32_MAX;
+    for (size_t i=0; i<sched->n_queues; i++) {
+        const simplehdlc_txsched_queue_t *queue = &sched->queues[i];
+        if (queue->head == queue->tail) continue;
+
+        uint32_t deadline = record_deadline(queue);
+        uint32_t remaining = time_reached(now, deadline) ? 0 : deadline - now;
+        if (remaining < wait) wait = remaining;
+    }
+
+    return wait;
+}
+
+simplehdlc_error_code_t simplehdlc_txsched_flush(simplehdlc_txsched_t *sched) {
+    return write_out(sched) ? SIMPLEHDLC_OK : SIMPLEHDLC_ERROR_WOULD_BLOCK;
+}
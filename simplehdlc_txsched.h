@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLEHDLC_SIMPLEHDLC_TXSCHED_H
+#define SIMPLEHDLC_SIMPLEHDLC_TXSCHED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "simplehdlc.h"
+
+// optional transmit scheduler: packets are encoded into one of several priority queues as they are sent, and written
+// out later, many at a time, with one call to write_callback (e.g. one write(2)) per write buffer full. a write starts
+// as soon as the queued bytes reach flush_bytes, or once the oldest packet in any queue has waited for that queue's
+// max_delay_us, so small packets are batched without any of them waiting longer than their queue allows. a queue with
+// no delay writes each of its packets straight away. every write takes everything queued, most urgent queue first, so
+// a control packet is never held up behind bulk packets which were queued before it but not yet written.
+//
+// the frames are written back to back. a frame's boundary marker is left out when the byte written before it is a
+// boundary marker already, e.g. when the frame before was queued with simplehdlc_txsched_send_encoded from a source
+// which closes its frames with a marker.
+//
+// all memory is provided by the caller. times are in microseconds from now_callback, and may wrap.
+
+#define SIMPLEHDLC_TXSCHED_MAX_QUEUES 8
+
+// queue bytes taken by each packet on top of its encoded size
+#define SIMPLEHDLC_TXSCHED_RECORD_SIZE 8
+
+typedef struct {
+    // holds the encoded packets waiting in the queue
+    uint8_t *buffer;
+    size_t buffer_len;
+
+    // longest a packet waits before it is written; 0 writes it straight away
+    uint32_t max_delay_us;
+} simplehdlc_txsched_queue_config_t;
+
+typedef struct {
+    // queue 0 is the most urgent
+    size_t n_queues;
+    simplehdlc_txsched_queue_config_t queues[SIMPLEHDLC_TXSCHED_MAX_QUEUES];
+
+    // queued packets are gathered here and passed to write_callback together. what is left in it after a short write
+    // goes out before anything else, however urgent, so it is best no bigger than the output can take at once.
+    uint8_t *write_buffer;
+    size_t write_buffer_len;
+
+    // queued bytes which start a write without waiting for any delay to run out; 0 gives write_buffer_len
+    size_t flush_bytes;
+
+    simplehdlc_framing_t framing;
+} simplehdlc_txsched_config_t;
+
+typedef struct {
+    uint32_t (*now_callback)(void *user_ptr);
+
+    // writes out data and returns how many bytes were taken; fewer than len (including 0) means the output is full
+    // for now, and the rest is offered again at the next simplehdlc_txsched_poll or simplehdlc_txsched_flush
+    size_t (*write_callback)(const uint8_t *data, size_t len, void *user_ptr);
+} simplehdlc_txsched_callbacks_t;
+
+typedef struct {
+    uint8_t *buffer;
+    size_t buffer_len;
+    uint32_t max_delay_us;
+
+    // each packet is a record of its encoded length and the time it was queued (both uint32_t), then its encoded bytes.
+    // the records from head to tail are waiting, and head_written bytes of the first one are in the write buffer.
+    size_t head;
+    size_t tail;
+    size_t head_written;
+} simplehdlc_txsched_queue_t;
+
+typedef struct {
+    simplehdlc_txsched_callbacks_t callbacks;
+    void *user_ptr;
+    simplehdlc_framing_t framing;
+
+    size_t n_queues;
+    simplehdlc_txsched_queue_t queues[SIMPLEHDLC_TXSCHED_MAX_QUEUES];
+    size_t queued_bytes; // encoded bytes in the queues which have not been moved to the write buffer
+    size_t flush_bytes;
+
+    uint8_t *write_buffer;
+    size_t write_buffer_len;
+    size_t write_len; // bytes in the write buffer which write_callback has not taken yet
+    bool last_was_marker; // the last byte moved to the write buffer was a boundary marker
+
+    // the queue whose oldest packet did not fit in the write buffer; it is finished before anything else is moved
+    simplehdlc_txsched_queue_t *partial;
+
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_writes; // calls to write_callback
+    uint64_t tx_short_writes; // calls to write_callback which did not take everything
+    uint64_t tx_markers_dropped;
+} simplehdlc_txsched_t;
+
+// returns SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL if n_queues is out of range or a buffer is empty, and
+// SIMPLEHDLC_ERROR_CALLBACK_MISSING without now_callback or write_callback
+simplehdlc_error_code_t
+simplehdlc_txsched_init(simplehdlc_txsched_t *sched, const simplehdlc_txsched_config_t *config,
+                        const simplehdlc_txsched_callbacks_t *callbacks, void *user_ptr);
+
+// encodes a packet into the given queue, and writes out everything queued if that is now due and no write has been
+// cut short since the last poll. returns SIMPLEHDLC_ERROR_WOULD_BLOCK, without queueing anything, if the queue does not
+// have room for it until more has been written, or SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL if it never will.
+simplehdlc_error_code_t
+simplehdlc_txsched_send(simplehdlc_txsched_t *sched, size_t queue, const uint8_t *payload, uint16_t len);
+
+// as simplehdlc_txsched_send, for bytes which are encoded already (such as frames from simplehdlc_encode_to_buffer).
+// they are written as they are, except that a leading boundary marker is left out if it follows another.
+simplehdlc_error_code_t
+simplehdlc_txsched_send_encoded(simplehdlc_txsched_t *sched, size_t queue, const uint8_t *data, size_t len);
+
+// writes out whatever has become due, and returns the number of microseconds until something else will be (UINT32_MAX
+// if nothing is queued). after a short write it returns UINT32_MAX, as nothing more is written until it is called
+// again: wait for the output to take more (e.g. for the fd to become writable), then poll.
+uint32_t simplehdlc_txsched_poll(simplehdlc_txsched_t *sched);
+
+// writes out everything queued now, whether it is due or not. returns SIMPLEHDLC_ERROR_WOULD_BLOCK if write_callback
+// did not take all of it.
+simplehdlc_error_code_t simplehdlc_txsched_flush(simplehdlc_txsched_t *sched);
+
+// encoded bytes waiting to be written, including any in the write buffer
+size_t simplehdlc_txsched_pending(const simplehdlc_txsched_t *sched);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //SIMPLEHDLC_SIMPLEHDLC_TXSCHED_H
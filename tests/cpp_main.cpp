@@ -0,0 +1,349 @@
+/* SPDX-License-Identifier: MIT */
+
+// checks the C++ header against the C library: both must produce and accept exactly the same bytes
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <setjmp.h>
+#include <vector>
+
+#include "simplehdlc.h"
+#include "simplehdlc_crc32.h"
+#include "simplehdlc.hpp"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#include "simplehdlc_coro.hpp"
+#endif
+
+// last, as its fail() macro clashes with the standard library headers
+#include <cmocka.h>
+
+static_assert(simplehdlc::crc32(std::array<std::uint8_t, 5>{1, 2, 3, 4, 5}) == 0x470B99F4);
+
+// a packet encoded at compile time
+static constexpr std::array<std::uint8_t, 12> constexpr_frame = [] {
+    std::array<std::uint8_t, 12> out{};
+    std::array<std::uint8_t, 2> payload{0x7E, 0x01};
+    simplehdlc::encode_to_buffer(out, payload);
+    return out;
+}();
+static_assert(constexpr_frame[0] == 0x7E && constexpr_frame[3] == 0x7D && constexpr_frame[4] == 0x5E);
+
+static std::uint32_t rng_state = 0x12345678;
+
+static std::uint32_t rng() {
+    // xorshift32
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static std::vector<std::uint8_t> random_payload(std::size_t max_len) {
+    std::vector<std::uint8_t> payload(rng() % (max_len + 1));
+    unsigned int escape_density = rng() % 4;
+    for (auto &b : payload) {
+        b = (escape_density && rng() % (escape_density * 8) == 0) ? ((rng() & 1) ? 0x7E : 0x7D) : rng();
+    }
+    return payload;
+}
+
+struct LogHandler {
+    std::vector<std::uint8_t> *log;
+
+    void operator()(std::span<const std::uint8_t> payload) const {
+        log->push_back(payload.size() >> 8);
+        log->push_back(payload.size() & 0xFF);
+        log->insert(log->end(), payload.begin(), payload.end());
+    }
+};
+
+struct VectorSink {
+    std::vector<std::uint8_t> *out;
+
+    void operator()(std::span<const std::uint8_t> data) const {
+        out->insert(out->end(), data.begin(), data.end());
+    }
+};
+
+static void c_log_callback(const std::uint8_t *payload, std::uint16_t len, void *user_ptr) {
+    LogHandler{static_cast<std::vector<std::uint8_t> *>(user_ptr)}(std::span<const std::uint8_t>(payload, len));
+}
+
+static void cpp_crc32_matches_c(void **state) {
+    (void) state;
+
+    for (int i=0; i<200; i++) {
+        auto data = random_payload(3000);
+        std::size_t split = data.empty() ? 0 : rng() % data.size();
+
+        std::uint32_t expected = simplehdlc_compute_crc32(data.data(), data.size());
+        assert_int_equal(simplehdlc::crc32(data), expected);
+
+        std::span<const std::uint8_t> all(data);
+        std::uint32_t crc = simplehdlc::crc32_update(0, all.first(split));
+        assert_int_equal(simplehdlc::crc32_update(crc, all.subspan(split)), expected);
+    }
+}
+
+static void cpp_encode_matches_c(void **state) {
+    (void) state;
+
+    std::vector<std::uint8_t> c_out(simplehdlc::max_encoded_size(3000));
+    std::vector<std::uint8_t> cpp_out(simplehdlc::max_encoded_size(3000));
+
+    std::vector<std::uint8_t> sink_out;
+    simplehdlc::Encoder<VectorSink> encoder(VectorSink{&sink_out});
+
+    for (int i=0; i<500; i++) {
+        auto payload = random_payload(3000);
+
+        std::size_t c_size;
+        assert_true(simplehdlc_encode_to_buffer(c_out.data(), c_out.size(), &c_size, payload.data(), payload.size()) ==
+                    SIMPLEHDLC_OK);
+
+        std::size_t cpp_size = simplehdlc::encode_to_buffer(cpp_out, payload);
+        assert_int_equal(cpp_size, c_size);
+        assert_memory_equal(cpp_out.data(), c_out.data(), c_size);
+
+        // one byte short is too small
+        assert_int_equal(simplehdlc::encode_to_buffer(std::span(cpp_out).first(c_size - 1), payload), 0);
+
+        sink_out.clear();
+        assert_true(encoder.encode(payload));
+        assert_int_equal(sink_out.size(), c_size);
+        assert_memory_equal(sink_out.data(), c_out.data(), c_size);
+    }
+
+    std::vector<std::uint8_t> too_long(0x10000);
+    assert_false(encoder.encode(too_long));
+    assert_int_equal(simplehdlc::encode_to_buffer(cpp_out, too_long), 0);
+}
+
+static void cpp_parse_matches_c(void **state) {
+    (void) state;
+
+    // C encoded packets of random size (some too large for the parse buffer), corrupted, cut short and separated by
+    // garbage
+    std::vector<std::uint8_t> stream;
+    std::vector<std::uint8_t> encoded(simplehdlc::max_encoded_size(600));
+    for (int i=0; i<500; i++) {
+        auto payload = random_payload(600);
+        std::size_t size;
+        simplehdlc_encode_to_buffer(encoded.data(), encoded.size(), &size, payload.data(), payload.size());
+
+        switch (rng() % 8) {
+            case 0: encoded[1 + rng() % (size - 1)] ^= 1 << (rng() % 8); break;
+            case 1: size = 1 + rng() % (size - 1); break;
+            default: break;
+        }
+        stream.insert(stream.end(), encoded.begin(), encoded.begin() + size);
+        for (std::uint32_t g=rng()%4; g>0; g--) stream.push_back(rng());
+    }
+
+    std::vector<std::uint8_t> c_log;
+    std::uint8_t rx_buffer[300];
+    simplehdlc_callbacks_t callbacks = {};
+    callbacks.rx_packet_callback = c_log_callback;
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &c_log);
+    simplehdlc_parse(&context, stream.data(), stream.size());
+    assert_true(c_log.size() > 0);
+
+    for (std::size_t max_chunk : {std::size_t(1), std::size_t(7), std::size_t(100), stream.size()}) {
+        std::vector<std::uint8_t> cpp_log;
+        simplehdlc::Parser<300, LogHandler> parser(LogHandler{&cpp_log});
+
+        std::span<const std::uint8_t> rest(stream);
+        while (!rest.empty()) {
+            std::size_t n = 1 + rng() % max_chunk;
+            if (n > rest.size()) n = rest.size();
+            parser.parse(rest.first(n));
+            rest = rest.subspan(n);
+        }
+
+        assert_int_equal(cpp_log.size(), c_log.size());
+        assert_memory_equal(cpp_log.data(), c_log.data(), c_log.size());
+    }
+}
+
+static void cpp_parse_drops_other_frame_types(void **state) {
+    (void) state;
+
+    // COBS and extended length frames are dropped whole, and the escaped frame after them is received
+    std::vector<std::uint8_t> payload(40);
+    for (std::size_t i=0; i<payload.size(); i++) payload[i] = i % 3 == 0 ? 0x7E : i;
+
+    std::vector<std::uint8_t> stream;
+    std::vector<std::uint8_t> encoded(SIMPLEHDLC_EXTENDED_MAX_ENCODED_SIZE(40));
+    std::size_t size;
+    assert_true(simplehdlc_encode_to_buffer_with_framing(encoded.data(), encoded.size(), &size, payload.data(), 40,
+                                                         SIMPLEHDLC_FRAMING_COBS) == SIMPLEHDLC_OK);
+    stream.insert(stream.end(), encoded.begin(), encoded.begin() + size);
+    for (simplehdlc_framing_t framing : {SIMPLEHDLC_FRAMING_ESCAPED, SIMPLEHDLC_FRAMING_COBS}) {
+        assert_true(simplehdlc_encode_to_buffer_extended(encoded.data(), encoded.size(), &size, payload.data(), 40,
+                                                         framing) == SIMPLEHDLC_OK);
+        stream.insert(stream.end(), encoded.begin(), encoded.begin() + size);
+    }
+    assert_true(simplehdlc_encode_to_buffer_with_framing(encoded.data(), encoded.size(), &size, payload.data(), 40,
+                                                         SIMPLEHDLC_FRAMING_ESCAPED) == SIMPLEHDLC_OK);
+    stream.insert(stream.end(), encoded.begin(), encoded.begin() + size);
+
+    std::vector<std::uint8_t> cpp_log;
+    simplehdlc::Parser<300, LogHandler> parser(LogHandler{&cpp_log});
+    parser.parse(stream);
+    assert_int_equal(cpp_log.size(), 2 + payload.size());
+    assert_memory_equal(&cpp_log[2], payload.data(), payload.size());
+}
+
+static void cpp_custom_markers(void **state) {
+    (void) state;
+
+    // SLIP style markers
+    std::vector<std::uint8_t> wire;
+    simplehdlc::Encoder<VectorSink, 0xC0, 0xDB> encoder(VectorSink{&wire});
+
+    std::vector<std::uint8_t> sent;
+    for (int i=0; i<50; i++) {
+        auto payload = random_payload(200);
+        for (auto &b : payload) {
+            if (rng() % 8 == 0) b = (rng() & 1) ? 0xC0 : 0xDB;
+        }
+
+        std::size_t start = wire.size();
+        assert_true(encoder.encode(payload));
+        for (std::size_t j=start+1; j<wire.size(); j++) assert_int_not_equal(wire[j], 0xC0);
+
+        std::vector<std::uint8_t> buffered(simplehdlc::max_encoded_size(payload.size()));
+        std::size_t size = simplehdlc::encode_to_buffer<0xC0, 0xDB>(buffered, payload);
+        assert_int_equal(size, wire.size() - start);
+        assert_memory_equal(buffered.data(), &wire[start], size);
+
+        LogHandler{&sent}(payload);
+    }
+
+    std::vector<std::uint8_t> received;
+    simplehdlc::Parser<200, LogHandler, 0xC0, 0xDB> parser(LogHandler{&received});
+    parser.parse(wire);
+    assert_int_equal(received.size(), sent.size());
+    assert_memory_equal(received.data(), sent.data(), sent.size());
+}
+
+#ifdef __linux__
+
+struct coro_test_state {
+    std::vector<std::vector<std::uint8_t>> payloads;
+    std::size_t sent = 0;
+    std::size_t received = 0;
+    std::size_t mismatches = 0;
+    std::size_t echoed = 0;
+    bool echo_done = false;
+    bool closed_seen = false;
+    simplehdlc_error_code_t send_after_close = SIMPLEHDLC_OK;
+};
+
+static simplehdlc::coro::Task coro_echo(simplehdlc::coro::Link &link, coro_test_state &test) {
+    while (auto frame = co_await link.next_frame()) {
+        // the received frame is sent straight back, so it must be copied if the send has to wait
+        if (co_await link.send(*frame) == SIMPLEHDLC_OK) test.echoed++;
+    }
+    test.echo_done = true;
+}
+
+static simplehdlc::coro::Task coro_sender(simplehdlc::coro::Link &link, coro_test_state &test) {
+    for (auto &payload : test.payloads) {
+        if (co_await link.send(payload) != SIMPLEHDLC_OK) break;
+        test.sent++;
+    }
+}
+
+static simplehdlc::coro::Task coro_receiver(simplehdlc::coro::Reactor &reactor, simplehdlc::coro::Link &link,
+                                            coro_test_state &test) {
+    while (test.received < test.payloads.size()) {
+        auto frame = co_await link.next_frame();
+        if (!frame) break;
+
+        auto &expected = test.payloads[test.received++];
+        if (frame->size() != expected.size() || !std::equal(frame->begin(), frame->end(), expected.begin())) {
+            test.mismatches++;
+        }
+    }
+    reactor.stop();
+}
+
+static simplehdlc::coro::Task coro_wait_for_close(simplehdlc::coro::Link &link, coro_test_state &test) {
+    auto frame = co_await link.next_frame();
+    test.closed_seen = !frame;
+
+    std::uint8_t payload[1] = {0};
+    test.send_after_close = co_await link.send(payload);
+}
+
+static void coro_test_loopback(void **state) {
+    (void) state;
+
+    coro_test_state test;
+    for (int i=0; i<2000; i++) test.payloads.push_back(random_payload(200));
+
+    int fds[2];
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    simplehdlc::coro::Reactor reactor;
+    assert_true(reactor.open() == SIMPLEHDLC_OK);
+
+    // the TX queues only hold a few packets, so both ends have to wait for them to drain
+    simplehdlc::coro::Link links[2];
+    for (int i=0; i<2; i++) assert_true(links[i].open(reactor, fds[i], 256, 1024) == SIMPLEHDLC_OK);
+
+    coro_echo(links[1], test);
+    coro_receiver(reactor, links[0], test);
+    coro_sender(links[0], test);
+    assert_true(reactor.run());
+
+    assert_int_equal(test.sent, test.payloads.size());
+    assert_int_equal(test.received, test.payloads.size());
+    assert_int_equal(test.echoed, test.payloads.size());
+    assert_int_equal(test.mismatches, 0);
+    assert_int_equal(links[0].dropped(), 0);
+
+    // a packet which can never fit in the TX queue is refused without waiting
+    std::vector<std::uint8_t> too_large(2000);
+    auto send = links[0].send(too_large);
+    assert_true(send.await_ready());
+    assert_true(send.await_resume() == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+
+    // closing one end wakes its coroutine, and the other end sees the socket close
+    coro_wait_for_close(links[0], test);
+    links[1].close();
+    assert_true(test.echo_done);
+    close(fds[1]);
+
+    while (!test.closed_seen) assert_true(reactor.poll(1000) >= 0);
+    assert_false(links[0].is_open());
+    assert_int_equal(links[0].error(), 0);
+    assert_true(test.send_after_close == SIMPLEHDLC_ERROR_IO);
+
+    close(fds[0]);
+}
+
+#endif
+
+int main() {
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test(cpp_crc32_matches_c),
+            cmocka_unit_test(cpp_encode_matches_c),
+            cmocka_unit_test(cpp_parse_matches_c),
+            cmocka_unit_test(cpp_parse_drops_other_frame_types),
+            cmocka_unit_test(cpp_custom_markers),
+#ifdef __linux__
+            cmocka_unit_test(coro_test_loopback),
+#endif
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -1,12 +1,36 @@
 /* SPDX-License-Identifier: MIT */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
+#include <string.h>
 #include <setjmp.h>
 #include <cmocka.h>
 
 #include "simplehdlc.h"
+#include "simplehdlc_mux.h"
+#include "simplehdlc_arq.h"
+#include "simplehdlc_txsched.h"
+#include "simplehdlc_template.h"
 #include "simplehdlc_crc32.h"
 
+#ifdef __linux__
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <pty.h>
+#include <sched.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "simplehdlc_epoll.h"
+#include "simplehdlc_pipeline.h"
+#include "simplehdlc_capture.h"
+#endif
+
 
 static void crc32_sanity_check(void **state) {
     uint8_t payload[5] = {1, 2, 3, 4, 5};
@@ -14,6 +38,88 @@ static void crc32_sanity_check(void **state) {
     assert_true(crc32 == 0x470B99F4); // calculated using python binascii module
 }
 
+static void crc32_engines_match_table(void **state) {
+    static const simplehdlc_crc32_engine_t engines[] = {
+            SIMPLEHDLC_CRC32_ENGINE_SLICE8, SIMPLEHDLC_CRC32_ENGINE_SLICE16, SIMPLEHDLC_CRC32_ENGINE_PCLMUL
+    };
+    static uint8_t data[70000];
+
+    uint32_t x = 0xDEADBEEF;
+    for (size_t i=0; i<sizeof(data); i++) {
+        x = x * 1103515245 + 12345;
+        data[i] = x >> 16;
+    }
+
+    uint8_t payload[5] = {1, 2, 3, 4, 5};
+    assert_true(simplehdlc_compute_crc32_with_engine(SIMPLEHDLC_CRC32_ENGINE_TABLE, payload, 5) == 0x470B99F4);
+
+    for (size_t e=0; e<sizeof(engines)/sizeof(engines[0]); e++) {
+        assert_true(simplehdlc_compute_crc32_with_engine(engines[e], payload, 5) == 0x470B99F4);
+
+        // every length around the block sizes of the engines, at every alignment
+        for (size_t offset=0; offset<16; offset++) {
+            for (size_t len=0; len<300; len++) {
+                assert_true(simplehdlc_compute_crc32_with_engine(engines[e], &data[offset], len) ==
+                            simplehdlc_compute_crc32_with_engine(SIMPLEHDLC_CRC32_ENGINE_TABLE, &data[offset], len));
+            }
+        }
+
+        assert_true(simplehdlc_compute_crc32_with_engine(engines[e], data, sizeof(data)) ==
+                    simplehdlc_compute_crc32_with_engine(SIMPLEHDLC_CRC32_ENGINE_TABLE, data, sizeof(data)));
+    }
+
+    assert_true(simplehdlc_compute_crc32(data, sizeof(data)) ==
+                simplehdlc_compute_crc32_with_engine(SIMPLEHDLC_CRC32_ENGINE_TABLE, data, sizeof(data)));
+}
+
+static void crc32_streaming_matches_oneshot(void **state) {
+    uint8_t data[1000];
+    for (size_t i=0; i<sizeof(data); i++) data[i] = i * 7 + (i >> 3);
+
+    uint32_t expected = simplehdlc_compute_crc32(data, sizeof(data));
+
+    static const size_t chunk_sizes[] = {1, 3, 16, 63, 64, 65, 333, sizeof(data)};
+    for (size_t c=0; c<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); c++) {
+        uint32_t crc = simplehdlc_crc32_init();
+        for (size_t i=0; i<sizeof(data); i+=chunk_sizes[c]) {
+            size_t n = sizeof(data) - i < chunk_sizes[c] ? sizeof(data) - i : chunk_sizes[c];
+            crc = simplehdlc_crc32_update(crc, &data[i], n);
+        }
+        assert_true(simplehdlc_crc32_final(crc) == expected);
+    }
+
+    assert_true(simplehdlc_crc32_final(simplehdlc_crc32_init()) == simplehdlc_compute_crc32(data, 0));
+}
+
+static void crc32_shift_matches_recompute(void **state) {
+    uint8_t data[300];
+    uint8_t changed[300];
+    for (size_t i=0; i<sizeof(data); i++) data[i] = i * 7 + (i >> 3);
+    uint32_t crc = simplehdlc_compute_crc32(data, sizeof(data));
+
+    // bytes changed anywhere, from the first byte to the last
+    static const size_t offsets[] = {0, 1, 17, 150, 296, 299};
+    static const size_t lens[] = {1, 2, 4, 3};
+    for (size_t o=0; o<sizeof(offsets)/sizeof(offsets[0]); o++) {
+        for (size_t l=0; l<sizeof(lens)/sizeof(lens[0]); l++) {
+            size_t offset = offsets[o];
+            size_t len = sizeof(data) - offset < lens[l] ? sizeof(data) - offset : lens[l];
+            memcpy(changed, data, sizeof(data));
+            for (size_t i=0; i<len; i++) changed[offset + i] ^= 0x5A + i;
+
+            uint32_t crc_change = simplehdlc_compute_crc32(&data[offset], len) ^
+                                  simplehdlc_compute_crc32(&changed[offset], len);
+            uint32_t factor = simplehdlc_crc32_shift_factor(sizeof(data) - offset - len);
+            assert_true((crc ^ simplehdlc_crc32_shift(crc_change, factor)) ==
+                        simplehdlc_compute_crc32(changed, sizeof(data)));
+        }
+    }
+
+    // nothing changed, or nothing after the change
+    assert_true(simplehdlc_crc32_shift(0, simplehdlc_crc32_shift_factor(100)) == 0);
+    assert_true(simplehdlc_crc32_shift(0x12345678, simplehdlc_crc32_shift_factor(0)) == 0x12345678);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 static void encode_test_too_small(void **state) {
@@ -25,6 +131,23 @@ static void encode_test_too_small(void **state) {
         assert_true(simplehdlc_encode_to_buffer(buffer, i, &encoded_size, payload, sizeof(payload)) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
         assert_int_equal(encoded_size, 0xFFFF);
     }
+
+    // any buffer short of the exact encoded size is too small, in either framing, wherever the encode runs out of room
+    static const simplehdlc_framing_t framings[] = {SIMPLEHDLC_FRAMING_ESCAPED, SIMPLEHDLC_FRAMING_COBS};
+    uint8_t large_payload[300], large_buffer[SIMPLEHDLC_MAX_ENCODED_SIZE(300)];
+    for (size_t i=0; i<sizeof(large_payload); i++) large_payload[i] = i % 5 == 0 ? SIMPLEHDLC_BOUNDARY_MARKER : i;
+    for (size_t f=0; f<2; f++) {
+        size_t size = simplehdlc_get_encoded_size_with_framing(large_payload, 300, framings[f]);
+        for (size_t len=7; len<size; len++) {
+            encoded_size = 0xFFFF;
+            assert_true(simplehdlc_encode_to_buffer_with_framing(large_buffer, len, &encoded_size, large_payload, 300,
+                                                                 framings[f]) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+            assert_int_equal(encoded_size, 0xFFFF);
+        }
+        assert_true(simplehdlc_encode_to_buffer_with_framing(large_buffer, size, &encoded_size, large_payload, 300,
+                                                             framings[f]) == SIMPLEHDLC_OK);
+        assert_int_equal(encoded_size, size);
+    }
 }
 
 static void encode_test_zero_length_payload(void **state) {
@@ -244,9 +367,2515 @@ static void encode_parse_test_zero_length_packet(void **state) {
     assert_int_equal(decoded_length, 0);
 }
 
+//////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    uint8_t data[65536];
+    size_t len;
+} frame_log_t;
+
+static void log_frame_callback(const uint8_t *payload, uint16_t payload_len, void *user_ptr) {
+    frame_log_t *log = (frame_log_t *) user_ptr;
+
+    assert_true(log->len + 2 + payload_len <= sizeof(log->data));
+    log->data[log->len++] = payload_len >> 8;
+    log->data[log->len++] = payload_len & 0xFF;
+    memcpy(&log->data[log->len], payload, payload_len);
+    log->len += payload_len;
+}
+
+static uint32_t test_rng_state = 0x12345678;
+
+static uint32_t test_rng(void) {
+    // xorshift32
+    test_rng_state ^= test_rng_state << 13;
+    test_rng_state ^= test_rng_state >> 17;
+    test_rng_state ^= test_rng_state << 5;
+    return test_rng_state;
+}
+
+// fills stream with encoded frames of random length, escape density and corruption, interleaved with garbage. with
+// mixed_framing, frames are randomly escaped or COBS framed, with legacy or extended lengths. if legacy is not NULL it
+// gets the same stream as a parser which only knows escaped frames with a two byte length should see it: the frames it
+// cannot read are replaced by just their boundary marker, and legacy_len is set to its length.
+static size_t build_random_streams(uint8_t *stream, size_t stream_len, bool mixed_framing, uint8_t *legacy,
+                                   size_t *legacy_len) {
+    static const uint8_t reserved[] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER};
+    uint8_t payload[600];
+    size_t count = 0;
+    size_t legacy_count = 0;
+
+    while (1) {
+        uint16_t payload_len = test_rng() % sizeof(payload);
+        unsigned int escape_density = test_rng() % 4;
+
+        for (uint16_t i=0; i<payload_len; i++) {
+            if (escape_density && (test_rng() % (escape_density * 8)) == 0) {
+                payload[i] = reserved[test_rng() & 1];
+            } else {
+                payload[i] = test_rng();
+            }
+        }
+
+        simplehdlc_framing_t framing = SIMPLEHDLC_FRAMING_ESCAPED;
+        bool extended = false;
+        if (mixed_framing) {
+            if (test_rng() & 1) framing = SIMPLEHDLC_FRAMING_COBS;
+            extended = (test_rng() & 3) == 0;
+        }
+
+        size_t encoded_size;
+        simplehdlc_error_code_t result;
+        if (extended) {
+            result = simplehdlc_encode_to_buffer_extended(&stream[count], stream_len - count, &encoded_size, payload,
+                                                          payload_len, framing);
+        } else {
+            result = simplehdlc_encode_to_buffer_with_framing(&stream[count], stream_len - count, &encoded_size,
+                                                              payload, payload_len, framing);
+        }
+        if (result != SIMPLEHDLC_OK) break;
+
+        switch (test_rng() % 8) {
+            case 0: // corrupt a byte
+                stream[count + 1 + test_rng() % (encoded_size - 1)] ^= 1 << (test_rng() % 8);
+                break;
+            case 1: // truncate the frame
+                encoded_size = 1 + test_rng() % (encoded_size - 1);
+                break;
+            default:
+                break;
+        }
+        if (legacy != NULL && framing == SIMPLEHDLC_FRAMING_ESCAPED && !extended) {
+            memcpy(&legacy[legacy_count], &stream[count], encoded_size);
+            legacy_count += encoded_size;
+        } else if (legacy != NULL) {
+            legacy[legacy_count++] = SIMPLEHDLC_BOUNDARY_MARKER;
+        }
+        count += encoded_size;
+
+        size_t garbage = test_rng() % 4;
+        for (size_t i=0; i<garbage && count<stream_len; i++) {
+            stream[count++] = test_rng();
+            if (legacy != NULL) legacy[legacy_count++] = stream[count - 1];
+        }
+    }
+
+    if (legacy != NULL) *legacy_len = legacy_count;
+    return count;
+}
+
+static size_t build_random_stream_with_framing(uint8_t *stream, size_t stream_len, bool mixed_framing) {
+    return build_random_streams(stream, stream_len, mixed_framing, NULL, NULL);
+}
+
+static size_t build_random_stream(uint8_t *stream, size_t stream_len) {
+    return build_random_stream_with_framing(stream, stream_len, false);
+}
+
+typedef struct {
+    uint8_t data[1024];
+    size_t len;
+} tx_log_t;
+
+static void tx_log_callback(uint8_t byte, void *user_ptr) {
+    tx_log_t *log = (tx_log_t *) user_ptr;
+    assert_true(log->len < sizeof(log->data));
+    log->data[log->len++] = byte;
+}
+
+static void encode_test_buffer_size_boundary(void **state) {
+    static const uint8_t reserved[] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER};
+    uint8_t payload[300];
+    uint8_t buffer[SIMPLEHDLC_MAX_ENCODED_SIZE(sizeof(payload))];
+    static tx_log_t tx_log;
+
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.tx_byte_callback = tx_log_callback;
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, NULL, 0, &callbacks, &tx_log);
+
+    for (int iteration=0; iteration<500; iteration++) {
+        uint16_t payload_len = test_rng() % (sizeof(payload) + 1);
+        unsigned int escape_density = test_rng() % 5;
+        for (uint16_t i=0; i<payload_len; i++) {
+            payload[i] = (test_rng() % 4 < escape_density) ? reserved[test_rng() & 1] : test_rng();
+        }
+
+        tx_log.len = 0;
+        assert_true(simplehdlc_encode_to_callback(&context, payload, payload_len, false) == SIMPLEHDLC_OK);
+
+        size_t expected_size = simplehdlc_get_encoded_size(payload, payload_len);
+        assert_int_equal(expected_size, tx_log.len);
+        assert_true(expected_size <= SIMPLEHDLC_MAX_ENCODED_SIZE(payload_len));
+
+        for (size_t buffer_len=expected_size-3; buffer_len<=expected_size+1; buffer_len++) {
+            size_t encoded_size = 0xFFFF;
+            simplehdlc_error_code_t result = simplehdlc_encode_to_buffer(buffer, buffer_len, &encoded_size, payload,
+                                                                         payload_len);
+            if (buffer_len < expected_size) {
+                assert_true(result == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+                assert_int_equal(encoded_size, 0xFFFF);
+            } else {
+                assert_true(result == SIMPLEHDLC_OK);
+                assert_int_equal(encoded_size, expected_size);
+                assert_memory_equal(buffer, tx_log.data, expected_size);
+            }
+        }
+    }
+}
+
+typedef struct {
+    tx_log_t log;
+    const uint8_t *payload;
+    size_t payload_len;
+    size_t direct_bytes;
+    size_t chunks;
+} tx_chunk_log_t;
+
+static void tx_chunk_log_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    tx_chunk_log_t *chunk_log = (tx_chunk_log_t *) user_ptr;
+
+    assert_true(chunk_log->log.len + len <= sizeof(chunk_log->log.data));
+    memcpy(&chunk_log->log.data[chunk_log->log.len], data, len);
+    chunk_log->log.len += len;
+    chunk_log->chunks++;
+
+    if (data >= chunk_log->payload && data < chunk_log->payload + chunk_log->payload_len) {
+        chunk_log->direct_bytes += len;
+    }
+}
+
+static void encode_test_chunk_callback_matches_byte_callback(void **state) {
+    static const uint8_t reserved[] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER};
+    uint8_t payload[400];
+    static tx_log_t byte_log;
+    static tx_chunk_log_t chunk_log;
+
+    simplehdlc_callbacks_t byte_callbacks = {0};
+    byte_callbacks.tx_byte_callback = tx_log_callback;
+    simplehdlc_context_t byte_context;
+    simplehdlc_init(&byte_context, NULL, 0, &byte_callbacks, &byte_log);
+
+    simplehdlc_callbacks_t chunk_callbacks = {0};
+    chunk_callbacks.tx_chunk_callback = tx_chunk_log_callback;
+    chunk_callbacks.tx_flush_buffer_callback = tx_flush_callback;
+    simplehdlc_context_t chunk_context;
+    simplehdlc_init(&chunk_context, NULL, 0, &chunk_callbacks, &chunk_log);
+
+    for (int iteration=0; iteration<500; iteration++) {
+        uint16_t payload_len = test_rng() % (sizeof(payload) + 1);
+        unsigned int escape_density = test_rng() % 5;
+        for (uint16_t i=0; i<payload_len; i++) {
+            if (escape_density == 0) {
+                payload[i] = test_rng() & 0x3F;
+            } else {
+                payload[i] = (test_rng() % 64 < escape_density * escape_density) ? reserved[test_rng() & 1] : test_rng();
+            }
+        }
+
+        byte_log.len = 0;
+        assert_true(simplehdlc_encode_to_callback(&byte_context, payload, payload_len, false) == SIMPLEHDLC_OK);
+
+        memset(&chunk_log, 0, sizeof(chunk_log));
+        chunk_log.payload = payload;
+        chunk_log.payload_len = payload_len;
+        tx_flushed = false;
+        assert_true(simplehdlc_encode_to_callback(&chunk_context, payload, payload_len, true) == SIMPLEHDLC_OK);
+        assert_true(tx_flushed);
+
+        assert_int_equal(chunk_log.log.len, byte_log.len);
+        assert_memory_equal(chunk_log.log.data, byte_log.data, byte_log.len);
+
+        // without escapes, everything but the header and CRC comes straight from the payload
+        if (escape_density == 0 && payload_len >= 16) {
+            assert_int_equal(chunk_log.direct_bytes, payload_len);
+            assert_true(chunk_log.chunks <= 3);
+        }
+    }
+}
+
+static void encode_test_streaming_encoder(void **state) {
+    uint8_t payload[5000];
+    for (size_t i=0; i<sizeof(payload); i++) payload[i] = (test_rng() % 16 == 0) ? SIMPLEHDLC_BOUNDARY_MARKER : test_rng();
+
+    static uint8_t expected[SIMPLEHDLC_MAX_ENCODED_SIZE(sizeof(payload))];
+    static uint8_t buffer[SIMPLEHDLC_MAX_ENCODED_SIZE(sizeof(payload))];
+    size_t expected_size;
+    assert_true(simplehdlc_encode_to_buffer(expected, sizeof(expected), &expected_size, payload, sizeof(payload)) == SIMPLEHDLC_OK);
+
+    // pieces of every size from 1 byte up, into a buffer
+    for (size_t piece=1; piece<=sizeof(payload); piece=piece*3+1) {
+        simplehdlc_encoder_t encoder;
+        assert_true(simplehdlc_encoder_begin_buffer(&encoder, buffer, sizeof(buffer), sizeof(payload)) == SIMPLEHDLC_OK);
+        for (size_t i=0; i<sizeof(payload); i+=piece) {
+            size_t n = sizeof(payload) - i < piece ? sizeof(payload) - i : piece;
+            assert_true(simplehdlc_encoder_append(&encoder, &payload[i], n) == SIMPLEHDLC_OK);
+        }
+
+        size_t encoded_size = 0;
+        assert_true(simplehdlc_encoder_finish(&encoder, &encoded_size) == SIMPLEHDLC_OK);
+        assert_int_equal(encoded_size, expected_size);
+        assert_memory_equal(buffer, expected, expected_size);
+    }
+
+    // gather into a buffer and to the chunk callback
+    simplehdlc_iovec_t iov[3] = {{payload, 10}, {&payload[10], 0}, {&payload[10], sizeof(payload) - 10}};
+    size_t encoded_size = 0;
+    assert_true(simplehdlc_encode_iov_to_buffer(buffer, sizeof(buffer), &encoded_size, iov, 3) == SIMPLEHDLC_OK);
+    assert_int_equal(encoded_size, expected_size);
+    assert_memory_equal(buffer, expected, expected_size);
+
+    static tx_chunk_log_t chunk_log;
+    memset(&chunk_log, 0, sizeof(chunk_log));
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.tx_chunk_callback = tx_chunk_log_callback;
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, NULL, 0, &callbacks, &chunk_log);
+
+    simplehdlc_iovec_t short_iov[2] = {{payload, 100}, {&payload[100], 200}};
+    assert_true(simplehdlc_encode_to_buffer(expected, sizeof(expected), &expected_size, payload, 300) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encode_iov_to_callback(&context, short_iov, 2, false) == SIMPLEHDLC_OK);
+    assert_int_equal(chunk_log.log.len, expected_size);
+    assert_memory_equal(chunk_log.log.data, expected, expected_size);
+
+    // flushing without a flush callback still sends the packet but reports the missing callback
+    assert_true(simplehdlc_encode_iov_to_callback(&context, short_iov, 2, true) == SIMPLEHDLC_ERROR_CALLBACK_MISSING);
+}
+
+static void encode_test_streaming_encoder_errors(void **state) {
+    uint8_t payload[16] = {0};
+    uint8_t buffer[64];
+    simplehdlc_encoder_t encoder;
+    size_t encoded_size = 0xFFFF;
+
+    // too much data
+    assert_true(simplehdlc_encoder_begin_buffer(&encoder, buffer, sizeof(buffer), 8) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encoder_append(&encoder, payload, 4) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encoder_append(&encoder, payload, 5) == SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH);
+    assert_true(simplehdlc_encoder_finish(&encoder, &encoded_size) == SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH);
+
+    // too little data
+    assert_true(simplehdlc_encoder_begin_buffer(&encoder, buffer, sizeof(buffer), 8) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encoder_append(&encoder, payload, 7) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encoder_finish(&encoder, &encoded_size) == SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH);
+
+    // out of room part way through
+    assert_true(simplehdlc_encoder_begin_buffer(&encoder, buffer, 12, 8) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encoder_append(&encoder, payload, 8) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encoder_finish(&encoder, &encoded_size) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+    assert_int_equal(encoded_size, 0xFFFF);
+
+    // no output callbacks
+    simplehdlc_callbacks_t callbacks = {0};
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, NULL, 0, &callbacks, NULL);
+    assert_true(simplehdlc_encoder_begin_callback(&encoder, &context, 8, false) == SIMPLEHDLC_ERROR_CALLBACK_MISSING);
+    assert_true(simplehdlc_encoder_append(&encoder, payload, 8) == SIMPLEHDLC_ERROR_CALLBACK_MISSING);
+
+    // gathered payloads must fit the length field
+    static uint8_t big[0x8000];
+    simplehdlc_iovec_t iov[2] = {{big, sizeof(big)}, {big, sizeof(big)}};
+    assert_true(simplehdlc_encode_iov_to_buffer(buffer, sizeof(buffer), &encoded_size, iov, 2) == SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE);
+}
+
+// the original byte-at-a-time parser, frozen as it was before the fast paths, frame types and stats were added, with
+// its own state so that nothing the library does can change it. it only knows escaped frames with a two byte length.
+typedef struct {
+    uint8_t *rx_buffer;
+    size_t rx_buffer_len;
+    size_t rx_count;
+    uint32_t rx_crc32;
+    hdlc_parser_state_t state;
+    size_t expected_len;
+    bool escape_next;
+    frame_log_t *log;
+} baseline_parser_t;
+
+static void baseline_init(baseline_parser_t *parser, uint8_t *rx_buffer, size_t rx_buffer_len, frame_log_t *log) {
+    memset(parser, 0, sizeof(baseline_parser_t));
+    parser->rx_buffer = rx_buffer;
+    parser->rx_buffer_len = rx_buffer_len;
+    parser->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+    parser->log = log;
+}
+
+static void baseline_parse(baseline_parser_t *context, const uint8_t *data, size_t len) {
+    for (size_t i=0; i<len; i++) {
+        uint8_t c = data[i];
+
+        // wait for frame boundary marker
+        if (c == SIMPLEHDLC_BOUNDARY_MARKER) {
+            context->expected_len = 0;
+            context->rx_count = 0;
+            context->rx_crc32 = 0;
+            context->escape_next = false;
+            context->state = SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB;
+            continue;
+        }
+
+        if (context->state == SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER) {
+            continue;
+        }
+
+        if (context->escape_next) {
+            c ^= (1 << 5);
+            context->escape_next = false;
+        } else if (c == SIMPLEHDLC_ESCAPE_MARKER) {
+            context->escape_next = true;
+            continue;
+        }
+
+        if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_MSB) {
+            context->expected_len |= c << 8;
+            context->state = SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB;
+
+        } else if (context->state == SIMPLEHDLC_STATE_CONSUMING_SIZE_LSB) {
+            context->expected_len |= c;
+            context->expected_len += 4; // for the CRC32
+
+            if (context->expected_len > (context->rx_buffer_len + 4)) {
+                // packet is too large so ignore it
+                context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+            } else {
+                context->state = SIMPLEHDLC_STATE_CONSUMING_PAYLOAD;
+            }
+
+        } else if (context->state == SIMPLEHDLC_STATE_CONSUMING_PAYLOAD) {
+            if (context->rx_count < context->expected_len-4) {
+                context->rx_buffer[context->rx_count++] = c;
+            } else {
+                context->rx_crc32 |= c;
+                context->rx_count++;
+
+                if (context->rx_count == context->expected_len) {
+                    uint32_t crc32 = simplehdlc_compute_crc32(context->rx_buffer, context->rx_count - 4);
+
+                    if (crc32 == context->rx_crc32) {
+                        log_frame_callback(context->rx_buffer, context->rx_count-4, context->log);
+                    }
+
+                    context->state = SIMPLEHDLC_STATE_WAITING_FOR_FRAME_MARKER;
+                } else {
+                    context->rx_crc32 <<= 8;
+                }
+            }
+        }
+    }
+}
+
+// simplehdlc_parse, fed in chunks of any size, finds exactly the frames the original parser does. in a mixed stream the
+// original parser skips the frames it cannot read, so it sees the same frames as simplehdlc_parse does in the stream
+// with those frames left out.
+static void parse_fast_path_matches_baseline(void **state) {
+    static uint8_t stream[32768], legacy[32768];
+    static frame_log_t baseline_log, fast_log;
+    static const size_t chunk_sizes[] = {1, 2, 3, 7, 16, 31, 64, 509, 4096, sizeof(stream)};
+
+    uint8_t rx_buffer[512], baseline_buffer[512];
+    simplehdlc_context_t context;
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+
+    for (int mixed=0; mixed<2; mixed++) {
+        size_t legacy_len;
+        size_t stream_len = build_random_streams(stream, sizeof(stream), mixed, legacy, &legacy_len);
+
+        baseline_parser_t baseline;
+        baseline_log.len = 0;
+        baseline_init(&baseline, baseline_buffer, sizeof(baseline_buffer), &baseline_log);
+        baseline_parse(&baseline, stream, stream_len);
+        assert_true(baseline_log.len > 0);
+
+        for (size_t c=0; c<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); c++) {
+            fast_log.len = 0;
+            simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &fast_log);
+
+            for (size_t i=0; i<legacy_len; i+=chunk_sizes[c]) {
+                size_t n = legacy_len - i < chunk_sizes[c] ? legacy_len - i : chunk_sizes[c];
+                simplehdlc_parse(&context, &legacy[i], n);
+            }
+
+            assert_int_equal(fast_log.len, baseline_log.len);
+            assert_memory_equal(fast_log.data, baseline_log.data, baseline_log.len);
+        }
+
+        // and simplehdlc_parse_bytewise agrees with both
+        fast_log.len = 0;
+        simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &fast_log);
+        simplehdlc_parse_bytewise(&context, legacy, legacy_len);
+        assert_int_equal(fast_log.len, baseline_log.len);
+        assert_memory_equal(fast_log.data, baseline_log.data, baseline_log.len);
+    }
+}
+
+typedef struct {
+    frame_log_t log;
+    uint8_t frame[65536];
+    size_t frame_len;
+    size_t frame_count;
+    bool open;
+    size_t ended_ok;
+    size_t ended_failed;
+
+    const uint8_t *input;
+    size_t input_len;
+    size_t direct_bytes;
+} stream_log_t;
+
+static void stream_begin_callback(size_t len, void *user_ptr) {
+    stream_log_t *stream_log = (stream_log_t *) user_ptr;
+
+    assert_false(stream_log->open);
+    stream_log->open = true;
+    stream_log->frame_len = len;
+    stream_log->frame_count = 0;
+}
+
+static void stream_data_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    stream_log_t *stream_log = (stream_log_t *) user_ptr;
+
+    assert_true(stream_log->open);
+    assert_true(len > 0);
+    assert_true(stream_log->frame_count + len <= stream_log->frame_len);
+    memcpy(&stream_log->frame[stream_log->frame_count], data, len);
+    stream_log->frame_count += len;
+
+    if (data >= stream_log->input && data < stream_log->input + stream_log->input_len) {
+        stream_log->direct_bytes += len;
+    }
+}
+
+static void stream_end_callback(bool crc_ok, void *user_ptr) {
+    stream_log_t *stream_log = (stream_log_t *) user_ptr;
+
+    assert_true(stream_log->open);
+    stream_log->open = false;
+
+    if (crc_ok) {
+        assert_int_equal(stream_log->frame_count, stream_log->frame_len);
+        log_frame_callback(stream_log->frame, stream_log->frame_len, &stream_log->log);
+        stream_log->ended_ok++;
+    } else {
+        stream_log->ended_failed++;
+    }
+}
+
+static void parse_test_streaming_matches_buffered(void **state) {
+    static uint8_t stream[32768];
+    static uint8_t large_rx_buffer[65536];
+    static frame_log_t buffered_log;
+    static stream_log_t stream_log;
+    static const size_t staging_sizes[] = {0, 1, 8, 32};
+    static const size_t chunk_sizes[] = {1, 5, 64, 1000, sizeof(stream)};
+
+    size_t stream_len = build_random_stream(stream, sizeof(stream));
+
+    simplehdlc_context_t context;
+    simplehdlc_callbacks_t buffered_callbacks = {0};
+    buffered_callbacks.rx_packet_callback = log_frame_callback;
+
+    buffered_log.len = 0;
+    simplehdlc_init(&context, large_rx_buffer, sizeof(large_rx_buffer), &buffered_callbacks, &buffered_log);
+    simplehdlc_parse(&context, stream, stream_len);
+
+    simplehdlc_callbacks_t stream_callbacks = {0};
+    stream_callbacks.rx_begin_callback = stream_begin_callback;
+    stream_callbacks.rx_data_callback = stream_data_callback;
+    stream_callbacks.rx_end_callback = stream_end_callback;
+
+    for (size_t b=0; b<sizeof(staging_sizes)/sizeof(staging_sizes[0]); b++) {
+        for (size_t c=0; c<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); c++) {
+            uint8_t staging[32];
+            memset(&stream_log, 0, sizeof(stream_log));
+            simplehdlc_init(&context, staging, staging_sizes[b], &stream_callbacks, &stream_log);
+
+            for (size_t i=0; i<stream_len; i+=chunk_sizes[c]) {
+                size_t n = stream_len - i < chunk_sizes[c] ? stream_len - i : chunk_sizes[c];
+                simplehdlc_parse(&context, &stream[i], n);
+            }
+
+            assert_int_equal(stream_log.log.len, buffered_log.len);
+            assert_memory_equal(stream_log.log.data, buffered_log.data, buffered_log.len);
+            assert_true(stream_log.ended_failed > 0);
+        }
+    }
+}
+
+static void parse_test_streaming_large_frame(void **state) {
+    static uint8_t payload[60000];
+    static uint8_t encoded[SIMPLEHDLC_MAX_ENCODED_SIZE(sizeof(payload))];
+    static stream_log_t stream_log;
+
+    for (size_t i=0; i<sizeof(payload); i++) payload[i] = (i * 31) & 0x3F;
+    size_t encoded_size;
+    assert_true(simplehdlc_encode_to_buffer(encoded, sizeof(encoded), &encoded_size, payload, sizeof(payload)) == SIMPLEHDLC_OK);
+
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_begin_callback = stream_begin_callback;
+    callbacks.rx_data_callback = stream_data_callback;
+    callbacks.rx_end_callback = stream_end_callback;
+
+    uint8_t staging[16];
+    simplehdlc_context_t context;
+    memset(&stream_log, 0, sizeof(stream_log));
+    stream_log.input = encoded;
+    stream_log.input_len = encoded_size;
+    simplehdlc_init(&context, staging, sizeof(staging), &callbacks, &stream_log);
+    simplehdlc_parse(&context, encoded, encoded_size);
+
+    // a clean payload is passed on straight from the input, without touching the 16 byte staging buffer
+    assert_int_equal(stream_log.ended_ok, 1);
+    assert_int_equal(stream_log.direct_bytes, sizeof(payload));
+    assert_memory_equal(&stream_log.log.data[2], payload, sizeof(payload));
+
+    // cutting the packet off with a boundary marker ends it as failed
+    memset(&stream_log, 0, sizeof(stream_log));
+    simplehdlc_parse(&context, encoded, encoded_size / 2);
+    uint8_t boundary = SIMPLEHDLC_BOUNDARY_MARKER;
+    simplehdlc_parse(&context, &boundary, 1);
+    assert_int_equal(stream_log.ended_ok, 0);
+    assert_int_equal(stream_log.ended_failed, 1);
+}
+
+static void decode_batch_matches_parse(void **state) {
+    static uint8_t stream[32768];
+    static uint8_t arena[2048];
+    static frame_log_t reference_log, batch_log;
+    static const size_t chunk_sizes[] = {1, 7, 300, 4096, sizeof(stream)};
+    static const size_t max_frames_options[] = {1, 3, 64};
+    static const size_t arena_sizes[] = {0, 700, sizeof(arena)};
+
+    size_t stream_len = build_random_stream(stream, sizeof(stream));
+
+    uint8_t rx_buffer[512];
+    simplehdlc_context_t context;
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+
+    reference_log.len = 0;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &reference_log);
+    simplehdlc_parse_bytewise(&context, stream, stream_len);
+
+    for (size_t c=0; c<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); c++) {
+        for (size_t m=0; m<sizeof(max_frames_options)/sizeof(max_frames_options[0]); m++) {
+            for (size_t a=0; a<sizeof(arena_sizes)/sizeof(arena_sizes[0]); a++) {
+                simplehdlc_frame_t frames[64];
+                size_t in_place = 0;
+                size_t crc_mismatches = 0;
+
+                batch_log.len = 0;
+                simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, NULL);
+
+                for (size_t i=0; i<stream_len; i+=chunk_sizes[c]) {
+                    size_t chunk_len = stream_len - i < chunk_sizes[c] ? stream_len - i : chunk_sizes[c];
+                    size_t offset = 0;
+
+                    while (offset < chunk_len) {
+                        size_t consumed = 0;
+                        size_t n = simplehdlc_decode_batch(&context, &stream[i + offset], chunk_len - offset, frames,
+                                                           max_frames_options[m], arena, arena_sizes[a], &consumed);
+                        assert_true(consumed > 0);
+                        assert_true(n <= max_frames_options[m]);
+
+                        for (size_t f=0; f<n; f++) {
+                            if (frames[f].status == SIMPLEHDLC_FRAME_OK) {
+                                log_frame_callback(frames[f].ptr, frames[f].len, &batch_log);
+                                if (frames[f].ptr >= &stream[i] && frames[f].ptr < &stream[i + chunk_len]) in_place++;
+                            } else {
+                                assert_null(frames[f].ptr);
+                                if (frames[f].status == SIMPLEHDLC_FRAME_CRC_MISMATCH) crc_mismatches++;
+                            }
+                        }
+
+                        offset += consumed;
+                    }
+                }
+
+                assert_int_equal(batch_log.len, reference_log.len);
+                assert_memory_equal(batch_log.data, reference_log.data, reference_log.len);
+                assert_true(crc_mismatches > 0);
+                if (chunk_sizes[c] == sizeof(stream)) assert_true(in_place > 0);
+            }
+        }
+    }
+}
+
+static void cobs_test_encode(void **state) {
+    static uint8_t payload[1200];
+    static uint8_t buffer[SIMPLEHDLC_COBS_MAX_ENCODED_SIZE(sizeof(payload))];
+    static tx_chunk_log_t chunk_log;
+    static tx_log_t byte_log;
+    static frame_log_t log;
+
+    // lengths around the group size, with payloads of nothing but boundary markers and with none at all
+    static const uint16_t lengths[] = {0, 1, 2, 246, 247, 248, 249, 250, 253, 254, 255, 500, 501, 502, 1200};
+
+    simplehdlc_callbacks_t chunk_callbacks = {0};
+    chunk_callbacks.tx_chunk_callback = tx_chunk_log_callback;
+    simplehdlc_context_t chunk_context;
+    simplehdlc_init(&chunk_context, NULL, 0, &chunk_callbacks, &chunk_log);
+    simplehdlc_set_tx_framing(&chunk_context, SIMPLEHDLC_FRAMING_COBS);
+
+    simplehdlc_callbacks_t byte_callbacks = {0};
+    byte_callbacks.tx_byte_callback = tx_log_callback;
+    simplehdlc_context_t byte_context;
+    simplehdlc_init(&byte_context, NULL, 0, &byte_callbacks, &byte_log);
+    simplehdlc_set_tx_framing(&byte_context, SIMPLEHDLC_FRAMING_COBS);
+
+    uint8_t rx_buffer[sizeof(payload)];
+    simplehdlc_callbacks_t rx_callbacks = {0};
+    rx_callbacks.rx_packet_callback = log_frame_callback;
+    simplehdlc_context_t rx_context;
+    simplehdlc_init(&rx_context, rx_buffer, sizeof(rx_buffer), &rx_callbacks, &log);
+
+    for (int iteration=0; iteration<600; iteration++) {
+        uint16_t payload_len = iteration < 45 ? lengths[iteration / 3] : test_rng() % (sizeof(payload) + 1);
+        unsigned int density = iteration < 45 ? (unsigned int) (iteration % 3) * 50 : test_rng() % 101;
+        for (uint16_t i=0; i<payload_len; i++) {
+            payload[i] = test_rng() % 100 < density ? SIMPLEHDLC_BOUNDARY_MARKER : test_rng() & 0x7D;
+        }
+
+        size_t expected_size = simplehdlc_get_encoded_size_with_framing(payload, payload_len, SIMPLEHDLC_FRAMING_COBS);
+        assert_true(expected_size <= SIMPLEHDLC_COBS_MAX_ENCODED_SIZE(payload_len));
+
+        size_t encoded_size = 0;
+        assert_true(simplehdlc_encode_to_buffer_with_framing(buffer, sizeof(buffer), &encoded_size, payload,
+                                                             payload_len, SIMPLEHDLC_FRAMING_COBS) == SIMPLEHDLC_OK);
+        assert_int_equal(encoded_size, expected_size);
+        assert_true(simplehdlc_encode_to_buffer_with_framing(buffer, expected_size - 1, &encoded_size, payload,
+                                                             payload_len, SIMPLEHDLC_FRAMING_COBS) ==
+                    SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+        assert_true(simplehdlc_encode_to_buffer_with_framing(buffer, sizeof(buffer), &encoded_size, payload,
+                                                             payload_len, SIMPLEHDLC_FRAMING_COBS) == SIMPLEHDLC_OK);
+
+        // the frame header, then no boundary marker at all
+        assert_int_equal(buffer[0], SIMPLEHDLC_BOUNDARY_MARKER);
+        assert_int_equal(buffer[1], SIMPLEHDLC_ESCAPE_MARKER);
+        assert_int_equal(buffer[2], SIMPLEHDLC_FRAMING_COBS);
+        assert_null(memchr(&buffer[1], SIMPLEHDLC_BOUNDARY_MARKER, encoded_size - 1));
+
+        // the callback encoders produce the same bytes
+        memset(&chunk_log, 0, sizeof(chunk_log));
+        byte_log.len = 0;
+        if (expected_size <= sizeof(byte_log.data)) {
+            assert_true(simplehdlc_encode_to_callback(&chunk_context, payload, payload_len, false) == SIMPLEHDLC_OK);
+            assert_true(simplehdlc_encode_to_callback(&byte_context, payload, payload_len, false) == SIMPLEHDLC_OK);
+            assert_int_equal(chunk_log.log.len, expected_size);
+            assert_memory_equal(chunk_log.log.data, buffer, expected_size);
+            assert_int_equal(byte_log.len, expected_size);
+            assert_memory_equal(byte_log.data, buffer, expected_size);
+        }
+
+        // and it parses back, a byte at a time or all at once
+        log.len = 0;
+        for (size_t i=0; i<encoded_size; i++) simplehdlc_parse(&rx_context, &buffer[i], 1);
+        simplehdlc_parse(&rx_context, buffer, encoded_size);
+        simplehdlc_parse_bytewise(&rx_context, buffer, encoded_size);
+        assert_int_equal(log.len, 3 * (2 + payload_len));
+        for (int copy=0; copy<3; copy++) {
+            assert_memory_equal(&log.data[copy * (2 + payload_len) + 2], payload, payload_len);
+        }
+    }
+
+    // the overhead is fixed: one byte per 254 for a payload full of boundary markers or without any
+    memset(payload, SIMPLEHDLC_BOUNDARY_MARKER, sizeof(payload));
+    assert_true(simplehdlc_get_encoded_size_with_framing(payload, sizeof(payload), SIMPLEHDLC_FRAMING_COBS) <=
+                SIMPLEHDLC_COBS_MAX_ENCODED_SIZE(sizeof(payload)));
+    assert_int_equal(simplehdlc_get_encoded_size_with_framing(payload, sizeof(payload), SIMPLEHDLC_FRAMING_ESCAPED),
+                     1 + 2 + 2 * sizeof(payload) + 4);
+}
+
+static void cobs_test_mixed_stream(void **state) {
+    static uint8_t stream[32768];
+    static uint8_t arena[2048];
+    static frame_log_t reference_log, log;
+    static stream_log_t stream_log;
+    static const size_t chunk_sizes[] = {1, 3, 64, 1000, sizeof(stream)};
+
+    size_t stream_len = build_random_stream_with_framing(stream, sizeof(stream), true);
+
+    uint8_t rx_buffer[600];
+    simplehdlc_context_t context;
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+
+    reference_log.len = 0;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &reference_log);
+    simplehdlc_parse_bytewise(&context, stream, stream_len);
+    assert_true(reference_log.len > 0);
+
+    simplehdlc_callbacks_t stream_callbacks = {0};
+    stream_callbacks.rx_begin_callback = stream_begin_callback;
+    stream_callbacks.rx_data_callback = stream_data_callback;
+    stream_callbacks.rx_end_callback = stream_end_callback;
+
+    for (size_t c=0; c<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); c++) {
+        // buffered
+        log.len = 0;
+        simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+        for (size_t i=0; i<stream_len; i+=chunk_sizes[c]) {
+            size_t n = stream_len - i < chunk_sizes[c] ? stream_len - i : chunk_sizes[c];
+            simplehdlc_parse(&context, &stream[i], n);
+        }
+        assert_int_equal(log.len, reference_log.len);
+        assert_memory_equal(log.data, reference_log.data, reference_log.len);
+
+        // streamed
+        uint8_t staging[8];
+        memset(&stream_log, 0, sizeof(stream_log));
+        simplehdlc_init(&context, staging, sizeof(staging), &stream_callbacks, &stream_log);
+        for (size_t i=0; i<stream_len; i+=chunk_sizes[c]) {
+            size_t n = stream_len - i < chunk_sizes[c] ? stream_len - i : chunk_sizes[c];
+            simplehdlc_parse(&context, &stream[i], n);
+        }
+        assert_int_equal(stream_log.log.len, reference_log.len);
+        assert_memory_equal(stream_log.log.data, reference_log.data, reference_log.len);
+
+        // batched
+        log.len = 0;
+        simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, NULL);
+        for (size_t i=0; i<stream_len; i+=chunk_sizes[c]) {
+            size_t chunk_len = stream_len - i < chunk_sizes[c] ? stream_len - i : chunk_sizes[c];
+            for (size_t offset=0; offset<chunk_len; ) {
+                simplehdlc_frame_t frames[16];
+                size_t consumed;
+                size_t n = simplehdlc_decode_batch(&context, &stream[i + offset], chunk_len - offset, frames, 16,
+                                                   arena, sizeof(arena), &consumed);
+                for (size_t f=0; f<n; f++) {
+                    if (frames[f].status == SIMPLEHDLC_FRAME_OK) log_frame_callback(frames[f].ptr, frames[f].len, &log);
+                }
+                offset += consumed;
+            }
+        }
+        assert_int_equal(log.len, reference_log.len);
+        assert_memory_equal(log.data, reference_log.data, reference_log.len);
+    }
+}
+
+static void extended_test_lengths(void **state) {
+    static uint8_t payload[20000];
+    static uint8_t buffer[SIMPLEHDLC_EXTENDED_MAX_ENCODED_SIZE(sizeof(payload))];
+    static frame_log_t log;
+    static const simplehdlc_framing_t framings[] = {SIMPLEHDLC_FRAMING_ESCAPED, SIMPLEHDLC_FRAMING_COBS};
+
+    // lengths either side of the varint byte boundaries
+    static const struct {
+        uint16_t len;
+        uint8_t varint[3];
+        size_t varint_len;
+    } lengths[] = {
+            {0, {0x00}, 1},
+            {1, {0x01}, 1},
+            {127, {0x7F}, 1},
+            {128, {0x80, 0x01}, 2},
+            {16383, {0xFF, 0x7F}, 2},
+            {16384, {0x80, 0x80, 0x01}, 3},
+    };
+
+    uint8_t rx_buffer[sizeof(payload)];
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+
+    for (size_t l=0; l<sizeof(lengths)/sizeof(lengths[0]); l++) {
+        uint16_t payload_len = lengths[l].len;
+        for (uint16_t i=0; i<payload_len; i++) payload[i] = test_rng() % 16 == 0 ? SIMPLEHDLC_ESCAPE_MARKER : test_rng();
+
+        for (size_t f=0; f<sizeof(framings)/sizeof(framings[0]); f++) {
+            size_t expected_size = simplehdlc_get_extended_encoded_size(payload, payload_len, framings[f]);
+            size_t encoded_size = 0;
+            assert_true(simplehdlc_encode_to_buffer_extended(buffer, sizeof(buffer), &encoded_size, payload,
+                                                             payload_len, framings[f]) == SIMPLEHDLC_OK);
+            assert_int_equal(encoded_size, expected_size);
+            assert_true(encoded_size <= (framings[f] == SIMPLEHDLC_FRAMING_COBS ?
+                                         SIMPLEHDLC_EXTENDED_COBS_MAX_ENCODED_SIZE(payload_len) :
+                                         SIMPLEHDLC_EXTENDED_MAX_ENCODED_SIZE(payload_len)));
+            assert_true(simplehdlc_encode_to_buffer_extended(buffer, expected_size - 1, &encoded_size, payload,
+                                                             payload_len, framings[f]) ==
+                        SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+            assert_true(simplehdlc_encode_to_buffer_extended(buffer, sizeof(buffer), &encoded_size, payload,
+                                                             payload_len, framings[f]) == SIMPLEHDLC_OK);
+
+            assert_int_equal(buffer[0], SIMPLEHDLC_BOUNDARY_MARKER);
+            assert_int_equal(buffer[1], SIMPLEHDLC_ESCAPE_MARKER);
+            assert_int_equal(buffer[2], framings[f] | SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH);
+            if (framings[f] == SIMPLEHDLC_FRAMING_ESCAPED) {
+                assert_memory_equal(&buffer[3], lengths[l].varint, lengths[l].varint_len);
+            }
+
+            // parses back like any other packet, a byte at a time or all at once
+            log.len = 0;
+            for (size_t i=0; i<encoded_size; i++) simplehdlc_parse(&context, &buffer[i], 1);
+            simplehdlc_parse(&context, buffer, encoded_size);
+            simplehdlc_parse_bytewise(&context, buffer, encoded_size);
+            assert_int_equal(log.len, 3 * (2 + payload_len));
+            for (int copy=0; copy<3; copy++) {
+                assert_memory_equal(&log.data[copy * (2 + payload_len) + 2], payload, payload_len);
+            }
+        }
+    }
+
+    simplehdlc_encoder_t encoder;
+    assert_true(simplehdlc_encoder_begin_buffer_extended(&encoder, buffer, sizeof(buffer),
+                                                         SIMPLEHDLC_MAX_EXTENDED_PAYLOAD + 1,
+                                                         SIMPLEHDLC_FRAMING_ESCAPED) ==
+                SIMPLEHDLC_ERROR_PAYLOAD_TOO_LARGE);
+
+    // a length of more than 32 bits is thrown away and one which cannot be counted with its CRC is too large, and
+    // neither upsets the packet after it
+    uint8_t stream[64] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER, SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH,
+                          0xFF, 0xFF, 0xFF, 0xFF, 0x7F, 0x01, 0x02,
+                          SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER, SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH,
+                          0xFC, 0xFF, 0xFF, 0xFF, 0x0F, 0x01, 0x02};
+    size_t stream_len = 20;
+    size_t encoded_size;
+    assert_true(simplehdlc_encode_to_buffer_extended(&stream[stream_len], sizeof(stream) - stream_len, &encoded_size,
+                                                     payload, 5, SIMPLEHDLC_FRAMING_ESCAPED) == SIMPLEHDLC_OK);
+    stream_len += encoded_size;
+
+    simplehdlc_frame_t frames[4];
+    size_t consumed;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, NULL);
+    assert_int_equal(simplehdlc_decode_batch(&context, stream, stream_len, frames, 4, NULL, 0, &consumed), 2);
+    assert_int_equal(frames[0].status, SIMPLEHDLC_FRAME_TOO_LARGE);
+    assert_int_equal(frames[0].len, 0xFFFFFFFCu);
+    assert_int_equal(frames[1].status, SIMPLEHDLC_FRAME_OK);
+    assert_int_equal(frames[1].len, 5);
+    assert_memory_equal(frames[1].ptr, payload, 5);
+}
+
+#define EXTENDED_TEST_PAYLOAD (3 * 1024 * 1024 + 17)
+
+// checks a streamed packet against the payload it should carry, without keeping a copy of it
+typedef struct {
+    const uint8_t *expected;
+    size_t expected_len;
+    size_t count;
+    size_t began;
+    size_t ended_ok;
+    size_t ended_failed;
+    bool mismatch;
+} stream_check_t;
+
+static void stream_check_begin_callback(size_t len, void *user_ptr) {
+    stream_check_t *check = (stream_check_t *) user_ptr;
+
+    assert_int_equal(len, check->expected_len);
+    check->began++;
+    check->count = 0;
+}
+
+static void stream_check_data_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    stream_check_t *check = (stream_check_t *) user_ptr;
+
+    assert_true(check->count + len <= check->expected_len);
+    if (memcmp(data, &check->expected[check->count], len) != 0) check->mismatch = true;
+    check->count += len;
+}
+
+static void stream_check_end_callback(bool crc_ok, void *user_ptr) {
+    stream_check_t *check = (stream_check_t *) user_ptr;
+
+    if (crc_ok) {
+        assert_int_equal(check->count, check->expected_len);
+        check->ended_ok++;
+    } else {
+        check->ended_failed++;
+    }
+}
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+} tx_sink_t;
+
+static void tx_sink_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    tx_sink_t *sink = (tx_sink_t *) user_ptr;
+
+    assert_true(sink->len + len <= sink->capacity);
+    memcpy(&sink->data[sink->len], data, len);
+    sink->len += len;
+}
+
+static void extended_test_large_frame(void **state) {
+    static uint8_t payload[EXTENDED_TEST_PAYLOAD];
+    static uint8_t encoded[SIMPLEHDLC_EXTENDED_MAX_ENCODED_SIZE(EXTENDED_TEST_PAYLOAD)];
+    static uint8_t sent[SIMPLEHDLC_EXTENDED_MAX_ENCODED_SIZE(EXTENDED_TEST_PAYLOAD)];
+    static uint8_t rx_buffer[EXTENDED_TEST_PAYLOAD];
+    static frame_log_t log;
+    static const simplehdlc_framing_t framings[] = {SIMPLEHDLC_FRAMING_ESCAPED, SIMPLEHDLC_FRAMING_COBS};
+
+    // mostly clean, with a reserved byte now and then
+    for (size_t i=0; i<sizeof(payload); i++) {
+        payload[i] = test_rng() % 64 == 0 ? SIMPLEHDLC_BOUNDARY_MARKER : test_rng();
+    }
+
+    for (size_t f=0; f<sizeof(framings)/sizeof(framings[0]); f++) {
+        // the streaming encoder, in uneven pieces
+        simplehdlc_encoder_t encoder;
+        assert_true(simplehdlc_encoder_begin_buffer_extended(&encoder, encoded, sizeof(encoded), sizeof(payload),
+                                                             framings[f]) == SIMPLEHDLC_OK);
+        for (size_t i=0; i<sizeof(payload); i+=4099) {
+            size_t n = sizeof(payload) - i < 4099 ? sizeof(payload) - i : 4099;
+            assert_true(simplehdlc_encoder_append(&encoder, &payload[i], n) == SIMPLEHDLC_OK);
+        }
+        size_t encoded_size;
+        assert_true(simplehdlc_encoder_finish(&encoder, &encoded_size) == SIMPLEHDLC_OK);
+        assert_int_equal(encoded_size, simplehdlc_get_extended_encoded_size(payload, sizeof(payload), framings[f]));
+        assert_int_equal(encoded[2], framings[f] | SIMPLEHDLC_FRAME_TYPE_EXTENDED_LENGTH);
+
+        // the callback encoder produces the same bytes
+        tx_sink_t sink = {sent, 0, sizeof(sent)};
+        simplehdlc_callbacks_t tx_callbacks = {0};
+        tx_callbacks.tx_chunk_callback = tx_sink_callback;
+        simplehdlc_context_t tx_context;
+        simplehdlc_init(&tx_context, NULL, 0, &tx_callbacks, &sink);
+        simplehdlc_set_tx_framing(&tx_context, framings[f]);
+        assert_true(simplehdlc_encode_to_callback_extended(&tx_context, payload, sizeof(payload), false) ==
+                    SIMPLEHDLC_OK);
+        assert_int_equal(sink.len, encoded_size);
+        assert_memory_equal(sent, encoded, encoded_size);
+
+        // streamed as a single packet through a 16 byte staging buffer, in reads the size of a link's
+        stream_check_t check = {payload, sizeof(payload), 0, 0, 0, 0, false};
+        simplehdlc_callbacks_t rx_callbacks = {0};
+        rx_callbacks.rx_begin_callback = stream_check_begin_callback;
+        rx_callbacks.rx_data_callback = stream_check_data_callback;
+        rx_callbacks.rx_end_callback = stream_check_end_callback;
+        uint8_t staging[16];
+        simplehdlc_context_t context;
+        simplehdlc_init(&context, staging, sizeof(staging), &rx_callbacks, &check);
+        for (size_t i=0; i<encoded_size; i+=1500) {
+            simplehdlc_parse(&context, &encoded[i], encoded_size - i < 1500 ? encoded_size - i : 1500);
+        }
+        assert_int_equal(check.began, 1);
+        assert_int_equal(check.ended_ok, 1);
+        assert_int_equal(check.ended_failed, 0);
+        assert_false(check.mismatch);
+
+        // rx_packet_callback cannot take it, however large the parse buffer, but simplehdlc_decode_batch can
+        simplehdlc_callbacks_t buffered_callbacks = {0};
+        buffered_callbacks.rx_packet_callback = log_frame_callback;
+        log.len = 0;
+        simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &buffered_callbacks, &log);
+        simplehdlc_parse(&context, encoded, encoded_size);
+        assert_int_equal(log.len, 0);
+
+        simplehdlc_frame_t frame;
+        size_t consumed;
+        simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &buffered_callbacks, NULL);
+        assert_int_equal(simplehdlc_decode_batch(&context, encoded, encoded_size, &frame, 1, NULL, 0, &consumed), 1);
+        assert_int_equal(frame.status, SIMPLEHDLC_FRAME_OK);
+        assert_int_equal(frame.len, sizeof(payload));
+        assert_memory_equal(frame.ptr, payload, sizeof(payload));
+    }
+}
+
+static void in_place_test_matches_buffer(void **state) {
+    static uint8_t payload[1024];
+    static uint8_t buffer[1024 + SIMPLEHDLC_IN_PLACE_ROOM(1024) + 64];
+    static uint8_t expected[SIMPLEHDLC_MAX_ENCODED_SIZE(1024)];
+    static uint8_t original[sizeof(buffer)];
+    static const uint8_t reserved[] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER};
+    size_t n_fallbacks = 0;
+
+    for (int round=0; round<5000; round++) {
+        uint16_t len = test_rng() % 1025;
+        unsigned int escape_percent = (unsigned int[]) {0, 1, 10, 50, 100}[test_rng() % 5];
+        for (uint16_t i=0; i<len; i++) {
+            payload[i] = test_rng() % 100 < escape_percent ? reserved[test_rng() & 1] : (test_rng() % 0x7D);
+        }
+
+        size_t expected_size;
+        assert_true(simplehdlc_encode_to_buffer_with_framing(expected, sizeof(expected), &expected_size, payload, len,
+                                                             SIMPLEHDLC_FRAMING_ESCAPED) == SIMPLEHDLC_OK);
+
+        // anything from no room at all to enough for the worst case
+        size_t headroom = test_rng() % 24;
+        size_t tailroom = test_rng() % 4 == 0 ? (size_t) len + 8 : test_rng() % 24;
+        size_t buffer_len = headroom + len + tailroom;
+        memset(buffer, 0xAA, sizeof(buffer));
+        memcpy(&buffer[headroom], payload, len);
+        memcpy(original, buffer, sizeof(buffer));
+
+        size_t frame_offset, frame_len;
+        simplehdlc_error_code_t error = simplehdlc_encode_in_place(buffer, buffer_len, headroom, len, &frame_offset,
+                                                                   &frame_len);
+
+        // with the marker, length and CRC catered for, all that matters is whether the escapes fit somewhere
+        if (headroom >= SIMPLEHDLC_IN_PLACE_HEADROOM && tailroom >= SIMPLEHDLC_IN_PLACE_TAILROOM) {
+            assert_int_equal(error == SIMPLEHDLC_OK, buffer_len >= expected_size);
+        }
+
+        if (error == SIMPLEHDLC_OK) {
+            assert_int_equal(frame_len, expected_size);
+            assert_true(frame_offset + frame_len <= buffer_len);
+            assert_memory_equal(&buffer[frame_offset], expected, expected_size);
+        } else {
+            // left as it was, to be encoded some other way
+            assert_int_equal(error, SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+            assert_memory_equal(buffer, original, sizeof(buffer));
+            n_fallbacks++;
+        }
+
+        // nothing outside the buffer is touched
+        assert_memory_equal(&buffer[buffer_len], &original[buffer_len], sizeof(buffer) - buffer_len);
+    }
+
+    assert_true(n_fallbacks > 0);
+}
+
+static void in_place_test_worst_case(void **state) {
+    uint8_t payload[64];
+    memset(payload, SIMPLEHDLC_ESCAPE_MARKER, sizeof(payload));
+    payload[10] = 0x55;
+    payload[40] = SIMPLEHDLC_BOUNDARY_MARKER;
+
+    uint8_t expected[SIMPLEHDLC_MAX_ENCODED_SIZE(64)];
+    size_t expected_size;
+    assert_true(simplehdlc_encode_to_buffer_with_framing(expected, sizeof(expected), &expected_size, payload, 64,
+                                                         SIMPLEHDLC_FRAMING_ESCAPED) == SIMPLEHDLC_OK);
+
+    // the worst case room fits, however it is split between the headroom and the tailroom
+    uint8_t buffer[64 + SIMPLEHDLC_IN_PLACE_ROOM(64)];
+    for (size_t headroom=SIMPLEHDLC_IN_PLACE_HEADROOM; headroom<=SIMPLEHDLC_IN_PLACE_HEADROOM + 64; headroom++) {
+        memcpy(&buffer[headroom], payload, sizeof(payload));
+
+        size_t frame_offset, frame_len;
+        assert_true(simplehdlc_encode_in_place(buffer, sizeof(buffer), headroom, 64, &frame_offset, &frame_len) ==
+                    SIMPLEHDLC_OK);
+        assert_int_equal(frame_len, expected_size);
+        assert_memory_equal(&buffer[frame_offset], expected, expected_size);
+    }
+
+    // one byte short of the frame, or a payload which does not fit in the buffer at all
+    size_t frame_offset, frame_len;
+    memcpy(&buffer[SIMPLEHDLC_IN_PLACE_HEADROOM], payload, sizeof(payload));
+    assert_true(simplehdlc_encode_in_place(buffer, expected_size - 1, SIMPLEHDLC_IN_PLACE_HEADROOM, 64, &frame_offset,
+                                           &frame_len) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+    assert_true(simplehdlc_encode_in_place(buffer, expected_size, SIMPLEHDLC_IN_PLACE_HEADROOM, 64, &frame_offset,
+                                           &frame_len) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encode_in_place(buffer, 70, 10, 64, &frame_offset, &frame_len) ==
+                SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+}
+
+static void template_test_matches_encode(void **state) {
+    static uint8_t payload[600];
+    static uint8_t frame_buffer[SIMPLEHDLC_MAX_ENCODED_SIZE(600)];
+    static uint8_t expected[SIMPLEHDLC_MAX_ENCODED_SIZE(600)];
+    static const uint8_t reserved[] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER};
+
+    for (int round=0; round<200; round++) {
+        uint16_t len = 1 + test_rng() % 600;
+        for (uint16_t i=0; i<len; i++) payload[i] = test_rng() % 8 == 0 ? reserved[test_rng() & 1] : test_rng();
+
+        // up to eight fields of up to 16 bytes, spread through the payload
+        simplehdlc_template_field_t fields[8];
+        size_t n_fields = 0;
+        uint16_t offset = 0;
+        while (n_fields < 8 && offset < len) {
+            offset += test_rng() % (len / 8 + 1);
+            if (offset >= len) break;
+            uint16_t field_len = 1 + test_rng() % 16;
+            if (field_len > len - offset) field_len = len - offset;
+            fields[n_fields].offset = offset;
+            fields[n_fields].len = field_len;
+            n_fields++;
+            offset += field_len;
+        }
+
+        simplehdlc_template_t tmpl;
+        assert_true(simplehdlc_template_init(&tmpl, frame_buffer, sizeof(frame_buffer), payload, len, fields,
+                                             n_fields) == SIMPLEHDLC_OK);
+
+        for (int update=0; update<50 && n_fields; update++) {
+            size_t field = test_rng() % n_fields;
+            uint8_t data[16];
+            unsigned int escape_percent = (unsigned int[]) {0, 25, 100}[test_rng() % 3];
+            for (size_t i=0; i<fields[field].len; i++) {
+                data[i] = test_rng() % 100 < escape_percent ? reserved[test_rng() & 1] : (test_rng() % 0x7D);
+            }
+            assert_true(simplehdlc_template_set_field(&tmpl, field, data) == SIMPLEHDLC_OK);
+            assert_memory_equal(&payload[fields[field].offset], data, fields[field].len);
+
+            size_t expected_size;
+            assert_true(simplehdlc_encode_to_buffer_with_framing(expected, sizeof(expected), &expected_size, payload,
+                                                                 len, SIMPLEHDLC_FRAMING_ESCAPED) == SIMPLEHDLC_OK);
+            assert_int_equal(tmpl.frame_len, expected_size);
+            assert_memory_equal(tmpl.frame, expected, expected_size);
+        }
+    }
+}
+
+static void template_test_errors(void **state) {
+    uint8_t payload[16] = {0};
+    uint8_t frame_buffer[7 + 16 + 2];
+    simplehdlc_template_t tmpl;
+
+    // fields out of order, overlapping or past the end of the payload
+    simplehdlc_template_field_t bad_fields[][2] = {
+            {{8, 2, 0, 0, 0}, {0, 2, 0, 0, 0}},
+            {{0, 4, 0, 0, 0}, {3, 2, 0, 0, 0}},
+            {{0, 2, 0, 0, 0}, {15, 2, 0, 0, 0}},
+    };
+    for (size_t i=0; i<sizeof(bad_fields)/sizeof(bad_fields[0]); i++) {
+        assert_true(simplehdlc_template_init(&tmpl, frame_buffer, sizeof(frame_buffer), payload, sizeof(payload),
+                                             bad_fields[i], 2) == SIMPLEHDLC_ERROR_PAYLOAD_LENGTH_MISMATCH);
+    }
+
+    simplehdlc_template_field_t fields[] = {{0, 2, 0, 0, 0}, {14, 2, 0, 0, 0}};
+    assert_true(simplehdlc_template_init(&tmpl, frame_buffer, 7 + 15, payload, sizeof(payload), fields, 2) ==
+                SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+    assert_true(simplehdlc_template_init(&tmpl, frame_buffer, sizeof(frame_buffer), payload, sizeof(payload), fields,
+                                         2) == SIMPLEHDLC_OK);
+
+    // room for two escapes, but not a third; the frame is left as it was
+    static const uint8_t escapes[] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_ESCAPE_MARKER};
+    assert_true(simplehdlc_template_set_field(&tmpl, 1, escapes) == SIMPLEHDLC_OK);
+
+    uint8_t before[sizeof(frame_buffer)];
+    size_t before_len = tmpl.frame_len;
+    memcpy(before, frame_buffer, sizeof(frame_buffer));
+    assert_true(simplehdlc_template_set_field(&tmpl, 0, escapes) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+    assert_int_equal(tmpl.frame_len, before_len);
+    assert_memory_equal(frame_buffer, before, sizeof(frame_buffer));
+    assert_int_equal(payload[0], 0);
+
+    // losing the escapes again makes room
+    static const uint8_t plain[] = {1, 2};
+    assert_true(simplehdlc_template_set_field(&tmpl, 1, plain) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_template_set_field(&tmpl, 0, escapes) == SIMPLEHDLC_OK);
+}
+
+typedef struct {
+    frame_log_t log;
+    const uint8_t *ring;
+    size_t ring_len;
+    size_t views; // packets passed on from the ring itself rather than the parse buffer
+    size_t split_views; // views which wrapped round the end of the ring
+} ring_log_t;
+
+static void ring_packet_callback(const uint8_t *first, size_t first_len, const uint8_t *second, size_t second_len,
+                                 void *user_ptr) {
+    ring_log_t *ring_log = (ring_log_t *) user_ptr;
+    frame_log_t *log = &ring_log->log;
+    size_t len = first_len + second_len;
+
+    assert_true(log->len + 2 + len <= sizeof(log->data));
+    log->data[log->len++] = len >> 8;
+    log->data[log->len++] = len & 0xFF;
+    memcpy(&log->data[log->len], first, first_len);
+    if (second_len) memcpy(&log->data[log->len + first_len], second, second_len);
+    log->len += len;
+
+    if (first >= ring_log->ring && first < &ring_log->ring[ring_log->ring_len]) {
+        ring_log->views++;
+        if (second_len) {
+            assert_ptr_equal(second, ring_log->ring);
+            ring_log->split_views++;
+        }
+    } else {
+        assert_int_equal(second_len, 0);
+    }
+}
+
+// a random stream in the first half, and then frames which have no escapes (unless in their length or CRC) in the rest
+static size_t build_ring_stream(uint8_t *stream, size_t stream_len, bool mixed_framing) {
+    size_t len = build_random_stream_with_framing(stream, stream_len / 2, mixed_framing);
+
+    uint8_t payload[300];
+    while (1) {
+        uint16_t payload_len = test_rng() % sizeof(payload);
+        for (uint16_t i=0; i<payload_len; i++) payload[i] = test_rng() % SIMPLEHDLC_ESCAPE_MARKER;
+
+        size_t encoded_size;
+        if (simplehdlc_encode_to_buffer(&stream[len], stream_len - len, &encoded_size, payload, payload_len) !=
+            SIMPLEHDLC_OK) {
+            return len;
+        }
+        len += encoded_size;
+    }
+}
+
+// parses what has been written to the ring and not yet read, and returns how many bytes were taken
+static size_t ring_consume(simplehdlc_context_t *context, const uint8_t *ring, size_t ring_len, size_t read_count,
+                           size_t write_count) {
+    size_t read_index = read_count % ring_len;
+    size_t available = write_count - read_count;
+    size_t first_len = ring_len - read_index < available ? ring_len - read_index : available;
+
+    return simplehdlc_parse_ring(context, &ring[read_index], first_len, ring, available - first_len, read_index,
+                                 ring_len);
+}
+
+// copies len bytes into the ring at write_count, wrapping round its end
+static void ring_produce(uint8_t *ring, size_t ring_len, size_t write_count, const uint8_t *data, size_t len) {
+    size_t write_index = write_count % ring_len;
+    size_t first_len = ring_len - write_index < len ? ring_len - write_index : len;
+    memcpy(&ring[write_index], data, first_len);
+    memcpy(ring, &data[first_len], len - first_len);
+}
+
+static void ring_test_matches_bytewise(void **state) {
+    static uint8_t stream[32768];
+    static uint8_t ring[1024];
+    static frame_log_t reference_log;
+    static ring_log_t ring_log;
+    static const size_t ring_lens[] = {7, 64, 700, 1024};
+
+    size_t stream_len = build_ring_stream(stream, sizeof(stream), true);
+
+    uint8_t rx_buffer[512];
+    simplehdlc_context_t context;
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+
+    reference_log.len = 0;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &reference_log);
+    simplehdlc_parse_bytewise(&context, stream, stream_len);
+    assert_true(reference_log.len > 0);
+
+    // with and without the ring callback; without it, packets which wrap go through the parse buffer
+    for (int with_ring_callback=0; with_ring_callback<2; with_ring_callback++) {
+        for (size_t r=0; r<sizeof(ring_lens)/sizeof(ring_lens[0]); r++) {
+            size_t ring_len = ring_lens[r];
+            memset(&ring_log, 0, sizeof(ring_log));
+            ring_log.ring = ring;
+            ring_log.ring_len = ring_len;
+
+            callbacks.rx_packet_callback = with_ring_callback ? NULL : log_frame_callback;
+            callbacks.rx_ring_packet_callback = with_ring_callback ? ring_packet_callback : NULL;
+            simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks,
+                            with_ring_callback ? (void *) &ring_log : (void *) &ring_log.log);
+
+            // the producer writes chunks of any size which fits, and the consumer reads now and then
+            size_t read_count = 0;
+            size_t write_count = 0;
+            while (write_count < stream_len) {
+                size_t space = ring_len - (write_count - read_count);
+                size_t n = test_rng() % (space + 1);
+                if (n > stream_len - write_count) n = stream_len - write_count;
+                ring_produce(ring, ring_len, write_count, &stream[write_count], n);
+                write_count += n;
+
+                if (test_rng() % 2 || write_count - read_count == ring_len) {
+                    size_t consumed = ring_consume(&context, ring, ring_len, read_count, write_count);
+                    assert_true(consumed <= write_count - read_count);
+
+                    // a full ring always makes way for more
+                    if (write_count - read_count == ring_len) assert_true(consumed > 0);
+                    read_count += consumed;
+                }
+            }
+            read_count += ring_consume(&context, ring, ring_len, read_count, write_count);
+
+            assert_int_equal(ring_log.log.len, reference_log.len);
+            assert_memory_equal(ring_log.log.data, reference_log.data, reference_log.len);
+        }
+
+        if (with_ring_callback) {
+            assert_true(ring_log.views > 0);
+            assert_true(ring_log.split_views > 0);
+        }
+    }
+}
+
+static void ring_test_hold_back(void **state) {
+    uint8_t payload[20];
+    for (size_t i=0; i<sizeof(payload); i++) payload[i] = i + 1;
+
+    uint8_t encoded[SIMPLEHDLC_MAX_ENCODED_SIZE(20)];
+    size_t encoded_size;
+    assert_true(simplehdlc_encode_to_buffer(encoded, sizeof(encoded), &encoded_size, payload, 20) == SIMPLEHDLC_OK);
+    assert_int_equal(encoded_size, 27);
+
+    uint8_t ring[64];
+    ring_log_t ring_log;
+    memset(&ring_log, 0, sizeof(ring_log));
+    ring_log.ring = ring;
+    ring_log.ring_len = sizeof(ring);
+
+    uint8_t rx_buffer[32];
+    simplehdlc_context_t context;
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_ring_packet_callback = ring_packet_callback;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &ring_log);
+
+    // a byte at a time, starting near the end of the ring so that the packet wraps; nothing is taken until it is all
+    // there, and then it is passed on from the ring
+    size_t read_count = 50;
+    for (size_t write_count=51; write_count<=50 + encoded_size; write_count++) {
+        ring_produce(ring, sizeof(ring), write_count - 1, &encoded[write_count - 51], 1);
+
+        size_t consumed = ring_consume(&context, ring, sizeof(ring), read_count, write_count);
+        if (write_count < 50 + encoded_size) {
+            assert_int_equal(consumed, 0);
+            assert_int_equal(ring_log.log.len, 0);
+        } else {
+            assert_int_equal(consumed, encoded_size);
+        }
+        read_count += consumed;
+    }
+
+    assert_int_equal(ring_log.views, 1);
+    assert_int_equal(ring_log.split_views, 1);
+    assert_int_equal(ring_log.log.len, 2 + sizeof(payload));
+    assert_memory_equal(&ring_log.log.data[2], payload, sizeof(payload));
+}
+
+#define MUX_TEST_STREAMS 8
+
+static void mux_log_frame_callback(uint32_t stream_id, const uint8_t *payload, uint16_t len, void *user_ptr) {
+    frame_log_t *logs = (frame_log_t *) user_ptr;
+    log_frame_callback(payload, len, &logs[stream_id]);
+}
+
+static void mux_matches_parse(void **state) {
+    static uint8_t streams[MUX_TEST_STREAMS][8192];
+    static frame_log_t logs[MUX_TEST_STREAMS];
+    static frame_log_t mux_logs[MUX_TEST_STREAMS];
+    size_t stream_lens[MUX_TEST_STREAMS];
+    size_t offsets[MUX_TEST_STREAMS] = {0};
+
+    static uint8_t rx_buffers[MUX_TEST_STREAMS][300];
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+    simplehdlc_context_t contexts[MUX_TEST_STREAMS];
+
+    for (size_t i=0; i<MUX_TEST_STREAMS; i++) {
+        stream_lens[i] = build_random_stream_with_framing(streams[i], sizeof(streams[i]), true);
+        logs[i].len = 0;
+        mux_logs[i].len = 0;
+        simplehdlc_init(&contexts[i], rx_buffers[i], sizeof(rx_buffers[i]), &callbacks, &logs[i]);
+    }
+
+    // one slot per link, so that no packet is dropped for want of one
+    static uint32_t memory[SIMPLEHDLC_MUX_MEMORY_SIZE(MUX_TEST_STREAMS, MUX_TEST_STREAMS) / sizeof(uint32_t) + 1];
+    static uint8_t slab[MUX_TEST_STREAMS * 300];
+    simplehdlc_mux_callbacks_t mux_callbacks = {mux_log_frame_callback};
+    simplehdlc_mux_t mux;
+    assert_true(simplehdlc_mux_init(&mux, MUX_TEST_STREAMS, memory, sizeof(memory), slab, 300, MUX_TEST_STREAMS,
+                                    &mux_callbacks, mux_logs) == SIMPLEHDLC_OK);
+
+    // feed the links random chunks in a random order, several at a time
+    bool remaining = true;
+    while (remaining) {
+        simplehdlc_mux_input_t inputs[MUX_TEST_STREAMS];
+        size_t n_inputs = 0;
+        remaining = false;
+
+        for (size_t i=0; i<MUX_TEST_STREAMS; i++) {
+            uint32_t id = (i + test_rng()) % MUX_TEST_STREAMS;
+            if (offsets[id] == stream_lens[id]) continue;
+
+            size_t n = 1 + test_rng() % 200;
+            if (n > stream_lens[id] - offsets[id]) n = stream_lens[id] - offsets[id];
+
+            simplehdlc_parse(&contexts[id], &streams[id][offsets[id]], n);
+            inputs[n_inputs].stream_id = id;
+            inputs[n_inputs].data = &streams[id][offsets[id]];
+            inputs[n_inputs].len = n;
+            n_inputs++;
+
+            offsets[id] += n;
+            if (offsets[id] < stream_lens[id]) remaining = true;
+        }
+
+        simplehdlc_mux_feed_batch(&mux, inputs, n_inputs);
+    }
+
+    for (size_t i=0; i<MUX_TEST_STREAMS; i++) {
+        assert_true(logs[i].len > 0);
+        assert_int_equal(mux_logs[i].len, logs[i].len);
+        assert_memory_equal(mux_logs[i].data, logs[i].data, logs[i].len);
+    }
+
+    // a link which ended part way through a packet still holds its slot
+    for (uint32_t id=0; id<MUX_TEST_STREAMS; id++) simplehdlc_mux_reset_stream(&mux, id);
+    assert_int_equal(mux.n_free_slots, MUX_TEST_STREAMS);
+    assert_int_equal(mux.rx_no_slot_drops, 0);
+}
+
+static void mux_test_slot_pool(void **state) {
+    uint8_t payload[4] = {1, 2, 3, 4};
+    uint8_t encoded[SIMPLEHDLC_MAX_ENCODED_SIZE(4)];
+    size_t encoded_size;
+    assert_true(simplehdlc_encode_to_buffer(encoded, sizeof(encoded), &encoded_size, payload, 4) == SIMPLEHDLC_OK);
+
+    static frame_log_t mux_logs[3];
+    for (size_t i=0; i<3; i++) mux_logs[i].len = 0;
+
+    uint32_t memory[SIMPLEHDLC_MUX_MEMORY_SIZE(3, 2) / sizeof(uint32_t) + 1];
+    uint8_t slab[2 * 4];
+    simplehdlc_mux_callbacks_t mux_callbacks = {mux_log_frame_callback};
+    simplehdlc_mux_t mux;
+
+    assert_true(simplehdlc_mux_init(&mux, 3, memory, SIMPLEHDLC_MUX_MEMORY_SIZE(3, 2) - 1, slab, 4, 2,
+                                    &mux_callbacks, mux_logs) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+    assert_true(simplehdlc_mux_init(&mux, 3, memory, sizeof(memory), slab, 4, 2, &mux_callbacks, mux_logs) ==
+                SIMPLEHDLC_OK);
+
+    // links 0 and 1 take both slots, so the packet on link 2 is dropped
+    for (uint32_t id=0; id<3; id++) simplehdlc_mux_feed(&mux, id, encoded, encoded_size - 1);
+    assert_int_equal(mux.n_free_slots, 0);
+    assert_int_equal(mux.rx_no_slot_drops, 1);
+
+    simplehdlc_mux_feed(&mux, 0, &encoded[encoded_size - 1], 1);
+    simplehdlc_mux_reset_stream(&mux, 1);
+    assert_int_equal(mux.n_free_slots, 2);
+    assert_int_equal(mux_logs[0].len, 6);
+    assert_int_equal(mux_logs[1].len, 0);
+    assert_int_equal(mux_logs[2].len, 0);
+
+    // with the slots returned, link 2 can receive
+    simplehdlc_mux_feed(&mux, 2, encoded, encoded_size);
+    assert_int_equal(mux_logs[2].len, 6);
+    assert_memory_equal(&mux_logs[2].data[2], payload, 4);
+
+    // larger than a slot
+    uint8_t large[5] = {0};
+    uint8_t large_encoded[SIMPLEHDLC_MAX_ENCODED_SIZE(5)];
+    assert_true(simplehdlc_encode_to_buffer(large_encoded, sizeof(large_encoded), &encoded_size, large, 5) == SIMPLEHDLC_OK);
+    simplehdlc_mux_feed(&mux, 1, large_encoded, encoded_size);
+    assert_int_equal(mux_logs[1].len, 0);
+    assert_int_equal(mux.n_free_slots, 2);
+}
+
+// loopback harness for the ARQ layer: two ends joined by a simulated link which delivers each frame after a delay
+// (with jitter, so frames can overtake each other) and loses or corrupts some of them, on a simulated clock
+
+#define ARQ_TEST_MAX_PAYLOAD 64
+#define ARQ_TEST_MAX_WINDOW 16
+#define ARQ_TEST_MAX_QUEUED 256
+
+typedef struct {
+    uint8_t data[SIMPLEHDLC_MAX_ENCODED_SIZE(SIMPLEHDLC_ARQ_HEADER_SIZE + ARQ_TEST_MAX_PAYLOAD)];
+    size_t len;
+    uint32_t deliver_at;
+} arq_test_frame_t;
+
+typedef struct arq_test_end {
+    struct arq_test_end *peer;
+    simplehdlc_context_t context;
+    uint8_t rx_buffer[SIMPLEHDLC_ARQ_HEADER_SIZE + ARQ_TEST_MAX_PAYLOAD];
+    simplehdlc_arq_t arq;
+    uint32_t memory[SIMPLEHDLC_ARQ_MEMORY_SIZE(ARQ_TEST_MAX_WINDOW, ARQ_TEST_MAX_PAYLOAD) / sizeof(uint32_t) + 1];
+
+    // frames on their way to the peer, and the one being encoded
+    arq_test_frame_t queue[ARQ_TEST_MAX_QUEUED];
+    size_t n_queued;
+    arq_test_frame_t encoding;
+
+    uint32_t n_sent;
+    uint32_t n_received;
+} arq_test_end_t;
+
+typedef struct {
+    unsigned int loss_percent;
+    unsigned int corrupt_percent;
+    uint32_t delay_ms;
+    uint32_t jitter_ms;
+} arq_test_link_t;
+
+static uint32_t arq_test_clock;
+static arq_test_link_t arq_test_link;
+
+static uint32_t arq_test_now_callback(void *user_ptr) {
+    (void) user_ptr;
+    return arq_test_clock;
+}
+
+static void arq_test_tx_chunk_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    arq_test_end_t *end = (arq_test_end_t *) user_ptr;
+
+    assert_true(end->encoding.len + len <= sizeof(end->encoding.data));
+    memcpy(&end->encoding.data[end->encoding.len], data, len);
+    end->encoding.len += len;
+}
+
+// each frame is flushed once it is encoded, which puts it on the link
+static void arq_test_tx_flush_callback(void *user_ptr) {
+    arq_test_end_t *end = (arq_test_end_t *) user_ptr;
+    arq_test_frame_t *frame = &end->encoding;
+
+    if (test_rng() % 100 >= arq_test_link.loss_percent) {
+        if (test_rng() % 100 < arq_test_link.corrupt_percent) {
+            frame->data[1 + test_rng() % (frame->len - 1)] ^= 1 << (test_rng() % 8);
+        }
+
+        assert_true(end->n_queued < ARQ_TEST_MAX_QUEUED);
+        frame->deliver_at = arq_test_clock + arq_test_link.delay_ms;
+        if (arq_test_link.jitter_ms) frame->deliver_at += test_rng() % arq_test_link.jitter_ms;
+        end->queue[end->n_queued++] = *frame;
+    }
+    frame->len = 0;
+}
+
+static void arq_test_frame_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    arq_test_end_t *end = (arq_test_end_t *) user_ptr;
+    simplehdlc_arq_receive(&end->arq, payload, len);
+}
+
+// packet n holds n followed by a pattern derived from it, and its length depends on it too
+static uint16_t make_arq_test_packet(uint32_t n, uint8_t *payload) {
+    uint16_t len = 4 + n % (ARQ_TEST_MAX_PAYLOAD - 3);
+    memcpy(payload, &n, 4);
+    for (uint16_t i=4; i<len; i++) payload[i] = (uint8_t) (n * 7 + i);
+    return len;
+}
+
+static void arq_test_packet_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    arq_test_end_t *end = (arq_test_end_t *) user_ptr;
+
+    // every packet arrives once and in order
+    uint8_t expected[ARQ_TEST_MAX_PAYLOAD];
+    uint16_t expected_len = make_arq_test_packet(end->n_received, expected);
+    assert_int_equal(len, expected_len);
+    assert_memory_equal(payload, expected, len);
+    end->n_received++;
+}
+
+static void arq_test_init_end(arq_test_end_t *end, arq_test_end_t *peer, size_t window) {
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = arq_test_frame_callback;
+    callbacks.tx_chunk_callback = arq_test_tx_chunk_callback;
+    callbacks.tx_flush_buffer_callback = arq_test_tx_flush_callback;
+
+    simplehdlc_arq_config_t config = {0};
+    config.window = window;
+    config.max_payload = ARQ_TEST_MAX_PAYLOAD;
+    config.initial_rto_ms = 200;
+    config.ack_delay_ms = 5;
+
+    simplehdlc_arq_callbacks_t arq_callbacks = {0};
+    arq_callbacks.now_callback = arq_test_now_callback;
+    arq_callbacks.rx_packet_callback = arq_test_packet_callback;
+
+    memset(end, 0, sizeof(arq_test_end_t));
+    end->peer = peer;
+    simplehdlc_init(&end->context, end->rx_buffer, sizeof(end->rx_buffer), &callbacks, end);
+    assert_true(simplehdlc_arq_init(&end->arq, &end->context, &config, end->memory, sizeof(end->memory),
+                                    &arq_callbacks, end) == SIMPLEHDLC_OK);
+}
+
+// puts the frames which have reached the end of the link into the peer's parser
+static void arq_test_deliver(arq_test_end_t *end) {
+    size_t kept = 0;
+    for (size_t i=0; i<end->n_queued; i++) {
+        if ((int32_t) (arq_test_clock - end->queue[i].deliver_at) >= 0) {
+            simplehdlc_parse(&end->peer->context, end->queue[i].data, end->queue[i].len);
+        } else {
+            end->queue[kept++] = end->queue[i];
+        }
+    }
+    end->n_queued = kept;
+}
+
+// sends n_packets from a to b and half as many from b to a, and returns how long it took
+static uint32_t arq_test_transfer(arq_test_end_t *a, arq_test_end_t *b, size_t window, uint32_t n_packets) {
+    arq_test_init_end(a, b, window);
+    arq_test_init_end(b, a, window);
+
+    uint32_t targets[2] = {n_packets, n_packets / 2};
+    arq_test_end_t *ends[2] = {a, b};
+    uint32_t start = arq_test_clock;
+
+    while (a->n_sent < targets[0] || b->n_sent < targets[1] || b->n_received < targets[0] ||
+           a->n_received < targets[1] || simplehdlc_arq_in_flight(&a->arq) || simplehdlc_arq_in_flight(&b->arq)) {
+        assert_true(arq_test_clock - start < 10 * 60 * 1000);
+
+        for (int e=0; e<2; e++) {
+            uint8_t payload[ARQ_TEST_MAX_PAYLOAD];
+            while (ends[e]->n_sent < targets[e]) {
+                uint16_t len = make_arq_test_packet(ends[e]->n_sent, payload);
+                if (simplehdlc_arq_send(&ends[e]->arq, payload, len) != SIMPLEHDLC_OK) break;
+                ends[e]->n_sent++;
+            }
+            simplehdlc_arq_poll(&ends[e]->arq);
+        }
+        for (int e=0; e<2; e++) arq_test_deliver(ends[e]);
+        arq_test_clock++;
+    }
+
+    return arq_test_clock - start;
+}
+
+static void arq_test_lossless(void **state) {
+    static arq_test_end_t a, b;
+    arq_test_link_t link = {0, 0, 20, 0};
+    arq_test_link = link;
+
+    // a window keeps the link busy where stop and wait spends each round trip idle
+    uint32_t stop_and_wait = arq_test_transfer(&a, &b, 1, 100);
+    assert_int_equal(a.arq.tx_retransmits, 0);
+    uint32_t windowed = arq_test_transfer(&a, &b, 8, 100);
+    assert_int_equal(a.arq.tx_retransmits, 0);
+    assert_int_equal(b.arq.rx_duplicates, 0);
+    assert_true(windowed * 4 < stop_and_wait);
+
+    // most acknowledgements ride on data frames, and the round trip estimate settles on the link's 40 ms
+    assert_true(a.arq.tx_acks + b.arq.tx_acks < a.arq.tx_packets);
+    assert_true(a.arq.rtt_measured);
+    assert_in_range(a.arq.srtt8 / 8, 40, 50);
+}
+
+static void arq_test_lossy(void **state) {
+    static arq_test_end_t a, b;
+    static const size_t windows[] = {1, 3, 8, 16};
+    arq_test_link_t link = {10, 5, 20, 15};
+    arq_test_link = link;
+
+    // enough packets for the sequence numbers to wrap several times
+    for (size_t w=0; w<sizeof(windows)/sizeof(windows[0]); w++) {
+        arq_test_transfer(&a, &b, windows[w], 1000);
+        assert_true(a.arq.tx_retransmits > 0);
+        assert_true(b.arq.tx_retransmits > 0);
+        if (windows[w] > 1) assert_true(b.arq.rx_out_of_order > 0);
+    }
+}
+
+// with every frame lost, each timeout doubles the RTO, and poll asks to be called again when the backed off timeout
+// runs out
+static void arq_test_backoff(void **state) {
+    static arq_test_end_t a, b;
+    arq_test_link_t link = {100, 0, 20, 0};
+    arq_test_link = link;
+    arq_test_init_end(&a, &b, 4);
+    arq_test_init_end(&b, &a, 4);
+
+    uint8_t payload[ARQ_TEST_MAX_PAYLOAD];
+    uint16_t len = make_arq_test_packet(0, payload);
+    assert_true(simplehdlc_arq_send(&a.arq, payload, len) == SIMPLEHDLC_OK);
+    assert_int_equal(simplehdlc_arq_poll(&a.arq), 200);
+
+    for (uint32_t rto=200; rto<1600; rto*=2) {
+        arq_test_clock += rto;
+        assert_int_equal(simplehdlc_arq_poll(&a.arq), 2 * rto);
+        assert_int_equal(a.arq.rto_ms, 2 * rto);
+    }
+    assert_int_equal(a.arq.tx_timeouts, 3);
+    assert_int_equal(a.arq.tx_retransmits, 3);
+}
+
+// the output of a transmit scheduler, which takes at most max_write bytes per write if that is set
+typedef struct {
+    uint8_t data[16384];
+    size_t len;
+    size_t max_write;
+    size_t n_writes;
+} txsched_test_output_t;
+
+static uint32_t txsched_test_clock;
+
+static uint32_t txsched_test_now_callback(void *user_ptr) {
+    (void) user_ptr;
+    return txsched_test_clock;
+}
+
+static size_t txsched_test_write_callback(const uint8_t *data, size_t len, void *user_ptr) {
+    txsched_test_output_t *output = (txsched_test_output_t *) user_ptr;
+    if (output->max_write && len > output->max_write) len = output->max_write;
+
+    assert_true(output->len + len <= sizeof(output->data));
+    memcpy(&output->data[output->len], data, len);
+    output->len += len;
+    output->n_writes++;
+    return len;
+}
+
+static void txsched_test_init(simplehdlc_txsched_t *sched, txsched_test_output_t *output, uint8_t *urgent_buffer,
+                              size_t urgent_len, uint8_t *bulk_buffer, size_t bulk_len, uint8_t *write_buffer,
+                              size_t write_len, simplehdlc_framing_t framing) {
+    simplehdlc_txsched_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.n_queues = 2;
+    config.queues[0].buffer = urgent_buffer;
+    config.queues[0].buffer_len = urgent_len;
+    config.queues[0].max_delay_us = 0;
+    config.queues[1].buffer = bulk_buffer;
+    config.queues[1].buffer_len = bulk_len;
+    config.queues[1].max_delay_us = 1000;
+    config.write_buffer = write_buffer;
+    config.write_buffer_len = write_len;
+    config.flush_bytes = 200;
+    config.framing = framing;
+
+    simplehdlc_txsched_callbacks_t callbacks = {txsched_test_now_callback, txsched_test_write_callback};
+    memset(output, 0, sizeof(txsched_test_output_t));
+    assert_true(simplehdlc_txsched_init(sched, &config, &callbacks, output) == SIMPLEHDLC_OK);
+}
+
+// parses what the scheduler wrote
+static void txsched_test_parse(const txsched_test_output_t *output, frame_log_t *log) {
+    static uint8_t rx_buffer[1024];
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, log);
+
+    log->len = 0;
+    simplehdlc_parse(&context, output->data, output->len);
+}
+
+static void txsched_test_coalesce(void **state) {
+    static uint8_t urgent_buffer[256], bulk_buffer[1024], write_buffer[512];
+    static txsched_test_output_t output;
+    static frame_log_t log;
+    simplehdlc_txsched_t sched;
+    txsched_test_clock = 0xFFFFFE00; // wraps part way through
+    txsched_test_init(&sched, &output, urgent_buffer, sizeof(urgent_buffer), bulk_buffer, sizeof(bulk_buffer),
+                      write_buffer, sizeof(write_buffer), SIMPLEHDLC_FRAMING_ESCAPED);
+
+    uint8_t payloads[3][20];
+    for (int i=0; i<3; i++) memset(payloads[i], 'a' + i, sizeof(payloads[i]));
+
+    // small bulk packets wait for each other, up to the queue's delay
+    for (int i=0; i<3; i++) assert_true(simplehdlc_txsched_send(&sched, 1, payloads[i], 20) == SIMPLEHDLC_OK);
+    assert_int_equal(output.n_writes, 0);
+    txsched_test_clock += 400;
+    assert_int_equal(simplehdlc_txsched_poll(&sched), 600);
+    assert_int_equal(output.n_writes, 0);
+    txsched_test_clock += 600;
+    assert_int_equal(simplehdlc_txsched_poll(&sched), UINT32_MAX);
+    assert_int_equal(output.n_writes, 1);
+    assert_int_equal(simplehdlc_txsched_pending(&sched), 0);
+
+    txsched_test_parse(&output, &log);
+    assert_int_equal(log.len, 3 * 22);
+    for (int i=0; i<3; i++) assert_memory_equal(&log.data[i * 22 + 2], payloads[i], 20);
+
+    // or until there are flush_bytes of them
+    output.len = 0;
+    size_t n_sent = 0;
+    while (output.n_writes == 1) {
+        assert_true(simplehdlc_txsched_send(&sched, 1, payloads[0], 20) == SIMPLEHDLC_OK);
+        n_sent++;
+    }
+    assert_int_equal(n_sent, 200 / 27 + 1);
+    assert_int_equal(output.n_writes, 2);
+
+    // an urgent packet goes straight away, ahead of the bulk packets queued before it, which go with it
+    output.len = 0;
+    for (int i=1; i<3; i++) assert_true(simplehdlc_txsched_send(&sched, 1, payloads[i], 20) == SIMPLEHDLC_OK);
+    assert_int_equal(output.n_writes, 2);
+    assert_true(simplehdlc_txsched_send(&sched, 0, payloads[0], 4) == SIMPLEHDLC_OK);
+    assert_int_equal(output.n_writes, 3);
+    assert_int_equal(sched.tx_packets, 3 + n_sent + 3);
+
+    txsched_test_parse(&output, &log);
+    assert_int_equal(log.len, 6 + 2 * 22);
+    assert_memory_equal(&log.data[2], payloads[0], 4);
+    assert_memory_equal(&log.data[6 + 2], payloads[1], 20);
+    assert_memory_equal(&log.data[6 + 22 + 2], payloads[2], 20);
+}
+
+static void txsched_test_markers(void **state) {
+    static uint8_t urgent_buffer[256], bulk_buffer[1024], write_buffer[512];
+    static txsched_test_output_t output;
+    static frame_log_t log;
+    simplehdlc_txsched_t sched;
+    txsched_test_clock = 0;
+    txsched_test_init(&sched, &output, urgent_buffer, sizeof(urgent_buffer), bulk_buffer, sizeof(bulk_buffer),
+                      write_buffer, sizeof(write_buffer), SIMPLEHDLC_FRAMING_ESCAPED);
+
+    // a frame from a source which closes its frames with a marker as well
+    uint8_t payload[5] = {1, 2, SIMPLEHDLC_BOUNDARY_MARKER, 4, 5};
+    uint8_t encoded[SIMPLEHDLC_MAX_ENCODED_SIZE(5) + 1];
+    size_t encoded_size;
+    assert_true(simplehdlc_encode_to_buffer(encoded, sizeof(encoded), &encoded_size, payload, 5) == SIMPLEHDLC_OK);
+    encoded[encoded_size++] = SIMPLEHDLC_BOUNDARY_MARKER;
+
+    assert_true(simplehdlc_txsched_send_encoded(&sched, 1, encoded, encoded_size) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_txsched_send(&sched, 1, payload, 5) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_txsched_send_encoded(&sched, 1, encoded, encoded_size) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_txsched_flush(&sched) == SIMPLEHDLC_OK);
+
+    // the frame after the closing marker starts without one of its own
+    assert_int_equal(sched.tx_markers_dropped, 1);
+    assert_int_equal(output.len, 3 * encoded_size - 2);
+    assert_int_equal(sched.tx_bytes, output.len);
+    assert_memory_equal(output.data, encoded, encoded_size);
+    assert_int_equal(output.data[encoded_size], encoded[1]);
+
+    txsched_test_parse(&output, &log);
+    assert_int_equal(log.len, 3 * 7);
+    for (int i=0; i<3; i++) assert_memory_equal(&log.data[i * 7 + 2], payload, 5);
+}
+
+static void txsched_test_short_writes(void **state) {
+    static uint8_t urgent_buffer[128], bulk_buffer[512], write_buffer[100];
+    static txsched_test_output_t output;
+    static frame_log_t log;
+    static const simplehdlc_framing_t framings[] = {SIMPLEHDLC_FRAMING_ESCAPED, SIMPLEHDLC_FRAMING_COBS};
+
+    for (size_t f=0; f<2; f++) {
+        simplehdlc_txsched_t sched;
+        txsched_test_clock = 0;
+        txsched_test_init(&sched, &output, urgent_buffer, sizeof(urgent_buffer), bulk_buffer, sizeof(bulk_buffer),
+                          write_buffer, sizeof(write_buffer), framings[f]);
+
+        // more than the queue could ever hold
+        uint8_t payload[200];
+        memset(payload, SIMPLEHDLC_BOUNDARY_MARKER, sizeof(payload));
+        assert_true(simplehdlc_txsched_send(&sched, 0, payload, 200) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+
+        // the output takes a few bytes at a time, and each queue's packets must still arrive whole and in order
+        output.max_write = 7;
+        uint8_t n_sent[2] = {0, 0};
+        size_t n_blocked = 0;
+        for (int i=0; i<400; i++) {
+            size_t queue = test_rng() % 4 == 0 ? 0 : 1;
+            uint16_t len = 2 + test_rng() % 40;
+            for (uint16_t j=0; j<len; j++) payload[j] = test_rng() % 4 == 0 ? SIMPLEHDLC_BOUNDARY_MARKER : j;
+            payload[0] = (uint8_t) queue;
+            payload[1] = n_sent[queue];
+
+            simplehdlc_error_code_t error = simplehdlc_txsched_send(&sched, queue, payload, len);
+            if (error == SIMPLEHDLC_ERROR_WOULD_BLOCK) {
+                n_blocked++;
+            } else {
+                assert_true(error == SIMPLEHDLC_OK);
+                n_sent[queue]++;
+            }
+
+            // nothing is due until the output takes more, once a write has been cut short
+            txsched_test_clock += test_rng() % 300;
+            uint32_t wait = simplehdlc_txsched_poll(&sched);
+            if (sched.write_len) assert_int_equal(wait, UINT32_MAX);
+        }
+        assert_true(n_blocked > 0);
+        assert_true(sched.tx_short_writes > 0);
+
+        while (simplehdlc_txsched_flush(&sched) == SIMPLEHDLC_ERROR_WOULD_BLOCK);
+        assert_int_equal(simplehdlc_txsched_pending(&sched), 0);
+        assert_int_equal(sched.tx_bytes, output.len);
+
+        txsched_test_parse(&output, &log);
+        uint8_t n_received[2] = {0, 0};
+        for (size_t offset=0; offset<log.len; ) {
+            size_t len = (log.data[offset] << 8) | log.data[offset + 1];
+            uint8_t queue = log.data[offset + 2];
+            assert_true(queue < 2);
+            assert_int_equal(log.data[offset + 3], n_received[queue]);
+            n_received[queue]++;
+            offset += 2 + len;
+        }
+        assert_int_equal(n_received[0], n_sent[0]);
+        assert_int_equal(n_received[1], n_sent[1]);
+    }
+}
+
+#ifdef __linux__
+
+typedef struct {
+    uint32_t rx_index;
+    size_t rx_frames;
+    size_t tx_ready_count;
+    size_t closed_count;
+    int closed_error;
+} epoll_test_link_t;
+
+// payloads are generated from their index so that the receiver can check them without a copy of what was sent
+static uint16_t make_test_payload(uint32_t index, uint8_t *payload) {
+    uint32_t x = index * 2654435761u + 1;
+    uint16_t len = x % 200;
+    for (uint16_t i=0; i<len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        payload[i] = (x % 8 == 0) ? SIMPLEHDLC_BOUNDARY_MARKER : x >> 8;
+    }
+    return len;
+}
+
+static void epoll_rx_batch_callback(simplehdlc_epoll_link_t *link, const simplehdlc_frame_t *frames, size_t n_frames) {
+    epoll_test_link_t *test = (epoll_test_link_t *) link->user_ptr;
+    uint8_t expected[200];
+
+    for (size_t i=0; i<n_frames; i++) {
+        uint16_t len = make_test_payload(test->rx_index++, expected);
+        assert_int_equal(frames[i].len, len);
+        assert_memory_equal(frames[i].ptr, expected, len);
+        test->rx_frames++;
+    }
+}
+
+static void epoll_tx_ready_callback(simplehdlc_epoll_link_t *link) {
+    ((epoll_test_link_t *) link->user_ptr)->tx_ready_count++;
+}
+
+static void epoll_closed_callback(simplehdlc_epoll_link_t *link, int error) {
+    epoll_test_link_t *test = (epoll_test_link_t *) link->user_ptr;
+    test->closed_count++;
+    test->closed_error = error;
+}
+
+static const simplehdlc_epoll_callbacks_t epoll_test_callbacks = {
+    epoll_rx_batch_callback, epoll_tx_ready_callback, epoll_closed_callback
+};
+
+// sends count packets from one link to another through the loop, retrying whenever the TX queue is full
+static size_t epoll_send_packets(simplehdlc_epoll_t *loop, simplehdlc_epoll_link_t *from, epoll_test_link_t *to,
+                                 uint32_t count) {
+    uint8_t payload[200];
+    size_t blocked = 0;
+
+    for (uint32_t i=0; i<count; i++) {
+        uint16_t len = make_test_payload(i, payload);
+        simplehdlc_error_code_t result;
+        while ((result = simplehdlc_epoll_send(from, payload, len)) == SIMPLEHDLC_ERROR_WOULD_BLOCK) {
+            blocked++;
+            assert_true(simplehdlc_epoll_poll(loop, 1000) > 0);
+        }
+        assert_true(result == SIMPLEHDLC_OK);
+    }
+
+    while (to->rx_frames < count) assert_true(simplehdlc_epoll_poll(loop, 1000) > 0);
+    return blocked;
+}
+
+static void epoll_test_socketpair(void **state) {
+    static simplehdlc_epoll_t loop;
+    simplehdlc_epoll_link_t links[2];
+    epoll_test_link_t tests[2] = {{0}};
+    uint8_t rx_buffers[2][256];
+    uint8_t tx_buffers[2][512];
+
+    int fds[2];
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    assert_true(simplehdlc_epoll_init(&loop, &epoll_test_callbacks) == SIMPLEHDLC_OK);
+    for (int i=0; i<2; i++) {
+        assert_true(simplehdlc_epoll_add(&loop, &links[i], fds[i], rx_buffers[i], sizeof(rx_buffers[i]), tx_buffers[i],
+                                         sizeof(tx_buffers[i]), &tests[i]) == SIMPLEHDLC_OK);
+    }
+
+    // the TX queue only holds a few packets, so sending has to wait for it to drain
+    size_t blocked = epoll_send_packets(&loop, &links[0], &tests[1], 2000);
+    assert_true(blocked > 0);
+    assert_true(tests[0].tx_ready_count > 0);
+    assert_int_equal(tests[1].rx_frames, 2000);
+
+    uint8_t large[600] = {0};
+    assert_true(simplehdlc_epoll_send(&links[0], large, sizeof(large)) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+
+    // the other end going away closes the link
+    close(fds[1]);
+    simplehdlc_epoll_remove(&links[1]);
+    while (tests[0].closed_count == 0) simplehdlc_epoll_poll(&loop, 1000);
+    assert_int_equal(tests[0].closed_error, 0);
+    assert_true(simplehdlc_epoll_send(&links[0], large, 1) == SIMPLEHDLC_ERROR_IO);
+
+    close(fds[0]);
+    simplehdlc_epoll_deinit(&loop);
+}
+
+static void epoll_test_pty(void **state) {
+    static simplehdlc_epoll_t loop;
+    simplehdlc_epoll_link_t links[2];
+    epoll_test_link_t tests[2] = {{0}};
+    uint8_t rx_buffers[2][256];
+    uint8_t tx_buffers[2][4096];
+
+    int master, slave;
+    assert_int_equal(openpty(&master, &slave, NULL, NULL, NULL), 0);
+
+    // raw mode, so the line discipline passes the bytes through untouched
+    struct termios tio;
+    assert_int_equal(tcgetattr(slave, &tio), 0);
+    cfmakeraw(&tio);
+    assert_int_equal(tcsetattr(slave, TCSANOW, &tio), 0);
+
+    assert_true(simplehdlc_epoll_init(&loop, &epoll_test_callbacks) == SIMPLEHDLC_OK);
+    int fds[2] = {master, slave};
+    for (int i=0; i<2; i++) {
+        assert_true(simplehdlc_epoll_add(&loop, &links[i], fds[i], rx_buffers[i], sizeof(rx_buffers[i]), tx_buffers[i],
+                                         sizeof(tx_buffers[i]), &tests[i]) == SIMPLEHDLC_OK);
+    }
+
+    epoll_send_packets(&loop, &links[0], &tests[1], 500);
+    epoll_send_packets(&loop, &links[1], &tests[0], 500);
+    assert_int_equal(tests[0].rx_frames, 500);
+    assert_int_equal(tests[1].rx_frames, 500);
+
+    // closing the slave hangs up the master, which reads fail with EIO
+    simplehdlc_epoll_remove(&links[1]);
+    close(slave);
+    while (tests[0].closed_count == 0) simplehdlc_epoll_poll(&loop, 1000);
+    assert_int_equal(tests[0].closed_error, EIO);
+
+    close(master);
+    simplehdlc_epoll_deinit(&loop);
+}
+
+#define PIPELINE_TEST_LINKS 16
+
+typedef struct {
+    uint32_t next_seq[PIPELINE_TEST_LINKS];
+    uint32_t handled[PIPELINE_TEST_LINKS];
+    uint32_t in_handler[PIPELINE_TEST_LINKS];
+    uint32_t errors;
+    bool slow;
+} pipeline_test_t;
+
+// packets carry their link id and sequence number, followed by filler derived from both
+static uint16_t make_pipeline_payload(uint32_t link_id, uint32_t seq, uint8_t *payload) {
+    uint16_t len = 8 + (seq * 7 + link_id) % 120;
+    memcpy(payload, &link_id, 4);
+    memcpy(&payload[4], &seq, 4);
+    for (uint16_t i=8; i<len; i++) payload[i] = seq * 31 + i * 17 + link_id;
+    return len;
+}
+
+// runs on the handler threads, so failures are counted rather than asserted
+static void pipeline_test_handler(uint32_t link_id, const uint8_t *payload, uint16_t len, void *user_ptr) {
+    pipeline_test_t *test = (pipeline_test_t *) user_ptr;
+    uint8_t expected[128];
+
+    if (__atomic_add_fetch(&test->in_handler[link_id], 1, __ATOMIC_SEQ_CST) != 1) {
+        __atomic_add_fetch(&test->errors, 1, __ATOMIC_RELAXED);
+    }
+
+    uint32_t id, seq;
+    memcpy(&id, payload, 4);
+    memcpy(&seq, &payload[4], 4);
+    if (id != link_id || seq < test->next_seq[link_id] || len != make_pipeline_payload(id, seq, expected) ||
+        memcmp(payload, expected, len) != 0) {
+        __atomic_add_fetch(&test->errors, 1, __ATOMIC_RELAXED);
+    }
+    test->next_seq[link_id] = seq + 1;
+    test->handled[link_id]++;
+
+    if (test->slow) usleep(20);
+
+    __atomic_sub_fetch(&test->in_handler[link_id], 1, __ATOMIC_SEQ_CST);
+}
+
+// feeds each link its packets in random pieces, interleaved with the other links
+static void pipeline_feed(simplehdlc_pipeline_t *pipeline, uint32_t n_packets) {
+    static uint8_t pending[PIPELINE_TEST_LINKS][2 * SIMPLEHDLC_MAX_ENCODED_SIZE(128)];
+    size_t pending_len[PIPELINE_TEST_LINKS] = {0};
+    uint8_t payload[128];
+
+    for (uint32_t seq=0; seq<=n_packets; seq++) {
+        for (uint32_t id=0; id<PIPELINE_TEST_LINKS; id++) {
+            if (seq < n_packets) {
+                size_t encoded_size;
+                uint16_t len = make_pipeline_payload(id, seq, payload);
+                assert_true(simplehdlc_encode_to_buffer(&pending[id][pending_len[id]],
+                                                        sizeof(pending[id]) - pending_len[id], &encoded_size, payload,
+                                                        len) == SIMPLEHDLC_OK);
+                pending_len[id] += encoded_size;
+            }
+
+            // leave at most a packet's worth behind for next time
+            size_t carry_max = SIMPLEHDLC_MAX_ENCODED_SIZE(128);
+            size_t n = pending_len[id] > carry_max ? pending_len[id] - carry_max : 0;
+            n = seq < n_packets ? n + test_rng() % (pending_len[id] - n + 1) : pending_len[id];
+            simplehdlc_pipeline_parse(pipeline, id, pending[id], n);
+            memmove(pending[id], &pending[id][n], pending_len[id] - n);
+            pending_len[id] -= n;
+        }
+    }
+}
+
+static void pipeline_test_ordering(void **state) {
+    static pipeline_test_t test;
+    memset(&test, 0, sizeof(test));
+
+    simplehdlc_pipeline_config_t config = {0};
+    config.n_links = PIPELINE_TEST_LINKS;
+    config.n_threads = 4;
+    config.n_buffers = PIPELINE_TEST_LINKS + 32;
+    config.buffer_size = 128;
+    config.link_queue_len = 8;
+    config.policy = SIMPLEHDLC_PIPELINE_BLOCK;
+    config.handler = pipeline_test_handler;
+    config.user_ptr = &test;
+
+    simplehdlc_pipeline_t *pipeline;
+    assert_true(simplehdlc_pipeline_create(&pipeline, &config) == SIMPLEHDLC_OK);
+
+    pipeline_feed(pipeline, 2000);
+    simplehdlc_pipeline_drain(pipeline);
+
+    assert_int_equal(test.errors, 0);
+    assert_int_equal(simplehdlc_pipeline_get_drops(pipeline), 0);
+    for (size_t i=0; i<PIPELINE_TEST_LINKS; i++) {
+        assert_int_equal(test.handled[i], 2000);
+        assert_int_equal(test.next_seq[i], 2000);
+    }
+
+    simplehdlc_pipeline_destroy(pipeline);
+
+    config.n_buffers = PIPELINE_TEST_LINKS;
+    assert_true(simplehdlc_pipeline_create(&pipeline, &config) == SIMPLEHDLC_ERROR_BUFFER_TOO_SMALL);
+}
+
+static void pipeline_test_drop_policy(void **state) {
+    static pipeline_test_t test;
+    memset(&test, 0, sizeof(test));
+    test.slow = true;
+
+    simplehdlc_pipeline_config_t config = {0};
+    config.n_links = PIPELINE_TEST_LINKS;
+    config.n_threads = 2;
+    config.n_buffers = PIPELINE_TEST_LINKS + 4;
+    config.buffer_size = 128;
+    config.link_queue_len = 2;
+    config.policy = SIMPLEHDLC_PIPELINE_DROP;
+    config.handler = pipeline_test_handler;
+    config.user_ptr = &test;
+
+    simplehdlc_pipeline_t *pipeline;
+    assert_true(simplehdlc_pipeline_create(&pipeline, &config) == SIMPLEHDLC_OK);
+
+    pipeline_feed(pipeline, 200);
+    simplehdlc_pipeline_drain(pipeline);
+
+    // the handlers cannot keep up, but what does get through is intact and in order
+    uint64_t handled = 0;
+    for (size_t i=0; i<PIPELINE_TEST_LINKS; i++) handled += test.handled[i];
+    assert_int_equal(test.errors, 0);
+    assert_true(simplehdlc_pipeline_get_drops(pipeline) > 0);
+    assert_int_equal(handled + simplehdlc_pipeline_get_drops(pipeline), 200 * PIPELINE_TEST_LINKS);
+
+    simplehdlc_pipeline_destroy(pipeline);
+}
+
+static void capture_test_parallel_matches_sequential(void **state) {
+    static uint8_t stream[65536];
+    static uint8_t arena[4096];
+    size_t stream_len = build_random_stream_with_framing(stream, sizeof(stream), true);
+
+    // sequential reference: one context over the whole capture
+    uint8_t rx_buffer[300];
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+    static frame_log_t log;
+    log.len = 0;
+    simplehdlc_context_t context;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+    simplehdlc_parse(&context, stream, stream_len);
+
+    static simplehdlc_frame_t batch_frames[4096];
+    size_t n_batch_frames = 0;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+    for (size_t offset=0; offset<stream_len; ) {
+        size_t consumed;
+        n_batch_frames += simplehdlc_decode_batch(&context, &stream[offset], stream_len - offset,
+                                                  &batch_frames[n_batch_frames], 16, arena, sizeof(arena), &consumed);
+        offset += consumed;
+    }
+
+    simplehdlc_capture_t sequential, parallel;
+    simplehdlc_capture_init(&sequential, stream, stream_len);
+    simplehdlc_capture_init(&parallel, stream, stream_len);
+    assert_true(simplehdlc_capture_decode(&sequential, 1, 0, sizeof(rx_buffer)) == SIMPLEHDLC_OK);
+    assert_int_equal(sequential.n_chunks, 1);
+
+    assert_int_equal(sequential.n_frames, n_batch_frames);
+    for (size_t i=0; i<n_batch_frames; i++) {
+        assert_int_equal(sequential.frames[i].len, batch_frames[i].len);
+        assert_int_equal(sequential.frames[i].status, batch_frames[i].status);
+        assert_int_equal(stream[sequential.frames[i].offset], SIMPLEHDLC_BOUNDARY_MARKER);
+    }
+
+    // the payloads of the good packets are those the parser delivers
+    static frame_log_t capture_log;
+    capture_log.len = 0;
+    uint8_t payload[600];
+    for (size_t i=0; i<sequential.n_frames; i++) {
+        if (sequential.frames[i].status != SIMPLEHDLC_FRAME_OK) continue;
+        assert_true(simplehdlc_capture_read_payload(&sequential, &sequential.frames[i], payload) == SIMPLEHDLC_OK);
+        log_frame_callback(payload, sequential.frames[i].len, &capture_log);
+    }
+    assert_int_equal(capture_log.len, log.len);
+    assert_memory_equal(capture_log.data, log.data, log.len);
+
+    for (size_t chunk_size=1; chunk_size<=4096; chunk_size*=8) {
+        assert_true(simplehdlc_capture_decode(&parallel, 4, chunk_size, sizeof(rx_buffer)) == SIMPLEHDLC_OK);
+        assert_true(parallel.n_chunks > 1);
+        assert_int_equal(parallel.n_frames, sequential.n_frames);
+        for (size_t i=0; i<sequential.n_frames; i++) {
+            assert_int_equal(parallel.frames[i].offset, sequential.frames[i].offset);
+            assert_int_equal(parallel.frames[i].len, sequential.frames[i].len);
+            assert_int_equal(parallel.frames[i].status, sequential.frames[i].status);
+        }
+
+        simplehdlc_capture_chunk_stats_t total = {0};
+        for (size_t i=0; i<parallel.n_chunks; i++) {
+            total.len += parallel.chunks[i].len;
+            total.frames_ok += parallel.chunks[i].frames_ok;
+            total.crc_failures += parallel.chunks[i].crc_failures;
+            total.oversize_drops += parallel.chunks[i].oversize_drops;
+            total.aborted_frames += parallel.chunks[i].aborted_frames;
+        }
+        assert_int_equal(total.len, stream_len);
+        assert_int_equal(total.frames_ok, sequential.chunks[0].frames_ok);
+        assert_int_equal(total.crc_failures, sequential.chunks[0].crc_failures);
+        assert_int_equal(total.oversize_drops, sequential.chunks[0].oversize_drops);
+        assert_int_equal(total.aborted_frames, sequential.chunks[0].aborted_frames);
+    }
+    assert_true(sequential.chunks[0].aborted_frames > 0);
+
+    simplehdlc_capture_close(&parallel);
+    simplehdlc_capture_close(&sequential);
+}
+
+static void capture_test_file(void **state) {
+    uint8_t payload[3] = {SIMPLEHDLC_BOUNDARY_MARKER, 1, 2};
+    uint8_t encoded[SIMPLEHDLC_MAX_ENCODED_SIZE(3)];
+    size_t encoded_size;
+    assert_true(simplehdlc_encode_to_buffer(encoded, sizeof(encoded), &encoded_size, payload, 3) == SIMPLEHDLC_OK);
+
+    char path[] = "/tmp/simplehdlc_capture_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    assert_int_equal(write(fd, "xx", 2), 2);
+    assert_int_equal(write(fd, encoded, encoded_size), encoded_size);
+    close(fd);
+
+    simplehdlc_capture_t capture;
+    assert_true(simplehdlc_capture_open(&capture, path) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_capture_decode(&capture, 2, 0, 65535) == SIMPLEHDLC_OK);
+    assert_int_equal(capture.n_frames, 1);
+    assert_int_equal(capture.frames[0].offset, 2);
+    assert_int_equal(capture.frames[0].len, 3);
+
+    uint8_t decoded[3];
+    assert_true(simplehdlc_capture_read_payload(&capture, &capture.frames[0], decoded) == SIMPLEHDLC_OK);
+    assert_memory_equal(decoded, payload, 3);
+    simplehdlc_capture_close(&capture);
+
+    unlink(path);
+    assert_true(simplehdlc_capture_open(&capture, path) == SIMPLEHDLC_ERROR_IO);
+}
+
+#define RING_TEST_RING_LEN 512
+
+typedef struct {
+    uint8_t ring[RING_TEST_RING_LEN];
+    const uint8_t *stream;
+    size_t stream_len;
+    size_t read_count; // written by the consumer
+    size_t write_count; // written by the producer
+    uint32_t rng_state;
+} ring_test_shared_t;
+
+// writes the stream into the ring in chunks of random size, as soon as there is room
+static void *ring_test_producer(void *arg) {
+    ring_test_shared_t *shared = (ring_test_shared_t *) arg;
+    size_t write_count = 0;
+
+    while (write_count < shared->stream_len) {
+        size_t read_count = __atomic_load_n(&shared->read_count, __ATOMIC_ACQUIRE);
+        size_t space = RING_TEST_RING_LEN - (write_count - read_count);
+        if (space == 0) {
+            sched_yield();
+            continue;
+        }
+
+        shared->rng_state ^= shared->rng_state << 13;
+        shared->rng_state ^= shared->rng_state >> 17;
+        shared->rng_state ^= shared->rng_state << 5;
+        size_t n = 1 + shared->rng_state % 97;
+        if (n > space) n = space;
+        if (n > shared->stream_len - write_count) n = shared->stream_len - write_count;
+
+        ring_produce(shared->ring, RING_TEST_RING_LEN, write_count, &shared->stream[write_count], n);
+        write_count += n;
+        __atomic_store_n(&shared->write_count, write_count, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+static void ring_test_producer_thread(void **state) {
+    static uint8_t stream[65536];
+    static frame_log_t reference_log;
+    static ring_log_t ring_log;
+    static ring_test_shared_t shared;
+
+    size_t stream_len = build_ring_stream(stream, sizeof(stream), false);
+
+    uint8_t rx_buffer[512];
+    simplehdlc_context_t context;
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+
+    reference_log.len = 0;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &reference_log);
+    simplehdlc_parse_bytewise(&context, stream, stream_len);
+
+    memset(&ring_log, 0, sizeof(ring_log));
+    ring_log.ring = shared.ring;
+    ring_log.ring_len = RING_TEST_RING_LEN;
+    callbacks.rx_packet_callback = NULL;
+    callbacks.rx_ring_packet_callback = ring_packet_callback;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &ring_log);
+
+    memset(&shared, 0, sizeof(shared));
+    shared.stream = stream;
+    shared.stream_len = stream_len;
+    shared.rng_state = 0x9E3779B9;
+
+    pthread_t producer;
+    assert_int_equal(pthread_create(&producer, NULL, ring_test_producer, &shared), 0);
+
+    // the consumer takes what it can whenever it looks, until the producer has finished and nothing more is taken
+    size_t read_count = 0;
+    while (1) {
+        size_t write_count = __atomic_load_n(&shared.write_count, __ATOMIC_ACQUIRE);
+        size_t consumed = ring_consume(&context, shared.ring, RING_TEST_RING_LEN, read_count, write_count);
+        read_count += consumed;
+        __atomic_store_n(&shared.read_count, read_count, __ATOMIC_RELEASE);
+
+        if (consumed == 0 && write_count == stream_len) break;
+        if (consumed == 0) sched_yield();
+    }
+
+    assert_int_equal(pthread_join(producer, NULL), 0);
+
+    assert_int_equal(ring_log.log.len, reference_log.len);
+    assert_memory_equal(ring_log.log.data, reference_log.data, reference_log.len);
+    assert_true(ring_log.views > 0);
+    assert_true(ring_log.split_views > 0);
+}
+
+#endif
+
+#ifdef SIMPLEHDLC_ENABLE_STATS
+
+static uint64_t fake_clock = 0;
+static size_t timed_frames = 0;
+
+static uint64_t fake_timestamp_callback(void *user_ptr) {
+    return fake_clock++;
+}
+
+static void frame_timing_callback(uint64_t start, uint64_t end, size_t len, simplehdlc_frame_status_t status,
+                                  void *user_ptr) {
+    assert_true(end > start);
+    assert_true(status != SIMPLEHDLC_FRAME_TOO_LARGE);
+    timed_frames++;
+}
+
+static void stats_test_counters(void **state) {
+    uint8_t good[SIMPLEHDLC_MAX_ENCODED_SIZE(4)];
+    uint8_t escaped[SIMPLEHDLC_MAX_ENCODED_SIZE(4)];
+    uint8_t large[SIMPLEHDLC_MAX_ENCODED_SIZE(64)];
+    size_t good_size, escaped_size, large_size;
+
+    uint8_t payload[64] = {1, 2, 3, 4};
+    uint8_t escaped_payload[4] = {SIMPLEHDLC_BOUNDARY_MARKER, 1, SIMPLEHDLC_ESCAPE_MARKER, 2};
+    assert_true(simplehdlc_encode_to_buffer(good, sizeof(good), &good_size, payload, 4) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encode_to_buffer(escaped, sizeof(escaped), &escaped_size, escaped_payload, 4) == SIMPLEHDLC_OK);
+    assert_true(simplehdlc_encode_to_buffer(large, sizeof(large), &large_size, payload, 64) == SIMPLEHDLC_OK);
+
+    uint8_t rx_buffer[16];
+    simplehdlc_context_t context;
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+    callbacks.timestamp_callback = fake_timestamp_callback;
+    callbacks.rx_frame_timing_callback = frame_timing_callback;
+    static frame_log_t log;
+    log.len = 0;
+    timed_frames = 0;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+
+    uint8_t garbage[3] = {1, 2, 3};
+    uint8_t idle[3] = {SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_BOUNDARY_MARKER, SIMPLEHDLC_BOUNDARY_MARKER};
+
+    simplehdlc_parse(&context, garbage, sizeof(garbage));        // 3 discarded bytes
+    simplehdlc_parse(&context, idle, sizeof(idle));              // idle fill, not aborted
+    simplehdlc_parse(&context, good, good_size);                 // ok
+    simplehdlc_parse(&context, escaped, escaped_size);           // ok, 2 escapes
+    good[4] ^= 1;
+    simplehdlc_parse(&context, good, good_size);                 // crc failure
+    simplehdlc_parse(&context, good, good_size - 2);             // aborted by the next marker
+    simplehdlc_parse(&context, large, large_size);               // too large for the parse buffer
+    simplehdlc_parse(&context, garbage, sizeof(garbage));        // discarded after the oversize drop
+
+    simplehdlc_stats_t stats;
+    simplehdlc_get_stats(&context, &stats);
+    assert_int_equal(stats.rx_frames_ok, 2);
+    assert_int_equal(stats.rx_crc_failures, 1);
+    assert_int_equal(stats.rx_oversize_drops, 1);
+    assert_int_equal(stats.rx_aborted_frames, 1);
+    assert_int_equal(stats.rx_discarded_bytes, 6 + large_size - 3);
+    assert_int_equal(stats.rx_escapes, 2);
+    assert_int_equal(stats.rx_bytes, 6 + sizeof(idle) + 2 * good_size + escaped_size + good_size - 2 + large_size);
+    assert_int_equal(timed_frames, 3);
+
+    // transmit side
+    callbacks.tx_byte_callback = tx_callback;
+    simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+    callback_buffer_count = 0;
+    assert_true(simplehdlc_encode_to_callback(&context, escaped_payload, 4, false) == SIMPLEHDLC_OK);
+    simplehdlc_get_stats(&context, &stats);
+    assert_int_equal(stats.tx_frames, 1);
+    assert_int_equal(stats.tx_bytes, escaped_size);
+    assert_int_equal(stats.tx_escapes, 2);
+    assert_int_equal(stats.rx_frames_ok, 0);
+
+    simplehdlc_reset_stats(&context);
+    simplehdlc_get_stats(&context, &stats);
+    assert_int_equal(stats.tx_frames, 0);
+}
+
+static void stats_test_parse_paths_agree(void **state) {
+    static uint8_t stream[32768];
+    static uint8_t arena[4096];
+    size_t stream_len = build_random_stream(stream, sizeof(stream));
+
+    uint8_t rx_buffer[300];
+    simplehdlc_callbacks_t callbacks = {0};
+    callbacks.rx_packet_callback = log_frame_callback;
+    static frame_log_t log;
+
+    simplehdlc_context_t reference, fast, batch;
+    simplehdlc_init(&reference, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+    simplehdlc_init(&fast, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+    simplehdlc_init(&batch, rx_buffer, sizeof(rx_buffer), &callbacks, &log);
+
+    log.len = 0;
+    simplehdlc_parse_bytewise(&reference, stream, stream_len);
+    log.len = 0;
+    simplehdlc_parse(&fast, stream, stream_len);
+
+    size_t offset = 0;
+    while (offset < stream_len) {
+        simplehdlc_frame_t frames[16];
+        size_t consumed;
+        simplehdlc_decode_batch(&batch, &stream[offset], stream_len - offset, frames, 16, arena, sizeof(arena), &consumed);
+        offset += consumed;
+    }
+
+    simplehdlc_stats_t reference_stats, fast_stats, batch_stats;
+    simplehdlc_get_stats(&reference, &reference_stats);
+    simplehdlc_get_stats(&fast, &fast_stats);
+    simplehdlc_get_stats(&batch, &batch_stats);
+
+    assert_true(reference_stats.rx_frames_ok > 0);
+    assert_true(reference_stats.rx_crc_failures > 0);
+    assert_true(reference_stats.rx_oversize_drops > 0);
+    assert_true(reference_stats.rx_aborted_frames > 0);
+    assert_memory_equal(&fast_stats, &reference_stats, sizeof(reference_stats));
+
+    // frames decoded in place skip the state machine, so their escapes cannot be counted, but there are none
+    assert_memory_equal(&batch_stats, &reference_stats, sizeof(reference_stats));
+}
+
+#endif
+
 int main(void) {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(crc32_sanity_check),
+            cmocka_unit_test(crc32_engines_match_table),
+            cmocka_unit_test(crc32_streaming_matches_oneshot),
+            cmocka_unit_test(crc32_shift_matches_recompute),
             cmocka_unit_test(encode_test_too_small),
             cmocka_unit_test(encode_test_zero_length_payload),
             cmocka_unit_test(encode_sanity_check),
@@ -259,7 +2888,49 @@ int main(void) {
             cmocka_unit_test(parse_test_buffer_too_small),
 
             cmocka_unit_test(encode_parse_sanity_check),
-            cmocka_unit_test(encode_parse_test_zero_length_packet)
+            cmocka_unit_test(encode_parse_test_zero_length_packet),
+
+            cmocka_unit_test(encode_test_buffer_size_boundary),
+            cmocka_unit_test(encode_test_chunk_callback_matches_byte_callback),
+            cmocka_unit_test(encode_test_streaming_encoder),
+            cmocka_unit_test(encode_test_streaming_encoder_errors),
+            cmocka_unit_test(parse_fast_path_matches_baseline),
+            cmocka_unit_test(parse_test_streaming_matches_buffered),
+            cmocka_unit_test(parse_test_streaming_large_frame),
+            cmocka_unit_test(decode_batch_matches_parse),
+            cmocka_unit_test(cobs_test_encode),
+            cmocka_unit_test(cobs_test_mixed_stream),
+            cmocka_unit_test(extended_test_lengths),
+            cmocka_unit_test(extended_test_large_frame),
+            cmocka_unit_test(in_place_test_matches_buffer),
+            cmocka_unit_test(in_place_test_worst_case),
+            cmocka_unit_test(template_test_matches_encode),
+            cmocka_unit_test(template_test_errors),
+            cmocka_unit_test(ring_test_matches_bytewise),
+            cmocka_unit_test(ring_test_hold_back),
+            cmocka_unit_test(mux_matches_parse),
+            cmocka_unit_test(mux_test_slot_pool),
+            cmocka_unit_test(arq_test_lossless),
+            cmocka_unit_test(arq_test_lossy),
+            cmocka_unit_test(arq_test_backoff),
+            cmocka_unit_test(txsched_test_coalesce),
+            cmocka_unit_test(txsched_test_markers),
+            cmocka_unit_test(txsched_test_short_writes),
+
+#ifdef __linux__
+            cmocka_unit_test(epoll_test_socketpair),
+            cmocka_unit_test(epoll_test_pty),
+            cmocka_unit_test(pipeline_test_ordering),
+            cmocka_unit_test(pipeline_test_drop_policy),
+            cmocka_unit_test(capture_test_parallel_matches_sequential),
+            cmocka_unit_test(capture_test_file),
+            cmocka_unit_test(ring_test_producer_thread),
+#endif
+
+#ifdef SIMPLEHDLC_ENABLE_STATS
+            cmocka_unit_test(stats_test_counters),
+            cmocka_unit_test(stats_test_parse_paths_agree),
+#endif
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: MIT */
+
+// built with SIMPLEHDLC_BOUNDARY_MARKER and SIMPLEHDLC_ESCAPE_MARKER overridden to 0x21 and 0x22, which escape to the
+// frame type values 0x01 and 0x02
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "simplehdlc.h"
+
+#ifdef __linux__
+#include "simplehdlc_capture.h"
+#endif
+
+#if SIMPLEHDLC_BOUNDARY_MARKER != 0x21 || SIMPLEHDLC_ESCAPE_MARKER != 0x22
+#error "tests/markers_main.c is built with the boundary marker 0x21 and the escape marker 0x22"
+#endif
+
+typedef struct {
+    uint8_t payload[0x2300];
+    size_t len;
+    size_t count;
+} last_frame_t;
+
+static void last_frame_callback(const uint8_t *payload, uint16_t len, void *user_ptr) {
+    last_frame_t *frame = user_ptr;
+    memcpy(frame->payload, payload, len);
+    frame->len = len;
+    frame->count++;
+}
+
+// a frame whose length starts with a marker has that marker escaped straight after the boundary marker, which must
+// be read as the length and not as a frame type
+static void markers_test_length_is_not_frame_type(void **state) {
+    static const uint16_t lengths[] = {0x2105, 0x2205};
+    static uint8_t payload[0x2300], encoded[SIMPLEHDLC_MAX_ENCODED_SIZE(0x2300)], rx_buffer[0x2300];
+    static last_frame_t frame;
+
+    for (size_t i=0; i<sizeof(payload); i++) payload[i] = i * 7;
+
+    for (size_t l=0; l<sizeof(lengths)/sizeof(lengths[0]); l++) {
+        size_t encoded_size;
+        assert_true(simplehdlc_encode_to_buffer_with_framing(encoded, sizeof(encoded), &encoded_size, payload, lengths[l],
+                                                             SIMPLEHDLC_FRAMING_ESCAPED) == SIMPLEHDLC_OK);
+        assert_int_equal(encoded[1], SIMPLEHDLC_ESCAPE_MARKER);
+        assert_int_equal(encoded[2], (lengths[l] >> 8) ^ (1 << 5));
+
+        simplehdlc_context_t context;
+        simplehdlc_callbacks_t callbacks = {0};
+        callbacks.rx_packet_callback = last_frame_callback;
+        memset(&frame, 0, sizeof(frame));
+        simplehdlc_init(&context, rx_buffer, sizeof(rx_buffer), &callbacks, &frame);
+        simplehdlc_parse(&context, encoded, encoded_size);
+        assert_int_equal(frame.count, 1);
+        assert_int_equal(frame.len, lengths[l]);
+        assert_memory_equal(frame.payload, payload, lengths[l]);
+
+#ifdef __linux__
+        simplehdlc_capture_t capture;
+        simplehdlc_capture_init(&capture, encoded, encoded_size);
+        assert_true(simplehdlc_capture_decode(&capture, 1, 0, sizeof(rx_buffer)) == SIMPLEHDLC_OK);
+        assert_int_equal(capture.n_frames, 1);
+        assert_int_equal(capture.frames[0].status, SIMPLEHDLC_FRAME_OK);
+        assert_int_equal(capture.frames[0].len, lengths[l]);
+        memset(frame.payload, 0, sizeof(frame.payload));
+        assert_true(simplehdlc_capture_read_payload(&capture, &capture.frames[0], frame.payload) == SIMPLEHDLC_OK);
+        assert_memory_equal(frame.payload, payload, lengths[l]);
+        simplehdlc_capture_close(&capture);
+#endif
+    }
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test(markers_test_length_is_not_frame_type),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
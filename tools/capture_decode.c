@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: MIT */
+
+// decodes a raw capture of a link and writes a CSV index of the packets in it (offset of the frame boundary marker,
+// payload length, status), optionally with the payloads in hex. per-chunk statistics go to stderr with --stats.
+//
+// usage: simplehdlc_capture_decode [--threads N] [--chunk-size N] [--max-payload N] [--payload] [--stats] <capture>
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "simplehdlc.h"
+#include "simplehdlc_capture.h"
+
+static const char *status_names[] = {"ok", "crc_mismatch", "too_large"};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--threads N] [--chunk-size N] [--max-payload N] [--payload] [--stats] <capture>\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n_threads = n_cpus > 0 ? (size_t) n_cpus : 1;
+    size_t chunk_size = 0;
+    size_t max_payload = 65535;
+    bool print_payload = false;
+    bool print_stats = false;
+    const char *path = NULL;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            n_threads = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--chunk-size") == 0 && i + 1 < argc) {
+            chunk_size = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--max-payload") == 0 && i + 1 < argc) {
+            max_payload = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--payload") == 0) {
+            print_payload = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (path == NULL || max_payload > SIMPLEHDLC_MAX_EXTENDED_PAYLOAD) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    simplehdlc_capture_t capture;
+    if (simplehdlc_capture_open(&capture, path) != SIMPLEHDLC_OK) {
+        perror(path);
+        return 1;
+    }
+
+    simplehdlc_error_code_t result = simplehdlc_capture_decode(&capture, n_threads, chunk_size, max_payload);
+    if (result != SIMPLEHDLC_OK) {
+        fprintf(stderr, "decode failed (%d)\n", result);
+        simplehdlc_capture_close(&capture);
+        return 1;
+    }
+
+    uint8_t *payload = print_payload ? malloc(max_payload ? max_payload : 1) : NULL;
+    if (print_payload && payload == NULL) {
+        perror("malloc");
+        simplehdlc_capture_close(&capture);
+        return 1;
+    }
+
+    printf(print_payload ? "offset,length,status,payload\n" : "offset,length,status\n");
+    for (size_t i=0; i<capture.n_frames; i++) {
+        const simplehdlc_capture_frame_t *frame = &capture.frames[i];
+        printf("%llu,%lu,%s", (unsigned long long) frame->offset, (unsigned long) frame->len, status_names[frame->status]);
+
+        if (print_payload) {
+            putchar(',');
+            if (simplehdlc_capture_read_payload(&capture, frame, payload) == SIMPLEHDLC_OK) {
+                for (uint32_t j=0; j<frame->len; j++) printf("%02x", payload[j]);
+            }
+        }
+        putchar('\n');
+    }
+
+    if (print_stats) {
+        fprintf(stderr, "chunk,offset,length,frames_ok,crc_failures,oversize_drops,aborted_frames\n");
+        for (size_t i=0; i<capture.n_chunks; i++) {
+            const simplehdlc_capture_chunk_stats_t *chunk = &capture.chunks[i];
+            fprintf(stderr, "%zu,%llu,%llu,%llu,%llu,%llu,%llu\n", i, (unsigned long long) chunk->offset,
+                    (unsigned long long) chunk->len, (unsigned long long) chunk->frames_ok,
+                    (unsigned long long) chunk->crc_failures, (unsigned long long) chunk->oversize_drops,
+                    (unsigned long long) chunk->aborted_frames);
+        }
+    }
+
+    free(payload);
+    simplehdlc_capture_close(&capture);
+    return 0;
+}